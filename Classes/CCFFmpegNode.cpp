@@ -56,8 +56,8 @@ bool CCFFmpegNode::init(void)
 	return true;
 }
 
-CCFFmpegNode::CCFFmpegNode() :_view(nullptr), _texture(nullptr), 
-_play(nullptr), _bar(nullptr)
+CCFFmpegNode::CCFFmpegNode() :_view(nullptr), _width(0), _height(0),
+_frame(nullptr), _play(nullptr), _bar(nullptr)
 {
 }
 
@@ -115,37 +115,30 @@ double playingPos = 0;
 void CCFFmpegNode::updateTexture(float dt)
 {
 
-	void *data;
+	ff::YUV420P *yuv;
 
-	data = _video.refresh();
-	if (data )
+	yuv = (ff::YUV420P *)_video.refresh();
+	if (yuv)
 	{
-		if (_texture && _width == _video.width() && _height == _video.height()){
+		if (_view){
 			_video.set_preload_time(1);
-			_texture->updateWithData(data, 0, 0, _width, _height);
+			//the planes go to the textures as they are, only when the picture changed
+			if (yuv->data[0] != _frame || yuv->w != _width || yuv->h != _height)
+			{
+				_view->setColorSpace(yuv->matrix, yuv->full_range != 0);
+				_view->updateWithYUV420P(yuv->w, yuv->h, yuv->data, yuv->linesize);
+			}
 		}
 		else
 		{
-			_texture = new Texture2D();
-			_width = _video.width();
-			_height = _video.height();
-			if (_view)
-			{
-				_view->removeFromParentAndCleanup(true);
-
-				TextureCache::getInstance()->removeUnusedTextures();
-			}
-
-			Size size;
-			_texture->initWithData(data, _width*_height * 3,
-				Texture2D::PixelFormat::RGB888, _width, _height, size);
-			_view = Sprite::createWithTexture(_texture);
-			_texture->release();
+			_view = YUVSprite::createWithYUV420P(yuv->w, yuv->h, yuv->data, yuv->linesize);
+			if (!_view)
+				return;
+			_view->setColorSpace(yuv->matrix, yuv->full_range != 0);
 			_view->setAnchorPoint(Vec2(0, 0));
 
 			//_view->setPosition(Vec2(0, 0));
 			_view->setVisible(true);
-			_view->setContentSize(Size(_width, _height));
 			//Ч
 			_view->setScaleX(1.6);
 			_view->setScaleY(1.6);
@@ -191,6 +184,9 @@ void CCFFmpegNode::updateTexture(float dt)
 			//_video.set_preload_nb( 1500 );
 			//_video.seek(200);
 		}
+		_frame = yuv->data[0];
+		_width = yuv->w;
+		_height = yuv->h;
 	}
 
 	if (_bar)
@@ -248,6 +244,7 @@ void CCFFmpegNode::updateTexture(float dt)
 			playingPos = 0;
 			CCLog("open %s ", name);
 		}
+		_frame = nullptr;
 		if (pidx >= sizeof(movies) / sizeof(const char*))
 			pidx = 0;
 	}
@@ -4,6 +4,7 @@
 #include "cocos2d.h"
 #include "ui/UIButton.h"
 #include "ui/UILoadingBar.h"
+#include "YUVSprite.h"
 #include <thread>
 
 NS_CC_BEGIN
@@ -18,14 +19,14 @@ public:
 	virtual bool init(void);
 	virtual bool initWithURL(const std::string& url);
 protected:
-	Sprite *_view;
+	YUVSprite *_view;
 	ui::Button *_play;
 	ui::Button *_next;
 	ui::Button *_prev;
 	ui::LoadingBar *_bar;
-	Texture2D *_texture;
 	int _width;
 	int _height;
+	const unsigned char *_frame;	//the picture in _view, refresh returns it until the next one
 	ff::FFVideo _video;
 	void updateTexture(float dt);
 
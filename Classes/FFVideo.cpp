@@ -370,4 +370,78 @@ namespace ff
 		}
 		return false;
 	}
+
+	int FFVideo::variant_bitrate() const
+	{
+		VideoState* is = (VideoState*)_ctx;
+		if (is)
+		{
+			return is->variant_bitrate;
+		}
+		return 0;
+	}
+
+	int FFVideo::variant_switches() const
+	{
+		VideoState* is = (VideoState*)_ctx;
+		if (is)
+		{
+			return is->variant_switches;
+		}
+		return 0;
+	}
+
+	void FFVideo::setGain(float gain)
+	{
+		VideoState* is = (VideoState*)_ctx;
+		if (is)
+		{
+			is->audio_gain = FFMAX(gain, 0.0f);
+		}
+	}
+
+	void FFVideo::setPan(float pan)
+	{
+		VideoState* is = (VideoState*)_ctx;
+		if (is)
+		{
+			is->audio_pan = av_clipf(pan, -1.0f, 1.0f);
+		}
+	}
+
+	void FFVideo::audioLevel(float *peak, float *rms)
+	{
+		VideoState* is = (VideoState*)_ctx;
+		*peak = *rms = 0;
+		if (is)
+		{
+			*peak = is->audio_peak.exchange(0.0f);
+			*rms = is->audio_rms;
+		}
+	}
+
+	int FFVideo::audio_underruns() const
+	{
+		VideoState* is = (VideoState*)_ctx;
+		if (is)
+		{
+			return is->audio_ring.underruns;
+		}
+		return 0;
+	}
+
+	void setAbrPolicy(AbrPolicy policy)
+	{
+		set_abr_policy(policy);
+	}
+
+	void setAudioLatency(double seconds)
+	{
+		set_audio_latency(seconds);
+	}
+
+	double getAudioLatency()
+	{
+		return get_audio_latency();
+	}
 }
\ No newline at end of file
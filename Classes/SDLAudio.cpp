@@ -98,6 +98,7 @@ namespace ff{
 			if (device->convert.needed) {
 				SDL_FreeAudioMem(device->convert.buf);
 			}
+			FreeAudioCVT(&device->convert);
 			if (device->opened) {
 				current_audio.impl.CloseDevice(device);
 				device->opened = 0;
@@ -210,6 +211,21 @@ namespace ff{
 			}
 		}
 
+	/* The streamer is a ring of [max_len] bytes, the caller keeps it from filling up */
+	static int
+		SDL_StreamInit(AudioStreamer * stream, int max_len, Uint8 silence)
+	{
+			stream->buffer = (Uint8 *)malloc(max_len);
+			if (stream->buffer == NULL) {
+				return -1;
+			}
+			stream->max_len = max_len;
+			stream->read_pos = 0;
+			stream->write_pos = 0;
+			memset(stream->buffer, silence, max_len);
+			return 0;
+		}
+
 	/* Deinitialize the stream simply by freeing the buffer */
 	static void
 		SDL_StreamDeinit(AudioStreamer * stream)
@@ -220,7 +236,7 @@ namespace ff{
 	static int
 		SDL_StreamLength(AudioStreamer * stream)
 	{
-			return (stream->write_pos - stream->read_pos) % stream->max_len;
+			return (stream->write_pos - stream->read_pos + stream->max_len) % stream->max_len;
 		}
 
 	/* Streaming functions (for when the input and output buffer sizes are different) */
@@ -228,24 +244,22 @@ namespace ff{
 	static void
 		SDL_StreamWrite(AudioStreamer * stream, Uint8 * buf, int length)
 	{
-			int i;
+			const int n = SDL_min(length, stream->max_len - stream->write_pos);
 
-			for (i = 0; i < length; ++i) {
-				stream->buffer[stream->write_pos] = buf[i];
-				++stream->write_pos;
-			}
+			memcpy(stream->buffer + stream->write_pos, buf, n);
+			memcpy(stream->buffer, buf + n, length - n);
+			stream->write_pos = (stream->write_pos + length) % stream->max_len;
 		}
 
 	/* Read [length] bytes out of the streamer into buf */
 	static void
 		SDL_StreamRead(AudioStreamer * stream, Uint8 * buf, int length)
 	{
-			int i;
+			const int n = SDL_min(length, stream->max_len - stream->read_pos);
 
-			for (i = 0; i < length; ++i) {
-				buf[i] = stream->buffer[stream->read_pos];
-				++stream->read_pos;
-			}
+			memcpy(buf, stream->buffer + stream->read_pos, n);
+			memcpy(buf + n, stream->buffer, length - n);
+			stream->read_pos = (stream->read_pos + length) % stream->max_len;
 		}
 
 	/* The general mixing thread function */
@@ -258,7 +272,6 @@ namespace ff{
 		void ( * fill) (void *userdata, Uint8 * stream, int len);
 		Uint32 delay;
 		/* For streaming when the buffer sizes don't match up */
-		Uint8 *istream;
 		int istream_len = 0;
 
 		/* The audio mixing is always a high priority thread */
@@ -277,29 +290,23 @@ namespace ff{
 		device->use_streamer = 0;
 
 		if (device->convert.needed) {
-#if 0                           /* !!! FIXME: I took len_div out of the structure. Use rate_incr instead? */
+			stream_len = device->convert.len;
 			/* If the result of the conversion alters the length, i.e. resampling is being used, use the streamer */
-			if (device->convert.len_mult != 1 || device->convert.len_div != 1) {
+			if (device->convert.rate_incr != 1.0) {
 				/* The streamer's maximum length should be twice whichever is larger: spec.size or len_cvt */
-				stream_max_len = 2 * device->spec.size;
-				if (device->convert.len_mult > device->convert.len_div) {
-					stream_max_len *= device->convert.len_mult;
-					stream_max_len /= device->convert.len_div;
-				}
-				if (SDL_StreamInit(&device->streamer, stream_max_len, silence) <
+				const int stream_max_len = 2 * SDL_max(device->spec.size,
+					device->convert.len * device->convert.len_mult);
+				if (SDL_StreamInit(&device->streamer, stream_max_len, device->spec.silence) <
 					0)
 					return -1;
 				device->use_streamer = 1;
 
-				/* istream_len should be the length of what we grab from the callback and feed to conversion,
-				so that we get close to spec_size. I.e. we want device.spec_size = istream_len * u / d
+				/* istream_len is what we grab from the callback and feed to conversion,
+				the device still takes spec.size at a time out of the streamer
 				*/
-				istream_len =
-					device->spec.size * device->convert.len_div /
-					device->convert.len_mult;
+				istream_len = device->convert.len;
+				stream_len = device->spec.size;
 			}
-#endif
-			stream_len = device->convert.len;
 		}
 		else {
 			stream_len = device->spec.size;
@@ -310,98 +317,45 @@ namespace ff{
 
 		/* Determine if the streamer is necessary here */
 		if (device->use_streamer == 1) {
-			/* This code is almost the same as the old code. The difference is, instead of reading
-			directly from the callback into "stream", then converting and sending the audio off,
-			we go: callback -> "istream" -> (conversion) -> streamer -> stream -> device.
-			However, reading and writing with streamer are done separately:
-			- We only call the callback and write to the streamer when the streamer does not
-			contain enough samples to output to the device.
-			- We only read from the streamer and tell the device to play when the streamer
-			does have enough samples to output.
-			This allows us to perform resampling in the conversion step, where the output of the
-			resampling process can be any number. We will have to see what a good size for the
-			stream's maximum length is, but I suspect 2*max(len_cvt, stream_len) is a good figure.
+			/* Instead of reading directly from the callback into "stream", then converting
+			and sending the audio off, we go: callback -> convert.buf -> (conversion) ->
+			streamer -> stream -> device.
+			The resampler output varies from one callback to the next, so the callback runs
+			until the streamer holds a whole device buffer, and the rest waits for the next one.
 			*/
+			const int silence = (int)device->spec.silence;
+
 			while (device->enabled) {
+				stream = current_audio.impl.GetDeviceBuf(device);
+				if (stream == NULL) {
+					stream = device->fake_stream;
+				}
 
 				if (device->paused) {
-					Delay(delay);
-					continue;
+					memset(stream, silence, stream_len);
 				}
+				else {
+					while (SDL_StreamLength(&device->streamer) < stream_len && device->enabled) {
+						lockMutex(device->mixer_lock);
+						(*fill) (udata, device->convert.buf, istream_len);
+						unlockMutex(device->mixer_lock);
 
-				/* Only read in audio if the streamer doesn't have enough already (if it does not have enough samples to output) */
-				if (SDL_StreamLength(&device->streamer) < stream_len) {
-					/* Set up istream */
-					if (device->convert.needed) {
-						if (device->convert.buf) {
-							istream = device->convert.buf;
-						}
-						else {
-							continue;
-						}
-					}
-					else {
-						/* FIXME: Ryan, this is probably wrong.  I imagine we don't want to get
-						* a device buffer both here and below in the stream output.
-						*/
-						istream = current_audio.impl.GetDeviceBuf(device);
-						if (istream == NULL) {
-							istream = device->fake_stream;
-						}
-					}
-
-					/* Read from the callback into the _input_ stream */
-					lockMutex(device->mixer_lock);
-					(*fill) (udata, istream, istream_len);
-					unlockMutex(device->mixer_lock);
-
-					/* Convert the audio if necessary and write to the streamer */
-					if (device->convert.needed) {
 						SDL_ConvertAudio(&device->convert);
-						if (istream == NULL) {
-							istream = device->fake_stream;
-						}
-						/* SDL_memcpy(istream, device->convert.buf, device->convert.len_cvt); */
 						SDL_StreamWrite(&device->streamer, device->convert.buf,
 							device->convert.len_cvt);
 					}
-					else {
-						SDL_StreamWrite(&device->streamer, istream, istream_len);
-					}
-				}
-
-				/* Only output audio if the streamer has enough to output */
-				if (SDL_StreamLength(&device->streamer) >= stream_len) {
-					/* Set up the output stream */
-					if (device->convert.needed) {
-						if (device->convert.buf) {
-							stream = device->convert.buf;
-						}
-						else {
-							continue;
-						}
-					}
-					else {
-						stream = current_audio.impl.GetDeviceBuf(device);
-						if (stream == NULL) {
-							stream = device->fake_stream;
-						}
-					}
-
-					/* Now read from the streamer */
 					SDL_StreamRead(&device->streamer, stream, stream_len);
-
-					/* Ready current buffer for play and change current buffer */
-					if (stream != device->fake_stream) {
-						current_audio.impl.PlayDevice(device);
-						/* Wait for an audio buffer to become available */
-						current_audio.impl.WaitDevice(device);
-					}
-					else {
-						Delay(delay);
-					}
 				}
 
+				/* Ready current buffer for play and change current buffer */
+				if (stream != device->fake_stream) {
+					current_audio.impl.PlayDevice(device);
+					/* Wait for an audio buffer to become available */
+					current_audio.impl.WaitDevice(device);
+				}
+				else {
+					Delay(delay);
+				}
 			}
 		}
 		else {
@@ -620,18 +574,25 @@ namespace ff{
 			}
 
 			if (build_cvt) {
+				/* the source frames of one device buffer */
+				const int max_frames = (int)(((Sint64)device->spec.samples * obtained->freq +
+					device->spec.freq - 1) / device->spec.freq);
+
 				/* Build an audio conversion block */
 				if (BuildAudioCVT(&device->convert,
 					obtained->format, obtained->channels,
 					obtained->freq,
 					device->spec.format, device->spec.channels,
-					device->spec.freq) < 0) {
+					device->spec.freq, max_frames) < 0) {
 					close_audio_device(device);
 					return 0;
 				}
 				if (device->convert.needed) {
+					/* whole frames, the resampler keeps any fraction for the next callback */
+					const int frame = (SDL_AUDIO_BITSIZE(obtained->format) / 8) * obtained->channels;
 					device->convert.len = (int)(((double)device->spec.size) /
 						device->convert.len_ratio);
+					device->convert.len -= device->convert.len % frame;
 
 					device->convert.buf =
 						(Uint8 *)SDL_AllocAudioMem(device->convert.len *
@@ -740,6 +701,53 @@ namespace ff{
 		SDL_PauseAudioDevice(1, pause_on);
 	}
 
+	void SDL_LockAudioDevice(AudioDeviceID devid)
+	{
+			AudioDevice *device = get_audio_device(devid);
+			if (device) {
+				current_audio.impl.LockDevice(device);
+			}
+	}
+
+	void LockAudio(void)
+	{
+		SDL_LockAudioDevice(1);
+	}
+
+	void SDL_UnlockAudioDevice(AudioDeviceID devid)
+	{
+			AudioDevice *device = get_audio_device(devid);
+			if (device) {
+				current_audio.impl.UnlockDevice(device);
+			}
+	}
+
+	void UnlockAudio(void)
+	{
+		SDL_UnlockAudioDevice(1);
+	}
+
+	double GetAudioLatency(void)
+	{
+		AudioDevice *device = open_devices[0];
+		double latency;
+
+		if (device == NULL) {
+			return 0;
+		}
+		latency = current_audio.impl.GetLatency(device);
+		if (latency < 0) {
+			/* the other buffers are queued */
+			latency = (double)(NUM_BUFFERS - 1) * device->spec.samples / device->spec.freq;
+		}
+		if (device->use_streamer) {
+			/* resampled, waiting for the next device buffers */
+			latency += (double)SDL_StreamLength(&device->streamer) /
+				(SDL_AUDIO_BITSIZE(device->spec.format) / 8 * device->spec.channels) / device->spec.freq;
+		}
+		return latency;
+	}
+
 	void
 		SDL_AudioQuit(void)
 	{
@@ -914,6 +922,12 @@ namespace ff{
 	{                               /* no-op. */
 		}
 
+	static double
+		SDL_AudioGetLatency_Default(AudioDevice *_this)
+	{
+			return -1;
+	}
+
 	static int
 		SDL_AudioOpenDevice_Default(AudioDevice *_this, const char *devname, int iscapture)
 	{
@@ -960,6 +974,7 @@ namespace ff{
 			FILL_STUB(CloseDevice);
 			FILL_STUB(LockDevice);
 			FILL_STUB(UnlockDevice);
+			FILL_STUB(GetLatency);
 			FILL_STUB(Deinitialize);
 #undef FILL_STUB
 	}
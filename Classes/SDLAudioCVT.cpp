@@ -1,5 +1,25 @@
 #include "SDLImp.h"
 #include <math.h>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+#define HAVE_SSE2_CVT 1
+#include <emmintrin.h>
+#if defined(__AVX2__) || (defined(_MSC_VER) && _MSC_VER >= 1700) || \
+	(defined(__GNUC__) && !defined(__clang__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))) || \
+	(defined(__clang__) && (__clang_major__ > 3 || (__clang_major__ == 3 && __clang_minor__ >= 8)))
+#define HAVE_AVX2_CVT 1
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define HAVE_NEON_CVT 1
+#include <arm_neon.h>
+#endif
 
 /*
 SDL ĳʼʵ
@@ -7,27 +27,1286 @@ SDL 
 namespace ff
 {
 
+	/*
+	* Vectorized versions of the hottest generated converters. They take the
+	*  same in-place buffer as the generated ones and give the same samples,
+	*  SDL_HandTunedTypeCVT picks the best one the CPU supports. They read and
+	*  write native byte order, so the LSB formats here assume a little-endian
+	*  host, as every x86 and ARM target we build for is.
+	*/
+#define DIVBY32767 3.05185094759972e-05f
+#define DIVBY2147483647 4.6566128752458e-10f
+
+#if defined(__GNUC__) && !defined(__AVX2__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+#define CVT_NEXT(cvt, fmt) \
+	if ((cvt)->filters[++(cvt)->filter_index]) { \
+		(cvt)->filters[(cvt)->filter_index]((cvt), (fmt)); \
+	}
+
+#if HAVE_SSE2_CVT
+	static void
+		SDL_CPUID(int leaf, int regs[4])
+	{
+#ifdef _MSC_VER
+			__cpuidex(regs, leaf, 0);
+#else
+			unsigned int a, b, c, d;
+			__cpuid_count(leaf, 0, a, b, c, d);
+			regs[0] = a;
+			regs[1] = b;
+			regs[2] = c;
+			regs[3] = d;
+#endif
+	}
+
+#endif
+
+#if HAVE_AVX2_CVT
+	static Uint32
+		SDL_XGETBV(void)
+	{
+#ifdef _MSC_VER
+			return (Uint32)_xgetbv(0);
+#else
+			Uint32 a, d;
+			__asm__ volatile ("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+			return a;
+#endif
+	}
+#endif
+
+	int
+		SDL_GetCPUFeatures(void)
+	{
+			static int features = -1;
+
+			if (features < 0) {
+				int f = 0;
+#if HAVE_SSE2_CVT
+				int regs[4];
+
+				SDL_CPUID(0, regs);
+				if (regs[0] >= 1) {
+					SDL_CPUID(1, regs);
+					if (regs[3] & (1 << 26))
+						f |= CPU_HAS_SSE2;
+#if HAVE_AVX2_CVT
+					/* AVX2 also needs the OS to save the ymm registers */
+					if ((regs[2] & (1 << 27)) && (SDL_XGETBV() & 6) == 6) {
+						SDL_CPUID(0, regs);
+						if (regs[0] >= 7) {
+							SDL_CPUID(7, regs);
+							if (regs[1] & (1 << 5))
+								f |= CPU_HAS_AVX2;
+						}
+					}
+#endif
+				}
+#endif
+#if HAVE_NEON_CVT
+				f |= CPU_HAS_NEON;
+#endif
+				features = f;
+			}
+			return features;
+	}
+
+#if HAVE_SSE2_CVT
+	/* widening filters run from the end, so no sample is overwritten before it is read */
+	static void
+		SDL_Convert_S16_to_F32_SSE2(AudioCVT * cvt, AudioFormat format)
+	{
+			const Sint16 *src = (const Sint16 *)cvt->buf;
+			float *dst = (float *)cvt->buf;
+			const __m128 scale = _mm_set1_ps(DIVBY32767);
+			int i = cvt->len_cvt / sizeof(Sint16);
+
+			while (i & 7) {
+				i--;
+				dst[i] = ((float)src[i]) * DIVBY32767;
+			}
+			while (i) {
+				__m128i v, lo, hi;
+				i -= 8;
+				v = _mm_loadu_si128((const __m128i *)(src + i));
+				lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+				hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+				_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+				_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+			}
+
+			cvt->len_cvt *= 2;
+			CVT_NEXT(cvt, AUDIO_F32LSB);
+	}
+
+	static void
+		SDL_Convert_F32_to_S16_SSE2(AudioCVT * cvt, AudioFormat format)
+	{
+			const float *src = (const float *)cvt->buf;
+			Sint16 *dst = (Sint16 *)cvt->buf;
+			const __m128 scale = _mm_set1_ps(32767.0f);
+			const int n = cvt->len_cvt / sizeof(float);
+			int i;
+
+			for (i = 0; i + 8 <= n; i += 8) {
+				__m128i lo = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i), scale));
+				__m128i hi = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale));
+				_mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(lo, hi));
+			}
+			for (; i < n; i++)
+				dst[i] = (Sint16)(src[i] * 32767.0f);
+
+			cvt->len_cvt /= 2;
+			CVT_NEXT(cvt, AUDIO_S16LSB);
+	}
+
+	static void
+		SDL_Convert_S32_to_F32_SSE2(AudioCVT * cvt, AudioFormat format)
+	{
+			const Sint32 *src = (const Sint32 *)cvt->buf;
+			float *dst = (float *)cvt->buf;
+			const __m128 scale = _mm_set1_ps(DIVBY2147483647);
+			const int n = cvt->len_cvt / sizeof(Sint32);
+			int i;
+
+			for (i = 0; i + 4 <= n; i += 4) {
+				__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+				_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+			}
+			for (; i < n; i++)
+				dst[i] = ((float)src[i]) * DIVBY2147483647;
+
+			CVT_NEXT(cvt, AUDIO_F32LSB);
+	}
+
+	/* scaled in double precision like the generated converter, 1.0 still fits */
+	static void
+		SDL_Convert_F32_to_S32_SSE2(AudioCVT * cvt, AudioFormat format)
+	{
+			const float *src = (const float *)cvt->buf;
+			Sint32 *dst = (Sint32 *)cvt->buf;
+			const __m128d scale = _mm_set1_pd(2147483647.0);
+			const int n = cvt->len_cvt / sizeof(float);
+			int i;
+
+			for (i = 0; i + 4 <= n; i += 4) {
+				__m128 v = _mm_loadu_ps(src + i);
+				__m128i lo = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(v), scale));
+				__m128i hi = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(v, v)), scale));
+				_mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi64(lo, hi));
+			}
+			for (; i < n; i++)
+				dst[i] = (Sint32)(src[i] * 2147483647.0);
+
+			CVT_NEXT(cvt, AUDIO_S32LSB);
+	}
+
+	static void
+		SDL_Convert_U8_to_S16_SSE2(AudioCVT * cvt, AudioFormat format)
+	{
+			const Uint8 *src = (const Uint8 *)cvt->buf;
+			Sint16 *dst = (Sint16 *)cvt->buf;
+			const __m128i bias = _mm_set1_epi8((char)0x80);
+			const __m128i zero = _mm_setzero_si128();
+			int i = cvt->len_cvt;
+
+			while (i & 15) {
+				i--;
+				dst[i] = (Sint16)((src[i] ^ 0x80) << 8);
+			}
+			while (i) {
+				__m128i v;
+				i -= 16;
+				v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i)), bias);
+				_mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi8(zero, v));
+				_mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpackhi_epi8(zero, v));
+			}
+
+			cvt->len_cvt *= 2;
+			CVT_NEXT(cvt, AUDIO_S16LSB);
+	}
+
+	static void
+		SDL_Convert_S16_to_U8_SSE2(AudioCVT * cvt, AudioFormat format)
+	{
+			const Uint16 *src = (const Uint16 *)cvt->buf;
+			Uint8 *dst = (Uint8 *)cvt->buf;
+			const __m128i bias = _mm_set1_epi16((short)0x8000);
+			const int n = cvt->len_cvt / sizeof(Uint16);
+			int i;
+
+			for (i = 0; i + 16 <= n; i += 16) {
+				__m128i lo = _mm_loadu_si128((const __m128i *)(src + i));
+				__m128i hi = _mm_loadu_si128((const __m128i *)(src + i + 8));
+				lo = _mm_srli_epi16(_mm_xor_si128(lo, bias), 8);
+				hi = _mm_srli_epi16(_mm_xor_si128(hi, bias), 8);
+				_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+			}
+			for (; i < n; i++)
+				dst[i] = (Uint8)((src[i] ^ 0x8000) >> 8);
+
+			cvt->len_cvt /= 2;
+			CVT_NEXT(cvt, AUDIO_U8);
+	}
+
+	/* the byte swaps only flip the endian bit of the format */
+	static void
+		SDL_Convert_Swap16_SSE2(AudioCVT * cvt, AudioFormat format)
+	{
+			Uint16 *buf = (Uint16 *)cvt->buf;
+			const int n = cvt->len_cvt / sizeof(Uint16);
+			int i;
+
+			for (i = 0; i + 8 <= n; i += 8) {
+				__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+				v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+				_mm_storeu_si128((__m128i *)(buf + i), v);
+			}
+			for (; i < n; i++)
+				buf[i] = SDL_Swap16(buf[i]);
+
+			CVT_NEXT(cvt, format ^ SDL_AUDIO_MASK_ENDIAN);
+	}
+
+	static void
+		SDL_Convert_Swap32_SSE2(AudioCVT * cvt, AudioFormat format)
+	{
+			Uint32 *buf = (Uint32 *)cvt->buf;
+			const int n = cvt->len_cvt / sizeof(Uint32);
+			int i;
+
+			for (i = 0; i + 4 <= n; i += 4) {
+				__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+				v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+				v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+				v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+				_mm_storeu_si128((__m128i *)(buf + i), v);
+			}
+			for (; i < n; i++)
+				buf[i] = SDL_Swap32(buf[i]);
+
+			CVT_NEXT(cvt, format ^ SDL_AUDIO_MASK_ENDIAN);
+	}
+#endif
+
+#if HAVE_AVX2_CVT
+	static TARGET_AVX2 void
+		SDL_Convert_S16_to_F32_AVX2(AudioCVT * cvt, AudioFormat format)
+	{
+			const Sint16 *src = (const Sint16 *)cvt->buf;
+			float *dst = (float *)cvt->buf;
+			const __m256 scale = _mm256_set1_ps(DIVBY32767);
+			int i = cvt->len_cvt / sizeof(Sint16);
+
+			while (i & 15) {
+				i--;
+				dst[i] = ((float)src[i]) * DIVBY32767;
+			}
+			while (i) {
+				__m256i lo, hi;
+				i -= 16;
+				lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+				hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + i + 8)));
+				_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+				_mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+			}
+
+			cvt->len_cvt *= 2;
+			CVT_NEXT(cvt, AUDIO_F32LSB);
+	}
+
+	static TARGET_AVX2 void
+		SDL_Convert_F32_to_S16_AVX2(AudioCVT * cvt, AudioFormat format)
+	{
+			const float *src = (const float *)cvt->buf;
+			Sint16 *dst = (Sint16 *)cvt->buf;
+			const __m256 scale = _mm256_set1_ps(32767.0f);
+			const int n = cvt->len_cvt / sizeof(float);
+			int i;
+
+			for (i = 0; i + 16 <= n; i += 16) {
+				__m256i lo = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale));
+				__m256i hi = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale));
+				/* packs works per 128 bit lane, put the quarters back in order */
+				__m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+				_mm256_storeu_si256((__m256i *)(dst + i), v);
+			}
+			for (; i < n; i++)
+				dst[i] = (Sint16)(src[i] * 32767.0f);
+
+			cvt->len_cvt /= 2;
+			CVT_NEXT(cvt, AUDIO_S16LSB);
+	}
+
+	static TARGET_AVX2 void
+		SDL_Convert_S32_to_F32_AVX2(AudioCVT * cvt, AudioFormat format)
+	{
+			const Sint32 *src = (const Sint32 *)cvt->buf;
+			float *dst = (float *)cvt->buf;
+			const __m256 scale = _mm256_set1_ps(DIVBY2147483647);
+			const int n = cvt->len_cvt / sizeof(Sint32);
+			int i;
+
+			for (i = 0; i + 8 <= n; i += 8) {
+				__m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+				_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+			}
+			for (; i < n; i++)
+				dst[i] = ((float)src[i]) * DIVBY2147483647;
+
+			CVT_NEXT(cvt, AUDIO_F32LSB);
+	}
+
+	static TARGET_AVX2 void
+		SDL_Convert_F32_to_S32_AVX2(AudioCVT * cvt, AudioFormat format)
+	{
+			const float *src = (const float *)cvt->buf;
+			Sint32 *dst = (Sint32 *)cvt->buf;
+			const __m256d scale = _mm256_set1_pd(2147483647.0);
+			const int n = cvt->len_cvt / sizeof(float);
+			int i;
+
+			for (i = 0; i + 8 <= n; i += 8) {
+				__m128i lo = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(src + i)), scale));
+				__m128i hi = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(src + i + 4)), scale));
+				_mm_storeu_si128((__m128i *)(dst + i), lo);
+				_mm_storeu_si128((__m128i *)(dst + i + 4), hi);
+			}
+			for (; i < n; i++)
+				dst[i] = (Sint32)(src[i] * 2147483647.0);
+
+			CVT_NEXT(cvt, AUDIO_S32LSB);
+	}
+#endif
+
+#if HAVE_NEON_CVT
+	static void
+		SDL_Convert_S16_to_F32_NEON(AudioCVT * cvt, AudioFormat format)
+	{
+			const Sint16 *src = (const Sint16 *)cvt->buf;
+			float *dst = (float *)cvt->buf;
+			int i = cvt->len_cvt / sizeof(Sint16);
+
+			while (i & 7) {
+				i--;
+				dst[i] = ((float)src[i]) * DIVBY32767;
+			}
+			while (i) {
+				int16x8_t v;
+				i -= 8;
+				v = vld1q_s16(src + i);
+				vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), DIVBY32767));
+				vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), DIVBY32767));
+			}
+
+			cvt->len_cvt *= 2;
+			CVT_NEXT(cvt, AUDIO_F32LSB);
+	}
+
+	static void
+		SDL_Convert_F32_to_S16_NEON(AudioCVT * cvt, AudioFormat format)
+	{
+			const float *src = (const float *)cvt->buf;
+			Sint16 *dst = (Sint16 *)cvt->buf;
+			const int n = cvt->len_cvt / sizeof(float);
+			int i;
+
+			for (i = 0; i + 8 <= n; i += 8) {
+				int32x4_t lo = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), 32767.0f));
+				int32x4_t hi = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(src + i + 4), 32767.0f));
+				vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+			}
+			for (; i < n; i++)
+				dst[i] = (Sint16)(src[i] * 32767.0f);
+
+			cvt->len_cvt /= 2;
+			CVT_NEXT(cvt, AUDIO_S16LSB);
+	}
+
+	static void
+		SDL_Convert_S32_to_F32_NEON(AudioCVT * cvt, AudioFormat format)
+	{
+			const Sint32 *src = (const Sint32 *)cvt->buf;
+			float *dst = (float *)cvt->buf;
+			const int n = cvt->len_cvt / sizeof(Sint32);
+			int i;
+
+			for (i = 0; i + 4 <= n; i += 4)
+				vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(src + i)), DIVBY2147483647));
+			for (; i < n; i++)
+				dst[i] = ((float)src[i]) * DIVBY2147483647;
+
+			CVT_NEXT(cvt, AUDIO_F32LSB);
+	}
+
+	/*
+	* Scaled in single precision, the conversion saturates so 1.0 gives the
+	*  largest sample. Within one step of the 32 bit range of the scalar code.
+	*/
+	static void
+		SDL_Convert_F32_to_S32_NEON(AudioCVT * cvt, AudioFormat format)
+	{
+			const float *src = (const float *)cvt->buf;
+			Sint32 *dst = (Sint32 *)cvt->buf;
+			const int n = cvt->len_cvt / sizeof(float);
+			int i;
+
+			for (i = 0; i + 4 <= n; i += 4)
+				vst1q_s32(dst + i, vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), 2147483648.0f)));
+			for (; i < n; i++)
+				dst[i] = (Sint32)(src[i] * 2147483647.0);
+
+			CVT_NEXT(cvt, AUDIO_S32LSB);
+	}
+
+	static void
+		SDL_Convert_U8_to_S16_NEON(AudioCVT * cvt, AudioFormat format)
+	{
+			const Uint8 *src = (const Uint8 *)cvt->buf;
+			Uint16 *dst = (Uint16 *)cvt->buf;
+			const uint8x8_t bias = vdup_n_u8(0x80);
+			int i = cvt->len_cvt;
+
+			while (i & 7) {
+				i--;
+				dst[i] = (Uint16)((src[i] ^ 0x80) << 8);
+			}
+			while (i) {
+				i -= 8;
+				vst1q_u16(dst + i, vshlq_n_u16(vmovl_u8(veor_u8(vld1_u8(src + i), bias)), 8));
+			}
+
+			cvt->len_cvt *= 2;
+			CVT_NEXT(cvt, AUDIO_S16LSB);
+	}
+
+	static void
+		SDL_Convert_S16_to_U8_NEON(AudioCVT * cvt, AudioFormat format)
+	{
+			const Uint16 *src = (const Uint16 *)cvt->buf;
+			Uint8 *dst = (Uint8 *)cvt->buf;
+			const uint16x8_t bias = vdupq_n_u16(0x8000);
+			const int n = cvt->len_cvt / sizeof(Uint16);
+			int i;
+
+			for (i = 0; i + 8 <= n; i += 8)
+				vst1_u8(dst + i, vshrn_n_u16(veorq_u16(vld1q_u16(src + i), bias), 8));
+			for (; i < n; i++)
+				dst[i] = (Uint8)((src[i] ^ 0x8000) >> 8);
+
+			cvt->len_cvt /= 2;
+			CVT_NEXT(cvt, AUDIO_U8);
+	}
+
+	static void
+		SDL_Convert_Swap16_NEON(AudioCVT * cvt, AudioFormat format)
+	{
+			Uint8 *buf = cvt->buf;
+			const int n = cvt->len_cvt & ~15;
+			int i;
+
+			for (i = 0; i < n; i += 16)
+				vst1q_u8(buf + i, vrev16q_u8(vld1q_u8(buf + i)));
+			for (; i + 2 <= cvt->len_cvt; i += 2) {
+				const Uint8 t = buf[i];
+				buf[i] = buf[i + 1];
+				buf[i + 1] = t;
+			}
+
+			CVT_NEXT(cvt, format ^ SDL_AUDIO_MASK_ENDIAN);
+	}
+
+	static void
+		SDL_Convert_Swap32_NEON(AudioCVT * cvt, AudioFormat format)
+	{
+			Uint8 *buf = cvt->buf;
+			const int n = cvt->len_cvt & ~15;
+			int i;
+
+			for (i = 0; i < n; i += 16)
+				vst1q_u8(buf + i, vrev32q_u8(vld1q_u8(buf + i)));
+			for (; i + 4 <= cvt->len_cvt; i += 4) {
+				Uint8 t = buf[i];
+				buf[i] = buf[i + 3];
+				buf[i + 3] = t;
+				t = buf[i + 1];
+				buf[i + 1] = buf[i + 2];
+				buf[i + 2] = t;
+			}
+
+			CVT_NEXT(cvt, format ^ SDL_AUDIO_MASK_ENDIAN);
+	}
+#endif
+
+	struct SDL_AudioVectorFilters
+	{
+		AudioFormat src_fmt;
+		AudioFormat dst_fmt;
+		int features;
+		AudioFilter filter;
+	};
+
+	/* best first, the first one the CPU supports is used */
+	static const SDL_AudioVectorFilters sdl_audio_vector_filters[] =
+	{
+#if HAVE_AVX2_CVT
+		{ AUDIO_S16LSB, AUDIO_F32LSB, CPU_HAS_AVX2, SDL_Convert_S16_to_F32_AVX2 },
+		{ AUDIO_F32LSB, AUDIO_S16LSB, CPU_HAS_AVX2, SDL_Convert_F32_to_S16_AVX2 },
+		{ AUDIO_S32LSB, AUDIO_F32LSB, CPU_HAS_AVX2, SDL_Convert_S32_to_F32_AVX2 },
+		{ AUDIO_F32LSB, AUDIO_S32LSB, CPU_HAS_AVX2, SDL_Convert_F32_to_S32_AVX2 },
+#endif
+#if HAVE_SSE2_CVT
+		{ AUDIO_S16LSB, AUDIO_F32LSB, CPU_HAS_SSE2, SDL_Convert_S16_to_F32_SSE2 },
+		{ AUDIO_F32LSB, AUDIO_S16LSB, CPU_HAS_SSE2, SDL_Convert_F32_to_S16_SSE2 },
+		{ AUDIO_S32LSB, AUDIO_F32LSB, CPU_HAS_SSE2, SDL_Convert_S32_to_F32_SSE2 },
+		{ AUDIO_F32LSB, AUDIO_S32LSB, CPU_HAS_SSE2, SDL_Convert_F32_to_S32_SSE2 },
+		{ AUDIO_U8, AUDIO_S16LSB, CPU_HAS_SSE2, SDL_Convert_U8_to_S16_SSE2 },
+		{ AUDIO_S16LSB, AUDIO_U8, CPU_HAS_SSE2, SDL_Convert_S16_to_U8_SSE2 },
+		{ AUDIO_S16LSB, AUDIO_S16MSB, CPU_HAS_SSE2, SDL_Convert_Swap16_SSE2 },
+		{ AUDIO_S16MSB, AUDIO_S16LSB, CPU_HAS_SSE2, SDL_Convert_Swap16_SSE2 },
+		{ AUDIO_U16LSB, AUDIO_U16MSB, CPU_HAS_SSE2, SDL_Convert_Swap16_SSE2 },
+		{ AUDIO_U16MSB, AUDIO_U16LSB, CPU_HAS_SSE2, SDL_Convert_Swap16_SSE2 },
+		{ AUDIO_S32LSB, AUDIO_S32MSB, CPU_HAS_SSE2, SDL_Convert_Swap32_SSE2 },
+		{ AUDIO_S32MSB, AUDIO_S32LSB, CPU_HAS_SSE2, SDL_Convert_Swap32_SSE2 },
+		{ AUDIO_F32LSB, AUDIO_F32MSB, CPU_HAS_SSE2, SDL_Convert_Swap32_SSE2 },
+		{ AUDIO_F32MSB, AUDIO_F32LSB, CPU_HAS_SSE2, SDL_Convert_Swap32_SSE2 },
+#endif
+#if HAVE_NEON_CVT
+		{ AUDIO_S16LSB, AUDIO_F32LSB, CPU_HAS_NEON, SDL_Convert_S16_to_F32_NEON },
+		{ AUDIO_F32LSB, AUDIO_S16LSB, CPU_HAS_NEON, SDL_Convert_F32_to_S16_NEON },
+		{ AUDIO_S32LSB, AUDIO_F32LSB, CPU_HAS_NEON, SDL_Convert_S32_to_F32_NEON },
+		{ AUDIO_F32LSB, AUDIO_S32LSB, CPU_HAS_NEON, SDL_Convert_F32_to_S32_NEON },
+		{ AUDIO_U8, AUDIO_S16LSB, CPU_HAS_NEON, SDL_Convert_U8_to_S16_NEON },
+		{ AUDIO_S16LSB, AUDIO_U8, CPU_HAS_NEON, SDL_Convert_S16_to_U8_NEON },
+		{ AUDIO_S16LSB, AUDIO_S16MSB, CPU_HAS_NEON, SDL_Convert_Swap16_NEON },
+		{ AUDIO_S16MSB, AUDIO_S16LSB, CPU_HAS_NEON, SDL_Convert_Swap16_NEON },
+		{ AUDIO_U16LSB, AUDIO_U16MSB, CPU_HAS_NEON, SDL_Convert_Swap16_NEON },
+		{ AUDIO_U16MSB, AUDIO_U16LSB, CPU_HAS_NEON, SDL_Convert_Swap16_NEON },
+		{ AUDIO_S32LSB, AUDIO_S32MSB, CPU_HAS_NEON, SDL_Convert_Swap32_NEON },
+		{ AUDIO_S32MSB, AUDIO_S32LSB, CPU_HAS_NEON, SDL_Convert_Swap32_NEON },
+		{ AUDIO_F32LSB, AUDIO_F32MSB, CPU_HAS_NEON, SDL_Convert_Swap32_NEON },
+		{ AUDIO_F32MSB, AUDIO_F32LSB, CPU_HAS_NEON, SDL_Convert_Swap32_NEON },
+#endif
+		{ 0, 0, 0, NULL }
+	};
+
 	static AudioFilter
 		SDL_HandTunedTypeCVT(AudioFormat src_fmt, AudioFormat dst_fmt)
 	{
-			/*
-			* Fill in any future conversions that are specialized to a
-			*  processor, platform, compiler, or library here.
-			*/
-			return NULL;                /* no specialized converter code available. */
-	}
-
+			const int features = SDL_GetCPUFeatures();
+			int i;
+
+			for (i = 0; sdl_audio_vector_filters[i].filter != NULL; i++) {
+				const SDL_AudioVectorFilters *filt = &sdl_audio_vector_filters[i];
+				if ((filt->src_fmt == src_fmt) && (filt->dst_fmt == dst_fmt) &&
+					(filt->features & features) == filt->features) {
+					return filt->filter;
+				}
+			}
+			return NULL;                /* no specialized converter code available. */
+	}
+
+	/*
+	* Data type and channel conversion fused in one pass, for mono and stereo
+	*  between S16 and F32. They give the same samples as the type filter and
+	*  SDL_ConvertStereo/SDL_ConvertMono run in the order BuildAudioCVT plans.
+	*  Other formats and channel counts run the separate filters.
+	*/
+#if HAVE_SSE2_CVT
+	static void
+		SDL_Convert_S16_1c_to_F32_2c_SSE2(AudioCVT * cvt, AudioFormat format)
+	{
+			const Sint16 *src = (const Sint16 *)cvt->buf;
+			float *dst = (float *)cvt->buf;
+			const __m128 scale = _mm_set1_ps(DIVBY32767);
+			int i = cvt->len_cvt / sizeof(Sint16);
+
+			while (i & 7) {
+				i--;
+				dst[2 * i] = dst[2 * i + 1] = ((float)src[i]) * DIVBY32767;
+			}
+			while (i) {
+				__m128i v;
+				__m128 lo, hi;
+				i -= 8;
+				v = _mm_loadu_si128((const __m128i *)(src + i));
+				lo = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), scale);
+				hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), scale);
+				_mm_storeu_ps(dst + 2 * i, _mm_unpacklo_ps(lo, lo));
+				_mm_storeu_ps(dst + 2 * i + 4, _mm_unpackhi_ps(lo, lo));
+				_mm_storeu_ps(dst + 2 * i + 8, _mm_unpacklo_ps(hi, hi));
+				_mm_storeu_ps(dst + 2 * i + 12, _mm_unpackhi_ps(hi, hi));
+			}
+
+			cvt->len_cvt *= 4;
+			CVT_NEXT(cvt, AUDIO_F32LSB);
+	}
+
+	static void
+		SDL_Convert_F32_1c_to_S16_2c_SSE2(AudioCVT * cvt, AudioFormat format)
+	{
+			const float *src = (const float *)cvt->buf;
+			Sint16 *dst = (Sint16 *)cvt->buf;
+			const __m128 scale = _mm_set1_ps(32767.0f);
+			const int n = cvt->len_cvt / sizeof(float);
+			int i;
+
+			for (i = 0; i + 8 <= n; i += 8) {
+				__m128i lo = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i), scale));
+				__m128i hi = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale));
+				__m128i v = _mm_packs_epi32(lo, hi);
+				_mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi16(v, v));
+				_mm_storeu_si128((__m128i *)(dst + 2 * i + 8), _mm_unpackhi_epi16(v, v));
+			}
+			for (; i < n; i++)
+				dst[2 * i] = dst[2 * i + 1] = (Sint16)(src[i] * 32767.0f);
+
+			CVT_NEXT(cvt, AUDIO_S16LSB);
+	}
+
+	/* both downmixes average in float, as SDL_ConvertMono does on F32 */
+	static inline __m128
+		SDL_MixPairs_SSE2(__m128 a, __m128 b)
+	{
+			const __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+			const __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			return _mm_mul_ps(_mm_add_ps(left, right), _mm_set1_ps(0.5f));
+	}
+
+	static void
+		SDL_Convert_S16_2c_to_F32_1c_SSE2(AudioCVT * cvt, AudioFormat format)
+	{
+			const Sint16 *src = (const Sint16 *)cvt->buf;
+			float *dst = (float *)cvt->buf;
+			const __m128 scale = _mm_set1_ps(DIVBY32767);
+			const int n = cvt->len_cvt / (2 * sizeof(Sint16));
+			int i;
+
+			for (i = 0; i + 4 <= n; i += 4) {
+				const __m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+				const __m128 lo = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), scale);
+				const __m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), scale);
+				_mm_storeu_ps(dst + i, SDL_MixPairs_SSE2(lo, hi));
+			}
+			for (; i < n; i++)
+				dst[i] = (((float)src[2 * i]) * DIVBY32767 + ((float)src[2 * i + 1]) * DIVBY32767) * 0.5f;
+
+			cvt->len_cvt = n * sizeof(float);
+			CVT_NEXT(cvt, AUDIO_F32LSB);
+	}
+
+	static void
+		SDL_Convert_F32_2c_to_S16_1c_SSE2(AudioCVT * cvt, AudioFormat format)
+	{
+			const float *src = (const float *)cvt->buf;
+			Sint16 *dst = (Sint16 *)cvt->buf;
+			const __m128 scale = _mm_set1_ps(32767.0f);
+			const int n = cvt->len_cvt / (2 * sizeof(float));
+			int i;
+
+			for (i = 0; i + 8 <= n; i += 8) {
+				const __m128 a = SDL_MixPairs_SSE2(_mm_loadu_ps(src + 2 * i), _mm_loadu_ps(src + 2 * i + 4));
+				const __m128 b = SDL_MixPairs_SSE2(_mm_loadu_ps(src + 2 * i + 8), _mm_loadu_ps(src + 2 * i + 12));
+				_mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(
+					_mm_cvttps_epi32(_mm_mul_ps(a, scale)), _mm_cvttps_epi32(_mm_mul_ps(b, scale))));
+			}
+			for (; i < n; i++)
+				dst[i] = (Sint16)(((src[2 * i] + src[2 * i + 1]) * 0.5f) * 32767.0f);
+
+			cvt->len_cvt = n * sizeof(Sint16);
+			CVT_NEXT(cvt, AUDIO_S16LSB);
+	}
+#endif
+
+#if HAVE_NEON_CVT
+	static void
+		SDL_Convert_S16_1c_to_F32_2c_NEON(AudioCVT * cvt, AudioFormat format)
+	{
+			const Sint16 *src = (const Sint16 *)cvt->buf;
+			float *dst = (float *)cvt->buf;
+			int i = cvt->len_cvt / sizeof(Sint16);
+
+			while (i & 7) {
+				i--;
+				dst[2 * i] = dst[2 * i + 1] = ((float)src[i]) * DIVBY32767;
+			}
+			while (i) {
+				int16x8_t v;
+				float32x4x2_t lo, hi;
+				i -= 8;
+				v = vld1q_s16(src + i);
+				lo.val[0] = lo.val[1] = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), DIVBY32767);
+				hi.val[0] = hi.val[1] = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), DIVBY32767);
+				vst2q_f32(dst + 2 * i, lo);
+				vst2q_f32(dst + 2 * i + 8, hi);
+			}
+
+			cvt->len_cvt *= 4;
+			CVT_NEXT(cvt, AUDIO_F32LSB);
+	}
+
+	static void
+		SDL_Convert_F32_1c_to_S16_2c_NEON(AudioCVT * cvt, AudioFormat format)
+	{
+			const float *src = (const float *)cvt->buf;
+			Sint16 *dst = (Sint16 *)cvt->buf;
+			const int n = cvt->len_cvt / sizeof(float);
+			int i;
+
+			for (i = 0; i + 8 <= n; i += 8) {
+				int16x8x2_t v;
+				v.val[0] = v.val[1] = vcombine_s16(
+					vqmovn_s32(vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), 32767.0f))),
+					vqmovn_s32(vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(src + i + 4), 32767.0f))));
+				vst2q_s16(dst + 2 * i, v);
+			}
+			for (; i < n; i++)
+				dst[2 * i] = dst[2 * i + 1] = (Sint16)(src[i] * 32767.0f);
+
+			CVT_NEXT(cvt, AUDIO_S16LSB);
+	}
+
+	/* both downmixes average in float, as SDL_ConvertMono does on F32 */
+	static void
+		SDL_Convert_S16_2c_to_F32_1c_NEON(AudioCVT * cvt, AudioFormat format)
+	{
+			const Sint16 *src = (const Sint16 *)cvt->buf;
+			float *dst = (float *)cvt->buf;
+			const int n = cvt->len_cvt / (2 * sizeof(Sint16));
+			int i;
+
+			for (i = 0; i + 4 <= n; i += 4) {
+				const int16x4x2_t v = vld2_s16(src + 2 * i);
+				const float32x4_t a = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v.val[0])), DIVBY32767);
+				const float32x4_t b = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v.val[1])), DIVBY32767);
+				vst1q_f32(dst + i, vmulq_n_f32(vaddq_f32(a, b), 0.5f));
+			}
+			for (; i < n; i++)
+				dst[i] = (((float)src[2 * i]) * DIVBY32767 + ((float)src[2 * i + 1]) * DIVBY32767) * 0.5f;
+
+			cvt->len_cvt = n * sizeof(float);
+			CVT_NEXT(cvt, AUDIO_F32LSB);
+	}
+
+	static void
+		SDL_Convert_F32_2c_to_S16_1c_NEON(AudioCVT * cvt, AudioFormat format)
+	{
+			const float *src = (const float *)cvt->buf;
+			Sint16 *dst = (Sint16 *)cvt->buf;
+			const int n = cvt->len_cvt / (2 * sizeof(float));
+			int i;
+
+			for (i = 0; i + 4 <= n; i += 4) {
+				const float32x4x2_t v = vld2q_f32(src + 2 * i);
+				const float32x4_t mix = vmulq_n_f32(vaddq_f32(v.val[0], v.val[1]), 0.5f);
+				vst1_s16(dst + i, vqmovn_s32(vcvtq_s32_f32(vmulq_n_f32(mix, 32767.0f))));
+			}
+			for (; i < n; i++)
+				dst[i] = (Sint16)(((src[2 * i] + src[2 * i + 1]) * 0.5f) * 32767.0f);
+
+			cvt->len_cvt = n * sizeof(Sint16);
+			CVT_NEXT(cvt, AUDIO_S16LSB);
+	}
+#endif
+
+	struct SDL_AudioFusedFilters
+	{
+		AudioFormat src_fmt;
+		int src_channels;
+		AudioFormat dst_fmt;
+		int dst_channels;
+		int features;
+		AudioFilter filter;
+	};
+
+	static const SDL_AudioFusedFilters sdl_audio_fused_filters[] =
+	{
+#if HAVE_SSE2_CVT
+		{ AUDIO_S16LSB, 1, AUDIO_F32LSB, 2, CPU_HAS_SSE2, SDL_Convert_S16_1c_to_F32_2c_SSE2 },
+		{ AUDIO_F32LSB, 1, AUDIO_S16LSB, 2, CPU_HAS_SSE2, SDL_Convert_F32_1c_to_S16_2c_SSE2 },
+		{ AUDIO_S16LSB, 2, AUDIO_F32LSB, 1, CPU_HAS_SSE2, SDL_Convert_S16_2c_to_F32_1c_SSE2 },
+		{ AUDIO_F32LSB, 2, AUDIO_S16LSB, 1, CPU_HAS_SSE2, SDL_Convert_F32_2c_to_S16_1c_SSE2 },
+#endif
+#if HAVE_NEON_CVT
+		{ AUDIO_S16LSB, 1, AUDIO_F32LSB, 2, CPU_HAS_NEON, SDL_Convert_S16_1c_to_F32_2c_NEON },
+		{ AUDIO_F32LSB, 1, AUDIO_S16LSB, 2, CPU_HAS_NEON, SDL_Convert_F32_1c_to_S16_2c_NEON },
+		{ AUDIO_S16LSB, 2, AUDIO_F32LSB, 1, CPU_HAS_NEON, SDL_Convert_S16_2c_to_F32_1c_NEON },
+		{ AUDIO_F32LSB, 2, AUDIO_S16LSB, 1, CPU_HAS_NEON, SDL_Convert_F32_2c_to_S16_1c_NEON },
+#endif
+		{ 0, 0, 0, 0, 0, NULL }
+	};
+
+	static AudioFilter
+		SDL_FusedAudioCVT(AudioFormat src_fmt, int src_channels,
+		AudioFormat dst_fmt, int dst_channels)
+	{
+			const int features = SDL_GetCPUFeatures();
+			int i;
+
+			for (i = 0; sdl_audio_fused_filters[i].filter != NULL; i++) {
+				const SDL_AudioFusedFilters *filt = &sdl_audio_fused_filters[i];
+				if ((filt->src_fmt == src_fmt) && (filt->src_channels == src_channels) &&
+					(filt->dst_fmt == dst_fmt) && (filt->dst_channels == dst_channels) &&
+					(filt->features & features) == filt->features) {
+					return filt->filter;
+				}
+			}
+			return NULL;
+	}
+
+	/*
+	* Polyphase windowed-sinc resampler. The rate ratio is reduced to up/down,
+	*  output frame n sits at input position n * down / up, kept exactly as an
+	*  integer position and a phase in [0, up). At most RESAMPLE_MAX_PHASES
+	*  filter phases are tabled, a larger up uses the nearest one. Each call
+	*  appends its input to a float history per channel so the filter runs
+	*  across callbacks, the output length varies with the phase, and frames
+	*  which don't fit in the buffer wait for the next call.
+	*/
+#define RESAMPLE_MAX_PHASES 1024
+#define RESAMPLE_MAX_CHANNELS 8
+#define RESAMPLE_PI 3.14159265358979323846
+#define RESAMPLE_TAPS_ALIGN 8
+
+	static int resample_quality = AUDIO_RESAMPLE_MEDIUM;
+
+	void SetAudioResampleQuality(int quality)
+	{
+		resample_quality = quality;
+	}
+
+	static const struct {
+		int half_taps;              /* zero crossings on each side */
+		double cutoff;              /* of the lower Nyquist frequency */
+		double beta;                /* Kaiser window */
+	} resample_qualities[] = {
+		{ 0, 0, 0 },                /* AUDIO_RESAMPLE_LINEAR, generated filters */
+		{ 8, 0.80, 6.0 },           /* AUDIO_RESAMPLE_LOW */
+		{ 16, 0.88, 8.0 },          /* AUDIO_RESAMPLE_MEDIUM */
+		{ 32, 0.94, 10.0 },         /* AUDIO_RESAMPLE_HIGH */
+	};
+
+	struct AudioResampler
+	{
+		int channels;
+		int up, down;               /* output/input rate ratio, reduced */
+		int taps;                   /* per phase, padded with zeros */
+		int phases;
+		float *coeffs;              /* phases rows of taps */
+		float *hist[RESAMPLE_MAX_CHANNELS]; /* input of each channel not consumed yet */
+		int hist_len;               /* frames in hist */
+		int hist_max;               /* the largest input plus two filters */
+		int pos;                    /* first input frame of the next output */
+		int frac;                   /* phase of the next output, in 1/up */
+		float *out;                 /* interleaved output of one call */
+		int out_max;                /* frames */
+		int(*run) (AudioResampler * rs, float *out, int max_out);
+	};
+
+	/* zeroth order modified Bessel function of the first kind */
+	static double
+		SDL_BesselI0(double x)
+	{
+			double sum = 1.0, term = 1.0;
+			int k;
+
+			for (k = 1; k < 50 && term > sum * 1e-12; k++) {
+				term *= (x * x / 4.0) / ((double)k * k);
+				sum += term;
+			}
+			return sum;
+	}
+
+	static int
+		SDL_gcd(int a, int b)
+	{
+			while (b) {
+				const int t = a % b;
+				a = b;
+				b = t;
+			}
+			return a;
+	}
+
+#define RESAMPLE_RUN(dot) \
+	int n, c; \
+	for (n = 0; n < max_out && rs->pos + rs->taps <= rs->hist_len; n++) { \
+		const float *h = rs->coeffs + \
+			rs->taps * (int)((Sint64)rs->frac * rs->phases / rs->up); \
+		for (c = 0; c < rs->channels; c++) \
+			*out++ = dot(h, rs->hist[c] + rs->pos, rs->taps); \
+		rs->frac += rs->down; \
+		rs->pos += rs->frac / rs->up; \
+		rs->frac %= rs->up; \
+	} \
+	return n;
+
+	static inline float
+		SDL_ResampleDot(const float *h, const float *x, int taps)
+	{
+			float sum = 0.0f;
+			int i;
+
+			for (i = 0; i < taps; i++)
+				sum += h[i] * x[i];
+			return sum;
+	}
+
+	static int
+		SDL_ResampleRun(AudioResampler * rs, float *out, int max_out)
+	{
+			RESAMPLE_RUN(SDL_ResampleDot);
+	}
+
+#if HAVE_SSE2_CVT
+	static inline float
+		SDL_ResampleDot_SSE(const float *h, const float *x, int taps)
+	{
+			__m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+			int i;
+
+			for (i = 0; i < taps; i += 8) {
+				a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(h + i), _mm_loadu_ps(x + i)));
+				a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(h + i + 4), _mm_loadu_ps(x + i + 4)));
+			}
+			a0 = _mm_add_ps(a0, a1);
+			a0 = _mm_add_ps(a0, _mm_movehl_ps(a0, a0));
+			a0 = _mm_add_ss(a0, _mm_shuffle_ps(a0, a0, 1));
+			return _mm_cvtss_f32(a0);
+	}
+
+	static int
+		SDL_ResampleRun_SSE(AudioResampler * rs, float *out, int max_out)
+	{
+			RESAMPLE_RUN(SDL_ResampleDot_SSE);
+	}
+#endif
+
+#if HAVE_AVX2_CVT
+	static inline TARGET_AVX2 float
+		SDL_ResampleDot_AVX2(const float *h, const float *x, int taps)
+	{
+			__m256 a = _mm256_setzero_ps();
+			__m128 s;
+			int i;
+
+			for (i = 0; i < taps; i += 8)
+				a = _mm256_add_ps(a, _mm256_mul_ps(_mm256_loadu_ps(h + i), _mm256_loadu_ps(x + i)));
+			s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+			s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+			s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+			return _mm_cvtss_f32(s);
+	}
+
+	static TARGET_AVX2 int
+		SDL_ResampleRun_AVX2(AudioResampler * rs, float *out, int max_out)
+	{
+			RESAMPLE_RUN(SDL_ResampleDot_AVX2);
+	}
+#endif
+
+#if HAVE_NEON_CVT
+	static inline float
+		SDL_ResampleDot_NEON(const float *h, const float *x, int taps)
+	{
+			float32x4_t a0 = vdupq_n_f32(0.0f), a1 = vdupq_n_f32(0.0f);
+			float32x2_t s;
+			int i;
+
+			for (i = 0; i < taps; i += 8) {
+				a0 = vmlaq_f32(a0, vld1q_f32(h + i), vld1q_f32(x + i));
+				a1 = vmlaq_f32(a1, vld1q_f32(h + i + 4), vld1q_f32(x + i + 4));
+			}
+			a0 = vaddq_f32(a0, a1);
+			s = vadd_f32(vget_low_f32(a0), vget_high_f32(a0));
+			return vget_lane_f32(vpadd_f32(s, s), 0);
+	}
+
+	static int
+		SDL_ResampleRun_NEON(AudioResampler * rs, float *out, int max_out)
+	{
+			RESAMPLE_RUN(SDL_ResampleDot_NEON);
+	}
+#endif
+
+	static void
+		SDL_FreeResampler(AudioResampler * rs)
+	{
+			int c;
+
+			if (rs == NULL)
+				return;
+			for (c = 0; c < rs->channels; c++)
+				free(rs->hist[c]);
+			free(rs->coeffs);
+			free(rs->out);
+			free(rs);
+	}
+
+	static AudioResampler *
+		SDL_CreateResampler(int channels, int src_rate, int dst_rate, int quality,
+		int max_frames)
+	{
+			AudioResampler *rs;
+			const int g = SDL_gcd(src_rate, dst_rate);
+			double fc, scale;
+			int half, p, k, c;
+
+			rs = (AudioResampler *)calloc(1, sizeof(AudioResampler));
+			if (rs == NULL)
+				return NULL;
+			rs->channels = channels;
+			rs->up = dst_rate / g;
+			rs->down = src_rate / g;
+			rs->phases = SDL_min(rs->up, RESAMPLE_MAX_PHASES);
+
+			/* downsampling lowers the cutoff, widen the filter to keep the transition band */
+			scale = SDL_min(1.0, (double)rs->up / rs->down);
+			fc = resample_qualities[quality].cutoff * scale;
+			half = (int)ceil(resample_qualities[quality].half_taps / scale);
+			rs->taps = (2 * half + RESAMPLE_TAPS_ALIGN - 1) & ~(RESAMPLE_TAPS_ALIGN - 1);
+
+			rs->coeffs = (float *)calloc(rs->phases * rs->taps, sizeof(float));
+			if (rs->coeffs == NULL) {
+				SDL_FreeResampler(rs);
+				return NULL;
+			}
+			for (p = 0; p < rs->phases; p++) {
+				float *h = rs->coeffs + p * rs->taps;
+				double sum = 0.0;
+
+				for (k = 0; k < 2 * half; k++) {
+					/* distance from the output position to tap k, in input frames */
+					const double x = half - 1 + (double)p / rs->phases - k;
+					const double w = x / half;
+					double v;
+
+					if (w <= -1.0 || w >= 1.0)
+						continue;
+					v = x == 0.0 ? fc : sin(RESAMPLE_PI * fc * x) / (RESAMPLE_PI * x);
+					v *= SDL_BesselI0(resample_qualities[quality].beta * sqrt(1.0 - w * w)) /
+						SDL_BesselI0(resample_qualities[quality].beta);
+					h[k] = (float)v;
+					sum += v;
+				}
+				/* unity gain at DC on every phase */
+				for (k = 0; k < 2 * half; k++)
+					h[k] = (float)(h[k] / sum);
+			}
+
+			/*
+			* Sized once for the largest call, the audio thread never allocates.
+			*  Less than a filter of history is left between calls, the other one
+			*  covers outputs the caller's buffer had no room for.
+			*/
+			rs->hist_max = max_frames + rs->taps * 2;
+			for (c = 0; c < channels; c++) {
+				rs->hist[c] = (float *)calloc(rs->hist_max, sizeof(float));
+				if (rs->hist[c] == NULL) {
+					SDL_FreeResampler(rs);
+					return NULL;
+				}
+			}
+			rs->out_max = (int)((Sint64)rs->hist_max * rs->up / rs->down) + 1;
+			rs->out = (float *)malloc(rs->out_max * channels * sizeof(float));
+			if (rs->out == NULL) {
+				SDL_FreeResampler(rs);
+				return NULL;
+			}
+			/* the first output lines up with the first input frame */
+			rs->hist_len = half - 1;
+
+			rs->run = SDL_ResampleRun;
+#if HAVE_SSE2_CVT
+			if (SDL_GetCPUFeatures() & CPU_HAS_SSE2)
+				rs->run = SDL_ResampleRun_SSE;
+#endif
+#if HAVE_AVX2_CVT
+			if (SDL_GetCPUFeatures() & CPU_HAS_AVX2)
+				rs->run = SDL_ResampleRun_AVX2;
+#endif
+#if HAVE_NEON_CVT
+			rs->run = SDL_ResampleRun_NEON;
+#endif
+			return rs;
+	}
+
+	/* append (frames) of (format) samples to the history */
+	static void
+		SDL_ResampleLoad(AudioResampler * rs, const Uint8 * buf, AudioFormat format, int frames)
+	{
+			const int channels = rs->channels;
+			const int at = rs->hist_len;
+			int i, c;
+
+#define load_samples(type, expr) \
+			{ \
+			const type *src = (const type *)buf; \
+			for (i = 0; i < frames; i++) { \
+				for (c = 0; c < channels; c++, src++) { \
+					rs->hist[c][at + i] = (expr); \
+				} \
+			} \
+			}
+
+			switch (format) {
+			case AUDIO_U8:
+				load_samples(Uint8, (*src - 128) * (1.0f / 128.0f));
+				break;
+			case AUDIO_S8:
+				load_samples(Sint8, *src * (1.0f / 128.0f));
+				break;
+			case AUDIO_U16LSB:
+				load_samples(Uint16, ((int)SDL_SwapLE16(*src) - 32768) * (1.0f / 32768.0f));
+				break;
+			case AUDIO_U16MSB:
+				load_samples(Uint16, ((int)SDL_SwapBE16(*src) - 32768) * (1.0f / 32768.0f));
+				break;
+			case AUDIO_S16LSB:
+				load_samples(Uint16, (Sint16)SDL_SwapLE16(*src) * (1.0f / 32768.0f));
+				break;
+			case AUDIO_S16MSB:
+				load_samples(Uint16, (Sint16)SDL_SwapBE16(*src) * (1.0f / 32768.0f));
+				break;
+			case AUDIO_S32LSB:
+				load_samples(Uint32, (float)((Sint32)SDL_SwapLE32(*src) * (1.0 / 2147483648.0)));
+				break;
+			case AUDIO_S32MSB:
+				load_samples(Uint32, (float)((Sint32)SDL_SwapBE32(*src) * (1.0 / 2147483648.0)));
+				break;
+			case AUDIO_F32LSB:
+				load_samples(float, SDL_SwapFloatLE(*src));
+				break;
+			case AUDIO_F32MSB:
+				load_samples(float, SDL_SwapFloatBE(*src));
+				break;
+			}
+
+#undef load_samples
+
+			rs->hist_len += frames;
+	}
+
+	/* write (n) interleaved float samples as (format), clipped */
+	static void
+		SDL_ResampleStore(const float *src, Uint8 * buf, AudioFormat format, int n)
+	{
+			int i;
+
+#define store_samples(type, expr) \
+			{ \
+			type *dst = (type *)buf; \
+			for (i = 0; i < n; i++, src++, dst++) { \
+				*dst = (expr); \
+			} \
+			}
+
+			/* the integer formats see the sample clipped to [-1, 1] as v */
+#define store_clipped(type, expr) \
+			{ \
+			type *dst = (type *)buf; \
+			for (i = 0; i < n; i++, src++, dst++) { \
+				const float v = *src < -1.0f ? -1.0f : (*src > 1.0f ? 1.0f : *src); \
+				*dst = (expr); \
+			} \
+			}
+
+			switch (format) {
+			case AUDIO_U8:
+				store_clipped(Uint8, (Uint8)SDL_min(255, (int)floor(v * 128.0f + 128.5f)));
+				break;
+			case AUDIO_S8:
+				store_clipped(Sint8, (Sint8)SDL_min(127, (int)floor(v * 128.0f + 0.5f)));
+				break;
+			case AUDIO_U16LSB:
+				store_clipped(Uint16, SDL_SwapLE16((Uint16)SDL_min(65535, (int)floor(v * 32768.0f + 32768.5f))));
+				break;
+			case AUDIO_U16MSB:
+				store_clipped(Uint16, SDL_SwapBE16((Uint16)SDL_min(65535, (int)floor(v * 32768.0f + 32768.5f))));
+				break;
+			case AUDIO_S16LSB:
+				store_clipped(Uint16, SDL_SwapLE16((Uint16)(Sint16)SDL_min(32767, (int)floor(v * 32768.0f + 0.5f))));
+				break;
+			case AUDIO_S16MSB:
+				store_clipped(Uint16, SDL_SwapBE16((Uint16)(Sint16)SDL_min(32767, (int)floor(v * 32768.0f + 0.5f))));
+				break;
+			case AUDIO_S32LSB:
+				store_clipped(Uint32, SDL_SwapLE32((Uint32)(Sint32)SDL_min(2147483647.0, floor(v * 2147483648.0 + 0.5))));
+				break;
+			case AUDIO_S32MSB:
+				store_clipped(Uint32, SDL_SwapBE32((Uint32)(Sint32)SDL_min(2147483647.0, floor(v * 2147483648.0 + 0.5))));
+				break;
+			case AUDIO_F32LSB:
+				store_samples(float, SDL_SwapFloatLE(*src));
+				break;
+			case AUDIO_F32MSB:
+				store_samples(float, SDL_SwapFloatBE(*src));
+				break;
+			}
+
+#undef store_clipped
+#undef store_samples
+	}
+
+	static void
+		SDL_ResampleSinc(AudioCVT * cvt, AudioFormat format)
+	{
+			AudioResampler *rs = cvt->resampler;
+			const int frame = (SDL_AUDIO_BITSIZE(format) / 8) * rs->channels;
+			const int max_out = SDL_min((cvt->len * cvt->len_mult) / frame, rs->out_max);
+			int frames = cvt->len_cvt / frame;
+			int n, c;
+
+#ifdef DEBUG_CONVERT
+			fprintf(stderr, "Resampling %d frames, x%f\n", frames, cvt->rate_incr);
+#endif
+
+			/* only a call over the max_frames given to BuildAudioCVT loses input */
+			frames = SDL_min(frames, rs->hist_max - rs->hist_len);
+
+			SDL_ResampleLoad(rs, cvt->buf, format, frames);
+			n = rs->run(rs, rs->out, max_out);
+			SDL_ResampleStore(rs->out, cvt->buf, format, n * rs->channels);
+
+			/* keep what the next outputs still need */
+			for (c = 0; c < rs->channels; c++) {
+				memmove(rs->hist[c], rs->hist[c] + rs->pos,
+					(rs->hist_len - rs->pos) * sizeof(float));
+			}
+			rs->hist_len -= rs->pos;
+			rs->pos = 0;
+
+			cvt->len_cvt = n * frame;
+			if (cvt->filters[++cvt->filter_index]) {
+				cvt->filters[cvt->filter_index](cvt, format);
+			}
+	}
+
+	void FreeAudioCVT(AudioCVT * cvt)
+	{
+		SDL_FreeResampler(cvt->resampler);
+		cvt->resampler = NULL;
+	}
+
 	static AudioFilter
 		SDL_HandTunedResampleCVT(AudioCVT * cvt, int dst_channels,
-		int src_rate, int dst_rate)
+		int src_rate, int dst_rate, int max_frames)
 	{
-			/*
-			* Fill in any future conversions that are specialized to a
-			*  processor, platform, compiler, or library here.
-			*/
-
-			return NULL;                /* no specialized converter code available. */
-	}
+			/* the lowest quality keeps the generated linear filters */
+			if (resample_quality <= AUDIO_RESAMPLE_LINEAR ||
+				dst_channels > RESAMPLE_MAX_CHANNELS)
+				return NULL;
+
+			/* the caller fails on a NULL resampler */
+			cvt->resampler = SDL_CreateResampler(dst_channels, src_rate, dst_rate,
+				SDL_min(resample_quality, AUDIO_RESAMPLE_HIGH), max_frames);
+			return SDL_ResampleSinc;
+	}
 
 	/* Duplicate a mono channel to both stereo channels */
 	static void
@@ -900,11 +2179,16 @@ namespace ff
 
 		static int
 			SDL_BuildAudioResampleCVT(AudioCVT * cvt, int dst_channels,
-			int src_rate, int dst_rate)
+			int src_rate, int dst_rate, int max_frames)
 		{
 				if (src_rate != dst_rate) {
 					AudioFilter filter = SDL_HandTunedResampleCVT(cvt, dst_channels,
-						src_rate, dst_rate);
+						src_rate, dst_rate, max_frames);
+
+					if (filter != NULL && cvt->resampler == NULL) {
+						OutOfMemory();
+						return -1;
+					}
 
 					/* No hand-tuned converter? Try the autogenerated ones. */
 					if (filter == NULL) {
@@ -949,60 +2233,10 @@ namespace ff
 
 
 
-	int BuildAudioCVT(AudioCVT * cvt,
-		AudioFormat src_fmt, Uint8 src_channels, int src_rate,
-		AudioFormat dst_fmt, Uint8 dst_channels, int dst_rate)
-	{
-		/*
-		* !!! FIXME: reorder filters based on which grow/shrink the buffer.
-		* !!! FIXME: ideally, we should do everything that shrinks the buffer
-		* !!! FIXME: first, so we don't have to process as many bytes in a given
-		* !!! FIXME: filter and abuse the CPU cache less. This might not be as
-		* !!! FIXME: good in practice as it sounds in theory, though.
-		*/
-
-		/* Sanity check target pointer */
-		if (cvt == NULL) {
-			return SDL_InvalidParamError("cvt");
-		}
-
-		/* there are no unsigned types over 16 bits, so catch this up front. */
-		if ((SDL_AUDIO_BITSIZE(src_fmt) > 16) && (!SDL_AUDIO_ISSIGNED(src_fmt))) {
-			return SDLog("Invalid source format");
-		}
-		if ((SDL_AUDIO_BITSIZE(dst_fmt) > 16) && (!SDL_AUDIO_ISSIGNED(dst_fmt))) {
-			return SDLog("Invalid destination format");
-		}
-
-		/* prevent possible divisions by zero, etc. */
-		if ((src_channels == 0) || (dst_channels == 0)) {
-			return SDLog("Source or destination channels is zero");
-		}
-		if ((src_rate == 0) || (dst_rate == 0)) {
-			return SDLog("Source or destination rate is zero");
-		}
-#ifdef DEBUG_CONVERT
-		printf("Build format %04x->%04x, channels %u->%u, rate %d->%d\n",
-			src_fmt, dst_fmt, src_channels, dst_channels, src_rate, dst_rate);
-#endif
-
-		/* Start off with no conversion necessary */
-		SDL_zerop(cvt);
-		cvt->src_format = src_fmt;
-		cvt->dst_format = dst_fmt;
-		cvt->needed = 0;
-		cvt->filter_index = 0;
-		cvt->filters[0] = NULL;
-		cvt->len_mult = 1;
-		cvt->len_ratio = 1.0;
-		cvt->rate_incr = ((double)dst_rate) / ((double)src_rate);
-
-		/* Convert data types, if necessary. Updates (cvt). */
-		if (SDL_BuildAudioTypeCVT(cvt, src_fmt, dst_fmt) == -1) {
-			return -1;              /* shouldn't happen, but just in case... */
-		}
-
-		/* Channel conversion */
+	/* Channel conversion, returns the channel count the filters reach */
+	static int
+		SDL_BuildAudioChannelCVT(AudioCVT * cvt, int src_channels, int dst_channels)
+	{
 		if (src_channels != dst_channels) {
 			if ((src_channels == 1) && (dst_channels > 1)) {
 				cvt->filters[cvt->filter_index++] = SDL_ConvertStereo;
@@ -1052,10 +2286,106 @@ namespace ff
 				/* Uh oh.. */;
 			}
 		}
+		return src_channels;
+	}
+
+	int BuildAudioCVT(AudioCVT * cvt,
+		AudioFormat src_fmt, Uint8 src_channels, int src_rate,
+		AudioFormat dst_fmt, Uint8 dst_channels, int dst_rate, int max_frames)
+	{
+		AudioFilter filter;
+		int channels_first, grows, in_frame;
+
+		/* Sanity check target pointer */
+		if (cvt == NULL) {
+			return SDL_InvalidParamError("cvt");
+		}
+
+		/* there are no unsigned types over 16 bits, so catch this up front. */
+		if ((SDL_AUDIO_BITSIZE(src_fmt) > 16) && (!SDL_AUDIO_ISSIGNED(src_fmt))) {
+			return SDLog("Invalid source format");
+		}
+		if ((SDL_AUDIO_BITSIZE(dst_fmt) > 16) && (!SDL_AUDIO_ISSIGNED(dst_fmt))) {
+			return SDLog("Invalid destination format");
+		}
+
+		/* prevent possible divisions by zero, etc. */
+		if ((src_channels == 0) || (dst_channels == 0)) {
+			return SDLog("Source or destination channels is zero");
+		}
+		if ((src_rate == 0) || (dst_rate == 0)) {
+			return SDLog("Source or destination rate is zero");
+		}
+		if (max_frames <= 0) {
+			return SDLog("Maximum frame count is zero");
+		}
+#ifdef DEBUG_CONVERT
+		printf("Build format %04x->%04x, channels %u->%u, rate %d->%d\n",
+			src_fmt, dst_fmt, src_channels, dst_channels, src_rate, dst_rate);
+#endif
+
+		/* Start off with no conversion necessary */
+		SDL_zerop(cvt);
+		cvt->src_format = src_fmt;
+		cvt->dst_format = dst_fmt;
+		cvt->needed = 0;
+		cvt->filter_index = 0;
+		cvt->filters[0] = NULL;
+		cvt->len_mult = 1;
+		cvt->len_ratio = 1.0;
+		cvt->rate_incr = ((double)dst_rate) / ((double)src_rate);
+
+		/*
+		* Shrinking stages go first, so the others touch fewer bytes: with fewer
+		*  channels out and samples not getting wider, mix the channels down
+		*  before converting the data type. A widening conversion goes first,
+		*  so the mix runs in the wider format. The channel filters take any
+		*  format.
+		*/
+		channels_first = (dst_channels < src_channels) &&
+			(SDL_AUDIO_BITSIZE(dst_fmt) <= SDL_AUDIO_BITSIZE(src_fmt));
+		in_frame = (SDL_AUDIO_BITSIZE(src_fmt) / 8) * src_channels;
+		grows = 0;
+
+		filter = SDL_FusedAudioCVT(src_fmt, src_channels, dst_fmt, dst_channels);
+		if (filter != NULL) {
+			const int out_frame = (SDL_AUDIO_BITSIZE(dst_fmt) / 8) * dst_channels;
+			cvt->filters[cvt->filter_index++] = filter;
+			if (out_frame > in_frame) {
+				cvt->len_mult *= out_frame / in_frame;
+			}
+			cvt->len_ratio = ((double)out_frame) / ((double)in_frame);
+			src_channels = dst_channels;
+		}
+		else {
+			if (channels_first) {
+				src_channels = SDL_BuildAudioChannelCVT(cvt, src_channels, dst_channels);
+			}
+
+			/* Convert data types, if necessary. Updates (cvt). */
+			if (SDL_BuildAudioTypeCVT(cvt, src_fmt, dst_fmt) == -1) {
+				return -1;              /* shouldn't happen, but just in case... */
+			}
+			grows = (cvt->len_ratio > 1.0);
+
+			if (!channels_first) {
+				src_channels = SDL_BuildAudioChannelCVT(cvt, src_channels, dst_channels);
+			}
+		}
+
+		/*
+		* These keep a fixed length ratio. SDL_ConvertAudio runs them a chunk at a
+		*  time when no stage makes the data bigger than it was read.
+		*/
+		if (!grows && cvt->len_ratio <= 1.0) {
+			cvt->chunk_filters = cvt->filter_index;
+			cvt->chunk_in_frame = in_frame;
+			cvt->chunk_out_frame = (SDL_AUDIO_BITSIZE(dst_fmt) / 8) * src_channels;
+		}
 
 		/* Do rate conversion, if necessary. Updates (cvt). */
-		if (SDL_BuildAudioResampleCVT(cvt, dst_channels, src_rate, dst_rate) ==
-			-1) {
+		if (SDL_BuildAudioResampleCVT(cvt, dst_channels, src_rate, dst_rate,
+			max_frames) == -1) {
 			return -1;              /* shouldn't happen, but just in case... */
 		}
 
@@ -1071,6 +2401,44 @@ namespace ff
 		return (cvt->needed);
 	}
 
+	/*
+	* Runs the fixed ratio filters a chunk at a time in place, so the buffer
+	*  goes through L1 once instead of once per filter. A callback buffer of
+	*  multichannel audio already spans several chunks. The chain never
+	*  grows, so each chunk is converted where it was read and then moved down
+	*  behind the previous one.
+	*/
+#define AUDIO_CHUNK_SIZE (16 * 1024)
+
+	static void
+		SDL_ConvertAudioChunks(AudioCVT * cvt)
+	{
+			AudioCVT chunk = *cvt;
+			const int frames = cvt->len_cvt / cvt->chunk_in_frame;
+			const int step = AUDIO_CHUNK_SIZE / cvt->chunk_in_frame;
+			int first;
+
+			chunk.filters[cvt->chunk_filters] = NULL;
+			for (first = 0; first < frames; first += step) {
+				const int n = SDL_min(step, frames - first);
+
+				chunk.buf = cvt->buf + first * cvt->chunk_in_frame;
+				chunk.len = chunk.len_cvt = n * cvt->chunk_in_frame;
+				chunk.filter_index = 0;
+				chunk.filters[0](&chunk, cvt->src_format);
+				if (first) {
+					memmove(cvt->buf + first * cvt->chunk_out_frame, chunk.buf, chunk.len_cvt);
+				}
+			}
+
+			/* the resampler, if any, takes the whole buffer */
+			cvt->len_cvt = frames * cvt->chunk_out_frame;
+			cvt->filter_index = cvt->chunk_filters;
+			if (cvt->filters[cvt->filter_index]) {
+				cvt->filters[cvt->filter_index](cvt, cvt->dst_format);
+			}
+	}
+
 	int
 		SDL_ConvertAudio(AudioCVT * cvt)
 	{
@@ -1090,7 +2458,357 @@ namespace ff
 
 			/* Set up the conversion and go! */
 			cvt->filter_index = 0;
+			if (cvt->chunk_filters > 1 && cvt->chunk_in_frame * 16 <= AUDIO_CHUNK_SIZE) {
+				SDL_ConvertAudioChunks(cvt);
+				return (0);
+			}
 			cvt->filters[0](cvt, cvt->src_format);
 			return (0);
 		}
+
+	/*
+	* Float mix bus. Samples are interleaved floats, gains go per channel so
+	*  one pass applies gain and pan. The limiter kernels have SSE2/NEON paths
+	*  for mono and stereo, other channel counts take the plain loops.
+	*/
+#define MIX_MAX_CHANNELS 8
+
+	void
+		SDL_MixAudioF32(float *dst, const float *src, int frames, int channels,
+		const float *gains, float *peak, float *rms)
+	{
+			const int n = frames * channels;
+			const int block = 4 * channels;
+			float pattern[4 * MIX_MAX_CHANNELS];
+			float max = 0.0f, sum = 0.0f;
+			int i = 0, k;
+
+			if (n <= 0) {
+				*peak = *rms = 0.0f;
+				return;
+			}
+			if (channels <= MIX_MAX_CHANNELS) {
+				/* the gains repeated over a whole number of vectors */
+				for (k = 0; k < block; k++)
+					pattern[k] = gains[k % channels];
+#if HAVE_SSE2_CVT
+				if (SDL_GetCPUFeatures() & CPU_HAS_SSE2) {
+					const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+					__m128 vmax = _mm_setzero_ps(), vsum = _mm_setzero_ps();
+					float v[4];
+
+					for (; i + block <= n; i += block) {
+						for (k = 0; k < block; k += 4) {
+							const __m128 s = _mm_mul_ps(_mm_loadu_ps(src + i + k), _mm_loadu_ps(pattern + k));
+							_mm_storeu_ps(dst + i + k, _mm_add_ps(_mm_loadu_ps(dst + i + k), s));
+							vmax = _mm_max_ps(vmax, _mm_and_ps(s, absmask));
+							vsum = _mm_add_ps(vsum, _mm_mul_ps(s, s));
+						}
+					}
+					_mm_storeu_ps(v, vmax);
+					max = SDL_max(SDL_max(v[0], v[1]), SDL_max(v[2], v[3]));
+					_mm_storeu_ps(v, vsum);
+					sum = (v[0] + v[1]) + (v[2] + v[3]);
+				}
+#endif
+#if HAVE_NEON_CVT
+				if (SDL_GetCPUFeatures() & CPU_HAS_NEON) {
+					float32x4_t vmax = vdupq_n_f32(0.0f), vsum = vdupq_n_f32(0.0f);
+					float32x2_t h;
+
+					for (; i + block <= n; i += block) {
+						for (k = 0; k < block; k += 4) {
+							const float32x4_t s = vmulq_f32(vld1q_f32(src + i + k), vld1q_f32(pattern + k));
+							vst1q_f32(dst + i + k, vaddq_f32(vld1q_f32(dst + i + k), s));
+							vmax = vmaxq_f32(vmax, vabsq_f32(s));
+							vsum = vmlaq_f32(vsum, s, s);
+						}
+					}
+					h = vpmax_f32(vget_low_f32(vmax), vget_high_f32(vmax));
+					max = vget_lane_f32(vpmax_f32(h, h), 0);
+					h = vpadd_f32(vget_low_f32(vsum), vget_high_f32(vsum));
+					sum = vget_lane_f32(vpadd_f32(h, h), 0);
+				}
+#endif
+			}
+			for (; i < n; i++) {
+				const float s = src[i] * gains[i % channels];
+				dst[i] += s;
+				max = SDL_max(max, (float)fabs(s));
+				sum += s * s;
+			}
+
+			*peak = max;
+			*rms = sqrtf(sum / n);
+	}
+
+	struct AudioLimiter
+	{
+		int channels;
+		int window;                 /**< lookahead in frames, the bus is delayed by window - 1 */
+		int max_frames;             /**< frames limited in one pass */
+		float ceiling;
+		float release;              /**< gain recovery per frame, a one pole coefficient */
+		float env;                  /**< lowest gain needed in the window, released slowly */
+		int quiet;                  /**< frames in a row with env at 1 */
+		unsigned int time;          /**< frame counter */
+		float *min_val;             /**< gains under 1 needed in the window, ascending */
+		unsigned int *min_time;     /**< and the frame each one is for */
+		int min_head, min_count;    /**< ring of window entries */
+		float *box;                 /**< last window env values, averaged */
+		double box_sum;
+		int box_pos;
+		float *delay;               /**< window - 1 delayed frames, then the input */
+		float *peaks;               /**< per frame peak of the input */
+		float *gains;               /**< per frame gain of the output */
+	};
+
+	AudioLimiter *
+		SDL_CreateLimiter(int channels, int freq, int max_frames, float ceiling)
+	{
+			AudioLimiter *lim = (AudioLimiter *)calloc(1, sizeof(AudioLimiter));
+			int i;
+
+			if (lim == NULL) {
+				OutOfMemory();
+				return NULL;
+			}
+			lim->channels = channels;
+			lim->window = SDL_max(freq / 200, 1);          /* 5 ms */
+			lim->max_frames = max_frames;
+			lim->ceiling = ceiling;
+			lim->release = 1.0f - (float)exp(-1.0 / (0.08 * freq));   /* 80 ms */
+			lim->env = 1.0f;
+			lim->quiet = lim->window;
+			lim->min_val = (float *)malloc(lim->window * sizeof(float));
+			lim->min_time = (unsigned int *)malloc(lim->window * sizeof(unsigned int));
+			lim->box = (float *)malloc(lim->window * sizeof(float));
+			lim->delay = (float *)calloc((lim->window - 1 + max_frames) * channels, sizeof(float));
+			lim->peaks = (float *)malloc(max_frames * sizeof(float));
+			lim->gains = (float *)malloc(max_frames * sizeof(float));
+			if (!lim->min_val || !lim->min_time || !lim->box || !lim->delay ||
+				!lim->peaks || !lim->gains) {
+				SDL_FreeLimiter(lim);
+				OutOfMemory();
+				return NULL;
+			}
+			for (i = 0; i < lim->window; i++)
+				lim->box[i] = 1.0f;
+			lim->box_sum = lim->window;
+			return lim;
+	}
+
+	void
+		SDL_FreeLimiter(AudioLimiter *lim)
+	{
+			if (lim == NULL) {
+				return;
+			}
+			free(lim->min_val);
+			free(lim->min_time);
+			free(lim->box);
+			free(lim->delay);
+			free(lim->peaks);
+			free(lim->gains);
+			free(lim);
+	}
+
+	/* frames the limiter holds the bus back */
+	int
+		SDL_LimiterDelay(const AudioLimiter *lim)
+	{
+			return lim->window - 1;
+	}
+
+	/* per frame peak of interleaved samples, returns the largest */
+	static float
+		SDL_FramePeaks(const float *buf, int frames, int channels, float *peaks)
+	{
+			float max = 0.0f;
+			int i = 0, c;
+
+#if HAVE_SSE2_CVT
+			if ((SDL_GetCPUFeatures() & CPU_HAS_SSE2) && channels <= 2) {
+				const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+				__m128 vmax = _mm_setzero_ps();
+				float v[4];
+
+				for (; i + 4 <= frames; i += 4) {
+					__m128 p;
+					if (channels == 1) {
+						p = _mm_and_ps(_mm_loadu_ps(buf + i), absmask);
+					}
+					else {
+						__m128 a = _mm_and_ps(_mm_loadu_ps(buf + 2 * i), absmask);
+						__m128 b = _mm_and_ps(_mm_loadu_ps(buf + 2 * i + 4), absmask);
+						a = _mm_max_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)));
+						b = _mm_max_ps(b, _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 3, 0, 1)));
+						p = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+					}
+					_mm_storeu_ps(peaks + i, p);
+					vmax = _mm_max_ps(vmax, p);
+				}
+				_mm_storeu_ps(v, vmax);
+				max = SDL_max(SDL_max(v[0], v[1]), SDL_max(v[2], v[3]));
+			}
+#endif
+#if HAVE_NEON_CVT
+			if ((SDL_GetCPUFeatures() & CPU_HAS_NEON) && channels <= 2) {
+				float32x4_t vmax = vdupq_n_f32(0.0f);
+				float32x2_t h;
+
+				for (; i + 4 <= frames; i += 4) {
+					float32x4_t p;
+					if (channels == 1) {
+						p = vabsq_f32(vld1q_f32(buf + i));
+					}
+					else {
+						const float32x4x2_t s = vld2q_f32(buf + 2 * i);
+						p = vmaxq_f32(vabsq_f32(s.val[0]), vabsq_f32(s.val[1]));
+					}
+					vst1q_f32(peaks + i, p);
+					vmax = vmaxq_f32(vmax, p);
+				}
+				h = vpmax_f32(vget_low_f32(vmax), vget_high_f32(vmax));
+				max = vget_lane_f32(vpmax_f32(h, h), 0);
+			}
+#endif
+			for (; i < frames; i++) {
+				float p = 0.0f;
+				for (c = 0; c < channels; c++)
+					p = SDL_max(p, (float)fabs(buf[i * channels + c]));
+				peaks[i] = p;
+				max = SDL_max(max, p);
+			}
+			return max;
+	}
+
+	/* dst = src * the gain of each frame */
+	static void
+		SDL_ApplyFrameGains(float *dst, const float *src, const float *gains,
+		int frames, int channels)
+	{
+			int i = 0, c;
+
+#if HAVE_SSE2_CVT
+			if ((SDL_GetCPUFeatures() & CPU_HAS_SSE2) && channels <= 2) {
+				for (; i + 4 <= frames; i += 4) {
+					const __m128 g = _mm_loadu_ps(gains + i);
+					if (channels == 1) {
+						_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), g));
+					}
+					else {
+						_mm_storeu_ps(dst + 2 * i, _mm_mul_ps(_mm_loadu_ps(src + 2 * i), _mm_unpacklo_ps(g, g)));
+						_mm_storeu_ps(dst + 2 * i + 4, _mm_mul_ps(_mm_loadu_ps(src + 2 * i + 4), _mm_unpackhi_ps(g, g)));
+					}
+				}
+			}
+#endif
+#if HAVE_NEON_CVT
+			if ((SDL_GetCPUFeatures() & CPU_HAS_NEON) && channels <= 2) {
+				for (; i + 4 <= frames; i += 4) {
+					const float32x4_t g = vld1q_f32(gains + i);
+					if (channels == 1) {
+						vst1q_f32(dst + i, vmulq_f32(vld1q_f32(src + i), g));
+					}
+					else {
+						float32x4x2_t s = vld2q_f32(src + 2 * i);
+						s.val[0] = vmulq_f32(s.val[0], g);
+						s.val[1] = vmulq_f32(s.val[1], g);
+						vst2q_f32(dst + 2 * i, s);
+					}
+				}
+			}
+#endif
+			for (; i < frames; i++) {
+				for (c = 0; c < channels; c++)
+					dst[i * channels + c] = src[i * channels + c] * gains[i];
+			}
+	}
+
+	/*
+	* Gain of the frame leaving the delay line: the lowest gain any frame of
+	*  the window needs (a sliding minimum), released slowly once they passed,
+	*  then averaged over the window so the gain reaches it smoothly by the
+	*  time the loud frame is played.
+	*/
+	static float
+		SDL_LimiterGain(AudioLimiter *lim, float peak)
+	{
+			const unsigned int t = lim->time++;
+			const int window = lim->window;
+			float held;
+
+			while (lim->min_count && (int)(t - lim->min_time[lim->min_head]) >= window) {
+				lim->min_head = (lim->min_head + 1) % window;
+				lim->min_count--;
+			}
+			if (peak > lim->ceiling) {
+				const float target = lim->ceiling / peak;
+				while (lim->min_count &&
+					lim->min_val[(lim->min_head + lim->min_count - 1) % window] >= target) {
+					lim->min_count--;
+				}
+				lim->min_val[(lim->min_head + lim->min_count) % window] = target;
+				lim->min_time[(lim->min_head + lim->min_count) % window] = t;
+				lim->min_count++;
+			}
+			held = lim->min_count ? lim->min_val[lim->min_head] : 1.0f;
+
+			if (held < lim->env) {
+				lim->env = held;
+			}
+			else {
+				lim->env += (held - lim->env) * lim->release;
+				if (lim->env > 1.0f - 1e-6f) {
+					lim->env = 1.0f;
+				}
+			}
+
+			lim->box_sum += lim->env - lim->box[lim->box_pos];
+			lim->box[lim->box_pos] = lim->env;
+			lim->box_pos = (lim->box_pos + 1) % window;
+			if (lim->env < 1.0f) {
+				lim->quiet = 0;
+			}
+			else if (++lim->quiet == window) {
+				lim->box_sum = window;      /* drop the rounding drift */
+			}
+			return (float)(lim->box_sum / window);
+	}
+
+	static void
+		SDL_LimitBlock(AudioLimiter *lim, float *buf, int frames)
+	{
+			const int channels = lim->channels;
+			const int delayed = (lim->window - 1) * channels;
+			float *in = lim->delay + delayed;
+			int i;
+
+			memcpy(in, buf, frames * channels * sizeof(float));
+			if (SDL_FramePeaks(in, frames, channels, lim->peaks) <= lim->ceiling &&
+				lim->quiet >= lim->window) {
+				/* nothing to limit in the window, the gains stay at 1 */
+				memcpy(buf, lim->delay, frames * channels * sizeof(float));
+				lim->time += frames;
+				lim->box_pos = (lim->box_pos + frames) % lim->window;
+			}
+			else {
+				for (i = 0; i < frames; i++)
+					lim->gains[i] = SDL_LimiterGain(lim, lim->peaks[i]);
+				SDL_ApplyFrameGains(buf, lim->delay, lim->gains, frames, channels);
+			}
+			memmove(lim->delay, lim->delay + frames * channels, delayed * sizeof(float));
+	}
+
+	void
+		SDL_LimitAudioF32(AudioLimiter *lim, float *buf, int frames)
+	{
+			while (frames > 0) {
+				const int n = SDL_min(frames, lim->max_frames);
+				SDL_LimitBlock(lim, buf, n);
+				buf += n * lim->channels;
+				frames -= n;
+			}
+	}
 }
\ No newline at end of file
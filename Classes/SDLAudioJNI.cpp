@@ -19,7 +19,9 @@ namespace ff
 	static JniMethodInfo jim_audioWriteShortBuffer;
 	static JniMethodInfo jim_audioWriteByteBuffer;
 	static JniMethodInfo jim_audioQuit;
+	static JniMethodInfo jim_audioQueuedFrames;
 	static bool bMethodInfoExist = false;
+	static bool bQueuedFramesExist = false;
 
 	static bool bInited = false;
 
@@ -51,6 +53,12 @@ namespace ff
 			jim_audioWriteShortBuffer.classID = (jclass)env->NewGlobalRef(jim_audioWriteShortBuffer.classID);
 			jim_audioWriteByteBuffer.classID = (jclass)env->NewGlobalRef(jim_audioWriteByteBuffer.classID);
 			jim_audioQuit.classID = (jclass)env->NewGlobalRef(jim_audioQuit.classID);
+			//older activities do not report the playback position
+			if (JniHelper::getStaticMethodInfo(jim_audioQueuedFrames, szFullClassName, "audioQueuedFrames", "()I"))
+			{
+				jim_audioQueuedFrames.classID = (jclass)env->NewGlobalRef(jim_audioQueuedFrames.classID);
+				bQueuedFramesExist = true;
+			}
 
 			bMethodInfoExist = true;
 		}
@@ -137,6 +145,14 @@ namespace ff
 		}	
 	}
 
+	int Android_JNI_GetAudioQueuedFrames()
+	{
+		if (!bInited || !bQueuedFramesExist) return -1;
+		JNIEnv *env = JniHelper::getEnv();
+
+		return env->CallStaticIntMethod(jim_audioQueuedFrames.classID, jim_audioQueuedFrames.methodID);
+	}
+
 	void Android_JNI_CloseAudioDevice()
 	{
 		if (!bInited) return;
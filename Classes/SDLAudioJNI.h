@@ -5,6 +5,7 @@ namespace ff{
 	extern int Android_JNI_OpenAudioDevice(int sampleRate, int is16Bit, int channelCount, int desiredBufferFrames);
 	extern void* Android_JNI_GetAudioBuffer();
 	extern void Android_JNI_WriteAudioBuffer();
+	extern int Android_JNI_GetAudioQueuedFrames();
 	extern void Android_JNI_CloseAudioDevice();
 }
 #endif
\ No newline at end of file
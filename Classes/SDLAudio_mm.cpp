@@ -16,6 +16,7 @@ namespace ff
         Uint8 *mixbuf;              /* The raw allocated mixing buffer */
         WAVEHDR wavebuf[NUM_BUFFERS];       /* Wave audio fragments */
         int next_buffer;
+        DWORD written;              /* Frames queued with waveOutWrite */
     };
     
 	char * WIN_StringToUTF8(TCHAR* tstr)
@@ -132,6 +133,20 @@ namespace ff
 						&_this->hidden->wavebuf[_this->hidden->next_buffer],
 						sizeof(_this->hidden->wavebuf[0]));
 					_this->hidden->next_buffer = (_this->hidden->next_buffer + 1) % NUM_BUFFERS;
+					_this->hidden->written += _this->spec.samples;
+				}
+
+			static double
+				WINMM_GetLatency(AudioDevice *_this)
+			{
+					MMTIME mmt;
+
+					mmt.wType = TIME_SAMPLES;
+					if (waveOutGetPosition(_this->hidden->hout, &mmt, sizeof(mmt)) != MMSYSERR_NOERROR ||
+						mmt.wType != TIME_SAMPLES)
+						return -1;
+					/* both count frames since the device opened and wrap together */
+					return (double)(DWORD)(_this->hidden->written - mmt.u.sample) / _this->spec.freq;
 				}
 
 			static void
@@ -389,6 +404,7 @@ namespace ff
 					impl->WaitDevice = WINMM_WaitDevice;
 					impl->WaitDone = WINMM_WaitDone;
 					impl->GetDeviceBuf = WINMM_GetDeviceBuf;
+					impl->GetLatency = WINMM_GetLatency;
 					impl->CloseDevice = WINMM_CloseDevice;
 
 					return 1;   /* _this audio target is available. */
@@ -150,6 +150,7 @@ namespace ff{
 	typedef Uint16 AudioFormat;
 
 	struct AudioCVT;
+	struct AudioResampler;
 	typedef void (* AudioFilter) (struct AudioCVT * cvt,AudioFormat format);
 	struct AudioCVT
 	{
@@ -164,6 +165,10 @@ namespace ff{
 		double len_ratio;           /**< Given len, final size is len*len_ratio */
 		AudioFilter filters[10];        /**< Filter list */
 		int filter_index;           /**< Current audio conversion function */
+		AudioResampler *resampler;  /**< Sample rate converter state, see FreeAudioCVT */
+		int chunk_filters;          /**< Leading filters with a fixed length ratio */
+		int chunk_in_frame;         /**< Bytes per frame before them */
+		int chunk_out_frame;        /**< Bytes per frame after them */
 	};
 	/* Streamer */
 	struct AudioStreamer
@@ -250,6 +255,7 @@ namespace ff{
 		void(*CloseDevice) (AudioDevice *_this);
 		void(*LockDevice) (AudioDevice *_this);
 		void(*UnlockDevice) (AudioDevice *_this);
+		double(*GetLatency) (AudioDevice *_this); /* Seconds queued ahead of the buffer being filled, < 0 if unknown */
 		void(*Deinitialize) (void);
 
 		/* !!! FIXME: add pause(), so we can optimize instead of mixing silence. */
@@ -289,6 +295,14 @@ namespace ff{
 		int demand_only;  /* 1==request explicitly, or it won't be available. */
 	};
 
+	enum {
+		CPU_HAS_SSE2 = 0x01,
+		CPU_HAS_AVX2 = 0x02,
+		CPU_HAS_NEON = 0x04
+	};
+	/* CPU_HAS_* flags of the vector code paths this CPU can run */
+	int SDL_GetCPUFeatures(void);
+
 	struct SDL_AudioRateFilters
 	{
 		AudioFormat fmt;
@@ -354,26 +368,40 @@ namespace ff{
 		void(*FreeHW)(Overlay *overlay);
 	};
 
+	struct YUVFixed;
+	/* fit is colortab and rgb_2_pix in fixed point, NULL when they don't fit it */
+	typedef void(*YUVBlitter)(int *colortab, Uint32 *rgb_2_pix, const struct YUVFixed *fit,
+		unsigned char *lum, unsigned char *cr,
+		unsigned char *cb, unsigned char *out,
+		int rows, int cols, int mod);
+
 	struct private_yuvhwdata {
-		Surface *stretch;
 		Surface *display;
 		Uint8 *pixels;
 		int *colortab;
 		Uint32 *rgb_2_pix;
-		void(*Display1X)(int *colortab, Uint32 *rgb_2_pix,
-			unsigned char *lum, unsigned char *cr,
-			unsigned char *cb, unsigned char *out,
-			int rows, int cols, int mod);
-		void(*Display2X)(int *colortab, Uint32 *rgb_2_pix,
-			unsigned char *lum, unsigned char *cr,
-			unsigned char *cb, unsigned char *out,
-			int rows, int cols, int mod);
+		struct YUVFixed *fit;		/* the tables for the vector blitters, fitted once */
+		YUVBlitter Display1X;
+		YUVBlitter Display2X;
+		struct YUVWorkers *workers;	/* band converters, started by the first large frame */
+		Uint8 *filter;			/* positions and rows of the stretch filter */
+		int filter_size;
 
 		/* These are just so we don't have to allocate them separately */
 		Uint16 pitches[3];
 		Uint8 *planes[3];
 	};
 
+	struct SDL_YUVBlitters
+	{
+		int bytes_per_pixel;
+		int features;		/* CPU_HAS_* flags they need, 0 for the table driven ones */
+		YUVBlitter Display1X;
+		YUVBlitter Display2X;
+	};
+	/* YV12/IYUV blitters of each display depth, best first */
+	extern const SDL_YUVBlitters sdl_yv12_blitters[];
+
 	struct Overlay {
 		Uint32 format;				/**< Read-only */
 		int w, h;				/**< Read-only */
@@ -550,12 +578,61 @@ namespace ff{
 #define AUDIO_F32MSB    0x9120  /**< As above, but big-endian byte order */
 #define AUDIO_F32       AUDIO_F32LSB
 
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+#define AUDIO_S32SYS    AUDIO_S32LSB
+#define AUDIO_F32SYS    AUDIO_F32LSB
+#else
+#define AUDIO_S32SYS    AUDIO_S32MSB
+#define AUDIO_F32SYS    AUDIO_F32MSB
+#endif
+
 	int OpenAudio(AudioSpec *desired, AudioSpec *obtained);
 	void CloseAudio(void);
 	void PauseAudio(int pause_on);
+	/*
+		Keep the callback from running, for changing what it reads.
+		*/
+	void LockAudio(void);
+	void UnlockAudio(void);
+	/*
+		Seconds between the buffer the callback is filling and the one the
+		speaker plays, as measured by the driver. Call it from the callback.
+		*/
+	double GetAudioLatency(void);
+	/*
+		max_frames is the most source frames one SDL_ConvertAudio call takes,
+		the sample rate converter is sized for it.
+		*/
 	int BuildAudioCVT(AudioCVT * cvt,
 		AudioFormat src_fmt, Uint8 src_channels, int src_rate,
-		AudioFormat dst_fmt, Uint8 dst_channels, int dst_rate);
+		AudioFormat dst_fmt, Uint8 dst_channels, int dst_rate, int max_frames);
+	void FreeAudioCVT(AudioCVT * cvt);
+
+	/*
+		Sample rate conversion quality of the next BuildAudioCVT, the sinc
+		filter gets longer and sharper with each level.
+		*/
+	enum {
+		AUDIO_RESAMPLE_LINEAR,      /**< generated linear filters, least CPU */
+		AUDIO_RESAMPLE_LOW,         /**< 16 taps windowed sinc */
+		AUDIO_RESAMPLE_MEDIUM,      /**< 32 taps, the default */
+		AUDIO_RESAMPLE_HIGH         /**< 64 taps */
+	};
+	void SetAudioResampleQuality(int quality);
+
+	/*
+		Float mix bus. SDL_MixAudioF32 adds src times a gain per channel to
+		dst and gives the peak and rms of what it added. SDL_LimitAudioF32
+		keeps the bus under the ceiling with 5 ms of lookahead, so it delays
+		the bus by as much.
+		*/
+	struct AudioLimiter;
+	void SDL_MixAudioF32(float *dst, const float *src, int frames, int channels,
+		const float *gains, float *peak, float *rms);
+	AudioLimiter *SDL_CreateLimiter(int channels, int freq, int max_frames, float ceiling);
+	void SDL_FreeLimiter(AudioLimiter *lim);
+	void SDL_LimitAudioF32(AudioLimiter *lim, float *buf, int frames);
+	int SDL_LimiterDelay(const AudioLimiter *lim);
 
 	/*
 		SDL Event
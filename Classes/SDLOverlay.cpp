@@ -1,10 +1,37 @@
 #include "SDLImp.h"
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+#define HAVE_SSE2_YUV 1
+#include <emmintrin.h>
+#if defined(__AVX2__) || (defined(_MSC_VER) && _MSC_VER >= 1700) || \
+	(defined(__GNUC__) && !defined(__clang__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))) || \
+	(defined(__clang__) && (__clang_major__ > 3 || (__clang_major__ == 3 && __clang_minor__ >= 8)))
+#define HAVE_AVX2_YUV 1
+#include <immintrin.h>
+#endif
+#endif
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define HAVE_NEON_YUV 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) && !defined(__AVX2__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+#ifdef _MSC_VER
+#define YUV_INLINE __forceinline
+#else
+#define YUV_INLINE inline __attribute__((always_inline))
+#endif
 
 /*
 	SDL Overlay ʵ
 */
 namespace ff{
 	int DisplayYUV_SW(Overlay *overlay, Rect *src, Rect *dst);
+	static void YUVFreeWorkers(struct YUVWorkers *w);
 
 	int LockYUV_SW(Overlay *overlay)
 	{
@@ -22,8 +49,11 @@ namespace ff{
 
 		swdata = overlay->hwdata;
 		if (swdata) {
-			if (swdata->stretch) {
-				FreeSurface(swdata->stretch);
+			if (swdata->workers) {
+				YUVFreeWorkers(swdata->workers);
+			}
+			if (swdata->filter) {
+				free(swdata->filter);
 			}
 			if (swdata->pixels) {
 				free(swdata->pixels);
@@ -34,6 +64,9 @@ namespace ff{
 			if (swdata->rgb_2_pix) {
 				free(swdata->rgb_2_pix);
 			}
+			if (swdata->fit) {
+				free(swdata->fit);
+			}
 			free(swdata);
 			overlay->hwdata = NULL;
 		}
@@ -61,7 +94,7 @@ namespace ff{
 		return 1 + free_bits_at_bottom(a >> 1);
 	}
 
-	static void Color16DitherYV12Mod1X(int *colortab, Uint32 *rgb_2_pix,
+	static void Color16DitherYV12Mod1X(int *colortab, Uint32 *rgb_2_pix, const YUVFixed *fit,
 		unsigned char *lum, unsigned char *cr,
 		unsigned char *cb, unsigned char *out,
 		int rows, int cols, int mod)
@@ -135,7 +168,7 @@ namespace ff{
 	* 16 bits replicated in the upper 16. This means I can write ints and get
 	* the horisontal doubling for free (almost).
 	*/
-	static void Color16DitherYV12Mod2X(int *colortab, Uint32 *rgb_2_pix,
+	static void Color16DitherYV12Mod2X(int *colortab, Uint32 *rgb_2_pix, const YUVFixed *fit,
 		unsigned char *lum, unsigned char *cr,
 		unsigned char *cb, unsigned char *out,
 		int rows, int cols, int mod)
@@ -207,7 +240,7 @@ namespace ff{
 			row2 += mod;
 		}
 	}
-	static void Color24DitherYV12Mod1X(int *colortab, Uint32 *rgb_2_pix,
+	static void Color24DitherYV12Mod1X(int *colortab, Uint32 *rgb_2_pix, const YUVFixed *fit,
 		unsigned char *lum, unsigned char *cr,
 		unsigned char *cb, unsigned char *out,
 		int rows, int cols, int mod)
@@ -290,7 +323,7 @@ namespace ff{
 			row2 += mod;
 		}
 	}
-	static void Color24DitherYV12Mod2X(int *colortab, Uint32 *rgb_2_pix,
+	static void Color24DitherYV12Mod2X(int *colortab, Uint32 *rgb_2_pix, const YUVFixed *fit,
 		unsigned char *lum, unsigned char *cr,
 		unsigned char *cb, unsigned char *out,
 		int rows, int cols, int mod)
@@ -388,7 +421,7 @@ namespace ff{
 		}
 	}
 
-	static void Color32DitherYV12Mod1X(int *colortab, Uint32 *rgb_2_pix,
+	static void Color32DitherYV12Mod1X(int *colortab, Uint32 *rgb_2_pix, const YUVFixed *fit,
 		unsigned char *lum, unsigned char *cr,
 		unsigned char *cb, unsigned char *out,
 		int rows, int cols, int mod)
@@ -457,7 +490,7 @@ namespace ff{
 			row2 += mod;
 		}
 	}
-	static void Color32DitherYV12Mod2X(int *colortab, Uint32 *rgb_2_pix,
+	static void Color32DitherYV12Mod2X(int *colortab, Uint32 *rgb_2_pix, const YUVFixed *fit,
 		unsigned char *lum, unsigned char *cr,
 		unsigned char *cb, unsigned char *out,
 		int rows, int cols, int mod)
@@ -533,7 +566,718 @@ namespace ff{
 			row2 += mod;
 		}
 	}
-	static void Color16DitherYUY2Mod1X(int *colortab, Uint32 *rgb_2_pix,
+
+	/*
+	* Vector versions of the YV12 blitters. They compute what the tables hold
+	* instead of looking it up: a chroma table entry is (int)(k * (c - 128)),
+	* that is sign(c - 128) * (a * ip + (a * frac >> 16)) with a = |c - 128|
+	* for the 16 bit fraction YUVFitTables finds, and an rgb_2_pix entry is
+	* the channel clamped to 0..255, then ((v >> loss) << shift). So they give
+	* the same pixels as the table driven blitters, and fall back to those if
+	* the tables can't be written that way. The 24 bit stores assume a little
+	* endian host like the rest of the vector code.
+	*/
+	struct YUVFixed
+	{
+		Uint16 ip[4];
+		Uint16 frac[4];
+		Uint16 neg[4];		/* 0xFFFF for the negative coefficients */
+		int loss[3];
+		int shift[3];
+		int order;		/* 1 for r, g, b in bytes 0-2, 2 for b, g, r, 0 otherwise */
+	};
+
+	static int YUVFitTables(const int *colortab, const Uint32 *rgb_2_pix,
+		int bpp, YUVFixed *fx)
+	{
+		const Uint32 mask = bpp == 2 ? 0xFFFF : 0xFFFFFFFF;
+		int i, j, a, m, lo_m, lo_a, u;
+
+		for (j = 0; j < 4; j++) {
+			const int *tab = &colortab[j * 256];
+			int neg = tab[255] < 0;
+
+			/* the largest m / a is the coefficient rounded down the least */
+			lo_m = 0;
+			lo_a = 1;
+			for (i = 0; i < 256; i++) {
+				a = i < 128 ? 128 - i : i - 128;
+				m = ((i < 128) != neg) ? -tab[i] : tab[i];
+				if (a && m * lo_a > lo_m * a) {
+					lo_m = m;
+					lo_a = a;
+				}
+			}
+			if (lo_m / lo_a > 255) {
+				return(-1);
+			}
+			fx->ip[j] = (Uint16)(lo_m / lo_a);
+			fx->frac[j] = (Uint16)((((Uint32)(lo_m % lo_a) << 16) + lo_a - 1) / lo_a);
+			fx->neg[j] = neg ? 0xFFFF : 0;
+			for (i = 0; i < 256; i++) {
+				a = i < 128 ? 128 - i : i - 128;
+				u = a * fx->ip[j] + ((a * fx->frac[j]) >> 16);
+				if (tab[i] != (((i < 128) != neg) ? -u : u)) {
+					return(-1);
+				}
+			}
+		}
+		for (j = 0; j < 3; j++) {
+			const Uint32 *tab = &rgb_2_pix[j * 768 + 256];
+			Uint32 top = tab[255] & mask;
+
+			fx->loss[j] = 8 - number_of_bits_set(top);
+			fx->shift[j] = top ? free_bits_at_bottom(top) : 0;
+			if (fx->loss[j] < 0) {
+				return(-1);
+			}
+			for (i = -256; i < 512; i++) {
+				int v = i < 0 ? 0 : i > 255 ? 255 : i;
+				if ((tab[i] & mask) != (Uint32)((v >> fx->loss[j]) << fx->shift[j])) {
+					return(-1);
+				}
+			}
+		}
+		fx->order = 0;
+		if (bpp != 2 && !fx->loss[0] && !fx->loss[1] && !fx->loss[2] && fx->shift[1] == 8) {
+			if (fx->shift[0] == 0 && fx->shift[2] == 16) {
+				fx->order = 1;
+			}
+			if (fx->shift[0] == 16 && fx->shift[2] == 0) {
+				fx->order = 2;
+			}
+		}
+		return(0);
+	}
+
+	static void YUVPutPixel(unsigned char *p, Uint32 value, int bpp)
+	{
+		switch (bpp) {
+		case 2:
+			*(unsigned short *)p = (unsigned short)value;
+			break;
+		case 3:
+			p[0] = (value)& 0xFF;
+			p[1] = (value >> 8) & 0xFF;
+			p[2] = (value >> 16) & 0xFF;
+			break;
+		default:
+			*(unsigned int *)p = value;
+			break;
+		}
+	}
+
+	/* n 24 bit pixels from 32 bit values, each store but the last overlapping the next pixel */
+	static YUV_INLINE void YUVPut24(unsigned char *p, const Uint32 *v, int n)
+	{
+		int i;
+
+		for (i = 0; i < n - 1; i++) {
+			memcpy(p + 3 * i, &v[i], 4);
+		}
+		YUVPutPixel(p + 3 * i, v[i], 3);
+	}
+
+	/* the 2x2 blocks from x on of a row pair, with the tables */
+	static void ColorYV12Tail(const int *colortab, const Uint32 *rgb_2_pix,
+		const unsigned char *lum, const unsigned char *lum2,
+		const unsigned char *cr, const unsigned char *cb,
+		unsigned char *row1, unsigned char *row2,
+		int x, int cols_2, int bpp, int scale, int pitch)
+	{
+		int k;
+
+		for (; x < cols_2; x++) {
+			int cr_r = 0 * 768 + 256 + colortab[cr[x] + 0 * 256];
+			int crb_g = 1 * 768 + 256 + colortab[cr[x] + 1 * 256]
+				+ colortab[cb[x] + 2 * 256];
+			int cb_b = 2 * 768 + 256 + colortab[cb[x] + 3 * 256];
+
+			for (k = 0; k < 4; k++) {
+				int L = (k < 2 ? lum : lum2)[2 * x + (k & 1)];
+				Uint32 value = (rgb_2_pix[L + cr_r] |
+					rgb_2_pix[L + crb_g] |
+					rgb_2_pix[L + cb_b]);
+				unsigned char *p = (k < 2 ? row1 : row2) + (2 * x + (k & 1)) * scale * bpp;
+
+				YUVPutPixel(p, value, bpp);
+				if (scale == 2) {
+					YUVPutPixel(p + bpp, value, bpp);
+					YUVPutPixel(p + pitch, value, bpp);
+					YUVPutPixel(p + pitch + bpp, value, bpp);
+				}
+			}
+		}
+	}
+
+	/* converts the first cols pixels of a row pair, cols is a multiple of the kernel step */
+	typedef void(*YUVRowKernel)(const YUVFixed *fx,
+		const unsigned char *lum, const unsigned char *lum2,
+		const unsigned char *cr, const unsigned char *cb,
+		unsigned char *row1, unsigned char *row2,
+		int cols, int pitch);
+
+	static void ColorYV12Vector(YUVRowKernel kernel, int step, YUVBlitter fallback,
+		int *colortab, Uint32 *rgb_2_pix, const YUVFixed *fit,
+		unsigned char *lum, unsigned char *cr,
+		unsigned char *cb, unsigned char *out,
+		int rows, int cols, int mod, int bpp, int scale)
+	{
+		const int pitch = (cols * scale + mod) * bpp;
+		const int cols_2 = cols / 2;
+		const int vcols = cols / step * step;
+		int y;
+
+		/* the table driven blitters step odd widths their own way */
+		if ((cols & 1) || !fit) {
+			fallback(colortab, rgb_2_pix, fit, lum, cr, cb, out, rows, cols, mod);
+			return;
+		}
+		for (y = rows / 2; y--;) {
+			kernel(fit, lum, lum + cols, cr, cb,
+				out, out + scale * pitch, vcols, pitch);
+			ColorYV12Tail(colortab, rgb_2_pix, lum, lum + cols, cr, cb,
+				out, out + scale * pitch, vcols / 2, cols_2, bpp, scale, pitch);
+			lum += 2 * cols;
+			cr += cols_2;
+			cb += cols_2;
+			out += 2 * scale * pitch;
+		}
+	}
+
+/* the row kernel gets its own copy for each depth and scale, with the branches on them folded */
+#define DEFINE_YV12_BLITTER(name, isa, target, step, bpp, scale, fallback) \
+	static target void name##_Rows(const YUVFixed *fx, \
+		const unsigned char *lum, const unsigned char *lum2, \
+		const unsigned char *cr, const unsigned char *cb, \
+		unsigned char *row1, unsigned char *row2, \
+		int cols, int pitch) \
+	{ \
+		ColorYV12Rows_##isa(fx, lum, lum2, cr, cb, row1, row2, cols, bpp, scale, pitch); \
+	} \
+	static void name(int *colortab, Uint32 *rgb_2_pix, const YUVFixed *fit, \
+		unsigned char *lum, unsigned char *cr, \
+		unsigned char *cb, unsigned char *out, \
+		int rows, int cols, int mod) \
+	{ \
+		ColorYV12Vector(name##_Rows, step, fallback, colortab, rgb_2_pix, fit, \
+			lum, cr, cb, out, rows, cols, mod, bpp, scale); \
+	}
+
+#define DEFINE_YV12_BLITTERS(isa, target, step) \
+	DEFINE_YV12_BLITTER(Color16YV12Mod1X_##isa, isa, target, step, 2, 1, Color16DitherYV12Mod1X) \
+	DEFINE_YV12_BLITTER(Color16YV12Mod2X_##isa, isa, target, step, 2, 2, Color16DitherYV12Mod2X) \
+	DEFINE_YV12_BLITTER(Color24YV12Mod1X_##isa, isa, target, step, 3, 1, Color24DitherYV12Mod1X) \
+	DEFINE_YV12_BLITTER(Color24YV12Mod2X_##isa, isa, target, step, 3, 2, Color24DitherYV12Mod2X) \
+	DEFINE_YV12_BLITTER(Color32YV12Mod1X_##isa, isa, target, step, 4, 1, Color32DitherYV12Mod1X) \
+	DEFINE_YV12_BLITTER(Color32YV12Mod2X_##isa, isa, target, step, 4, 2, Color32DitherYV12Mod2X)
+
+#if HAVE_SSE2_YUV
+	/* sign(v) * (a * ip + (a * frac >> 16)), s is the sign mask of v */
+	static YUV_INLINE __m128i
+		YUVTerm_SSE2(__m128i a, __m128i s, const YUVFixed *fx, int j)
+	{
+		__m128i u = _mm_add_epi16(_mm_mullo_epi16(a, _mm_set1_epi16((short)fx->ip[j])),
+			_mm_mulhi_epu16(a, _mm_set1_epi16((short)fx->frac[j])));
+
+		s = _mm_xor_si128(s, _mm_set1_epi16((short)fx->neg[j]));
+		return _mm_sub_epi16(_mm_xor_si128(u, s), s);
+	}
+
+	/* 16 pixels of a row, t holds the chroma terms of pixels 0-7 and 8-15 for r, g and b */
+	static YUV_INLINE void
+		YUVPixels_SSE2(const YUVFixed *fx, const unsigned char *lum, const __m128i *t,
+		unsigned char *out, int bpp, int scale, int pitch)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i l = _mm_loadu_si128((const __m128i *)lum);
+		__m128i ll = _mm_unpacklo_epi8(l, zero);
+		__m128i lh = _mm_unpackhi_epi8(l, zero);
+		__m128i p[4], c[3], v;
+		int i, j;
+
+		for (j = 0; j < 3; j++) {
+			c[j] = _mm_packus_epi16(_mm_add_epi16(ll, t[2 * j]), _mm_add_epi16(lh, t[2 * j + 1]));
+		}
+		if (bpp != 2 && fx->order) {
+			/* whole bytes, interleaving them is enough */
+			const __m128i lo = fx->order == 1 ? c[0] : c[2];
+			const __m128i hi = fx->order == 1 ? c[2] : c[0];
+
+			for (i = 0; i < 2; i++) {
+				__m128i lg = i ? _mm_unpackhi_epi8(lo, c[1]) : _mm_unpacklo_epi8(lo, c[1]);
+				__m128i hz = i ? _mm_unpackhi_epi8(hi, zero) : _mm_unpacklo_epi8(hi, zero);
+				p[2 * i] = _mm_unpacklo_epi16(lg, hz);
+				p[2 * i + 1] = _mm_unpackhi_epi16(lg, hz);
+			}
+		}
+		else {
+			p[0] = p[1] = p[2] = p[3] = zero;
+			for (j = 0; j < 3; j++) {
+				const __m128i loss = _mm_cvtsi32_si128(fx->loss[j]);
+				const __m128i shift = _mm_cvtsi32_si128(fx->shift[j]);
+
+				for (i = 0; i < 2; i++) {
+					v = _mm_srl_epi16(i ? _mm_unpackhi_epi8(c[j], zero) : _mm_unpacklo_epi8(c[j], zero), loss);
+					if (bpp == 2) {
+						p[i] = _mm_or_si128(p[i], _mm_sll_epi16(v, shift));
+					}
+					else {
+						p[2 * i] = _mm_or_si128(p[2 * i], _mm_sll_epi32(_mm_unpacklo_epi16(v, zero), shift));
+						p[2 * i + 1] = _mm_or_si128(p[2 * i + 1], _mm_sll_epi32(_mm_unpackhi_epi16(v, zero), shift));
+					}
+				}
+			}
+		}
+		if (bpp == 2) {
+			if (scale == 1) {
+				_mm_storeu_si128((__m128i *)out, p[0]);
+				_mm_storeu_si128((__m128i *)(out + 16), p[1]);
+			}
+			else {
+				for (i = 0; i < 2; i++) {
+					__m128i lo = _mm_unpacklo_epi16(p[i], p[i]);
+					__m128i hi = _mm_unpackhi_epi16(p[i], p[i]);
+					_mm_storeu_si128((__m128i *)(out + 32 * i), lo);
+					_mm_storeu_si128((__m128i *)(out + 32 * i + 16), hi);
+					_mm_storeu_si128((__m128i *)(out + pitch + 32 * i), lo);
+					_mm_storeu_si128((__m128i *)(out + pitch + 32 * i + 16), hi);
+				}
+			}
+		}
+		else if (bpp == 4) {
+			if (scale == 1) {
+				for (i = 0; i < 4; i++) {
+					_mm_storeu_si128((__m128i *)(out + 16 * i), p[i]);
+				}
+			}
+			else {
+				for (i = 0; i < 4; i++) {
+					__m128i lo = _mm_unpacklo_epi32(p[i], p[i]);
+					__m128i hi = _mm_unpackhi_epi32(p[i], p[i]);
+					_mm_storeu_si128((__m128i *)(out + 32 * i), lo);
+					_mm_storeu_si128((__m128i *)(out + 32 * i + 16), hi);
+					_mm_storeu_si128((__m128i *)(out + pitch + 32 * i), lo);
+					_mm_storeu_si128((__m128i *)(out + pitch + 32 * i + 16), hi);
+				}
+			}
+		}
+		else {
+			__m128i tmp[8];
+
+			if (scale == 1) {
+				for (i = 0; i < 4; i++) {
+					_mm_storeu_si128(&tmp[i], p[i]);
+				}
+				YUVPut24(out, (const Uint32 *)tmp, 16);
+			}
+			else {
+				for (i = 0; i < 4; i++) {
+					_mm_storeu_si128(&tmp[2 * i], _mm_unpacklo_epi32(p[i], p[i]));
+					_mm_storeu_si128(&tmp[2 * i + 1], _mm_unpackhi_epi32(p[i], p[i]));
+				}
+				YUVPut24(out, (const Uint32 *)tmp, 32);
+				YUVPut24(out + pitch, (const Uint32 *)tmp, 32);
+			}
+		}
+	}
+
+	static YUV_INLINE void
+		ColorYV12Rows_SSE2(const YUVFixed *fx,
+		const unsigned char *lum, const unsigned char *lum2,
+		const unsigned char *cr, const unsigned char *cb,
+		unsigned char *row1, unsigned char *row2,
+		int cols, int bpp, int scale, int pitch)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i bias = _mm_set1_epi16(128);
+		int x;
+
+		for (x = 0; x < cols; x += 16) {
+			__m128i vr = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(cr + x / 2)), zero), bias);
+			__m128i vb = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(cb + x / 2)), zero), bias);
+			__m128i sr = _mm_srai_epi16(vr, 15);
+			__m128i sb = _mm_srai_epi16(vb, 15);
+			__m128i ar = _mm_sub_epi16(_mm_xor_si128(vr, sr), sr);
+			__m128i ab = _mm_sub_epi16(_mm_xor_si128(vb, sb), sb);
+			__m128i tr = YUVTerm_SSE2(ar, sr, fx, 0);
+			__m128i tg = _mm_add_epi16(YUVTerm_SSE2(ar, sr, fx, 1), YUVTerm_SSE2(ab, sb, fx, 2));
+			__m128i tb = YUVTerm_SSE2(ab, sb, fx, 3);
+			__m128i t[6];
+
+			/* one chroma sample for two pixels */
+			t[0] = _mm_unpacklo_epi16(tr, tr);
+			t[1] = _mm_unpackhi_epi16(tr, tr);
+			t[2] = _mm_unpacklo_epi16(tg, tg);
+			t[3] = _mm_unpackhi_epi16(tg, tg);
+			t[4] = _mm_unpacklo_epi16(tb, tb);
+			t[5] = _mm_unpackhi_epi16(tb, tb);
+			YUVPixels_SSE2(fx, lum + x, t, row1 + x * scale * bpp, bpp, scale, pitch);
+			YUVPixels_SSE2(fx, lum2 + x, t, row2 + x * scale * bpp, bpp, scale, pitch);
+		}
+	}
+
+	DEFINE_YV12_BLITTERS(SSE2, , 16)
+#endif
+
+#if HAVE_AVX2_YUV
+	static YUV_INLINE TARGET_AVX2 __m256i
+		YUVTerm_AVX2(__m256i a, __m256i s, const YUVFixed *fx, int j)
+	{
+		__m256i u = _mm256_add_epi16(_mm256_mullo_epi16(a, _mm256_set1_epi16((short)fx->ip[j])),
+			_mm256_mulhi_epu16(a, _mm256_set1_epi16((short)fx->frac[j])));
+
+		s = _mm256_xor_si256(s, _mm256_set1_epi16((short)fx->neg[j]));
+		return _mm256_sub_epi16(_mm256_xor_si256(u, s), s);
+	}
+
+	/* pixels 0-3 of each 128 bit lane doubled, then pixels 4-7 */
+	static YUV_INLINE TARGET_AVX2 void
+		YUVStore2x_AVX2(unsigned char *out, int pitch, __m256i lo, __m256i hi)
+	{
+		__m256i a = _mm256_permute2x128_si256(lo, hi, 0x20);
+		__m256i b = _mm256_permute2x128_si256(lo, hi, 0x31);
+
+		_mm256_storeu_si256((__m256i *)out, a);
+		_mm256_storeu_si256((__m256i *)(out + 32), b);
+		_mm256_storeu_si256((__m256i *)(out + pitch), a);
+		_mm256_storeu_si256((__m256i *)(out + pitch + 32), b);
+	}
+
+	/*
+	* 32 pixels of a row. The unpacks work within 128 bit lanes, so t holds
+	* the chroma terms of pixels 0-7 and 16-23, then 8-15 and 24-31, the
+	* order of the unpacked luma, and packus puts the pixels back in order.
+	*/
+	static YUV_INLINE TARGET_AVX2 void
+		YUVPixels_AVX2(const YUVFixed *fx, const unsigned char *lum, const __m256i *t,
+		unsigned char *out, int bpp, int scale, int pitch)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		__m256i l = _mm256_loadu_si256((const __m256i *)lum);
+		__m256i ll = _mm256_unpacklo_epi8(l, zero);
+		__m256i lh = _mm256_unpackhi_epi8(l, zero);
+		__m256i p[4], c[3];
+		__m128i c0, c1;
+		int i, j;
+
+		for (j = 0; j < 3; j++) {
+			c[j] = _mm256_packus_epi16(_mm256_add_epi16(ll, t[2 * j]), _mm256_add_epi16(lh, t[2 * j + 1]));
+		}
+		if (bpp != 2 && fx->order) {
+			const __m256i lo = fx->order == 1 ? c[0] : c[2];
+			const __m256i hi = fx->order == 1 ? c[2] : c[0];
+
+			/* pixels 8i-8i+7 and 16+8i-16+8i+7, split over the lanes */
+			for (i = 0; i < 2; i++) {
+				__m256i lg = i ? _mm256_unpackhi_epi8(lo, c[1]) : _mm256_unpacklo_epi8(lo, c[1]);
+				__m256i hz = i ? _mm256_unpackhi_epi8(hi, zero) : _mm256_unpacklo_epi8(hi, zero);
+				__m256i a = _mm256_unpacklo_epi16(lg, hz);
+				__m256i b = _mm256_unpackhi_epi16(lg, hz);
+				p[i] = _mm256_permute2x128_si256(a, b, 0x20);
+				p[2 + i] = _mm256_permute2x128_si256(a, b, 0x31);
+			}
+		}
+		else {
+			p[0] = p[1] = p[2] = p[3] = zero;
+			for (j = 0; j < 3; j++) {
+				const __m128i loss = _mm_cvtsi32_si128(fx->loss[j]);
+				const __m128i shift = _mm_cvtsi32_si128(fx->shift[j]);
+
+				c0 = _mm256_castsi256_si128(c[j]);
+				c1 = _mm256_extracti128_si256(c[j], 1);
+				if (bpp == 2) {
+					p[0] = _mm256_or_si256(p[0], _mm256_sll_epi16(_mm256_srl_epi16(_mm256_cvtepu8_epi16(c0), loss), shift));
+					p[1] = _mm256_or_si256(p[1], _mm256_sll_epi16(_mm256_srl_epi16(_mm256_cvtepu8_epi16(c1), loss), shift));
+				}
+				else {
+					p[0] = _mm256_or_si256(p[0], _mm256_sll_epi32(_mm256_srl_epi32(_mm256_cvtepu8_epi32(c0), loss), shift));
+					p[1] = _mm256_or_si256(p[1], _mm256_sll_epi32(_mm256_srl_epi32(_mm256_cvtepu8_epi32(_mm_srli_si128(c0, 8)), loss), shift));
+					p[2] = _mm256_or_si256(p[2], _mm256_sll_epi32(_mm256_srl_epi32(_mm256_cvtepu8_epi32(c1), loss), shift));
+					p[3] = _mm256_or_si256(p[3], _mm256_sll_epi32(_mm256_srl_epi32(_mm256_cvtepu8_epi32(_mm_srli_si128(c1, 8)), loss), shift));
+				}
+			}
+		}
+		if (bpp == 2) {
+			if (scale == 1) {
+				_mm256_storeu_si256((__m256i *)out, p[0]);
+				_mm256_storeu_si256((__m256i *)(out + 32), p[1]);
+			}
+			else {
+				for (i = 0; i < 2; i++) {
+					YUVStore2x_AVX2(out + 64 * i, pitch,
+						_mm256_unpacklo_epi16(p[i], p[i]), _mm256_unpackhi_epi16(p[i], p[i]));
+				}
+			}
+		}
+		else if (bpp == 4) {
+			if (scale == 1) {
+				for (i = 0; i < 4; i++) {
+					_mm256_storeu_si256((__m256i *)(out + 32 * i), p[i]);
+				}
+			}
+			else {
+				for (i = 0; i < 4; i++) {
+					YUVStore2x_AVX2(out + 64 * i, pitch,
+						_mm256_unpacklo_epi32(p[i], p[i]), _mm256_unpackhi_epi32(p[i], p[i]));
+				}
+			}
+		}
+		else {
+			__m256i tmp[8];
+
+			if (scale == 1) {
+				for (i = 0; i < 4; i++) {
+					_mm256_storeu_si256(&tmp[i], p[i]);
+				}
+				YUVPut24(out, (const Uint32 *)tmp, 32);
+			}
+			else {
+				for (i = 0; i < 4; i++) {
+					__m256i lo = _mm256_unpacklo_epi32(p[i], p[i]);
+					__m256i hi = _mm256_unpackhi_epi32(p[i], p[i]);
+					_mm256_storeu_si256(&tmp[2 * i], _mm256_permute2x128_si256(lo, hi, 0x20));
+					_mm256_storeu_si256(&tmp[2 * i + 1], _mm256_permute2x128_si256(lo, hi, 0x31));
+				}
+				YUVPut24(out, (const Uint32 *)tmp, 64);
+				YUVPut24(out + pitch, (const Uint32 *)tmp, 64);
+			}
+		}
+	}
+
+	static YUV_INLINE TARGET_AVX2 void
+		ColorYV12Rows_AVX2(const YUVFixed *fx,
+		const unsigned char *lum, const unsigned char *lum2,
+		const unsigned char *cr, const unsigned char *cb,
+		unsigned char *row1, unsigned char *row2,
+		int cols, int bpp, int scale, int pitch)
+	{
+		const __m256i bias = _mm256_set1_epi16(128);
+		int x;
+
+		for (x = 0; x < cols; x += 32) {
+			__m256i vr = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(cr + x / 2))), bias);
+			__m256i vb = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(cb + x / 2))), bias);
+			__m256i sr = _mm256_srai_epi16(vr, 15);
+			__m256i sb = _mm256_srai_epi16(vb, 15);
+			__m256i ar = _mm256_abs_epi16(vr);
+			__m256i ab = _mm256_abs_epi16(vb);
+			__m256i tr = YUVTerm_AVX2(ar, sr, fx, 0);
+			__m256i tg = _mm256_add_epi16(YUVTerm_AVX2(ar, sr, fx, 1), YUVTerm_AVX2(ab, sb, fx, 2));
+			__m256i tb = YUVTerm_AVX2(ab, sb, fx, 3);
+			__m256i t[6];
+
+			t[0] = _mm256_unpacklo_epi16(tr, tr);
+			t[1] = _mm256_unpackhi_epi16(tr, tr);
+			t[2] = _mm256_unpacklo_epi16(tg, tg);
+			t[3] = _mm256_unpackhi_epi16(tg, tg);
+			t[4] = _mm256_unpacklo_epi16(tb, tb);
+			t[5] = _mm256_unpackhi_epi16(tb, tb);
+			YUVPixels_AVX2(fx, lum + x, t, row1 + x * scale * bpp, bpp, scale, pitch);
+			YUVPixels_AVX2(fx, lum2 + x, t, row2 + x * scale * bpp, bpp, scale, pitch);
+		}
+	}
+
+	DEFINE_YV12_BLITTERS(AVX2, TARGET_AVX2, 32)
+#endif
+
+#if HAVE_NEON_YUV
+	static YUV_INLINE int16x8_t
+		YUVTerm_NEON(uint16x8_t a, uint16x8_t s, const YUVFixed *fx, int j)
+	{
+		const uint16x4_t frac = vdup_n_u16(fx->frac[j]);
+		uint16x8_t u = vaddq_u16(vmulq_n_u16(a, fx->ip[j]),
+			vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(a), frac), 16),
+			vshrn_n_u32(vmull_u16(vget_high_u16(a), frac), 16)));
+		int16x8_t v = vreinterpretq_s16_u16(u);
+
+		return vbslq_s16(veorq_u16(s, vdupq_n_u16(fx->neg[j])), vnegq_s16(v), v);
+	}
+
+	/* 16 pixels of a row, t holds the chroma terms of pixels 0-7 and 8-15 for r, g and b */
+	static YUV_INLINE void
+		YUVPixels_NEON(const YUVFixed *fx, const unsigned char *lum, const int16x8_t *t,
+		unsigned char *out, int bpp, int scale, int pitch)
+	{
+		uint8x16_t l = vld1q_u8(lum);
+		int16x8_t ll = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(l)));
+		int16x8_t lh = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(l)));
+		uint8x16_t c[3];
+		uint16x8_t p16[2];
+		uint32x4_t p32[4];
+		Uint32 tmp[32];
+		int i, j;
+
+		for (j = 0; j < 3; j++) {
+			c[j] = vcombine_u8(vqmovun_s16(vaddq_s16(ll, t[2 * j])), vqmovun_s16(vaddq_s16(lh, t[2 * j + 1])));
+		}
+		if (bpp != 2 && fx->order) {
+			/* whole bytes, the interleaving stores lay them out */
+			const uint8x16_t lo = fx->order == 1 ? c[0] : c[2];
+			const uint8x16_t hi = fx->order == 1 ? c[2] : c[0];
+
+			if (scale == 1) {
+				if (bpp == 4) {
+					uint8x16x4_t q = { { lo, c[1], hi, vdupq_n_u8(0) } };
+					vst4q_u8(out, q);
+				}
+				else {
+					uint8x16x3_t q = { { lo, c[1], hi } };
+					vst3q_u8(out, q);
+				}
+				return;
+			}
+			{
+				uint8x16x2_t dlo = vzipq_u8(lo, lo);
+				uint8x16x2_t dg = vzipq_u8(c[1], c[1]);
+				uint8x16x2_t dhi = vzipq_u8(hi, hi);
+
+				for (i = 0; i < 2; i++) {
+					if (bpp == 4) {
+						uint8x16x4_t q = { { dlo.val[i], dg.val[i], dhi.val[i], vdupq_n_u8(0) } };
+						vst4q_u8(out + 64 * i, q);
+						vst4q_u8(out + pitch + 64 * i, q);
+					}
+					else {
+						uint8x16x3_t q = { { dlo.val[i], dg.val[i], dhi.val[i] } };
+						vst3q_u8(out + 48 * i, q);
+						vst3q_u8(out + pitch + 48 * i, q);
+					}
+				}
+			}
+			return;
+		}
+
+		for (i = 0; i < 2; i++) {
+			p16[i] = vdupq_n_u16(0);
+		}
+		for (i = 0; i < 4; i++) {
+			p32[i] = vdupq_n_u32(0);
+		}
+		for (j = 0; j < 3; j++) {
+			const int16x8_t loss = vdupq_n_s16((short)-fx->loss[j]);
+			uint16x8_t v[2];
+
+			v[0] = vshlq_u16(vmovl_u8(vget_low_u8(c[j])), loss);
+			v[1] = vshlq_u16(vmovl_u8(vget_high_u8(c[j])), loss);
+			if (bpp == 2) {
+				const int16x8_t shift = vdupq_n_s16((short)fx->shift[j]);
+				for (i = 0; i < 2; i++) {
+					p16[i] = vorrq_u16(p16[i], vshlq_u16(v[i], shift));
+				}
+			}
+			else {
+				const int32x4_t shift = vdupq_n_s32(fx->shift[j]);
+				for (i = 0; i < 2; i++) {
+					p32[2 * i] = vorrq_u32(p32[2 * i], vshlq_u32(vmovl_u16(vget_low_u16(v[i])), shift));
+					p32[2 * i + 1] = vorrq_u32(p32[2 * i + 1], vshlq_u32(vmovl_u16(vget_high_u16(v[i])), shift));
+				}
+			}
+		}
+		if (bpp == 2) {
+			if (scale == 1) {
+				vst1q_u16((uint16_t *)out, p16[0]);
+				vst1q_u16((uint16_t *)(out + 16), p16[1]);
+			}
+			else {
+				/* the interleaving stores write each pixel twice */
+				for (i = 0; i < 2; i++) {
+					uint16x8x2_t d = { { p16[i], p16[i] } };
+					vst2q_u16((uint16_t *)(out + 32 * i), d);
+					vst2q_u16((uint16_t *)(out + pitch + 32 * i), d);
+				}
+			}
+		}
+		else if (bpp == 4) {
+			if (scale == 1) {
+				for (i = 0; i < 4; i++) {
+					vst1q_u32((uint32_t *)(out + 16 * i), p32[i]);
+				}
+			}
+			else {
+				for (i = 0; i < 4; i++) {
+					uint32x4x2_t d = { { p32[i], p32[i] } };
+					vst2q_u32((uint32_t *)(out + 32 * i), d);
+					vst2q_u32((uint32_t *)(out + pitch + 32 * i), d);
+				}
+			}
+		}
+		else {
+			if (scale == 1) {
+				for (i = 0; i < 4; i++) {
+					vst1q_u32(&tmp[4 * i], p32[i]);
+				}
+				YUVPut24(out, tmp, 16);
+			}
+			else {
+				for (i = 0; i < 4; i++) {
+					uint32x4x2_t d = { { p32[i], p32[i] } };
+					vst2q_u32(&tmp[8 * i], d);
+				}
+				YUVPut24(out, tmp, 32);
+				YUVPut24(out + pitch, tmp, 32);
+			}
+		}
+	}
+
+	static YUV_INLINE void
+		ColorYV12Rows_NEON(const YUVFixed *fx,
+		const unsigned char *lum, const unsigned char *lum2,
+		const unsigned char *cr, const unsigned char *cb,
+		unsigned char *row1, unsigned char *row2,
+		int cols, int bpp, int scale, int pitch)
+	{
+		const int16x8_t bias = vdupq_n_s16(128);
+		int x;
+
+		for (x = 0; x < cols; x += 16) {
+			int16x8_t vr = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(cr + x / 2))), bias);
+			int16x8_t vb = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(cb + x / 2))), bias);
+			uint16x8_t sr = vcltq_s16(vr, vdupq_n_s16(0));
+			uint16x8_t sb = vcltq_s16(vb, vdupq_n_s16(0));
+			uint16x8_t ar = vreinterpretq_u16_s16(vabsq_s16(vr));
+			uint16x8_t ab = vreinterpretq_u16_s16(vabsq_s16(vb));
+			int16x8_t tr = YUVTerm_NEON(ar, sr, fx, 0);
+			int16x8_t tg = vaddq_s16(YUVTerm_NEON(ar, sr, fx, 1), YUVTerm_NEON(ab, sb, fx, 2));
+			int16x8_t tb = YUVTerm_NEON(ab, sb, fx, 3);
+			int16x8x2_t zr = vzipq_s16(tr, tr);
+			int16x8x2_t zg = vzipq_s16(tg, tg);
+			int16x8x2_t zb = vzipq_s16(tb, tb);
+			int16x8_t t[6] = { zr.val[0], zr.val[1], zg.val[0], zg.val[1], zb.val[0], zb.val[1] };
+
+			YUVPixels_NEON(fx, lum + x, t, row1 + x * scale * bpp, bpp, scale, pitch);
+			YUVPixels_NEON(fx, lum2 + x, t, row2 + x * scale * bpp, bpp, scale, pitch);
+		}
+	}
+
+	DEFINE_YV12_BLITTERS(NEON, , 16)
+#endif
+
+	/* best first, CreateYUV_SW takes the first one the CPU supports */
+	const SDL_YUVBlitters sdl_yv12_blitters[] =
+	{
+#if HAVE_AVX2_YUV
+		{ 2, CPU_HAS_AVX2, Color16YV12Mod1X_AVX2, Color16YV12Mod2X_AVX2 },
+		{ 3, CPU_HAS_AVX2, Color24YV12Mod1X_AVX2, Color24YV12Mod2X_AVX2 },
+		{ 4, CPU_HAS_AVX2, Color32YV12Mod1X_AVX2, Color32YV12Mod2X_AVX2 },
+#endif
+#if HAVE_SSE2_YUV
+		{ 2, CPU_HAS_SSE2, Color16YV12Mod1X_SSE2, Color16YV12Mod2X_SSE2 },
+		{ 3, CPU_HAS_SSE2, Color24YV12Mod1X_SSE2, Color24YV12Mod2X_SSE2 },
+		{ 4, CPU_HAS_SSE2, Color32YV12Mod1X_SSE2, Color32YV12Mod2X_SSE2 },
+#endif
+#if HAVE_NEON_YUV
+		{ 2, CPU_HAS_NEON, Color16YV12Mod1X_NEON, Color16YV12Mod2X_NEON },
+		{ 3, CPU_HAS_NEON, Color24YV12Mod1X_NEON, Color24YV12Mod2X_NEON },
+		{ 4, CPU_HAS_NEON, Color32YV12Mod1X_NEON, Color32YV12Mod2X_NEON },
+#endif
+		{ 2, 0, Color16DitherYV12Mod1X, Color16DitherYV12Mod2X },
+		{ 3, 0, Color24DitherYV12Mod1X, Color24DitherYV12Mod2X },
+		{ 4, 0, Color32DitherYV12Mod1X, Color32DitherYV12Mod2X },
+		{ 0, 0, NULL, NULL }
+	};
+
+	static void Color16DitherYUY2Mod1X(int *colortab, Uint32 *rgb_2_pix, const YUVFixed *fit,
 		unsigned char *lum, unsigned char *cr,
 		unsigned char *cb, unsigned char *out,
 		int rows, int cols, int mod)
@@ -582,7 +1326,7 @@ namespace ff{
 	* 16 bits replicated in the upper 16. This means I can write ints and get
 	* the horisontal doubling for free (almost).
 	*/
-	static void Color16DitherYUY2Mod2X(int *colortab, Uint32 *rgb_2_pix,
+	static void Color16DitherYUY2Mod2X(int *colortab, Uint32 *rgb_2_pix, const YUVFixed *fit,
 		unsigned char *lum, unsigned char *cr,
 		unsigned char *cb, unsigned char *out,
 		int rows, int cols, int mod)
@@ -622,12 +1366,12 @@ namespace ff{
 				row++;
 
 			}
-			row += next_row;
+			row += next_row + mod / 2;
 		}
 	}
 
 
-	static void Color24DitherYUY2Mod1X(int *colortab, Uint32 *rgb_2_pix,
+	static void Color24DitherYUY2Mod1X(int *colortab, Uint32 *rgb_2_pix, const YUVFixed *fit,
 		unsigned char *lum, unsigned char *cr,
 		unsigned char *cb, unsigned char *out,
 		int rows, int cols, int mod)
@@ -677,7 +1421,7 @@ namespace ff{
 		}
 	}
 
-	static void Color24DitherYUY2Mod2X(int *colortab, Uint32 *rgb_2_pix,
+	static void Color24DitherYUY2Mod2X(int *colortab, Uint32 *rgb_2_pix, const YUVFixed *fit,
 		unsigned char *lum, unsigned char *cr,
 		unsigned char *cb, unsigned char *out,
 		int rows, int cols, int mod)
@@ -729,11 +1473,11 @@ namespace ff{
 				row += 2 * 3;
 
 			}
-			row += next_row;
+			row += next_row + mod * 3;
 		}
 	}
 
-	static void Color32DitherYUY2Mod1X(int *colortab, Uint32 *rgb_2_pix,
+	static void Color32DitherYUY2Mod1X(int *colortab, Uint32 *rgb_2_pix, const YUVFixed *fit,
 		unsigned char *lum, unsigned char *cr,
 		unsigned char *cb, unsigned char *out,
 		int rows, int cols, int mod)
@@ -776,7 +1520,7 @@ namespace ff{
 		}
 	}
 
-	static void Color32DitherYUY2Mod2X(int *colortab, Uint32 *rgb_2_pix,
+	static void Color32DitherYUY2Mod2X(int *colortab, Uint32 *rgb_2_pix, const YUVFixed *fit,
 		unsigned char *lum, unsigned char *cr,
 		unsigned char *cb, unsigned char *out,
 		int rows, int cols, int mod)
@@ -788,7 +1532,6 @@ namespace ff{
 		int crb_g;
 		int cb_b;
 		int cols_2 = cols / 2;
-		mod += mod;
 		y = rows;
 		while (y--)
 		{
@@ -820,7 +1563,7 @@ namespace ff{
 
 			}
 
-			row += next_row;
+			row += next_row + mod;
 		}
 	}
 	/* The functions used to manipulate software video overlays */
@@ -830,325 +1573,329 @@ namespace ff{
 		DisplayYUV_SW,
 		FreeYUV_SW
 	};
-	/* USE_ASM_STRETCH  */
-	//#define USE_ASM_STRETCH
-#ifdef USE_ASM_STRETCH
-
-#ifdef HAVE_MPROTECT
-#include <sys/types.h>
-#include <sys/mman.h>
-#endif
-#ifdef __GNUC__
-#define PAGE_ALIGNED __attribute__((__aligned__(4096)))
-#else
-#define PAGE_ALIGNED
-#endif
-
-#if defined(_M_IX86) || defined(i386)
-#define PREFIX16	0x66
-#define STORE_BYTE	0xAA
-#define STORE_WORD	0xAB
-#define LOAD_BYTE	0xAC
-#define LOAD_WORD	0xAD
-#define RETURN		0xC3
-#else
-#error Need assembly opcodes for this architecture
-#endif
-
-	static unsigned char copy_row[4096] PAGE_ALIGNED;
-
-	static int generate_rowbytes(int src_w, int dst_w, int bpp)
-	{
-		static struct {
-			int bpp;
-			int src_w;
-			int dst_w;
-			int status;
-		} last;
-
-		int i;
-		int pos, inc;
-		unsigned char *eip, *fence;
-		unsigned char load, store;
-
-		/* See if we need to regenerate the copy buffer */
-		if ((src_w == last.src_w) &&
-			(dst_w == last.dst_w) && (bpp == last.bpp)) {
-			return(last.status);
-		}
-		last.bpp = bpp;
-		last.src_w = src_w;
-		last.dst_w = dst_w;
-		last.status = -1;
-
-		switch (bpp) {
-		case 1:
-			load = LOAD_BYTE;
-			store = STORE_BYTE;
-			break;
-		case 2:
-		case 4:
-			load = LOAD_WORD;
-			store = STORE_WORD;
-			break;
-		default:
-			SDLog("ASM stretch of %d bytes isn't supported\n");
-			return(-1);
-		}
-#ifdef HAVE_MPROTECT
-		/* Make the code writeable */
-		if (mprotect(copy_row, sizeof(copy_row), PROT_READ | PROT_WRITE) < 0) {
-			SDLog("Couldn't make copy buffer writeable");
-			return(-1);
-		}
-#endif
-		pos = 0x10000;
-		inc = (src_w << 16) / dst_w;
-		eip = copy_row;
-		fence = copy_row + sizeof(copy_row) - 2;
-		for (i = 0; i<dst_w && eip < end; ++i) {
-			while (pos >= 0x10000L) {
-				if (eip == fence) {
-					return -1;
-				}
-				if (bpp == 2) {
-					*eip++ = PREFIX16;
-				}
-				*eip++ = load;
-				pos -= 0x10000L;
-			}
-			if (eip == fence) {
-				return -1;
-			}
-			if (bpp == 2) {
-				*eip++ = PREFIX16;
-			}
-			*eip++ = store;
-			pos += inc;
-		}
-		*eip++ = RETURN;
-
-#ifdef HAVE_MPROTECT
-		/* Make the code executable but not writeable */
-		if (mprotect(copy_row, sizeof(copy_row), PROT_READ | PROT_EXEC) < 0) {
-			SDLog("Couldn't make copy buffer executable");
-			return(-1);
-		}
-#endif
-		last.status = 0;
-		return(0);
-	}
-
-#endif /* USE_ASM_STRETCH */
-
-#define DEFINE_COPY_ROW(name, type)			\
-void name(type *src, int src_w, type *dst, int dst_w)	\
-		{							\
-	int i;						\
-	int pos, inc;					\
-	type pixel = 0;					\
-							\
-	pos = 0x10000;					\
-	inc = (src_w << 16) / dst_w;			\
-	for ( i=dst_w; i>0; --i ) {			\
-			while ( pos >= 0x10000L ) {		\
-			pixel = *src++;			\
-			pos -= 0x10000L;		\
-					}					\
-		*dst++ = pixel;				\
-		pos += inc;				\
-		}						\
-		}
-	DEFINE_COPY_ROW(copy_row1, Uint8)
-		DEFINE_COPY_ROW(copy_row2, Uint16)
-		DEFINE_COPY_ROW(copy_row4, Uint32)
-
-		/* The ASM code doesn't handle 24-bpp stretch blits */
-		void copy_row3(Uint8 *src, int src_w, Uint8 *dst, int dst_w)
-	{
-		int i;
-		int pos, inc;
-		Uint8 pixel[3] = { 0, 0, 0 };
-
-		pos = 0x10000;
-		inc = (src_w << 16) / dst_w;
-		for (i = dst_w; i>0; --i) {
-			while (pos >= 0x10000L) {
-				pixel[0] = *src++;
-				pixel[1] = *src++;
-				pixel[2] = *src++;
-				pos -= 0x10000L;
-			}
-			*dst++ = pixel[0];
-			*dst++ = pixel[1];
-			*dst++ = pixel[2];
-			pos += inc;
-		}
-	}
+	/*
+	* DisplayYUV_SW splits the output in horizontal bands, the caller
+	* converts one and the workers of the overlay the others. Small frames
+	* are converted by the caller alone.
+	*/
+#define YUV_MAX_BANDS 8
+#define YUV_BAND_PIXELS (256 * 1024)	/* output pixels worth a band of their own */
 
-	/* Perform a stretch blit between two surfaces of the same format.
-	NOTE:  This function is not safe to call from multiple threads!
-	*/
-	static int SoftStretch(Surface *src, Rect *srcrect,
-		Surface *dst, Rect *dstrect)
-	{
-		int src_locked;
-		int dst_locked;
-		int pos, inc;
-		int dst_maxrow;
-		int src_row, dst_row;
-		Uint8 *srcp = NULL;
-		Uint8 *dstp;
-		Rect full_src;
-		Rect full_dst;
-#ifdef USE_ASM_STRETCH
-		bool use_asm = true;
-#ifdef __GNUC__
-		int u1, u2;
-#endif
-#endif /* USE_ASM_STRETCH */
-		const int bpp = dst->format->BytesPerPixel;
-
-		if (src->format->BitsPerPixel != dst->format->BitsPerPixel) {
-			SDLog("Only works with same format surfaces");
-			return(-1);
-		}
-
-		/* Verify the blit rectangles */
-		if (srcrect) {
-			if ((srcrect->x < 0) || (srcrect->y < 0) ||
-				((srcrect->x + srcrect->w) > src->w) ||
-				((srcrect->y + srcrect->h) > src->h)) {
-				SDLog("Invalid source blit rectangle");
-				return(-1);
-			}
-		}
-		else {
-			full_src.x = 0;
-			full_src.y = 0;
-			full_src.w = src->w;
-			full_src.h = src->h;
-			srcrect = &full_src;
-		}
-		if (dstrect) {
-			if ((dstrect->x < 0) || (dstrect->y < 0) ||
-				((dstrect->x + dstrect->w) > dst->w) ||
-				((dstrect->y + dstrect->h) > dst->h)) {
-				SDLog("Invalid destination blit rectangle");
-				return(-1);
-			}
-		}
-		else {
-			full_dst.x = 0;
-			full_dst.y = 0;
-			full_dst.w = dst->w;
-			full_dst.h = dst->h;
-			dstrect = &full_dst;
-		}
-
-		/* Lock the destination if it's in hardware */
-		dst_locked = 0;
-		if (MUSTLOCK(dst)) {
-			if (LockSurface(dst) < 0) {
-				SDLog("Unable to lock destination surface");
-				return(-1);
-			}
-			dst_locked = 1;
-		}
-		/* Lock the source if it's in hardware */
-		src_locked = 0;
-		if (MUSTLOCK(src)) {
-			if (LockSurface(src) < 0) {
-				if (dst_locked) {
-					UnlockSurface(dst);
-				}
-				SDLog("Unable to lock source surface");
-				return(-1);
-			}
-			src_locked = 1;
-		}
-
-		/* Set up the data... */
-		pos = 0x10000;
-		inc = (srcrect->h << 16) / dstrect->h;
-		src_row = srcrect->y;
-		dst_row = dstrect->y;
-
-#ifdef USE_ASM_STRETCH
-		/* Write the opcodes for this stretch */
-		if ((bpp == 3) ||
-			(generate_rowbytes(srcrect->w, dstrect->w, bpp) < 0)) {
-			use_asm = false;
-		}
-#endif
-
-		/* Perform the stretch blit */
-		for (dst_maxrow = dst_row + dstrect->h; dst_row<dst_maxrow; ++dst_row) {
-			dstp = (Uint8 *)dst->pixels + (dst_row*dst->pitch)
-				+ (dstrect->x*bpp);
-			while (pos >= 0x10000L) {
-				srcp = (Uint8 *)src->pixels + (src_row*src->pitch)
-					+ (srcrect->x*bpp);
-				++src_row;
-				pos -= 0x10000L;
-			}
-#ifdef USE_ASM_STRETCH
-			if (use_asm) {
-#ifdef __GNUC__
-				__asm__ __volatile__(
-					"call *%4"
-					: "=&D" (u1), "=&S" (u2)
-					: "0" (dstp), "1" (srcp), "r" (copy_row)
-					: "memory");
-#elif defined(_MSC_VER) || defined(__WATCOMC__)
-				{ void *code = copy_row;
-				__asm {
-					push edi
-						push esi
-
-						mov edi, dstp
-						mov esi, srcp
-						call dword ptr code
-
-						pop esi
-						pop edi
-				}
-				}
-#else
-#error Need inline assembly for this compiler
-#endif
-			}
-			else
-#endif
-				switch (bpp) {
-				case 1:
-					copy_row1(srcp, srcrect->w, dstp, dstrect->w);
-					break;
-				case 2:
-					copy_row2((Uint16 *)srcp, srcrect->w,
-						(Uint16 *)dstp, dstrect->w);
-					break;
-				case 3:
-					copy_row3(srcp, srcrect->w, dstp, dstrect->w);
-					break;
-				case 4:
-					copy_row4((Uint32 *)srcp, srcrect->w,
-						(Uint32 *)dstp, dstrect->w);
-					break;
-			}
-			pos += inc;
-		}
-
-		/* We need to unlock the surfaces if they're locked */
-		if (dst_locked) {
-			UnlockSurface(dst);
-		}
-		if (src_locked) {
-			UnlockSurface(src);
-		}
-		return(0);
-	}
+	struct YUVWorkers
+	{
+		mutex_t *mutex;
+		cond_t *cond;			/* a new job, a band done or quit */
+		thread_t *threads[YUV_MAX_BANDS - 1];
+		int count;
+		void(*fn)(void *arg, int band, int bands);
+		void *arg;
+		int bands;
+		int next;			/* first band nobody took */
+		int pending;			/* bands not done yet */
+		int quit;
+	};
+
+	static int YUVWorkerThread(void *arg)
+	{
+		YUVWorkers *w = (YUVWorkers *)arg;
+		std::unique_lock<mutex_t> lk(*w->mutex);
+
+		while (!w->quit) {
+			if (w->next < w->bands) {
+				void(*fn)(void *, int, int) = w->fn;
+				void *job = w->arg;
+				int band = w->next++;
+				int bands = w->bands;
+
+				lk.unlock();
+				fn(job, band, bands);
+				lk.lock();
+				if (!--w->pending) {
+					w->cond->notify_all();
+				}
+			}
+			else {
+				w->cond->wait(lk);
+			}
+		}
+		return(0);
+	}
+
+	/* one thread less than the CPUs, the caller converts a band too */
+	static YUVWorkers *YUVCreateWorkers(void)
+	{
+		int n = (int)std::thread::hardware_concurrency() - 1;
+		YUVWorkers *w;
+
+		if (n > YUV_MAX_BANDS - 1) {
+			n = YUV_MAX_BANDS - 1;
+		}
+		if (n < 1) {
+			return(NULL);
+		}
+		w = (YUVWorkers *)malloc(sizeof *w);
+		if (w == NULL) {
+			return(NULL);
+		}
+		memset(w, 0, sizeof *w);
+		w->mutex = createMutex();
+		w->cond = createCond();
+		/* run with the threads that started, count holds only those */
+		while (w->count < n &&
+			(w->threads[w->count] = createThread(YUVWorkerThread, w)) != NULL) {
+			w->count++;
+		}
+		if (w->count == 0) {
+			YUVFreeWorkers(w);
+			return(NULL);
+		}
+		return(w);
+	}
+
+	static void YUVFreeWorkers(YUVWorkers *w)
+	{
+		int i;
+
+		{
+			std::unique_lock<mutex_t> lk(*w->mutex);
+			w->quit = 1;
+			w->cond->notify_all();
+		}
+		for (i = 0; i < w->count; i++) {
+			waitThread(w->threads[i], NULL);
+		}
+		destroyCond(w->cond);
+		destroyMutex(w->mutex);
+		free(w);
+	}
+
+	/* calls fn for bands 0 to bands - 1 and returns once they are all done */
+	static void YUVRunBands(YUVWorkers *w, void(*fn)(void *, int, int), void *arg, int bands)
+	{
+		int band;
+
+		if (!w || bands < 2) {
+			for (band = 0; band < bands; band++) {
+				fn(arg, band, bands);
+			}
+			return;
+		}
+		std::unique_lock<mutex_t> lk(*w->mutex);
+		w->fn = fn;
+		w->arg = arg;
+		w->bands = bands;
+		w->next = 0;
+		w->pending = bands;
+		w->cond->notify_all();
+		while (w->next < w->bands) {
+			band = w->next++;
+			lk.unlock();
+			fn(arg, band, bands);
+			lk.lock();
+			w->pending--;
+		}
+		while (w->pending) {
+			w->cond->wait(lk);
+		}
+	}
+
+	struct YUVBlitJob
+	{
+		struct private_yuvhwdata *swdata;
+		YUVBlitter blit;
+		Uint8 *lum, *Cr, *Cb;
+		int lum_pitch;
+		int chroma_pitch;
+		int chroma_ysub;		/* 2 when two rows share a chroma row */
+		Uint8 *dstp;
+		int dst_pitch;
+		int scale;
+		int w, h, mod;
+	};
+
+	static void YUVBlitBand(void *arg, int band, int bands)
+	{
+		const YUVBlitJob *job = (const YUVBlitJob *)arg;
+		/* on row pairs, the 4:2:0 blitters convert two rows per chroma row */
+		const int pairs = (job->h + 1) / 2;
+		const int y0 = 2 * (pairs * band / bands);
+		const int y1 = band == bands - 1 ? job->h : 2 * (pairs * (band + 1) / bands);
+		const int chroma = y0 / job->chroma_ysub * job->chroma_pitch;
+
+		job->blit(job->swdata->colortab, job->swdata->rgb_2_pix, job->swdata->fit,
+			job->lum + y0 * job->lum_pitch, job->Cr + chroma, job->Cb + chroma,
+			job->dstp + y0 * job->scale * job->dst_pitch, y1 - y0, job->w, job->mod);
+	}
+
+	/* a Y, U or V plane of the overlay, sample x of row y is at pixels[y * pitch + x * step] */
+	struct YUVPlane
+	{
+		const Uint8 *pixels;
+		int step;
+		int pitch;
+		int w, h;
+		int xsub, ysub;
+	};
+
+	struct YUVStretchJob
+	{
+		const int *colortab;
+		const Uint32 *rgb_2_pix;
+		YUVPlane planes[3];		/* Y, Cr, Cb */
+		Rect src, dst;
+		const Uint32 *xmap[2];		/* the luma and chroma positions of each output pixel */
+		Uint16 *rows;			/* a filtered row of each plane per band */
+		int rows_len;
+		Uint8 *dstp;
+		int dst_pitch;
+		int bpp;
+	};
+
+	/*
+	* Position in a plane subsampled by sub of output pixel i of n, which
+	* cover luma pixels start to start + len, as x << 8 | weight of x + 1.
+	* Sample centers line up, the edges repeat.
+	*/
+	static Uint32 YUVFilterPos(int i, int n, int start, int len, int sub, int size)
+	{
+		Sint64 pos = (((Sint64)2 * start * n + (Sint64)(2 * i + 1) * len) << 16) / (2 * n * sub) - 0x8000;
+
+		if (pos < 0) {
+			pos = 0;
+		}
+		if (pos > ((Sint64)(size - 1) << 16)) {
+			pos = (Sint64)(size - 1) << 16;
+		}
+		return (Uint32)(pos >> 8);
+	}
+
+	/* output row y of a plane, filtered vertically, with the last sample repeated once */
+	static void YUVFilterRow(const YUVStretchJob *job, const YUVPlane *plane, int y, Uint16 *row)
+	{
+		const Uint32 pos = YUVFilterPos(y, job->dst.h, job->src.y, job->src.h, plane->ysub, plane->h);
+		const int f = pos & 0xFF;
+		const Uint8 *a = plane->pixels + (pos >> 8) * plane->pitch;
+		const Uint8 *b = (int)(pos >> 8) < plane->h - 1 ? a + plane->pitch : a;
+		int x;
+
+		for (x = 0; x < plane->w; x++) {
+			row[x] = (Uint16)(a[x * plane->step] * (256 - f) + b[x * plane->step] * f);
+		}
+		row[x] = row[x - 1];
+	}
+
+	static YUV_INLINE int YUVFilterPixel(const Uint16 *row, Uint32 pos)
+	{
+		const Uint16 *p = row + (pos >> 8);
+		const int f = pos & 0xFF;
+
+		return (p[0] * (256 - f) + p[1] * f + 0x8000) >> 16;
+	}
+
+	static void YUVStretchBand(void *arg, int band, int bands)
+	{
+		const YUVStretchJob *job = (const YUVStretchJob *)arg;
+		const int y0 = job->dst.h * band / bands;
+		const int y1 = job->dst.h * (band + 1) / bands;
+		Uint16 *lum = job->rows + band * job->rows_len;
+		Uint16 *cr = lum + job->planes[0].w + 1;
+		Uint16 *cb = cr + job->planes[1].w + 1;
+		int x, y;
+
+		for (y = y0; y < y1; y++) {
+			Uint8 *out = job->dstp + y * job->dst_pitch;
+
+			YUVFilterRow(job, &job->planes[0], y, lum);
+			YUVFilterRow(job, &job->planes[1], y, cr);
+			YUVFilterRow(job, &job->planes[2], y, cb);
+			for (x = 0; x < job->dst.w; x++) {
+				int L = YUVFilterPixel(lum, job->xmap[0][x]);
+				int Cr = YUVFilterPixel(cr, job->xmap[1][x]);
+				int Cb = YUVFilterPixel(cb, job->xmap[1][x]);
+				int cr_r = 0 * 768 + 256 + job->colortab[Cr + 0 * 256];
+				int crb_g = 1 * 768 + 256 + job->colortab[Cr + 1 * 256]
+					+ job->colortab[Cb + 2 * 256];
+				int cb_b = 2 * 768 + 256 + job->colortab[Cb + 3 * 256];
+
+				YUVPutPixel(out + x * job->bpp, (job->rgb_2_pix[L + cr_r] |
+					job->rgb_2_pix[L + crb_g] |
+					job->rgb_2_pix[L + cb_b]), job->bpp);
+			}
+		}
+	}
 
+	/*
+	* Converts and scales src of the overlay to dst in one pass, with a
+	* bilinear filter on the planes.
+	*/
+	static int YUVStretch(Overlay *overlay, Surface *display, Uint8 *lum, Uint8 *Cr, Uint8 *Cb,
+		Rect *src, Rect *dst, Uint8 *dstp, int bands)
+	{
+		struct private_yuvhwdata *swdata = overlay->hwdata;
+		const int planar = overlay->format == YV12_OVERLAY || overlay->format == IYUV_OVERLAY;
+		YUVStretchJob job;
+		Uint32 *xmap;
+		int i, size;
+
+		if ((src->x < 0) || (src->y < 0) || (src->w <= 0) || (src->h <= 0) ||
+			((src->x + src->w) > overlay->w) ||
+			((src->y + src->h) > overlay->h)) {
+			SDLog("Invalid source blit rectangle");
+			return(-1);
+		}
+		if ((dst->x < 0) || (dst->y < 0) ||
+			((dst->x + dst->w) > display->w) ||
+			((dst->y + dst->h) > display->h)) {
+			SDLog("Invalid destination blit rectangle");
+			return(-1);
+		}
+		if (dst->w <= 0 || dst->h <= 0) {
+			return(0);
+		}
+
+		job.colortab = swdata->colortab;
+		job.rgb_2_pix = swdata->rgb_2_pix;
+		job.src = *src;
+		job.dst = *dst;
+		job.dstp = dstp;
+		job.dst_pitch = display->pitch;
+		job.bpp = display->format->BytesPerPixel;
+		for (i = 0; i < 3; i++) {
+			YUVPlane *plane = &job.planes[i];
+
+			plane->pixels = i == 0 ? lum : i == 1 ? Cr : Cb;
+			plane->step = planar ? 1 : i == 0 ? 2 : 4;
+			plane->pitch = planar ? overlay->pitches[i == 0 ? 0 : 1] : overlay->pitches[0];
+			plane->xsub = i == 0 ? 1 : 2;
+			plane->ysub = i == 0 || !planar ? 1 : 2;
+			plane->w = overlay->w / plane->xsub;
+			plane->h = overlay->h / plane->ysub;
+		}
+
+		/* the positions and the rows of each band share a buffer kept with the overlay */
+		job.rows_len = job.planes[0].w + 1 + 2 * (job.planes[1].w + 1);
+		size = 2 * dst->w * sizeof(Uint32) + bands * job.rows_len * sizeof(Uint16);
+		if (size > swdata->filter_size) {
+			Uint8 *filter = (Uint8 *)realloc(swdata->filter, size);
+			if (filter == NULL) {
+				//SDL_OutOfMemory();
+				return(-1);
+			}
+			swdata->filter = filter;
+			swdata->filter_size = size;
+		}
+		xmap = (Uint32 *)swdata->filter;
+		for (i = 0; i < dst->w; i++) {
+			xmap[i] = YUVFilterPos(i, dst->w, src->x, src->w, 1, job.planes[0].w);
+			xmap[dst->w + i] = YUVFilterPos(i, dst->w, src->x, src->w, 2, job.planes[1].w);
+		}
+		job.xmap[0] = xmap;
+		job.xmap[1] = xmap + dst->w;
+		job.rows = (Uint16 *)(xmap + 2 * dst->w);
+
+		YUVRunBands(swdata->workers, YUVStretchBand, &job, bands);
+		return(0);
+	}
 	/*
 		SDL_CreateYUV_SW
 	*/
@@ -1211,7 +1958,10 @@ void name(type *src, int src_w, type *dst, int dst_w)	\
 			FreeYUVOverlay(overlay);
 			return(NULL);
 		}
-		swdata->stretch = NULL;
+		swdata->workers = NULL;
+		swdata->filter = NULL;
+		swdata->filter_size = 0;
+		swdata->fit = NULL;
 		swdata->display = display;
 		swdata->pixels = (Uint8 *)malloc(width*height * 2);
 		swdata->colortab = (int *)malloc(4 * 256 * sizeof(int));
@@ -1284,21 +2034,26 @@ void name(type *src, int src_w, type *dst, int dst_w)	\
 			b_2_pix_alloc[i + 512] = b_2_pix_alloc[511];
 		}
 
+		/* the vector blitters take the tables in fixed point, fit once here rather than per blit */
+		swdata->fit = (YUVFixed *)malloc(sizeof(YUVFixed));
+		if (swdata->fit && YUVFitTables(swdata->colortab, swdata->rgb_2_pix,
+			display->format->BytesPerPixel, swdata->fit) < 0) {
+			free(swdata->fit);
+			swdata->fit = NULL;
+		}
+
 		/* You have chosen wisely... */
 		switch (format) {
 		case YV12_OVERLAY:
 		case IYUV_OVERLAY:
-			if (display->format->BytesPerPixel == 2) {
-				swdata->Display1X = Color16DitherYV12Mod1X;
-				swdata->Display2X = Color16DitherYV12Mod2X;
-			}
-			if (display->format->BytesPerPixel == 3) {
-				swdata->Display1X = Color24DitherYV12Mod1X;
-				swdata->Display2X = Color24DitherYV12Mod2X;
-			}
-			if (display->format->BytesPerPixel == 4) {
-				swdata->Display1X = Color32DitherYV12Mod1X;
-				swdata->Display2X = Color32DitherYV12Mod2X;
+			for (i = 0; sdl_yv12_blitters[i].Display1X; i++) {
+				const SDL_YUVBlitters *b = &sdl_yv12_blitters[i];
+				if (b->bytes_per_pixel == display->format->BytesPerPixel &&
+					(b->features & SDL_GetCPUFeatures()) == b->features) {
+					swdata->Display1X = b->Display1X;
+					swdata->Display2X = b->Display2X;
+					break;
+				}
 			}
 			break;
 		case YUY2_OVERLAY:
@@ -1362,16 +2117,16 @@ void name(type *src, int src_w, type *dst, int dst_w)	\
 		Surface *display;
 		Uint8 *lum, *Cr, *Cb;
 		Uint8 *dstp;
-		int mod;
+		int bands;
+		int ret = 0;
 
 		swdata = overlay->hwdata;
 		stretch = 0;
 		scale_2x = 0;
 		if (src->x || src->y || src->w < overlay->w || src->h < overlay->h) {
 			/* The source rectangle has been clipped.
-			Using a scratch surface is easier than adding clipped
-			source support to all the blitters, plus that would
-			slow them down in the general unclipped case.
+			The blitters don't support clipped sources, the stretch
+			filter does.
 			*/
 			stretch = 1;
 		}
@@ -1384,25 +2139,7 @@ void name(type *src, int src_w, type *dst, int dst_w)	\
 				stretch = 1;
 			}
 		}
-		if (stretch) {
-			if (!swdata->stretch) {
-				display = swdata->display;
-				swdata->stretch = CreateRGBSurface(
-					SWSURFACE,
-					overlay->w, overlay->h,
-					display->format->BitsPerPixel,
-					display->format->Rmask,
-					display->format->Gmask,
-					display->format->Bmask, 0);
-				if (!swdata->stretch) {
-					return(-1);
-				}
-			}
-			display = swdata->stretch;
-		}
-		else {
-			display = swdata->display;
-		}
+		display = swdata->display;
 		switch (overlay->format) {
 		case YV12_OVERLAY:
 			lum = overlay->pixels[0];
@@ -1433,43 +2170,62 @@ void name(type *src, int src_w, type *dst, int dst_w)	\
 			SDLog("Unsupported YUV format in blit");
 			return(-1);
 		}
+
+		bands = dst->w * dst->h / YUV_BAND_PIXELS;
+		if (bands > 1 && !swdata->workers) {
+			swdata->workers = YUVCreateWorkers();
+		}
+		if (bands > (swdata->workers ? swdata->workers->count + 1 : 1)) {
+			bands = swdata->workers ? swdata->workers->count + 1 : 1;
+		}
+		if (bands < 1) {
+			bands = 1;
+		}
+
 		if (MUSTLOCK(display)) {
 			if (LockSurface(display) < 0) {
 				return(-1);
 			}
 		}
+		dstp = (Uint8 *)display->pixels
+			+ dst->x * display->format->BytesPerPixel
+			+ dst->y * display->pitch;
+
 		if (stretch) {
-			dstp = (Uint8 *)swdata->stretch->pixels;
+			ret = YUVStretch(overlay, display, lum, Cr, Cb, src, dst, dstp, bands);
 		}
 		else {
-			dstp = (Uint8 *)display->pixels
-				+ dst->x * display->format->BytesPerPixel
-				+ dst->y * display->pitch;
-		}
-		mod = (display->pitch / display->format->BytesPerPixel);
+			YUVBlitJob job;
 
-		if (scale_2x) {
-			mod -= (overlay->w * 2);
-			swdata->Display2X(swdata->colortab, swdata->rgb_2_pix,
-				lum, Cr, Cb, dstp, overlay->h, overlay->w, mod);
-		}
-		else {
-			mod -= overlay->w;
-			swdata->Display1X(swdata->colortab, swdata->rgb_2_pix,
-				lum, Cr, Cb, dstp, overlay->h, overlay->w, mod);
+			job.swdata = swdata;
+			job.blit = scale_2x ? swdata->Display2X : swdata->Display1X;
+			job.lum = lum;
+			job.Cr = Cr;
+			job.Cb = Cb;
+			job.lum_pitch = overlay->pitches[0];
+			if (overlay->format == YV12_OVERLAY || overlay->format == IYUV_OVERLAY) {
+				job.chroma_pitch = overlay->pitches[1];
+				job.chroma_ysub = 2;
+			}
+			else {
+				job.chroma_pitch = overlay->pitches[0];
+				job.chroma_ysub = 1;
+			}
+			job.dstp = dstp;
+			job.dst_pitch = display->pitch;
+			job.scale = scale_2x ? 2 : 1;
+			job.w = overlay->w;
+			job.h = overlay->h;
+			job.mod = display->pitch / display->format->BytesPerPixel - overlay->w * job.scale;
+			YUVRunBands(swdata->workers, YUVBlitBand, &job, bands);
 		}
 		if (MUSTLOCK(display)) {
 			UnlockSurface(display);
 		}
-		
-		if (stretch) {
-			display = swdata->display;
-			SoftStretch(swdata->stretch, src, display, dst);
-		}
-		
+
 		//UpdateRects(display, 1, dst);
 
-		return(0);
+		return(ret);
 	}
 }
 
@@ -72,7 +72,13 @@ namespace ff{
 	//ȼSDL_CreateThread
 	thread_t* createThread(int(*func)(void*), void *p)
 	{
-		return new thread_t(func, p);
+		/* NULL when the thread can't start, as SDL_CreateThread */
+		try {
+			return new thread_t(func, p);
+		}
+		catch (const std::exception &) {
+			return nullptr;
+		}
 	}
 
 	//ȼSDL_WaitThread,ȴ߳̽
@@ -23,6 +23,7 @@
 #if defined(__ANDROID__) || defined(ANDROID)
 #include "SDLImp.h"
 #include "SDLAudioJNI.h"
+#include <chrono>
 
 namespace ff
 {
@@ -30,6 +31,16 @@ namespace ff
     struct PrivateAudioData
     {
     };
+
+	/*
+	* Android_JNI_GetAudioQueuedFrames is a JNI call into the AudioTrack, too
+	*  slow for every callback. It is sampled at most every
+	*  LATENCY_POLL_INTERVAL, in between the last sample is returned.
+	*/
+#define LATENCY_POLL_INTERVAL std::chrono::milliseconds(200)
+	static std::chrono::steady_clock::time_point latencyPolled;
+	static int latencyFrames = -1;
+
 	static int
 		AndroidAUD_OpenDevice(AudioDevice *_this, const char *devname, int iscapture)
 	{
@@ -45,6 +56,8 @@ namespace ff
 			}
 
 			audioDevice = _this;
+			latencyPolled = std::chrono::steady_clock::time_point();
+			latencyFrames = -1;
 
 			test_format = FirstAudioFormat(_this->spec.format);
 			while (test_format != 0) { /* no "UNKNOWN" constant */
@@ -97,6 +110,19 @@ namespace ff
 			return (Uint8 *)Android_JNI_GetAudioBuffer();
 		}
 
+	static double
+		AndroidAUD_GetLatency(AudioDevice *_this)
+	{
+			/* written to the AudioTrack and not played yet */
+			const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+			if (now - latencyPolled >= LATENCY_POLL_INTERVAL) {
+				latencyFrames = Android_JNI_GetAudioQueuedFrames();
+				latencyPolled = now;
+			}
+			return latencyFrames < 0 ? -1 : (double)latencyFrames / _this->spec.freq;
+		}
+
 	static void
 		AndroidAUD_CloseDevice(AudioDevice *_this)
 	{
@@ -118,6 +144,7 @@ namespace ff
 			impl->PlayDevice = AndroidAUD_PlayDevice;
 			impl->GetDeviceBuf = AndroidAUD_GetDeviceBuf;
 			impl->CloseDevice = AndroidAUD_CloseDevice;
+			impl->GetLatency = AndroidAUD_GetLatency;
 
 			/* and the capabilities */
 			impl->HasCaptureSupport = 0; /* TODO */
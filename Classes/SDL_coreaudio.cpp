@@ -27,6 +27,8 @@
 #endif
 
 #include <AudioUnit/AudioUnit.h>
+#include <atomic>
+#include <new>
 
 #define DEBUG_COREAUDIO 0
 namespace ff{
@@ -37,12 +39,16 @@ namespace ff{
         void *buffer;
         UInt32 bufferOffset;
         UInt32 bufferSize;
+        double latency;     /* seconds the hardware adds after the render callback */
+        std::atomic<bool> latency_stale;    /* route or I/O buffer changed, measure again */
+        UInt32 io_frames;   /* frames the render callback was last asked for */
 #if MACOSX_COREAUDIO
         AudioDeviceID deviceID;
 #endif
     };
     
 static void COREAUDIO_CloseDevice(AudioDevice *_this);
+static void remove_latency_listeners(AudioDevice *_this);
 
 #define CHECK_RESULT(msg) \
     if (result != noErr) { \
@@ -271,6 +277,12 @@ outputCallback(void *inRefCon,
     void *ptr;
     UInt32 i;
 
+    /* the I/O buffer size changed */
+    if (inNumberFrames != _this->hidden->io_frames) {
+        _this->hidden->io_frames = inNumberFrames;
+        _this->hidden->latency_stale.store(true, std::memory_order_relaxed);
+    }
+
     /* Only do anything if audio is enabled and not paused */
     if (!_this->enabled || _this->paused) {
         for (i = 0; i < ioData->mNumberBuffers; i++) {
@@ -345,6 +357,8 @@ COREAUDIO_CloseDevice(AudioDevice *_this)
                 ((iscapture) ? kAudioUnitScope_Output :
                  kAudioUnitScope_Input);
 
+            remove_latency_listeners(_this);
+
             /* stop processing the audio unit */
             result = AudioOutputUnitStop(_this->hidden->audioUnit);
 
@@ -364,12 +378,132 @@ COREAUDIO_CloseDevice(AudioDevice *_this)
             _this->hidden->audioUnitOpened = 0;
         }
         free(_this->hidden->buffer);
-        free(_this->hidden);
+        delete _this->hidden;
         _this->hidden = NULL;
     }
 }
 
 
+#if MACOSX_COREAUDIO
+/* the device latency and safety offset, and one I/O buffer */
+static const AudioObjectPropertySelector latency_selectors[] = {
+    kAudioDevicePropertyLatency,
+    kAudioDevicePropertySafetyOffset,
+    kAudioDevicePropertyBufferFrameSize
+};
+#endif
+
+static double
+output_latency(AudioDevice *_this)
+{
+#if MACOSX_COREAUDIO
+    AudioObjectPropertyAddress addr = {
+        0,
+        kAudioDevicePropertyScopeOutput,
+        kAudioObjectPropertyElementMaster
+    };
+    UInt32 frames = 0, value, size, i;
+
+    for (i = 0; i < SDL_arraysize(latency_selectors); i++) {
+        addr.mSelector = latency_selectors[i];
+        size = sizeof(value);
+        if (AudioObjectGetPropertyData(_this->hidden->deviceID, &addr, 0, NULL,
+                                       &size, &value) == kAudioHardwareNoError)
+            frames += value;
+    }
+    return (double) frames / _this->spec.freq;
+#else
+    Float32 latency = 0, duration = 0;
+    UInt32 size;
+
+    size = sizeof(latency);
+    AudioSessionGetProperty(kAudioSessionProperty_CurrentHardwareOutputLatency,
+                            &size, &latency);
+    size = sizeof(duration);
+    AudioSessionGetProperty(kAudioSessionProperty_CurrentHardwareIOBufferDuration,
+                            &size, &duration);
+    return latency + duration;
+#endif
+}
+
+/*
+ * The latency is measured again, on the render thread, after the route,
+ * the device latency or the I/O buffer size changed. The listeners only
+ * flag it: they run on a notification thread.
+ */
+#if MACOSX_COREAUDIO
+static OSStatus
+latency_listener(AudioObjectID inObjectID, UInt32 inNumberAddresses,
+                 const AudioObjectPropertyAddress inAddresses[], void *inClientData)
+{
+    AudioDevice *_this = (AudioDevice *) inClientData;
+
+    _this->hidden->latency_stale.store(true, std::memory_order_relaxed);
+    return noErr;
+}
+#else
+static void
+latency_listener(void *inClientData, AudioSessionPropertyID inID,
+                 UInt32 inDataSize, const void *inData)
+{
+    AudioDevice *_this = (AudioDevice *) inClientData;
+
+    _this->hidden->latency_stale.store(true, std::memory_order_relaxed);
+}
+#endif
+
+static void
+add_latency_listeners(AudioDevice *_this)
+{
+#if MACOSX_COREAUDIO
+    AudioObjectPropertyAddress addr = {
+        0,
+        kAudioDevicePropertyScopeOutput,
+        kAudioObjectPropertyElementMaster
+    };
+    UInt32 i;
+
+    for (i = 0; i < SDL_arraysize(latency_selectors); i++) {
+        addr.mSelector = latency_selectors[i];
+        AudioObjectAddPropertyListener(_this->hidden->deviceID, &addr,
+                                       latency_listener, _this);
+    }
+#else
+    AudioSessionAddPropertyListener(kAudioSessionProperty_AudioRouteChange,
+                                    latency_listener, _this);
+#endif
+}
+
+static void
+remove_latency_listeners(AudioDevice *_this)
+{
+#if MACOSX_COREAUDIO
+    AudioObjectPropertyAddress addr = {
+        0,
+        kAudioDevicePropertyScopeOutput,
+        kAudioObjectPropertyElementMaster
+    };
+    UInt32 i;
+
+    for (i = 0; i < SDL_arraysize(latency_selectors); i++) {
+        addr.mSelector = latency_selectors[i];
+        AudioObjectRemovePropertyListener(_this->hidden->deviceID, &addr,
+                                          latency_listener, _this);
+    }
+#else
+    AudioSessionRemovePropertyListenerWithUserData(kAudioSessionProperty_AudioRouteChange,
+                                                   latency_listener, _this);
+#endif
+}
+
+static double
+COREAUDIO_GetLatency(AudioDevice *_this)
+{
+    if (_this->hidden->latency_stale.exchange(false, std::memory_order_relaxed))
+        _this->hidden->latency = output_latency(_this);
+    return _this->hidden->latency;
+}
+
 static int
 prepare_audiounit(AudioDevice *_this, const char *devname, int iscapture,
                   const AudioStreamBasicDescription * strdesc)
@@ -461,6 +595,20 @@ prepare_audiounit(AudioDevice *_this, const char *devname, int iscapture,
     _this->hidden->bufferOffset = _this->hidden->bufferSize = _this->spec.size;
     _this->hidden->buffer = malloc(_this->hidden->bufferSize);
 
+#if !MACOSX_COREAUDIO
+    /* render no more than a buffer at a time, for small buffers */
+    {
+        Float32 duration = 0, wanted = (Float32) _this->spec.samples / _this->spec.freq;
+        UInt32 size = sizeof(duration);
+
+        AudioSessionGetProperty(kAudioSessionProperty_CurrentHardwareIOBufferDuration,
+                                &size, &duration);
+        if (wanted < duration)
+            AudioSessionSetProperty(kAudioSessionProperty_PreferredHardwareIOBufferDuration,
+                                    sizeof(wanted), &wanted);
+    }
+#endif
+
     result = AudioUnitInitialize(_this->hidden->audioUnit);
     CHECK_RESULT("AudioUnitInitialize");
 
@@ -468,6 +616,9 @@ prepare_audiounit(AudioDevice *_this, const char *devname, int iscapture,
     result = AudioOutputUnitStart(_this->hidden->audioUnit);
     CHECK_RESULT("AudioOutputUnitStart");
 
+    _this->hidden->latency = output_latency(_this);
+    add_latency_listeners(_this);
+
     /* We're running! */
     return 1;
 }
@@ -481,12 +632,11 @@ COREAUDIO_OpenDevice(AudioDevice *_this, const char *devname, int iscapture)
     int valid_datatype = 0;
 
     /* Initialize all variables that we clean on shutdown */
-    _this->hidden = (struct PrivateAudioData *)
-        malloc((sizeof *_this->hidden));
+    /* value-initialized: zeroed, with its atomic constructed */
+    _this->hidden = new (std::nothrow) PrivateAudioData();
     if (_this->hidden == NULL) {
         return OutOfMemory();
     }
-    memset(_this->hidden, 0, (sizeof *_this->hidden));
 
     /* Setup a AudioStreamBasicDescription with the requested format */
     memset(&strdesc, '\0', sizeof(AudioStreamBasicDescription));
@@ -547,6 +697,7 @@ COREAUDIO_Init(AudioDriverImpl * impl)
     /* Set the function pointers */
     impl->OpenDevice = COREAUDIO_OpenDevice;
     impl->CloseDevice = COREAUDIO_CloseDevice;
+    impl->GetLatency = COREAUDIO_GetLatency;
 
 #if MACOSX_COREAUDIO
     impl->DetectDevices = COREAUDIO_DetectDevices;
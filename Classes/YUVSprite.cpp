@@ -1,30 +1,10 @@
 /*
- * 用来在cocos2dx-x 2.x.x，中直接显示yuv图像
+ * 用来在cocos2d-x 3.x，中直接显示yuv图像
  */
 #include "cocos2d.h"
 #include "YUVSprite.h"
+#include "ff.h"
 
-static double cc_clock()
-{
-    double clock;
-#if CC_TARGET_PLATFORM == CC_PLATFORM_WIN32
-    clock = (double)GetTickCount();
-#else
-    timeval tv;
-    gettimeofday(&tv,NULL);
-    clock = (double)tv.tv_sec*1000.0 + (double)(tv.tv_usec)/1000.0;
-#endif
-    return clock;
-}
-
-#define ATTRIB_VERTEX 3
-#define ATTRIB_TEXTURE 4
-static const GLfloat squareVertices[] = {
-    -1.0f, -1.0f,
-    1.0f, -1.0f,
-    -1.0f,  1.0f,
-    1.0f,  1.0f,
-};
 static const GLfloat coordVertices[] = {
     0.0f,  1.0f,
     1.0f,  1.0f,
@@ -48,20 +28,50 @@ uniform sampler2D tex_v;\n\
 uniform float yborder;\n\
 uniform float uborder;\n\
 uniform float vborder;\n\
+uniform mat3 yuvmatrix;\n\
+uniform vec3 yuvoffset;\n\
 void main(void)\n\
 {\n\
     vec3 yuv;\n\
     vec3 rgb;\n\
     yuv.x = texture2D(tex_y, vec2(TexCoordOut.x*yborder,TexCoordOut.y)).r;\n\
-    yuv.y = texture2D(tex_u, vec2(TexCoordOut.x*uborder,TexCoordOut.y)).r - 0.5;\n\
-    yuv.z = texture2D(tex_v, vec2(TexCoordOut.x*vborder,TexCoordOut.y)).r - 0.5;\n\
-    rgb = mat3( 1,       1,         1,\n\
-               0,       -0.39465,  2.03211,\n\
-               1.13983, -0.58060,  0) * yuv;\n\
+    yuv.y = texture2D(tex_u, vec2(TexCoordOut.x*uborder,TexCoordOut.y)).r;\n\
+    yuv.z = texture2D(tex_v, vec2(TexCoordOut.x*vborder,TexCoordOut.y)).r;\n\
+    rgb = yuvmatrix * (yuv - yuvoffset);\n\
     gl_FragColor = vec4(rgb, 1);\n\
 }";
+/*
+ * yuvmatrix by range then ff::YUVMatrix, columns for y, u and v
+ */
+static const GLfloat _yuvMatrix[2][3][9] = {
+    {   /* y 16-235, u and v 16-240 */
+        { 1.16438f, 1.16438f, 1.16438f, 0, -0.39176f, 2.01723f, 1.59603f, -0.81297f, 0 },   /* BT.601 */
+        { 1.16438f, 1.16438f, 1.16438f, 0, -0.21325f, 2.11240f, 1.79274f, -0.53291f, 0 },   /* BT.709 */
+        { 1.16438f, 1.16438f, 1.16438f, 0, -0.18733f, 2.14177f, 1.67867f, -0.65042f, 0 },   /* BT.2020 */
+    },
+    {   /* full range */
+        { 1, 1, 1, 0, -0.34414f, 1.77200f, 1.40200f, -0.71414f, 0 },
+        { 1, 1, 1, 0, -0.18732f, 1.85560f, 1.57480f, -0.46812f, 0 },
+        { 1, 1, 1, 0, -0.16455f, 1.88140f, 1.47460f, -0.57135f, 0 },
+    },
+};
+static const GLfloat _yuvOffset[2][3] = {
+    { 16.0f/255.0f, 128.0f/255.0f, 128.0f/255.0f },
+    { 0, 128.0f/255.0f, 128.0f/255.0f },
+};
 static const char * _yuv420pShaderName = "yuv420p_shader";
 
+YUVSprite * YUVSprite::create()
+{
+    YUVSprite *sprite = new YUVSprite();
+    if(sprite && sprite->init()){
+        sprite->autorelease();
+        return sprite;
+    }
+    CC_SAFE_DELETE(sprite);
+    return NULL;
+}
+
 YUVSprite * YUVSprite::createWithYUV420P(int w,int h,uint8_t *yuv[3],int linesize[3])
 {
     YUVSprite *sprite = new YUVSprite();
@@ -73,14 +83,15 @@ YUVSprite * YUVSprite::createWithYUV420P(int w,int h,uint8_t *yuv[3],int linesiz
     return NULL;
 }
 
-static double t0;
 YUVSprite::YUVSprite()
 {
     _width = 0;
     _height = 0;
+    _linesize[0] = _linesize[1] = _linesize[2] = 0;
+    _matrix = ff::YUV_MATRIX_BT601;
+    _fullRange = false;
     _prog = NULL;
     textureDone = 0;
-    t0 = cc_clock();
 }
 
 YUVSprite::~YUVSprite()
@@ -89,7 +100,6 @@ YUVSprite::~YUVSprite()
         glDeleteTextures(1,&id_y);
         glDeleteTextures(1,&id_u);
         glDeleteTextures(1,&id_v);
-    //    CCLOG("~YUV %f",cc_clock()-t0);
     }
 }
 
@@ -101,21 +111,20 @@ bool YUVSprite::init()
 bool YUVSprite::initWidthYUV420P(int w,int h,uint8_t *yuv[3],int linesize[3])
 {
     /* 初始化shader program */
-    //double t0 = cc_clock();
-    CCShaderCache * ccsc = CCShaderCache::sharedShaderCache();
+    GLProgramCache * cache = GLProgramCache::getInstance();
     while(1){
-        if(ccsc){
-            _prog = ccsc->programForKey(_yuv420pShaderName);
+        if(cache){
+            _prog = cache->getGLProgram(_yuv420pShaderName);
             if(!_prog){
-                _prog = new CCGLProgram();
+                _prog = new GLProgram();
             
-                if(_prog && _prog->initWithVertexShaderByteArray(_vshader,_fshader) ){
+                if(_prog && _prog->initWithByteArrays(_vshader,_fshader) ){
                     //add attribute
-                    _prog->addAttribute("position", ATTRIB_VERTEX);
-                    _prog->addAttribute("TexCoordIn", ATTRIB_TEXTURE);
+                    _prog->bindAttribLocation("position", GLProgram::VERTEX_ATTRIB_POSITION);
+                    _prog->bindAttribLocation("TexCoordIn", GLProgram::VERTEX_ATTRIB_TEX_COORD);
                     if(_prog->link()){
                         _prog->updateUniforms();
-                        ccsc->addProgram(_prog, _yuv420pShaderName);
+                        cache->addGLProgram(_prog, _yuv420pShaderName);
                         _prog->release();
                         CHECK_GL_ERROR_DEBUG();
                         break;
@@ -125,114 +134,125 @@ bool YUVSprite::initWidthYUV420P(int w,int h,uint8_t *yuv[3],int linesize[3])
                 }else{
                     CCLOG("yuv420p shader program compile failed");
                 }
+                CC_SAFE_RELEASE_NULL(_prog);
             }else break;
         }
         CCLOG("YUVSprite::initWidthYUV420P yuv420p shader program init failed");
         return false;
     }
-    //double t1 = cc_clock();
+    if(!Sprite::init())
+        return false;
+
+    textureUniformY = glGetUniformLocation(_prog->getProgram(), "tex_y");
+    textureUniformU = glGetUniformLocation(_prog->getProgram(), "tex_u");
+    textureUniformV = glGetUniformLocation(_prog->getProgram(), "tex_v");
+    
+    borderUniformY = glGetUniformLocation(_prog->getProgram(), "yborder");
+    borderUniformU = glGetUniformLocation(_prog->getProgram(), "uborder");
+    borderUniformV = glGetUniformLocation(_prog->getProgram(), "vborder");
+
+    matrixUniform = glGetUniformLocation(_prog->getProgram(), "yuvmatrix");
+    offsetUniform = glGetUniformLocation(_prog->getProgram(), "yuvoffset");
+
     /* 加载texture */
-    if(CCSprite::init()){
-        if(yuv){
-            _width = w;
-            _height = h;
-            
-            setContentSize(CCSize(w,h));
-            CCRect rect = CCRectZero;
-            rect.size = CCSize(w,h);
-            setTextureRect(rect,false,rect.size);
-            textureUniformY = glGetUniformLocation(_prog->getProgram(), "tex_y");
-            textureUniformU = glGetUniformLocation(_prog->getProgram(), "tex_u");
-            textureUniformV = glGetUniformLocation(_prog->getProgram(), "tex_v");
-            
-            borderUniformY = glGetUniformLocation(_prog->getProgram(), "yborder");
-            borderUniformU = glGetUniformLocation(_prog->getProgram(), "uborder");
-            borderUniformV = glGetUniformLocation(_prog->getProgram(), "vborder");
-            
-            _border[0] = (float)w/(float)linesize[0];
-            _border[1] = (float)w/(2.0f*linesize[1]);
-            _border[2] = (float)w/(2.0f*linesize[2]);
-           // double t2 = cc_clock();
+    if(yuv)
+        updateWithYUV420P(w,h,yuv,linesize);
+    return true;
+}
+
+int YUVSprite::updateWithYUV420P(int w,int h,uint8_t *yuv[3],int linesize[3])
+{
+    GLuint *ids[3] = { &id_y, &id_u, &id_v };
+    int i,bytes = 0;
+
+    if(w <= 0 || h <= 0 || !yuv)
+        return 0;
+
+    /* the planes are uploaded with their line size as width */
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if(!textureDone || w != _width || h != _height ||
+       linesize[0] != _linesize[0] || linesize[1] != _linesize[1] || linesize[2] != _linesize[2]){
+        if(!textureDone){
             glGenTextures(1, &id_y);
-            glBindTexture(GL_TEXTURE_2D, id_y);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, linesize[0], h, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, yuv[0]);
-            glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            
-           // double t3 = cc_clock();
             glGenTextures(1, &id_u);
-            glBindTexture(GL_TEXTURE_2D, id_u);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE,linesize[1], h/2, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, yuv[1]);
-            glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            
-           // double t4 = cc_clock();
             glGenTextures(1, &id_v);
-            glBindTexture(GL_TEXTURE_2D, id_v);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, linesize[2], h/2, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, yuv[2]);
+            textureDone = 1;
+        }
+        for(i = 0; i < 3; i++){
+            GL::bindTexture2D(*ids[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, linesize[i], i ? (h+1)/2 : h, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, yuv[i]);
             glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            
-           // double t5 = cc_clock();
-           // CCLOG("prog %f, unif %f , y= %f , u=%f , v=%f",t1-t0,t2-t1,t3-t2,t4-t3,t5-t4);
-            CHECK_GL_ERROR_DEBUG();
+            _linesize[i] = linesize[i];
+            bytes += linesize[i] * (i ? (h+1)/2 : h);
+        }
+        _width = w;
+        _height = h;
+        _border[0] = (float)w/(float)linesize[0];
+        _border[1] = (float)((w+1)/2)/(float)linesize[1];
+        _border[2] = (float)((w+1)/2)/(float)linesize[2];
 
-            textureDone = 1;
+        Rect rect(0,0,w,h);
+        setTextureRect(rect,false,rect.size);
+    }else{
+        for(i = 0; i < 3; i++){
+            GL::bindTexture2D(*ids[i]);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, linesize[i], i ? (h+1)/2 : h, GL_LUMINANCE, GL_UNSIGNED_BYTE, yuv[i]);
+            bytes += linesize[i] * (i ? (h+1)/2 : h);
         }
-        return true;
     }
-    return false;
+    CHECK_GL_ERROR_DEBUG();
+    return bytes;
+}
+
+void YUVSprite::setColorSpace(int matrix,bool fullRange)
+{
+    if(matrix < ff::YUV_MATRIX_BT601 || matrix > ff::YUV_MATRIX_BT2020)
+        matrix = ff::YUV_MATRIX_BT601;
+    _matrix = matrix;
+    _fullRange = fullRange;
+}
+
+void YUVSprite::draw(Renderer *renderer, const Mat4 &transform, uint32_t flags)
+{
+    if(!textureDone || !_prog)
+        return;
+    _customCommand.init(_globalZOrder);
+    _customCommand.func = CC_CALLBACK_0(YUVSprite::onDraw, this, transform, flags);
+    renderer->addCommand(&_customCommand);
 }
 
-void YUVSprite::draw()
+void YUVSprite::onDraw(const Mat4 &transform, uint32_t flags)
 {
-    CC_PROFILER_START_CATEGORY(kCCProfilerCategorySprite, "YUVSprite - draw");
+    CC_PROFILER_START_CATEGORY(kProfilerCategorySprite, "YUVSprite - draw");
     
-    CCAssert(!m_pobBatchNode, "If YUVSprite is being rendered by CCSpriteBatchNode, YUVSprite#draw SHOULD NOT be called");
-   // CC_NODE_DRAW_SETUP();
-    ccGLBlendFunc( m_sBlendFunc.src, m_sBlendFunc.dst );
+    CCASSERT(!_batchNode, "If YUVSprite is being rendered by SpriteBatchNode, YUVSprite#draw SHOULD NOT be called");
+    GL::blendFunc( _blendFunc.src, _blendFunc.dst );
 
-    if(_prog){
-        _prog->use();
-        _prog->setUniformsForBuiltins();
-    }
-    if(textureDone){
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, id_y);
-        glUniform1i(textureUniformY, 0);
-        
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, id_u);
-        glUniform1i(textureUniformU, 1);
-        
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, id_v);
-        glUniform1i(textureUniformV, 2);
-        
-        glUniform1f(borderUniformY,_border[0]);
-        glUniform1f(borderUniformU,_border[1]);
-        glUniform1f(borderUniformV,_border[2]);
-    }
-    //ccGLEnableVertexAttribs( kCCVertexAttribFlag_PosColorTex );
+    _prog->use();
+    _prog->setUniformsForBuiltins(transform);
+
+    GL::bindTexture2DN(0, id_y);
+    glUniform1i(textureUniformY, 0);
     
-#define kQuadSize sizeof(m_sQuad.bl)
-#ifdef EMSCRIPTEN
-    long offset = 0;
-    setGLBufferData(&m_sQuad, 4 * kQuadSize, 0);
-#else
-    long offset = (long)&m_sQuad;
-#endif // EMSCRIPTEN
-    CHECK_GL_ERROR_DEBUG();
+    GL::bindTexture2DN(1, id_u);
+    glUniform1i(textureUniformU, 1);
+    
+    GL::bindTexture2DN(2, id_v);
+    glUniform1i(textureUniformV, 2);
+    
+    glUniform1f(borderUniformY,_border[0]);
+    glUniform1f(borderUniformU,_border[1]);
+    glUniform1f(borderUniformV,_border[2]);
+
+    glUniformMatrix3fv(matrixUniform, 1, GL_FALSE, _yuvMatrix[_fullRange][_matrix]);
+    glUniform3fv(offsetUniform, 1, _yuvOffset[_fullRange]);
     
     GLfloat square[8];
-    CCSize s = this->getTextureRect().size;
-    CCPoint offsetPix = this->getOffsetPosition();
+    Size s = this->getTextureRect().size;
+    Vec2 offsetPix = this->getOffsetPosition();
     
     square[0] = offsetPix.x;
     square[1] = offsetPix.y;
@@ -246,47 +266,15 @@ void YUVSprite::draw()
     square[4] = offsetPix.x;
     square[5] = offsetPix.y+s.height;
 
-    glVertexAttribPointer(ATTRIB_VERTEX, 2, GL_FLOAT, 0, 0, square);
-    glEnableVertexAttribArray(ATTRIB_VERTEX);
-    
-    glVertexAttribPointer(ATTRIB_TEXTURE, 2, GL_FLOAT, 0, 0, coordVertices);
-    glEnableVertexAttribArray(ATTRIB_TEXTURE);
+    /* client side arrays */
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    GL::enableVertexAttribs(GL::VERTEX_ATTRIB_FLAG_POSITION | GL::VERTEX_ATTRIB_FLAG_TEX_COORD);
+    glVertexAttribPointer(GLProgram::VERTEX_ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE, 0, square);
+    glVertexAttribPointer(GLProgram::VERTEX_ATTRIB_TEX_COORD, 2, GL_FLOAT, GL_FALSE, 0, coordVertices);
 
-    /*
-    // vertex
-    int diff = offsetof( ccV3F_C4B_T2F, vertices);
-    glVertexAttribPointer(kCCVertexAttrib_Position, 3, GL_FLOAT, GL_FALSE, kQuadSize, (void*) (offset + diff));
-    
-    // texCoods
-    diff = offsetof( ccV3F_C4B_T2F, texCoords);
-    glVertexAttribPointer(kCCVertexAttrib_TexCoords, 2, GL_FLOAT, GL_FALSE, kQuadSize, (void*)(offset + diff));
-    
-    // color
-    diff = offsetof( ccV3F_C4B_T2F, colors);
-    glVertexAttribPointer(kCCVertexAttrib_Color, 4, GL_UNSIGNED_BYTE, GL_TRUE, kQuadSize, (void*)(offset + diff));
-    */
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     CHECK_GL_ERROR_DEBUG();
-#if CC_SPRITE_DEBUG_DRAW == 1
-    // draw bounding box
-    CCPoint vertices[4]={
-        ccp(m_sQuad.tl.vertices.x,m_sQuad.tl.vertices.y),
-        ccp(m_sQuad.bl.vertices.x,m_sQuad.bl.vertices.y),
-        ccp(m_sQuad.br.vertices.x,m_sQuad.br.vertices.y),
-        ccp(m_sQuad.tr.vertices.x,m_sQuad.tr.vertices.y),
-    };
-    ccDrawPoly(vertices, 4, true);
-#elif CC_SPRITE_DEBUG_DRAW == 2
-    // draw texture box
-    CCSize s = this->getTextureRect().size;
-    CCPoint offsetPix = this->getOffsetPosition();
-    CCPoint vertices[4] = {
-        ccp(offsetPix.x,offsetPix.y), ccp(offsetPix.x+s.width,offsetPix.y),
-        ccp(offsetPix.x+s.width,offsetPix.y+s.height), ccp(offsetPix.x,offsetPix.y+s.height)
-    };
-    ccDrawPoly(vertices, 4, true);
-#endif // CC_SPRITE_DEBUG_DRAW
-    CC_INCREMENT_GL_DRAWS(1);
+    CC_INCREMENT_GL_DRAWN_BATCHES_AND_VERTICES(1, 4);
     
-    CC_PROFILER_STOP_CATEGORY(kCCProfilerCategorySprite, "YUVSprite - draw");
+    CC_PROFILER_STOP_CATEGORY(kProfilerCategorySprite, "YUVSprite - draw");
 }
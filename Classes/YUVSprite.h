@@ -5,26 +5,50 @@
 #ifndef YUV_SPRITE_h
 #define YUV_SPRITE_h
 
+#include "cocos2d.h"
+
 using namespace cocos2d;
 
-class YUVSprite : public CCSprite
+class YUVSprite : public Sprite
 {
 public:
+    static YUVSprite * create();
+
     static YUVSprite * createWithYUV420P(int w,int h,uint8_t *yuv[3],int linesize[3]);
-    
+
     YUVSprite();
-    
+
     virtual ~YUVSprite();
-    
+
     virtual bool init();
-    
+
     virtual bool initWidthYUV420P(int w,int h,uint8_t *yuv[3],int linesize[3]);
-    
-    virtual void draw();
+
+    /*
+     * Uploads a new picture. The plane textures are kept and only
+     * reallocated when the size or the line sizes change, the padding at
+     * the end of the lines is cut by the border uniforms.
+     * Returns the bytes uploaded.
+     */
+    virtual int updateWithYUV420P(int w,int h,uint8_t *yuv[3],int linesize[3]);
+
+    /*
+     * The matrix is a ff::YUVMatrix, BT.601 limited range by default.
+     */
+    void setColorSpace(int matrix,bool fullRange);
+
+    virtual void draw(Renderer *renderer, const Mat4 &transform, uint32_t flags) override;
+protected:
+    void onDraw(const Mat4 &transform, uint32_t flags);
+
+    CustomCommand _customCommand;
 private:
     int _width,_height;
+    int _linesize[3];
     float _border[3];
-    CCGLProgram * _prog;
+    int _matrix;
+    bool _fullRange;
+    GLProgram * _prog;
     GLuint id_y;
     GLuint id_u;
     GLuint id_v;
@@ -34,6 +58,8 @@ private:
     GLuint borderUniformY;
     GLuint borderUniformU;
     GLuint borderUniformV;
+    GLuint matrixUniform;
+    GLuint offsetUniform;
     int textureDone;
 };
 
@@ -55,9 +55,12 @@ int nb_vfilters = 0;
 char *afilters = NULL;
 #endif
 int autorotate = 1;
+int abr_policy = 0;
+double audio_latency = 0;
 
 /* current context */
 int64_t audio_callback_time;
+static std::atomic<double> audio_output_latency; //after the mix bus buffer being filled, see sdl_mx_audio_callback
 
 AVPacket flush_pkt;
 
@@ -187,6 +190,67 @@ static void set_default_window_size(int width, int height, AVRational sar)
 	default_height = rect.h;
 }
 
+/*
+ * The matrix of a decoded frame: its colorspace, else its primaries, else
+ * what players assume for the size, BT.709 from 720 lines up.
+ */
+static int yuv_matrix(const AVFrame *frame)
+{
+    switch(frame->colorspace){
+    case AVCOL_SPC_BT709:
+        return YUV_MATRIX_BT709;
+    case AVCOL_SPC_BT2020_NCL:
+    case AVCOL_SPC_BT2020_CL:
+        return YUV_MATRIX_BT2020;
+    case AVCOL_SPC_BT470BG:
+    case AVCOL_SPC_SMPTE170M:
+    case AVCOL_SPC_FCC:
+        return YUV_MATRIX_BT601;
+    default:
+        break;
+    }
+    switch(frame->color_primaries){
+    case AVCOL_PRI_BT709:
+        return YUV_MATRIX_BT709;
+    case AVCOL_PRI_BT2020:
+        return YUV_MATRIX_BT2020;
+    case AVCOL_PRI_BT470M:
+    case AVCOL_PRI_BT470BG:
+    case AVCOL_PRI_SMPTE170M:
+    case AVCOL_PRI_SMPTE240M:
+        return YUV_MATRIX_BT601;
+    default:
+        break;
+    }
+    return frame->height >= 720 ? YUV_MATRIX_BT709 : YUV_MATRIX_BT601;
+}
+
+/*
+ * YUV to RGB in 16.16 fixed point, by full_range then YUVMatrix:
+ * the scale of y - offset, then v for r, u and v for g, u for b.
+ */
+typedef struct YUVCoefs {
+    int offset, y, rv, gu, gv, bu;
+} YUVCoefs;
+
+static const YUVCoefs yuv_coefs[2][3] = {
+    {   /* y 16-235, u and v 16-240 */
+        { 16, 76309, 104597, 25675, 53279, 132201 },   /* BT.601 */
+        { 16, 76309, 117489, 13975, 34925, 138438 },   /* BT.709 */
+        { 16, 76309, 110014, 12277, 42626, 140363 },   /* BT.2020 */
+    },
+    {   /* full range */
+        { 0, 65536, 91881, 22553, 46802, 116130 },
+        { 0, 65536, 103206, 12276, 30679, 121609 },
+        { 0, 65536, 96639, 10784, 37444, 123299 },
+    },
+};
+
+static inline uint8_t clip_rgb(int v)
+{
+    return v < 0 ? 0 : v > (255 << 16) ? 255 : (uint8_t)((v + 0x8000) >> 16);
+}
+
 uint8_t* yuv420pToRgb(yuv420p * pyuv420p)
 {
     /*
@@ -201,7 +265,8 @@ uint8_t* yuv420pToRgb(yuv420p * pyuv420p)
     		psurface);
     DisplayYUVOverlay(pbmp, &rect);
      */
-    uint8_t Y,U,V,R,G,B;
+    const YUVCoefs *c = &yuv_coefs[pyuv420p->full_range ? 1 : 0][pyuv420p->matrix];
+    int Y,U,V;
     uint8_t *py, *pu, *pv;
     uint8_t *prgbline;
     int x2,linesize;
@@ -215,23 +280,14 @@ uint8_t* yuv420pToRgb(yuv420p * pyuv420p)
         pv = pyuv420p->data[2]+x2*pyuv420p->linesize[2];
         prgbline = pdata+y*linesize;
         for(int x=0;x<pyuv420p->w;x++){
-            Y = *(py+x);
+            Y = (*(py+x) - c->offset) * c->y;
             x2 = x>>1;
-            U = *(pu+x2);
-            V = *(pv+x2);
-            
-            
-          // r = y + 1.13983f*(v-0.5f);
-          // g = y - 0.39465f*(u-0.5f) - 0.58060f*(v-0.5f);
-          // b = y + 2.03211f*(u-0.5f);
-            
-            R = Y + 1.4075f*(V-128);
-            G = Y - 0.3455f*(U-128) - 0.7169f*(V-128);
-            B = Y + 1.779f*(U-128);
+            U = *(pu+x2) - 128;
+            V = *(pv+x2) - 128;
             
-            *prgbline++ = R;
-            *prgbline++ = G;
-            *prgbline++ = B;
+            *prgbline++ = clip_rgb(Y + c->rv*V);
+            *prgbline++ = clip_rgb(Y - c->gu*U - c->gv*V);
+            *prgbline++ = clip_rgb(Y + c->bu*U);
         }
     }
     return pdata;
@@ -688,6 +744,9 @@ static void video_image_display(VideoState *is)
         is->pyuv420p.data[1] = vp->frame->data[1];
         is->pyuv420p.linesize[2] = vp->frame->linesize[2];
         is->pyuv420p.data[2] = vp->frame->data[2];
+        is->pyuv420p.matrix = yuv_matrix(vp->frame);
+        is->pyuv420p.full_range = vp->frame->color_range == AVCOL_RANGE_JPEG ||
+            vp->frame->format == AV_PIX_FMT_YUVJ420P;
    //     if(is->toRGB){
    //         DisplayYUVOverlay(vp->bmp, &rect);
    //     }
@@ -963,6 +1022,33 @@ static int decode_interrupt_cb(void *ctx)
 	return is->abort_request;
 }
 
+void set_abr_policy(int policy)
+{
+	abr_policy = policy;
+}
+
+void set_audio_latency(double seconds)
+{
+	audio_latency = FFMAX(seconds, 0.0);
+}
+
+/*
+ * Seconds of media waiting in the packet queue of st
+ */
+static double packet_queue_span(PacketQueue *q, AVStream *st)
+{
+	double span = 0;
+
+	if (!st)
+		return 0;
+	lockMutex(q->mutex);
+	if (q->first_pkt && q->last_pkt &&
+		q->first_pkt->pkt.pts != AV_NOPTS_VALUE && q->last_pkt->pkt.pts != AV_NOPTS_VALUE)
+		span = (q->last_pkt->pkt.pts - q->first_pkt->pkt.pts) * av_q2d(st->time_base);
+	unlockMutex(q->mutex);
+	return span;
+}
+
 static void frame_queue_signal(FrameQueue *f)
 {
 	lockMutex(f->mutex);
@@ -1167,13 +1253,6 @@ static int audio_decode_frame(VideoState *is)
 		return -1;
 
 	do {
-#if defined(_WIN32)
-		while (frame_queue_nb_remaining(&is->sampq) == 0) {
-			if ((av_gettime_relative() - audio_callback_time) > 1000000LL * is->audio_hw_buf_size / is->audio_tgt.bytes_per_sec / 2)
-				return -1;
-			av_usleep(1000);
-		}
-#endif
 		if (!(af = frame_queue_peek_readable(&is->sampq)))
 			return -1;
 	//	if (lastread == 0)
@@ -1278,16 +1357,17 @@ static int audio_decode_frame(VideoState *is)
 
 
 /* copy samples for viewing in editor window */
-static void update_sample_display(VideoState *is, short *samples, int samples_size)
+static void update_sample_display(VideoState *is, const float *samples, int samples_size)
 {
-	int size, len;
+	int size, len, i;
 
-	size = samples_size / sizeof(short);
+	size = samples_size / sizeof(float);
 	while (size > 0) {
 		len = SAMPLE_ARRAY_SIZE - is->sample_array_index;
 		if (len > size)
 			len = size;
-		memcpy(is->sample_array + is->sample_array_index, samples, len * sizeof(short));
+		for (i = 0; i < len; i++)
+			is->sample_array[is->sample_array_index + i] = (int16_t)av_clip_int16(lrintf(samples[i] * 32767.0f));
 		samples += len;
 		is->sample_array_index += len;
 		if (is->sample_array_index >= SAMPLE_ARRAY_SIZE)
@@ -1296,52 +1376,166 @@ static void update_sample_display(VideoState *is, short *samples, int samples_si
 	}
 }
 
-//double mct = 0;
-/* prepare a new audio buffer */
-static void sdl_audio_callback(void *opaque, Uint8 *stream, int len)
+/*
+ * The device callback only copies from the AudioRing of the stream,
+ * decoding and resampling run ahead of it in audio_render_thread.
+ * The clock and serial of the data at the write position, and the packet
+ * queue serial, are published with a sequence count, the callback reads
+ * them again if the writer was in the middle of an update. The callback
+ * also feeds the sample display, so it shows what is being played.
+ */
+static int audio_ring_init(AudioRing *r, int min_size)
+{
+	int size = 1;
+
+	while (size < min_size)
+		size <<= 1;
+	r->data = (uint8_t *)av_malloc(size);
+	if (!r->data)
+		return AVERROR(ENOMEM);
+	r->wpos = 0;
+	r->rpos = 0;
+	r->seq = 0;
+	r->discard = 0;
+	r->clock = NAN;
+	r->serial = -1;
+	r->queue_serial = -1;
+	r->underruns = 0;
+	r->starved = 1;
+	r->size.store(size, std::memory_order_release);
+	return 0;
+}
+
+static void audio_ring_free(AudioRing *r)
 {
-	VideoState *is = (VideoState *)opaque;
-	int audio_size, len1;
+	r->size = 0;
+	av_freep(&r->data);
+}
 
-	audio_callback_time = av_gettime_relative();
-//	if (mct == 0)mct = cc_clock();
-//	double t = cc_clock();
-//	My_log(0, 0, "sdl_audio_callback audio_callback_time = %f,loop = %f", audio_callback_time,t-mct);
-//	mct = t;
-	while (len > 0) {
+/* copy what fits, audio_ring_publish makes it readable */
+static int audio_ring_write(AudioRing *r, const uint8_t *src, int len)
+{
+	const unsigned int size = r->size.load(std::memory_order_relaxed);
+	const unsigned int wpos = r->wpos.load(std::memory_order_relaxed);
+	const unsigned int off = wpos & (size - 1);
+	int n = FFMIN((unsigned int)len, size - (wpos - r->rpos.load(std::memory_order_acquire)));
+	int n1 = FFMIN((unsigned int)n, size - off);
+
+	memcpy(r->data + off, src, n1);
+	memcpy(r->data, src + n1, n - n1);
+	return n;
+}
+
+static void audio_ring_publish(AudioRing *r, int len, double clock, int serial, int queue_serial, int new_serial)
+{
+	const unsigned int wpos = r->wpos.load(std::memory_order_relaxed);
+	const unsigned int seq = r->seq.load(std::memory_order_relaxed);
+
+	r->seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	if (new_serial)
+		r->discard.store(wpos, std::memory_order_relaxed);
+	r->clock.store(clock, std::memory_order_relaxed);
+	r->serial.store(serial, std::memory_order_relaxed);
+	r->queue_serial.store(queue_serial, std::memory_order_relaxed);
+	r->wpos.store(wpos + len, std::memory_order_relaxed);
+	r->seq.store(seq + 2, std::memory_order_release);
+}
+
+/* decode and resample into the ring, ahead of the device */
+static int audio_render_thread(void *arg)
+{
+	VideoState *is = (VideoState *)arg;
+	AudioRing *r = &is->audio_ring;
+	const int64_t period = 1000000LL * is->audio_hw_buf_size / is->audio_tgt.bytes_per_sec;
+	int serial = -1;
+	int audio_size, len1, queue_serial;
+
+	while (!is->audioq.abort_request) {
+		queue_serial = is->audioq.serial;
+		/* a seek makes what the ring holds stale, tell the callback now
+		 * rather than with the next frame */
+		if (queue_serial != r->queue_serial.load(std::memory_order_relaxed))
+			audio_ring_publish(r, 0, r->clock.load(std::memory_order_relaxed),
+				r->serial.load(std::memory_order_relaxed), queue_serial, 0);
 		if (is->audio_buf_index >= (int)is->audio_buf_size) {
 			audio_size = audio_decode_frame(is);
-//			My_log(0, 0, "audio_size = %d,len = %d", audio_size,len);
 			if (audio_size < 0) {
-				/* if error, just output silence */
-				is->audio_buf = is->silence_buf;
-				if( is->audio_tgt.frame_size != 0 )
-					is->audio_buf_size = sizeof(is->silence_buf) / is->audio_tgt.frame_size * is->audio_tgt.frame_size;
-				else
-					//FIXME: is->audio_tgt.frame_size = 0?
-					is->audio_buf_size = 0;
-			}
-			else {
-				if (is->show_mode != SHOW_MODE_VIDEO)
-					update_sample_display(is, (int16_t *)is->audio_buf, audio_size);
-				is->audio_buf_size = audio_size;
+				/* paused, or nothing we can play yet */
+				av_usleep(FFMIN(period, 10000));
+				continue;
 			}
+			is->audio_buf_size = audio_size;
 			is->audio_buf_index = 0;
 		}
-		len1 = is->audio_buf_size - is->audio_buf_index;
-		if (len1 > len)
-			len1 = len;
-		memcpy(stream, (uint8_t *)is->audio_buf + is->audio_buf_index, len1);
-		len -= len1;
-		stream += len1;
+		len1 = audio_ring_write(r, is->audio_buf + is->audio_buf_index, is->audio_buf_size - is->audio_buf_index);
+		if (!len1) {
+			/* full, the device takes a buffer per period */
+			av_usleep(period / 2);
+			continue;
+		}
 		is->audio_buf_index += len1;
+		audio_ring_publish(r, len1,
+			is->audio_clock - (double)(is->audio_buf_size - is->audio_buf_index) / is->audio_tgt.bytes_per_sec,
+			is->audio_clock_serial, queue_serial, is->audio_clock_serial != serial);
+		serial = is->audio_clock_serial;
+	}
+	return 0;
+}
+
+/* prepare a new audio buffer */
+static void sdl_audio_callback(void *opaque, Uint8 *stream, int len)
+{
+	VideoState *is = (VideoState *)opaque;
+	AudioRing *r = &is->audio_ring;
+	const unsigned int size = r->size.load(std::memory_order_acquire);
+	unsigned int seq, wpos, rpos, discard, off;
+	double clock;
+	int serial, queue_serial, len1, n1;
+
+	audio_callback_time = av_gettime_relative();
+	if (!size || is->paused) {
+		memset(stream, 0, len);
+		return;
 	}
-	is->audio_write_buf_size = is->audio_buf_size - is->audio_buf_index;
-	/* Let's assume the audio driver that is used by SDL has two periods. */
-	if (!isnan(is->audio_clock)) {
-//		My_log(0, 0, "callback audio_clock=%f,audio_hw_buf_size=%d,audio_write_buf_size=%d,bytes_per_sec=%d , audio_clock_serial=%d,audio_callback_time = %f",
-//			is->audio_clock, is->audio_hw_buf_size, is->audio_write_buf_size, is->audio_tgt.bytes_per_sec, is->audio_clock_serial, (double)(audio_callback_time / 1000000.0));
-		set_clock_at(&is->audclk, is->audio_clock - (double)(2 * is->audio_hw_buf_size + is->audio_write_buf_size) / is->audio_tgt.bytes_per_sec, is->audio_clock_serial, audio_callback_time / 1000000.0);
+	do {
+		seq = r->seq.load(std::memory_order_acquire);
+		wpos = r->wpos.load(std::memory_order_relaxed);
+		discard = r->discard.load(std::memory_order_relaxed);
+		clock = r->clock.load(std::memory_order_relaxed);
+		serial = r->serial.load(std::memory_order_relaxed);
+		queue_serial = r->queue_serial.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((seq & 1) || seq != r->seq.load(std::memory_order_relaxed));
+
+	rpos = r->rpos.load(std::memory_order_relaxed);
+	if (serial != queue_serial)
+		rpos = wpos; /* seeked, what the ring holds is stale */
+	else if ((int)(discard - rpos) > 0)
+		rpos = discard;
+	len1 = FFMIN((unsigned int)len, wpos - rpos);
+	off = rpos & (size - 1);
+	n1 = FFMIN((unsigned int)len1, size - off);
+	memcpy(stream, r->data + off, n1);
+	memcpy(stream + n1, r->data, len1 - n1);
+	rpos += len1;
+	r->rpos.store(rpos, std::memory_order_release);
+	if (is->show_mode != SHOW_MODE_VIDEO)
+		update_sample_display(is, (const float *)stream, len1);
+
+	if (len1 < len) {
+		memset(stream + len1, 0, len - len1);
+		/* count each dropout once, not the refill after a seek or the end */
+		if (!r->starved && serial == queue_serial && !is->eof)
+			r->underruns.fetch_add(1, std::memory_order_relaxed);
+		r->starved = 1;
+	}
+	else {
+		r->starved = 0;
+	}
+	/* rpos is heard once this buffer and what the driver holds are played */
+	if (!isnan(clock)) {
+		set_clock_at(&is->audclk, clock - audio_output_latency.load(std::memory_order_relaxed) - (double)(len + (wpos - rpos)) / is->audio_tgt.bytes_per_sec, serial, audio_callback_time / 1000000.0);
 		sync_clock_to_slave(&is->extclk, &is->audclk);
 	}
 }
@@ -1393,76 +1587,163 @@ static int getAudioChanelCount()
 	}
 	return count;
 }
-const int max_audioval = ((1 << (16 - 1)) - 1);
-const int min_audioval = -(1 << (16 - 1));
-int clamp(int d,int mi,int ma)
+/*
+ * The streams are mixed on a float bus at the device rate and channels:
+ * each AudioChanel adds its samples with the gain and pan of its stream,
+ * a lookahead limiter keeps the sum under full scale instead of clipping
+ * it, and the bus is converted once to the format the device plays.
+ */
+#define MIX_LIMIT_CEILING 0.966f //-0.3 dBFS
+
+static AudioSpec gSpec;
+static AudioCVT gBusCVT; //bus to device format
+static AudioLimiter *gLimiter;
+static float *gMixBus;
+static float *gMixData;
+static int gMixFrames;
+
+/* gain per bus channel, pan moves the front pair, the center stays unity */
+static void mix_gains(VideoState *is, int channels, float *gains)
 {
-	if (d>ma)
-		return ma;
-	if (d < mi)
-		return mi;
-	return d;
+	float gain = is->audio_gain;
+	float pan = av_clipf(is->audio_pan, -1.0f, 1.0f);
+
+	for (int c = 0; c < channels; c++)
+		gains[c] = gain;
+	if (channels >= 2) {
+		gains[0] *= FFMIN(1.0f, 1.0f - pan);
+		gains[1] *= FFMIN(1.0f, 1.0f + pan);
+	}
+}
+
+static int mix_bus_alloc(int frames)
+{
+	gMixBus = (float *)av_malloc(frames * gSpec.channels * sizeof(float));
+	gMixData = (float *)av_malloc(frames * gSpec.channels * sizeof(float));
+	if (!gMixBus || !gMixData)
+		return -1;
+	gMixFrames = frames;
+	return 0;
 }
 
-static void MixAudioFormat(Sint16 *des, Sint16 *src, AudioFormat format,int len,float volume)
+static void mix_bus_free()
 {
-	Sint16 A, B;
-	while (len--){
-		A = *(src++);
-		B = *des;
-		*des = (Sint16)clamp((int)A + (int)B, min_audioval, max_audioval);
-		des++;
+	SDL_FreeLimiter(gLimiter);
+	gLimiter = NULL;
+	FreeAudioCVT(&gBusCVT);
+	av_freep(&gMixBus);
+	av_freep(&gMixData);
+	gMixFrames = 0;
+}
+
+static int mix_bus_open()
+{
+	if (BuildAudioCVT(&gBusCVT, AUDIO_F32SYS, gSpec.channels, gSpec.freq,
+		gSpec.format, gSpec.channels, gSpec.freq, gSpec.samples) < 0)
+		return -1;
+	gLimiter = SDL_CreateLimiter(gSpec.channels, gSpec.freq, gSpec.samples, MIX_LIMIT_CEILING);
+	if (!gLimiter || mix_bus_alloc(gSpec.samples) < 0) {
+		mix_bus_free();
+		return -1;
 	}
+	return 0;
 }
 
-static void sdl_mx_audio_callback(void *pd, Uint8 *stream, int len)
+/* mix (frames) of at most gMixFrames to the device format in stream */
+static void mix_bus_run(Uint8 *stream, int frames)
 {
-	AudioFormat format = AUDIO_S16SYS;
-	memset(stream, 0, len);
-	Uint8 * mixData = new Uint8[len];
+	const int channels = gSpec.channels;
+	const int bus_len = frames * channels * sizeof(float);
+	float gains[8], peak, rms;
+	float *bus;
+
+	/* a float device plays the bus as is */
+	bus = gBusCVT.needed ? gMixBus : (float *)stream;
+	memset(bus, 0, bus_len);
 	for (int i = 0; i < MAXCHANEL; i++)
 	{
 		AudioChanel * pac = mxAudioChanel[i];
 		if (pac)
 		{
-			pac->_callback(pac->_is, mixData, len);
-			//SDL_MixAudioFormat(stream, mixData, format,len, 128);
-			if (!(pac->_is->step || pac->_is->seek_req))
-				MixAudioFormat((Sint16*)stream, (Sint16*)mixData, format, len / 2, 128);
+			VideoState *is = pac->_is;
+			pac->_callback(is, (Uint8 *)gMixData, bus_len);
+			if (!(is->step || is->seek_req)) {
+				mix_gains(is, channels, gains);
+				SDL_MixAudioF32(bus, gMixData, frames, channels, gains, &peak, &rms);
+				if (peak > is->audio_peak.load(std::memory_order_relaxed))
+					is->audio_peak.store(peak, std::memory_order_relaxed);
+				is->audio_rms.store(rms, std::memory_order_relaxed);
+			}
+			else {
+				is->audio_rms.store(0.0f, std::memory_order_relaxed);
+			}
 		}
 	}
-	delete [] mixData;
+	SDL_LimitAudioF32(gLimiter, bus, frames);
+	if (gBusCVT.needed) {
+		gBusCVT.buf = (Uint8 *)bus;
+		gBusCVT.len = bus_len;
+		SDL_ConvertAudio(&gBusCVT);
+		memcpy(stream, bus, gBusCVT.len_cvt);
+	}
+}
+
+static void sdl_mx_audio_callback(void *pd, Uint8 *stream, int len)
+{
+	const int frame = SDL_AUDIO_BITSIZE(gSpec.format) / 8 * gSpec.channels;
+	int frames = len / frame;
+
+	audio_output_latency.store(GetAudioLatency() + (double)SDL_LimiterDelay(gLimiter) / gSpec.freq,
+		std::memory_order_relaxed);
+	/* the bus is sized when the device opens, a larger buffer is mixed in pieces */
+	while (frames > 0) {
+		const int n = FFMIN(frames, gMixFrames);
+		mix_bus_run(stream, n);
+		stream += n * frame;
+		frames -= n;
+	}
 }
 
 static bool gInitAudio = false;
-static AudioSpec gSpec;
 static int initAudio(AudioSpec *desired, AudioSpec *obtained)
 {
 	int ret = 0;
-	if (!OpenAudioChanel((VideoState *)desired->userdata, desired->callback))
+	AudioChanel *pac;
+
+	LockAudio();
+	pac = OpenAudioChanel((VideoState *)desired->userdata, desired->callback);
+	UnlockAudio();
+	if (!pac)
 		return -1;
 	if (!gInitAudio)
 	{
 		desired->callback = sdl_mx_audio_callback;
 		ret = OpenAudio(desired, &gSpec);
-		if (gSpec.format != AUDIO_S16SYS)
+		if (ret < 0) {
+			CloseAudioChanel(pac);
+			return ret;
+		}
+		if (gSpec.channels > 8 || mix_bus_open() < 0)
 		{
 			My_log(NULL, AV_LOG_ERROR, "Close audio device!\n");
 			CloseAudio();
+			CloseAudioChanel(pac);
 			return -1;
 		}
-		if ( ret >= 0 )
-			PauseAudio(0);
+		PauseAudio(0);
 		gInitAudio = true;
 	}
+	/* the streams write to the bus */
 	*obtained = gSpec;
+	obtained->format = AUDIO_F32SYS;
+	CalculateAudioSpec(obtained);
 	return ret;
 }
 
 static void CloseAudioChanelByVideoState(VideoState *pvs)
 {
-	CloseAudio();
-
+	/* the other channels keep playing, the callback just can't be in this one */
+	LockAudio();
 	for (int i = 0; i < MAXCHANEL; i++)
 	{
 		AudioChanel * pac = mxAudioChanel[i];
@@ -1473,6 +1754,7 @@ static void CloseAudioChanelByVideoState(VideoState *pvs)
 			break;
 		}
 	}
+	UnlockAudio();
 	/*
 		‘⁄»´≤øµƒ…˘“ÙªÏ∫œÕ®µ¿πÿ±’∫Û£¨πÿ±’…˘“Ù…Ë±∏
 		’‚“≤–Ìµº÷¬∆µ∑±µƒ¥Úø™πÿ±’…˘“Ù…Ë±∏µº÷¬µÁ‘Î“Ù
@@ -1483,10 +1765,18 @@ static void CloseAudioChanelByVideoState(VideoState *pvs)
 			return;
 	}
 	//all audio chanel is close.
-	
+	CloseAudio();
+	mix_bus_free();
 	gInitAudio = false;
 }
 
+double get_audio_latency()
+{
+	if (!gInitAudio)
+		return 0;
+	return audio_output_latency + (double)gSpec.samples / gSpec.freq;
+}
+
 static int audio_open(void *opaque, int64_t wanted_channel_layout, int wanted_nb_channels, int wanted_sample_rate, struct AudioParams *audio_hw_params)
 {
 	AudioSpec wanted_spec, spec;
@@ -1513,9 +1803,13 @@ static int audio_open(void *opaque, int64_t wanted_channel_layout, int wanted_nb
 	}
 	while (next_sample_rate_idx && next_sample_rates[next_sample_rate_idx] >= wanted_spec.freq)
 		next_sample_rate_idx--;
-	wanted_spec.format = AUDIO_S16SYS;
+	wanted_spec.format = AUDIO_F32SYS;
 	wanted_spec.silence = 0;
-	wanted_spec.samples = FFMAX(AUDIO_MIN_BUFFER_SIZE, 2 << av_log2(wanted_spec.freq / AUDIO_MAX_CALLBACKS_PER_SEC));
+	if (audio_latency > 0)
+		/* the driver plays one buffer while the others are filled */
+		wanted_spec.samples = FFMAX(AUDIO_MIN_TARGET_BUFFER_SIZE, 1 << av_log2((int)(wanted_spec.freq * audio_latency / NUM_BUFFERS)));
+	else
+		wanted_spec.samples = FFMAX(AUDIO_MIN_BUFFER_SIZE, 2 << av_log2(wanted_spec.freq / AUDIO_MAX_CALLBACKS_PER_SEC));
 	wanted_spec.callback = sdl_audio_callback;
 	wanted_spec.userdata = opaque;
 	while (initAudio(&wanted_spec, &spec) < 0) {
@@ -1534,7 +1828,7 @@ static int audio_open(void *opaque, int64_t wanted_channel_layout, int wanted_nb
 		}
 		wanted_channel_layout = av_get_default_channel_layout(wanted_spec.channels);
 	}
-	if (spec.format != AUDIO_S16SYS) {
+	if (spec.format != AUDIO_F32SYS) {
 		My_log(NULL, AV_LOG_ERROR,
 			"SDL advised audio format %d is not supported!\n", spec.format);
 		CloseAudio();
@@ -1550,7 +1844,7 @@ static int audio_open(void *opaque, int64_t wanted_channel_layout, int wanted_nb
 		}
 	}
 
-	audio_hw_params->fmt = AV_SAMPLE_FMT_S16;
+	audio_hw_params->fmt = AV_SAMPLE_FMT_FLT;
 	audio_hw_params->freq = spec.freq;
 	audio_hw_params->channel_layout = wanted_channel_layout;
 	audio_hw_params->channels = spec.channels;
@@ -1576,7 +1870,10 @@ static void stream_component_close(VideoState *is, int stream_index)
 	switch (avctx->codec_type) {
 	case AVMEDIA_TYPE_AUDIO:
 		decoder_abort(&is->auddec, &is->sampq);
+		waitThread(is->audio_render_tid, NULL);
+		is->audio_render_tid = NULL;
 		CloseAudioChanelByVideoState(is);
+		audio_ring_free(&is->audio_ring);
 		//CloseAudio();
 		decoder_destroy(&is->auddec);
 		swr_free(&is->swr_ctx);
@@ -2331,7 +2628,7 @@ fail:
 
 static int configure_audio_filters(VideoState *is, const char *afilters, int force_output_format)
 {
-	static const enum AVSampleFormat sample_fmts[] = { AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_NONE };
+	static const enum AVSampleFormat sample_fmts[] = { AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_NONE };
 	int sample_rates[2] = { 0, -1 };
 	int64_t channel_layouts[2] = { 0, -1 };
 	int channels[2] = { 0, -1 };
@@ -2898,6 +3195,11 @@ static int stream_component_open(VideoState *is, int stream_index)
 		if ((ret = audio_open(is, channel_layout, nb_channels, sample_rate, &is->audio_tgt)) < 0)
 			goto fail;
 		is->audio_hw_buf_size = ret;
+		/* a few device buffers ahead, at least 100ms */
+		if ((ret = audio_ring_init(&is->audio_ring, FFMAX(4 * is->audio_hw_buf_size, is->audio_tgt.bytes_per_sec / 10))) < 0) {
+			CloseAudioChanelByVideoState(is);
+			goto fail;
+		}
 		is->audio_src = is->audio_tgt;
 		is->audio_buf_size = 0;
 		is->audio_buf_index = 0;
@@ -2918,6 +3220,7 @@ static int stream_component_open(VideoState *is, int stream_index)
 			is->auddec.start_pts_tb = is->audio_st->time_base;
 		}
 		decoder_start(&is->auddec, audio_thread, is);
+		is->audio_render_tid = createThread(audio_render_thread, is);
 		//PauseAudio(0);
 		break;
 	case AVMEDIA_TYPE_VIDEO:
@@ -2994,6 +3297,8 @@ static int read_thread(void *arg)
 	mutex_t *wait_mutex = createMutex();
 	int scan_all_pmts_set = 0;
 	int64_t pkt_ts;
+	int is_hls = 0;
+	int64_t abr_update_time = 0;
 
 	memset(st_index, -1, sizeof(st_index));
 	is->last_video_stream = is->video_stream = -1;
@@ -3029,6 +3334,8 @@ static int read_thread(void *arg)
 		av_dict_set(&format_opts, "scan_all_pmts", "1", AV_DICT_DONT_OVERWRITE);
 		scan_all_pmts_set = 1;
 	}
+	if (abr_policy)
+		av_dict_set_int(&format_opts, "abr", abr_policy, 0);
 	err = avformat_open_input(&ic, is->filename, is->iformat, &format_opts);
 	if (err < 0) {
 		char errmsg[1024];
@@ -3042,6 +3349,8 @@ static int read_thread(void *arg)
 	
 	//if (scan_all_pmts_set)
 		av_dict_set(&format_opts, "scan_all_pmts", NULL, AV_DICT_MATCH_CASE);
+	/* only the hls demuxer knows abr */
+	av_dict_set(&format_opts, "abr", NULL, AV_DICT_MATCH_CASE);
 
 	if ((t = av_dict_get(format_opts, "", NULL, AV_DICT_IGNORE_SUFFIX))) {
 		My_log(NULL, AV_LOG_ERROR, "Option %s not found.\n", t->key);
@@ -3051,6 +3360,9 @@ static int read_thread(void *arg)
 		goto fail;
 	}
 	is->ic = ic;
+	is_hls = !strcmp(ic->iformat->name, "hls,applehttp");
+	if (is_hls && (t = av_dict_get(ic->metadata, "variant_bitrate", NULL, 0)))
+		is->variant_bitrate = atoi(t->value);
 
 	if (genpts)
 		ic->flags |= AVFMT_FLAG_GENPTS;
@@ -3307,6 +3619,27 @@ static int read_thread(void *arg)
 			is->eof = 0;
 			is->audioq.eof = 0;
 		}
+		/*
+		 * hls: pick up variant switches and report our buffer level,
+		 * which the buffer based adaptation works from
+		 */
+		if (is_hls) {
+			if (ic->event_flags & AVFMT_EVENT_FLAG_METADATA_UPDATED) {
+				ic->event_flags &= ~AVFMT_EVENT_FLAG_METADATA_UPDATED;
+				if ((t = av_dict_get(ic->metadata, "variant_bitrate", NULL, 0)) &&
+					atoi(t->value) != is->variant_bitrate) {
+					is->variant_bitrate = atoi(t->value);
+					is->variant_switches++;
+					My_log(NULL, AV_LOG_INFO, "hls switched to variant %d bps\n", is->variant_bitrate);
+				}
+			}
+			if (abr_policy && av_gettime_relative() - abr_update_time > 250000) {
+				double level = FFMAX(packet_queue_span(&is->videoq, is->video_st),
+					packet_queue_span(&is->audioq, is->audio_st));
+				av_opt_set_int(ic->priv_data, "abr_buffer_level", (int64_t)(level * AV_TIME_BASE), 0);
+				abr_update_time = av_gettime_relative();
+			}
+		}
 		//if (pkt->stream_index == is->audio_stream){
 		//	if (last_read_pts == 0){
 		//		last_read_pts = pkt->pts;
@@ -3398,6 +3731,10 @@ VideoState *stream_open(const char *filename, AVInputFormat *iformat)
     is->isNewFrame = 0;
     is->pyuv420p.w = -10;
     is->pyuv420p.h = -10;
+    is->pyuv420p.matrix = YUV_MATRIX_BT601;
+    is->pyuv420p.full_range = 0;
+	is->audio_gain = 1.0f;
+	is->audio_pan = 0.0f;
 	do 
 	{
 		/* start video display */
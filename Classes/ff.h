@@ -9,10 +9,19 @@ namespace ff
         VIDEO_PIX_YUV420P,
     };
     
+    enum YUVMatrix
+    {
+        YUV_MATRIX_BT601 = 0,
+        YUV_MATRIX_BT709,
+        YUV_MATRIX_BT2020,
+    };
+    
     typedef struct YUV420P{
         int w,h;
         unsigned char * data[3];
         int linesize[3];
+        int matrix;     //YUVMatrix of the picture
+        int full_range; //0 when y goes from 16 to 235 and u,v from 16 to 240
     } YUV420P;
     
 	class FFVideo
@@ -47,8 +56,8 @@ namespace ff
 		int codec_height() const; //Ƶĸ߶
 		/*
 		 *	ˢ,ųҪһ֡ʵøú1/30s
-		 *	ɹһRGB rawָ룬ʽΪTexture2D::PixelFormat::RGB888
-		 *	ֱΪʹ
+		 *	ɹһYUV420Pָ(getPixelFormat)һ֮֡ǰͬһͼ
+		 *	ƽֱӽYUVSprite::updateWithYUV420Pϴ
 		 */
 		void *refresh();
         
@@ -76,6 +85,24 @@ namespace ff
 		 *	ʧܷ-1
 		 */
 		double preload_time();
+		/*
+		 *	HLS master playlists: bit rate of the variant being played and
+		 *	how often adaptation switched variants, see setAbrPolicy.
+		 */
+		int variant_bitrate() const;
+		int variant_switches() const;
+		/*
+		 *	Audio mix bus: gain 1 is unity, pan goes from -1 left to 1 right.
+		 *	audioLevel can be called from any thread, it gives the peak since
+		 *	the previous call and the rms of the last mixed buffer, 1 full scale.
+		 */
+		void setGain(float gain);
+		void setPan(float pan);
+		void audioLevel(float *peak, float *rms);
+		/*
+		 *	Times the audio device ran dry while the stream was playing.
+		 */
+		int audio_underruns() const;
 	private:
 		void* _ctx;
 		bool _first;
@@ -85,6 +112,23 @@ namespace ff
 	* ȡƵļϢ
 	*/
 	int getVideoInfo(const char * filename, int *w, int *h);
+	enum AbrPolicy
+	{
+		ABR_NONE = 0,		//play the variant picked at open
+		ABR_THROUGHPUT = 1,	//follow the measured segment download rate
+		ABR_BUFFER = 2,		//follow the amount of buffered media
+	};
+	/*
+	 * Variant adaptation for HLS streams opened after the call
+	 */
+	void setAbrPolicy(AbrPolicy policy);
+	/*
+	 * Output latency in seconds to aim for when the audio device is opened,
+	 * 0 for the default buffers. getAudioLatency gives the latency measured
+	 * while playing, it is what audio/video sync uses.
+	 */
+	void setAudioLatency(double seconds);
+	double getAudioLatency();
 
 	enum TranCode
 	{
@@ -5,6 +5,7 @@
 #include <limits.h>
 #include <signal.h>
 #include <stdint.h>
+#include <atomic>
 #include "SDLImp.h"
 
 #if __cplusplus
@@ -64,6 +65,8 @@ namespace ff{
 #define AUDIO_MIN_BUFFER_SIZE 512
 	/* Calculate actual buffer size keeping in mind not cause too frequent audio callbacks */
 #define AUDIO_MAX_CALLBACKS_PER_SEC 30
+	/* Smallest SDL audio buffer for a latency target, in samples. */
+#define AUDIO_MIN_TARGET_BUFFER_SIZE 64
 
 	/* no AV sync correction is done if below the minimum AV sync threshold */
 #define AV_SYNC_THRESHOLD_MIN 0.04
@@ -188,6 +191,25 @@ namespace ff{
 		thread_t *decoder_tid;
 	};
 
+	/*
+	 * Resampled audio of a stream on its way to the device: audio_render_thread
+	 * writes, the device callback reads, neither of them locks. Positions count
+	 * bytes since the ring was opened, size is a power of two.
+	 */
+	struct AudioRing {
+		uint8_t *data;
+		std::atomic<int> size; //0 until data is allocated
+		std::atomic<unsigned int> wpos;
+		std::atomic<unsigned int> rpos;
+		std::atomic<unsigned int> seq; //odd while the writer updates the fields below
+		std::atomic<unsigned int> discard; //bytes before this are from an older serial
+		std::atomic<double> clock; //audio clock at wpos
+		std::atomic<int> serial; //serial of the data at wpos
+		std::atomic<int> queue_serial; //audioq.serial as the writer last saw it, differs from serial after a seek
+		std::atomic<int> underruns;
+		int starved; //the callback ran out of data, owned by the callback
+	};
+
 	enum ShowMode {
 		SHOW_MODE_NONE = -1, SHOW_MODE_VIDEO = 0, SHOW_MODE_WAVES, SHOW_MODE_RDFT, SHOW_MODE_NB
 	};
@@ -213,6 +235,8 @@ namespace ff{
         int w,h;
         uint8_t * data[3];
         int linesize[3];
+        int matrix;     //YUVMatrix, chosen per frame by yuv_matrix
+        int full_range;
     } yuv420p;
     
 	struct VideoState {
@@ -256,13 +280,13 @@ namespace ff{
 		AVStream *audio_st;
 		PacketQueue audioq;
 		int audio_hw_buf_size;
-		uint8_t silence_buf[AUDIO_MIN_BUFFER_SIZE];
 		uint8_t *audio_buf;
 		uint8_t *audio_buf1;
 		unsigned int audio_buf_size; /* in bytes */
 		unsigned int audio_buf1_size;
 		int audio_buf_index; /* in bytes */
-		int audio_write_buf_size;
+		AudioRing audio_ring;
+		thread_t *audio_render_tid;
 		struct AudioParams audio_src;
 #if CONFIG_AVFILTER
 		struct AudioParams audio_filter_src;
@@ -330,6 +354,12 @@ namespace ff{
 		int nMIN_FRAMES;
 		const char *errmsg;
 		int errcode;
+		int variant_bitrate; //bit rate of the HLS variant being played, 0 if unknown
+		int variant_switches;
+		std::atomic<float> audio_gain; //mix bus gain, 1 is unity
+		std::atomic<float> audio_pan; //-1 left .. 1 right
+		std::atomic<float> audio_peak; //largest sample mixed since audio_level read it
+		std::atomic<float> audio_rms; //of the last buffer mixed
         
 #if CONFIG_VIDEOTOOLBOX
         /* hwaccel options */
@@ -358,6 +388,9 @@ namespace ff{
 	void stream_close(VideoState *is); //ֹ̣ͣ߳ͷڴ
 	void stream_toggle_pause(VideoState *is); //תźͣ
 	void toggle_pause(VideoState *is); //ͬ
+	void set_abr_policy(int policy); //HLS variant adaptation for streams opened afterwards, 0 none 1 throughput 2 buffer
+	void set_audio_latency(double seconds); //output latency to aim for when the audio device opens, 0 for the default buffers
+	double get_audio_latency(); //measured by the driver while playing, 0 when the device is closed
 	int is_stream_pause(VideoState *is); //жƵǷͣ
 
 	void video_refresh(VideoState *is, double *remaining_time);
@@ -66,7 +66,23 @@
 #include <errno.h>
 #include <time.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #include <signal.h>
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define USE_EPOLL 1
+#else
+#define USE_EPOLL 0
+#endif
+/* worker threads need their own epoll loop */
+#define USE_WORKERS (USE_EPOLL && HAVE_PTHREADS)
 
 #include "cmdutils.h"
 #include "ffserver_config.h"
@@ -115,6 +131,16 @@ static const char * const http_state[] = {
 
 #define SYNC_TIMEOUT (10 * 1000)
 
+/* muxed data kept for the clients of a shared output: the chunks since the
+ * last key frame are always kept, older ones beyond these limits dropped */
+#define SHARED_MAX_CHUNKS 1024
+#define SHARED_MAX_BYTES  (4 * 1024 * 1024)
+/* chunks sent by a single writev() */
+#define SHARED_IOV        16
+
+/* bound of the key frames indexed over a time-shift window */
+#define TIME_SHIFT_MAX_ENTRIES 16384
+
 typedef struct RTSPActionServerSetup {
     uint32_t ipaddr;
     char transport_option[512];
@@ -125,12 +151,146 @@ typedef struct {
     int64_t time1, time2;
 } DataRateData;
 
+typedef struct FeedEvent {
+    struct FFServerStream *feed;
+    int closed;                   /* the feeder went away */
+} FeedEvent;
+
+/* An event loop. The main loop owns the listening sockets, the RTSP and
+ * RTP sessions and the feeders. Worker loops only stream HTTP connections,
+ * handed over to them once the reply header has been sent. */
+typedef struct EventLoop {
+    int epoll_fd;
+    int wake_fd;                  /* eventfd signalled by other threads */
+    int listen_fd[2];             /* HTTP and RTSP, main loop only */
+    int listen_ready[2];
+    int64_t cur_time;             /* in ms, sampled once per iteration */
+    int64_t wake_time;            /* in us, when the last wait returned */
+    int64_t last_tick;
+    struct HTTPContext *first_ctx;    /* connections served by this loop */
+    struct HTTPContext *ready;        /* to be handled without waiting */
+    struct HTTPContext *running;      /* being handled */
+    struct HTTPContext *tick;         /* packetized, handled every 10 ms */
+    int woken;
+#if USE_WORKERS
+    pthread_t thread;
+    pthread_mutex_t lock;         /* protects the fields below */
+#endif
+    int wake_pending;
+    int nb_conns;                 /* connections served by a worker */
+    struct HTTPContext *inbox;    /* handed over by another loop */
+    FeedEvent *feed_events;       /* feeds with new data, workers only */
+    int nb_feed_events;
+    unsigned int feed_events_size;
+    /* read by the metrics page */
+    uint64_t iterations;
+    int64_t busy_time;            /* in us, spent handling events */
+    int64_t busy_max;             /* in us, since the previous read */
+} EventLoop;
+
+/* Counters of the metrics page, maintained as things happen so that it
+ * does not walk the connections. Those the workers update are changed
+ * atomically. */
+typedef struct StreamMetrics {
+    struct FFServerStream *stream;
+    int clients;                  /* HTTP connections to the stream */
+    uint64_t send_stalls;         /* sends which found the socket full */
+    int64_t bytes_received;       /* feeds only */
+    DataRateData sent_rate;       /* updated every second */
+    DataRateData received_rate;
+    struct StreamMetrics *next;
+} StreamMetrics;
+
+typedef struct ServerMetrics {
+    uint64_t conns_accepted;
+    uint64_t conns_refused;       /* too many connections or no bandwidth */
+    uint64_t conns_timed_out;     /* no request received in time */
+    uint64_t conns_dropped;       /* clients gone before the end of stream */
+    uint64_t send_stalls;
+} ServerMetrics;
+
+typedef struct SharedChunk {
+    AVBufferRef *buf;             /* output of one packet */
+    int key;                      /* starts with a key frame */
+} SharedChunk;
+
+/* Output of a live stream muxed once and sent to all its clients. The
+ * chunks are reference counted, a client only holds the ones it is
+ * sending. */
+typedef struct SharedOutput {
+    struct HTTPContext *mux;      /* feed reader and muxer, not connected */
+    AVBufferRef *header;          /* may be NULL if the header is empty */
+    int started, ended;
+    SharedChunk chunks[SHARED_MAX_CHUNKS];
+    int64_t first_seq, next_seq;  /* chunks held */
+    int64_t last_key_seq;         /* -1 if none held */
+    int64_t size;                 /* bytes held */
+    int nb_clients;
+#if USE_WORKERS
+    pthread_mutex_t lock;         /* protects the chunks, header and ended */
+#endif
+    struct SharedOutput *next;
+} SharedOutput;
+
+/* A feed file mapped in memory. The feeder copies the packets into it and
+ * publishes the write index in the FFM header, the readers demux from the
+ * mapping: no system call per packet, and a single copy of the feed in the
+ * page cache. */
+typedef struct FeedMap {
+    FFServerStream *feed;
+    int fd;
+    uint8_t *data;
+    int64_t size;                 /* mapped bytes */
+    int64_t file_size;            /* readable bytes, read atomically */
+    int64_t alloc_size;           /* file size on disk, feeder only */
+    int writable;
+    int refs;
+#if USE_WORKERS
+    pthread_rwlock_t lock;        /* held for writing while truncating */
+#endif
+    struct FeedMap *next;
+} FeedMap;
+
+typedef struct FeedReader {
+    FeedMap *map;
+    int64_t pos;
+} FeedReader;
+
+typedef struct TimeShiftEntry {
+    int64_t dts;                  /* of a key frame, in AV_TIME_BASE */
+    int64_t pos;                  /* FFM packet where its header starts */
+} TimeShiftEntry;
+
+/* Key frames of a feed within its time-shift window, so that a client can
+ * start right away from any point of the window. The feeder indexes them
+ * as it writes the packets. */
+typedef struct TimeShiftIndex {
+    FFServerStream *feed;
+    TimeShiftEntry entries[TIME_SHIFT_MAX_ENTRIES];
+    int first, nb;                /* entries held, as a ring */
+    int key_stream;
+    int64_t live_dts;             /* last frame written */
+    int warned;
+    /* frame parser state, across the FFM packets */
+    int synced;
+    int skip;                     /* frame data left before the next header */
+    uint8_t header[FRAME_HEADER_SIZE + 4];
+    int header_len;
+    int64_t header_pos;
+    struct TimeShiftIndex *next;
+} TimeShiftIndex;
+
 /* context associated with one connection */
 typedef struct HTTPContext {
     enum HTTPState state;
     int fd; /* socket file descriptor */
     struct sockaddr_in from_addr; /* origin */
     struct pollfd *poll_entry; /* used when polling */
+    int revents; /* readiness not consumed yet (POLLIN, POLLOUT, POLLERR, POLLHUP) */
+    struct EventLoop *loop; /* loop serving this connection */
+    struct HTTPContext *loop_next; /* in loop->first_ctx or an inbox */
+    struct HTTPContext *ready_next; /* in loop->ready, running or tick */
+    int queued;
     int64_t timeout;
     uint8_t *buffer_ptr, *buffer_end;
     int http_error;
@@ -142,6 +302,8 @@ typedef struct HTTPContext {
     int64_t data_count;
     /* feed input */
     int feed_fd;
+    struct FeedMap *feed_map; /* written or read by this connection */
+    struct StreamMetrics *metrics; /* of the stream, HTTP only */
     /* input format handling */
     AVFormatContext *fmt_in;
     int64_t start_time;            /* In milliseconds - this wraps fairly often */
@@ -170,6 +332,7 @@ typedef struct HTTPContext {
     int buffer_size;
     uint8_t *buffer;
     int is_packetized; /* if true, the stream is packetized */
+    int key_packet; /* the last packet read is a key frame */
     int packet_stream_index; /* current stream for output in state machine */
 
     /* RTSP state specific */
@@ -188,6 +351,14 @@ typedef struct HTTPContext {
     /* RTP/TCP specific */
     struct HTTPContext *rtsp_c;
     uint8_t *packet_buffer, *packet_buffer_ptr, *packet_buffer_end;
+
+    /* shared output specific */
+    struct SharedOutput *shared;
+    int64_t shared_seq; /* next chunk to send */
+    int shared_wait_key; /* skip chunks until a key frame */
+    AVBufferRef *shared_refs[SHARED_IOV]; /* chunks being sent */
+    int nb_shared_refs;
+    int shared_offset; /* bytes of shared_refs[0] already sent */
 } HTTPContext;
 
 typedef struct FeedData {
@@ -204,18 +375,23 @@ static FFServerConfig config = {
     .use_defaults = 1,
 };
 
-static void new_connection(int server_fd, int is_rtsp);
+static int new_connection(int server_fd, int is_rtsp);
 static void close_connection(HTTPContext *c);
+static void conn_queue(HTTPContext *c);
 
 /* HTTP handling */
 static int handle_connection(HTTPContext *c);
 static inline void print_stream_params(AVIOContext *pb, FFServerStream *stream);
 static void compute_status(HTTPContext *c);
+static int compute_metrics(HTTPContext *c, const char *info);
 static int open_input_stream(HTTPContext *c, const char *info);
 static int http_parse_request(HTTPContext *c);
 static int http_send_data(HTTPContext *c);
 static int http_start_receive_data(HTTPContext *c);
 static int http_receive_data(HTTPContext *c);
+static void shared_attach(HTTPContext *c);
+static void shared_detach(HTTPContext *c);
+static void shared_pump_feed(FFServerStream *feed);
 
 /* RTSP handling */
 static int rtsp_parse_request(HTTPContext *c);
@@ -254,6 +430,24 @@ static uint64_t current_bandwidth;
 /* Making this global saves on passing it around everywhere */
 static int64_t cur_time;
 
+static EventLoop main_loop = { .epoll_fd = -1, .wake_fd = -1 };
+
+static SharedOutput *first_shared;
+static FeedMap *first_feed_map;
+static TimeShiftIndex *first_time_shift;
+
+static ServerMetrics metrics;
+static StreamMetrics *first_stream_metrics;
+
+static EventLoop *workers;
+
+#if USE_WORKERS
+/* the logfile, the feed write indexes and bytes_served are the only state
+ * the workers share with the main loop, besides the feed maps */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 static AVLFG random_state;
 
 static FILE *logfile = NULL;
@@ -299,6 +493,22 @@ static void ffm_set_write_index(AVFormatContext *s, int64_t pos,
     ffm->file_size = file_size;
 }
 
+/* move the FFM demuxer to the packet at pos, it resumes on the first frame
+ * starting in that packet */
+static int ffm_seek_packet(AVFormatContext *s, int64_t pos)
+{
+    FFMContext *ffm = s->priv_data;
+    int64_t ret = avio_seek(s->pb, pos, SEEK_SET);
+
+    if (ret < 0)
+        return ret;
+    ffm->read_state   = READ_HEADER;
+    ffm->packet_ptr   = ffm->packet;
+    ffm->packet_end   = ffm->packet;
+    ffm->first_packet = 1;
+    return 0;
+}
+
 static char *ctime1(char *buf2, int buf_size)
 {
     time_t ti;
@@ -321,6 +531,9 @@ static void http_vlog(const char *fmt, va_list vargs)
     if (!logfile)
         return;
 
+#if USE_WORKERS
+    pthread_mutex_lock(&log_lock);
+#endif
     if (print_prefix) {
         ctime1(buf, sizeof(buf));
         fprintf(logfile, "%s ", buf);
@@ -328,6 +541,9 @@ static void http_vlog(const char *fmt, va_list vargs)
     print_prefix = strstr(fmt, "\n") != NULL;
     vfprintf(logfile, fmt, vargs);
     fflush(logfile);
+#if USE_WORKERS
+    pthread_mutex_unlock(&log_lock);
+#endif
 }
 
 #ifdef __GNUC__
@@ -363,15 +579,15 @@ static void log_connection(HTTPContext *c)
              c->protocol, (c->http_error ? c->http_error : 200), c->data_count);
 }
 
-static void update_datarate(DataRateData *drd, int64_t count)
+static void update_datarate(DataRateData *drd, int64_t count, int64_t now)
 {
     if (!drd->time1 && !drd->count1) {
-        drd->time1 = drd->time2 = cur_time;
+        drd->time1 = drd->time2 = now;
         drd->count1 = drd->count2 = count;
-    } else if (cur_time - drd->time2 > 5000) {
+    } else if (now - drd->time2 > 5000) {
         drd->time1 = drd->time2;
         drd->count1 = drd->count2;
-        drd->time2 = cur_time;
+        drd->time2 = now;
         drd->count2 = count;
     }
 }
@@ -385,6 +601,507 @@ static int compute_datarate(DataRateData *drd, int64_t count)
     return ((count - drd->count1) * 1000) / (cur_time - drd->time1);
 }
 
+static inline void lock_shared(void)
+{
+#if USE_WORKERS
+    pthread_mutex_lock(&shared_lock);
+#endif
+}
+
+static inline void unlock_shared(void)
+{
+#if USE_WORKERS
+    pthread_mutex_unlock(&shared_lock);
+#endif
+}
+
+static void add_bytes_served(FFServerStream *stream, int64_t len)
+{
+    lock_shared();
+    stream->bytes_served += len;
+    unlock_shared();
+}
+
+static inline void metrics_inc(uint64_t *counter)
+{
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t metrics_get(uint64_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void metrics_init(void)
+{
+    FFServerStream *stream;
+    StreamMetrics *m, **mp = &first_stream_metrics;
+
+    for (stream = config.first_stream; stream; stream = stream->next) {
+        m = av_mallocz(sizeof(*m));
+        if (!m)
+            return;
+        m->stream = stream;
+        *mp = m;
+        mp = &m->next;
+    }
+}
+
+static StreamMetrics *stream_metrics(FFServerStream *stream)
+{
+    StreamMetrics *m;
+
+    for (m = first_stream_metrics; m; m = m->next)
+        if (m->stream == stream)
+            return m;
+    return NULL;
+}
+
+/* sample the byte counts for the rates, every second from the main loop */
+static void metrics_update(void)
+{
+    StreamMetrics *m;
+    int64_t bytes;
+
+    for (m = first_stream_metrics; m; m = m->next) {
+        lock_shared();
+        bytes = m->stream->bytes_served;
+        unlock_shared();
+        update_datarate(&m->sent_rate, bytes, cur_time);
+        update_datarate(&m->received_rate, m->bytes_received, cur_time);
+    }
+}
+
+/* the socket buffer of c is full */
+static void conn_stalled(HTTPContext *c)
+{
+    c->revents &= ~POLLOUT;
+    metrics_inc(&metrics.send_stalls);
+    if (c->metrics)
+        metrics_inc(&c->metrics->send_stalls);
+}
+
+/* the time spent handling events since the loop woke up is the latency it
+ * added to the events arriving meanwhile */
+static void loop_account(EventLoop *loop)
+{
+    int64_t busy = av_gettime() - loop->wake_time;
+    int64_t max;
+
+    __atomic_store_n(&loop->iterations, loop->iterations + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&loop->busy_time, loop->busy_time + busy,
+                     __ATOMIC_RELAXED);
+    max = __atomic_load_n(&loop->busy_max, __ATOMIC_RELAXED);
+    /* the metrics reader resets busy_max concurrently */
+    while (busy > max &&
+           !__atomic_compare_exchange_n(&loop->busy_max, &max, busy, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static inline void feed_map_rdlock(FeedMap *map)
+{
+#if USE_WORKERS
+    pthread_rwlock_rdlock(&map->lock);
+#endif
+}
+
+static inline void feed_map_wrlock(FeedMap *map)
+{
+#if USE_WORKERS
+    if (map)
+        pthread_rwlock_wrlock(&map->lock);
+#endif
+}
+
+static inline void feed_map_unlock(FeedMap *map)
+{
+#if USE_WORKERS
+    if (map)
+        pthread_rwlock_unlock(&map->lock);
+#endif
+}
+
+/* return the map of a feed file, or NULL to use file I/O. The maps are
+ * opened and released from the main loop only. */
+static FeedMap *feed_map_open(FFServerStream *feed)
+{
+#if HAVE_MMAP
+    FeedMap *map;
+    int64_t size;
+
+    for (map = first_feed_map; map; map = map->next) {
+        if (map->feed == feed) {
+            map->refs++;
+            return map;
+        }
+    }
+    /* the whole ring must be mapped */
+    if (!feed->feed_max_size)
+        return NULL;
+
+    map = av_mallocz(sizeof(*map));
+    if (!map)
+        return NULL;
+    map->writable = !feed->readonly;
+    map->fd = open(feed->feed_filename, map->writable ? O_RDWR : O_RDONLY);
+    if (map->fd < 0)
+        goto fail;
+    size = lseek(map->fd, 0, SEEK_END);
+    if (size < FFM_PACKET_SIZE)
+        goto fail;
+    map->file_size = map->alloc_size = size;
+    /* the feeder wraps around once past feed_max_size, the pages beyond
+     * the end of the file are only touched after it has grown */
+    map->size = FFMAX(size, feed->feed_max_size + FFM_PACKET_SIZE);
+    if ((uint64_t)map->size > SIZE_MAX)
+        goto fail;
+    map->data = mmap(NULL, map->size,
+                     map->writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                     MAP_SHARED, map->fd, 0);
+    if (map->data == MAP_FAILED)
+        goto fail;
+#if USE_WORKERS
+    pthread_rwlock_init(&map->lock, NULL);
+#endif
+    map->feed = feed;
+    map->refs = 1;
+    map->next = first_feed_map;
+    first_feed_map = map;
+    return map;
+
+fail:
+    http_log("Could not map feed file '%s', using file I/O\n",
+             feed->feed_filename);
+    if (map->fd >= 0)
+        close(map->fd);
+    av_free(map);
+#endif
+    return NULL;
+}
+
+static void feed_map_unref(FeedMap **pmap)
+{
+    FeedMap **mp, *map = *pmap;
+
+    if (!map)
+        return;
+    *pmap = NULL;
+    if (--map->refs)
+        return;
+
+    for (mp = &first_feed_map; *mp; mp = &(*mp)->next) {
+        if (*mp == map) {
+            *mp = map->next;
+            break;
+        }
+    }
+#if HAVE_MMAP
+    munmap(map->data, map->size);
+#endif
+    close(map->fd);
+#if USE_WORKERS
+    pthread_rwlock_destroy(&map->lock);
+#endif
+    av_free(map);
+}
+
+/* copy a packet in the map at pos, feeder only */
+static int feed_map_write(FeedMap *map, int64_t pos, const uint8_t *buf)
+{
+    int64_t end = pos + FFM_PACKET_SIZE;
+
+    if (end > map->size)
+        return AVERROR(ENOSPC);
+    /* grow the file before touching its new pages */
+    if (end > map->alloc_size) {
+        if (ftruncate(map->fd, end) < 0)
+            return AVERROR(errno);
+        map->alloc_size = end;
+    }
+    memcpy(map->data + pos, buf, FFM_PACKET_SIZE);
+    return 0;
+}
+
+/* make the packets written visible to the readers. The size is stored
+ * first, so that a reader seeing the new index also sees the data it
+ * points to. The index stays big-endian, as in any FFM file. */
+static void feed_map_publish(FeedMap *map, int64_t write_index,
+                             int64_t file_size)
+{
+    __atomic_store_n(&map->file_size, file_size, __ATOMIC_RELEASE);
+    __atomic_store_n((uint64_t *)(map->data + 8), av_be2ne64(write_index),
+                     __ATOMIC_RELEASE);
+}
+
+static int64_t feed_map_write_index(FeedMap *map, int64_t *file_size)
+{
+    int64_t write_index;
+
+    write_index = av_be2ne64(__atomic_load_n((uint64_t *)(map->data + 8),
+                                             __ATOMIC_ACQUIRE));
+    *file_size = __atomic_load_n(&map->file_size, __ATOMIC_ACQUIRE);
+    return FFMAX(write_index, FFM_PACKET_SIZE);
+}
+
+static int feed_map_read(void *opaque, uint8_t *buf, int buf_size)
+{
+    FeedReader *r = opaque;
+    FeedMap *map = r->map;
+    int64_t size;
+
+    feed_map_rdlock(map);
+    size = __atomic_load_n(&map->file_size, __ATOMIC_ACQUIRE);
+    if (r->pos >= size) {
+        feed_map_unlock(map);
+        return AVERROR_EOF;
+    }
+    buf_size = FFMIN(buf_size, size - r->pos);
+    memcpy(buf, map->data + r->pos, buf_size);
+    feed_map_unlock(map);
+    r->pos += buf_size;
+    return buf_size;
+}
+
+static int64_t feed_map_seek(void *opaque, int64_t offset, int whence)
+{
+    FeedReader *r = opaque;
+    int64_t size = __atomic_load_n(&r->map->file_size, __ATOMIC_ACQUIRE);
+
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return size;
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += r->pos;
+        break;
+    case SEEK_END:
+        offset += size;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (offset < 0)
+        return AVERROR(EINVAL);
+    r->pos = offset;
+    return offset;
+}
+
+/* I/O context demuxing a feed from its map */
+static AVIOContext *feed_map_alloc_input(FeedMap *map)
+{
+    FeedReader *r = av_mallocz(sizeof(*r));
+    uint8_t *buf = av_malloc(FFM_PACKET_SIZE);
+    AVIOContext *pb = NULL;
+
+    if (r && buf)
+        pb = avio_alloc_context(buf, FFM_PACKET_SIZE, 0, r,
+                                feed_map_read, NULL, feed_map_seek);
+    if (!pb) {
+        av_free(r);
+        av_free(buf);
+        return NULL;
+    }
+    r->map = map;
+    return pb;
+}
+
+static void feed_map_free_input(AVIOContext **ppb)
+{
+    AVIOContext *pb = *ppb;
+
+    if (!pb)
+        return;
+    av_freep(&pb->opaque);
+    av_freep(&pb->buffer);
+    av_freep(ppb);
+}
+
+/* key frames of the time-shift window of a feed, oldest first */
+static inline TimeShiftEntry *time_shift_entry(TimeShiftIndex *ts, int i)
+{
+    return &ts->entries[(ts->first + i) % TIME_SHIFT_MAX_ENTRIES];
+}
+
+/* return the index of a feed with a time-shift window, NULL otherwise.
+ * The indexes are only used from the main loop and kept while the server
+ * runs, so that the window survives the feeder reconnecting. */
+static TimeShiftIndex *time_shift_get(FFServerStream *feed)
+{
+    TimeShiftIndex *ts;
+    int i;
+
+    if (!feed || feed->time_shift <= 0)
+        return NULL;
+    for (ts = first_time_shift; ts; ts = ts->next)
+        if (ts->feed == feed)
+            return ts;
+
+    ts = av_mallocz(sizeof(*ts));
+    if (!ts)
+        return NULL;
+    ts->feed = feed;
+    ts->live_dts = AV_NOPTS_VALUE;
+    /* index the video key frames, or those of the first stream */
+    for (i = 0; i < feed->nb_streams; i++) {
+        if (feed->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO) {
+            ts->key_stream = i;
+            break;
+        }
+    }
+    ts->next = first_time_shift;
+    first_time_shift = ts;
+    return ts;
+}
+
+static void time_shift_drop_oldest(TimeShiftIndex *ts)
+{
+    ts->first = (ts->first + 1) % TIME_SHIFT_MAX_ENTRIES;
+    ts->nb--;
+}
+
+static void time_shift_add(TimeShiftIndex *ts, int64_t dts, int64_t pos)
+{
+    int64_t window = ts->feed->time_shift;
+    TimeShiftEntry *e;
+
+    if (ts->nb) {
+        e = time_shift_entry(ts, ts->nb - 1);
+        if (dts < e->dts)
+            /* the timestamps went back: new feeder session */
+            ts->nb = 0;
+        else if (dts - e->dts < window / TIME_SHIFT_MAX_ENTRIES)
+            /* spread the entries over the window */
+            return;
+    }
+    if (ts->nb == TIME_SHIFT_MAX_ENTRIES)
+        time_shift_drop_oldest(ts);
+    e = time_shift_entry(ts, ts->nb++);
+    e->dts = dts;
+    e->pos = pos;
+
+    while (time_shift_entry(ts, 0)->dts < dts - window)
+        time_shift_drop_oldest(ts);
+}
+
+/* follow the frames of the FFM packet the feeder wrote at pos, and index
+ * the key frames. A frame header may span two packets. */
+static void time_shift_parse_packet(TimeShiftIndex *ts, int64_t pos,
+                                    const uint8_t *pkt)
+{
+    int frame_offset = AV_RB16(pkt + 12);
+    int end = FFM_PACKET_SIZE - AV_RB16(pkt + 2);
+    int p = FFM_HEADER_SIZE, len, header_size;
+    int64_t dts;
+
+    /* what was in this packet left the file */
+    while (ts->nb && time_shift_entry(ts, 0)->pos == pos) {
+        if (!ts->warned &&
+            time_shift_entry(ts, 0)->dts > ts->live_dts - ts->feed->time_shift) {
+            http_log("Feed file '%s' is too small for its time-shift window, "
+                     "increase FileMaxSize\n", ts->feed->feed_filename);
+            ts->warned = 1;
+        }
+        time_shift_drop_oldest(ts);
+    }
+
+    if (end < p)
+        return;
+    if (!ts->synced || (frame_offset & 0x8000)) {
+        /* resync on the first frame starting in this packet */
+        frame_offset &= 0x7fff;
+        ts->synced = frame_offset >= FFM_HEADER_SIZE && frame_offset < end;
+        if (!ts->synced)
+            return;
+        p = frame_offset;
+        ts->skip = 0;
+        ts->header_len = 0;
+    }
+
+    while (p < end) {
+        if (ts->skip) {
+            len = FFMIN(ts->skip, end - p);
+            ts->skip -= len;
+            p += len;
+            continue;
+        }
+        if (!ts->header_len)
+            ts->header_pos = pos;
+        header_size = ts->header_len >= 2 && (ts->header[1] & FLAG_DTS) ?
+                      FRAME_HEADER_SIZE + 4 : FRAME_HEADER_SIZE;
+        len = FFMIN(header_size - ts->header_len, end - p);
+        memcpy(ts->header + ts->header_len, pkt + p, len);
+        ts->header_len += len;
+        p += len;
+        if (ts->header_len < FRAME_HEADER_SIZE ||
+            ((ts->header[1] & FLAG_DTS) &&
+             ts->header_len < FRAME_HEADER_SIZE + 4))
+            continue;
+
+        if (ts->header[0] >= ts->feed->nb_streams) {
+            ts->synced = 0;
+            return;
+        }
+        dts = AV_RB64(ts->header + 8);
+        if (ts->header[1] & FLAG_DTS)
+            dts -= AV_RB32(ts->header + 16);
+        ts->live_dts = dts;
+        if (ts->header[0] == ts->key_stream &&
+            (ts->header[1] & FLAG_KEY_FRAME))
+            time_shift_add(ts, dts, ts->header_pos);
+        ts->skip = AV_RB24(ts->header + 2);
+        ts->header_len = 0;
+    }
+}
+
+/* a new feeder connected, the file was truncated if it was asked to */
+static void time_shift_start_feed(FFServerStream *feed)
+{
+    TimeShiftIndex *ts = time_shift_get(feed);
+
+    if (!ts)
+        return;
+    ts->synced = 0;
+    if (feed->truncate)
+        ts->nb = 0;
+}
+
+/* timestamp of the live edge of a feed, in AV_TIME_BASE */
+static int64_t time_shift_live(FFServerStream *feed)
+{
+    TimeShiftIndex *ts = time_shift_get(feed);
+
+    if (!ts || ts->live_dts == AV_NOPTS_VALUE)
+        return av_gettime();
+    return ts->live_dts;
+}
+
+/* return the key frame to start from to play a feed from t: the last one
+ * before t, the oldest one if t is out of the window, NULL if the feed has
+ * no time-shift window */
+static TimeShiftEntry *time_shift_find(FFServerStream *feed, int64_t t)
+{
+    TimeShiftIndex *ts = time_shift_get(feed);
+    int lo, hi, mid;
+
+    if (!ts || !ts->nb)
+        return NULL;
+    if (time_shift_entry(ts, 0)->dts >= t)
+        return time_shift_entry(ts, 0);
+
+    lo = 0;
+    hi = ts->nb - 1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) >> 1;
+        if (time_shift_entry(ts, mid)->dts <= t)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return time_shift_entry(ts, lo);
+}
 
 static void start_children(FFServerStream *feed)
 {
@@ -413,7 +1130,15 @@ static void start_children(FFServerStream *feed)
 
         feed->pid_start = time(0);
 
+#if USE_WORKERS
+        /* the child logs before exec(), do not let it inherit the log
+         * locked by a worker */
+        pthread_mutex_lock(&log_lock);
+#endif
         feed->pid = fork();
+#if USE_WORKERS
+        pthread_mutex_unlock(&log_lock);
+#endif
         if (feed->pid < 0) {
             http_log("Unable to create children\n");
             exit(1);
@@ -473,7 +1198,7 @@ static int socket_open_listen(struct sockaddr_in *my_addr)
         goto fail;
     }
 
-    if (listen (server_fd, 5) < 0) {
+    if (listen (server_fd, SOMAXCONN) < 0) {
         perror ("listen");
         goto fail;
     }
@@ -545,49 +1270,516 @@ static void start_multicast(void)
         }
 
         rtp_c->state = HTTPSTATE_SEND_DATA;
+        conn_queue(rtp_c);
     }
 }
 
-/* main loop of the HTTP server */
-static int http_server(void)
+/* return the events the connection is waiting for */
+static int conn_events(HTTPContext *c)
 {
-    int server_fd = 0, rtsp_server_fd = 0;
-    int ret, delay;
-    struct pollfd *poll_table, *poll_entry;
-    HTTPContext *c, *c_next;
+    switch(c->state) {
+    case HTTPSTATE_SEND_HEADER:
+    case RTSPSTATE_SEND_REPLY:
+    case RTSPSTATE_SEND_PACKET:
+        return POLLOUT;
+    case HTTPSTATE_SEND_DATA_HEADER:
+    case HTTPSTATE_SEND_DATA:
+    case HTTPSTATE_SEND_DATA_TRAILER:
+        /* for TCP, we output as much as we can
+         * (may need to put a limit) */
+        return c->is_packetized ? 0 : POLLOUT;
+    case HTTPSTATE_WAIT_REQUEST:
+    case HTTPSTATE_RECEIVE_DATA:
+    case HTTPSTATE_WAIT_FEED:
+    case RTSPSTATE_WAIT_REQUEST:
+        /* need to catch errors */
+        return POLLIN;/* Maybe this will work */
+    default:
+        return 0;
+    }
+}
 
-    poll_table = av_mallocz_array(config.nb_max_http_connections + 2,
-                                  sizeof(*poll_table));
-    if(!poll_table) {
-        http_log("Impossible to allocate a poll table handling %d "
-                 "connections.\n", config.nb_max_http_connections);
-        return -1;
+/* when ffserver is doing the timing, we work by looking at which packet
+ * needs to be sent every 10 ms (one tick wait XXX: 10 ms assumed) */
+static int conn_ticks(HTTPContext *c)
+{
+    return c->is_packetized &&
+           (c->state == HTTPSTATE_SEND_DATA_HEADER ||
+            c->state == HTTPSTATE_SEND_DATA ||
+            c->state == HTTPSTATE_SEND_DATA_TRAILER);
+}
+
+#if USE_EPOLL
+/* handle the connection on the next iteration of its loop, without
+ * waiting for an event. Only called from the thread running c->loop */
+static void conn_queue(HTTPContext *c)
+{
+    EventLoop *loop = c->loop;
+
+    if (c->queued)
+        return;
+    c->queued = 1;
+    c->ready_next = loop->ready;
+    loop->ready = c;
+}
+
+static void conn_dequeue(HTTPContext *c)
+{
+    HTTPContext **lists[3] = { &c->loop->ready, &c->loop->running,
+                               &c->loop->tick };
+    HTTPContext **cp;
+    int i;
+
+    for (i = 0; i < 3 && c->queued; i++) {
+        for (cp = lists[i]; *cp; cp = &(*cp)->ready_next) {
+            if (*cp == c) {
+                *cp = c->ready_next;
+                c->queued = 0;
+                break;
+            }
+        }
     }
+}
 
-    if (config.http_addr.sin_port) {
-        server_fd = socket_open_listen(&config.http_addr);
-        if (server_fd < 0)
-            goto quit;
+static int loop_init(EventLoop *loop)
+{
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0)
+        return AVERROR(errno);
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wake_fd < 0)
+        return AVERROR(errno);
+    ev.data.ptr = loop;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) < 0)
+        return AVERROR(errno);
+#if USE_WORKERS
+    pthread_mutex_init(&loop->lock, NULL);
+#endif
+    return 0;
+}
+
+/* listening sockets are level triggered, only a batch of connections is
+ * accepted per iteration */
+static int loop_listen(EventLoop *loop, int i, int fd)
+{
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    loop->listen_fd[i] = fd;
+    ev.data.ptr = &loop->listen_fd[i];
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        return AVERROR(errno);
+    return 0;
+}
+#else
+static void conn_queue(HTTPContext *c)
+{
+}
+
+static void conn_dequeue(HTTPContext *c)
+{
+}
+#endif
+
+/* Connection sockets are registered once, edge triggered: readiness is
+ * accumulated in c->revents and a bit is only cleared when a read or a
+ * write returns EAGAIN. */
+static int loop_add(EventLoop *loop, HTTPContext *c)
+{
+#if USE_EPOLL
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET };
+
+    ev.data.ptr = c;
+    if (c->fd >= 0 && epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) < 0)
+        return AVERROR(errno);
+#endif
+    c->loop = loop;
+    c->loop_next = loop->first_ctx;
+    loop->first_ctx = c;
+    return 0;
+}
+
+static void loop_remove(EventLoop *loop, HTTPContext *c)
+{
+    HTTPContext **cp;
+
+    conn_dequeue(c);
+    for (cp = &loop->first_ctx; *cp; cp = &(*cp)->loop_next) {
+        if (*cp == c) {
+            *cp = c->loop_next;
+            break;
+        }
     }
+#if USE_EPOLL
+    if (c->fd >= 0)
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+#endif
+}
 
-    if (config.rtsp_addr.sin_port) {
-        rtsp_server_fd = socket_open_listen(&config.rtsp_addr);
-        if (rtsp_server_fd < 0) {
-            closesocket(server_fd);
-            goto quit;
+#if USE_WORKERS
+/* must be called with loop->lock held */
+static void loop_wake(EventLoop *loop)
+{
+    uint64_t one = 1;
+
+    if (loop->wake_pending)
+        return;
+    loop->wake_pending = 1;
+    if (write(loop->wake_fd, &one, sizeof(one)) != sizeof(one))
+        av_log(NULL, AV_LOG_WARNING, "Could not wake up event loop\n");
+}
+
+/* collect what the other threads handed over since the last wake up */
+static HTTPContext *loop_take_inbox(EventLoop *loop)
+{
+    HTTPContext *c, *inbox;
+    int i;
+
+    pthread_mutex_lock(&loop->lock);
+    inbox = loop->inbox;
+    loop->inbox = NULL;
+    loop->wake_pending = 0;
+    if (loop->nb_feed_events) {
+        for (c = loop->first_ctx; c; c = c->loop_next) {
+            if (c->state != HTTPSTATE_WAIT_FEED)
+                continue;
+            for (i = 0; i < loop->nb_feed_events; i++) {
+                FeedEvent *ev = &loop->feed_events[i];
+                if (c->stream->feed != ev->feed)
+                    continue;
+                c->state = ev->closed ? HTTPSTATE_SEND_DATA_TRAILER :
+                                        HTTPSTATE_SEND_DATA;
+                conn_queue(c);
+            }
         }
+        loop->nb_feed_events = 0;
     }
+    pthread_mutex_unlock(&loop->lock);
+    return inbox;
+}
 
-    if (!rtsp_server_fd && !server_fd) {
-        http_log("HTTP and RTSP disabled.\n");
-        goto quit;
+static void notify_feed_event(EventLoop *loop, FFServerStream *feed,
+                              int closed)
+{
+    FeedEvent *ev;
+    int i;
+
+    pthread_mutex_lock(&loop->lock);
+    for (i = 0; i < loop->nb_feed_events; i++)
+        if (loop->feed_events[i].feed == feed)
+            break;
+    if (i == loop->nb_feed_events) {
+        ev = av_fast_realloc(loop->feed_events, &loop->feed_events_size,
+                             (i + 1) * sizeof(*ev));
+        if (!ev) {
+            pthread_mutex_unlock(&loop->lock);
+            return;
+        }
+        loop->feed_events = ev;
+        ev[i].feed = feed;
+        ev[i].closed = 0;
+        loop->nb_feed_events++;
     }
+    loop->feed_events[i].closed |= closed;
+    loop_wake(loop);
+    pthread_mutex_unlock(&loop->lock);
+}
 
-    http_log("FFserver started.\n");
+/* the workers only get one wake up per iteration, whatever the number of
+ * packets received meanwhile */
+static void notify_workers(FFServerStream *feed, int closed)
+{
+    int i;
 
-    start_children(config.first_feed);
+    for (i = 0; i < config.nb_workers; i++)
+        notify_feed_event(&workers[i], feed, closed);
+}
 
-    start_multicast();
+/* a connection can be streamed by a worker once its reply header is sent,
+ * if nothing else needs it on the main loop anymore */
+static int conn_can_hand_off(HTTPContext *c)
+{
+    return config.nb_workers && c->state == HTTPSTATE_SEND_DATA_HEADER &&
+           c->fd >= 0 && c->stream && !c->post && !c->is_packetized &&
+           !c->wmp_client_id;
+}
+
+static void conn_hand_off(HTTPContext *c)
+{
+    EventLoop *w = &workers[0];
+    int i;
+
+    for (i = 1; i < config.nb_workers; i++)
+        if (workers[i].nb_conns < w->nb_conns)
+            w = &workers[i];
+
+    loop_remove(&main_loop, c);
+    pthread_mutex_lock(&w->lock);
+    w->nb_conns++;
+    c->loop_next = w->inbox;
+    w->inbox = c;
+    loop_wake(w);
+    pthread_mutex_unlock(&w->lock);
+}
+#endif
+
+#if USE_EPOLL
+/* connections are always closed by the main loop, which owns the
+ * connection list and the bandwidth accounting */
+static void loop_retire(EventLoop *loop, HTTPContext *c)
+{
+    if (loop == &main_loop) {
+        log_connection(c);
+        /* close and free the connection */
+        close_connection(c);
+        return;
+    }
+#if USE_WORKERS
+    loop_remove(loop, c);
+    c->loop = &main_loop;
+    pthread_mutex_lock(&loop->lock);
+    loop->nb_conns--;
+    pthread_mutex_unlock(&loop->lock);
+
+    pthread_mutex_lock(&main_loop.lock);
+    c->loop_next = main_loop.inbox;
+    main_loop.inbox = c;
+    loop_wake(&main_loop);
+    pthread_mutex_unlock(&main_loop.lock);
+#endif
+}
+#endif
+
+/* wake up the connections waiting for data from a feed */
+static void wake_feed_waiters(FFServerStream *feed, int closed)
+{
+    HTTPContext *c;
+
+    for (c = main_loop.first_ctx; c; c = c->loop_next) {
+        if (c->state == HTTPSTATE_WAIT_FEED && c->stream->feed == feed) {
+            c->state = closed ? HTTPSTATE_SEND_DATA_TRAILER :
+                                HTTPSTATE_SEND_DATA;
+            conn_queue(c);
+        }
+    }
+#if USE_WORKERS
+    notify_workers(feed, closed);
+#endif
+}
+
+#if USE_EPOLL
+/* wait for events and queue the connections that became ready */
+static int loop_wait(EventLoop *loop, int timeout)
+{
+    struct epoll_event events[256];
+    uint64_t count;
+    int i, n;
+
+    n = epoll_wait(loop->epoll_fd, events, FF_ARRAY_ELEMS(events), timeout);
+    if (n < 0 && errno != EINTR)
+        return AVERROR(errno);
+    loop->wake_time = av_gettime();
+    loop->cur_time = loop->wake_time / 1000;
+
+    for (i = 0; i < n; i++) {
+        void *ptr = events[i].data.ptr;
+
+        if (ptr == loop) {
+            while (read(loop->wake_fd, &count, sizeof(count)) > 0)
+                ;
+            loop->woken = 1;
+        } else if (ptr == &loop->listen_fd[0] || ptr == &loop->listen_fd[1]) {
+            loop->listen_ready[(int *)ptr - loop->listen_fd] = 1;
+        } else {
+            HTTPContext *c = ptr;
+            /* the EPOLL* flags have the values of the POLL* ones */
+            c->revents |= events[i].events &
+                          (POLLIN | POLLOUT | POLLERR | POLLHUP);
+            conn_queue(c);
+        }
+    }
+    return 0;
+}
+
+static int loop_timeout(EventLoop *loop)
+{
+    if (loop->ready)
+        return 0;
+    if (loop->tick)
+        return FFMAX(10 - (av_gettime() / 1000 - loop->last_tick), 0);
+    return 1000;
+}
+
+/* handle the queued connections: each one is handled once per call, and
+ * requeued while it has events it did not consume */
+static void loop_run(EventLoop *loop)
+{
+    HTTPContext *c;
+    int events;
+
+    if (loop->tick && loop->cur_time - loop->last_tick >= 10) {
+        while ((c = loop->tick)) {
+            loop->tick = c->ready_next;
+            c->queued = 0;
+            conn_queue(c);
+        }
+        loop->last_tick = loop->cur_time;
+    }
+
+    loop->running = loop->ready;
+    loop->ready = NULL;
+    while ((c = loop->running)) {
+        loop->running = c->ready_next;
+        c->queued = 0;
+
+        if (handle_connection(c) < 0) {
+            loop_retire(loop, c);
+            continue;
+        }
+#if USE_WORKERS
+        if (loop == &main_loop && conn_can_hand_off(c)) {
+            conn_hand_off(c);
+            continue;
+        }
+#endif
+        if (conn_ticks(c)) {
+            c->queued = 1;
+            c->ready_next = loop->tick;
+            loop->tick = c;
+            continue;
+        }
+        events = conn_events(c);
+        if (events && (c->revents & (events | POLLERR | POLLHUP)))
+            conn_queue(c);
+    }
+}
+
+#if USE_WORKERS
+static void *worker_thread(void *arg)
+{
+    EventLoop *loop = arg;
+    HTTPContext *c, *inbox;
+
+    for(;;) {
+        if (loop_wait(loop, loop_timeout(loop)) < 0) {
+            http_log("Worker event loop failed: %s\n", strerror(errno));
+            break;
+        }
+        if (loop->woken) {
+            loop->woken = 0;
+            inbox = loop_take_inbox(loop);
+            while ((c = inbox)) {
+                inbox = c->loop_next;
+                c->revents = 0;
+                if (loop_add(loop, c) < 0) {
+                    loop_retire(loop, c);
+                    continue;
+                }
+                conn_queue(c);
+            }
+        }
+        loop_run(loop);
+        loop_account(loop);
+    }
+    return NULL;
+}
+
+static void start_workers(void)
+{
+    int i, ret;
+
+    workers = av_mallocz_array(config.nb_workers, sizeof(*workers));
+    if (!workers) {
+        config.nb_workers = 0;
+        return;
+    }
+    for (i = 0; i < config.nb_workers; i++) {
+        EventLoop *w = &workers[i];
+        w->epoll_fd = w->wake_fd = -1;
+        if ((ret = loop_init(w)) < 0 ||
+            (ret = AVERROR(pthread_create(&w->thread, NULL,
+                                          worker_thread, w))) < 0) {
+            http_log("Could not start worker %d: %s\n", i, av_err2str(ret));
+            break;
+        }
+    }
+    config.nb_workers = i;
+}
+#endif
+
+static int epoll_loop(void)
+{
+    EventLoop *loop = &main_loop;
+    HTTPContext *c;
+    int64_t last_sweep = 0;
+    int i, n;
+
+    for(;;) {
+        if (loop_wait(loop, loop_timeout(loop)) < 0)
+            return -1;
+        cur_time = loop->cur_time;
+
+        if (need_to_start_children) {
+            need_to_start_children = 0;
+            start_children(config.first_feed);
+        }
+
+#if USE_WORKERS
+        if (loop->woken) {
+            /* connections the workers are done with */
+            HTTPContext *inbox = loop_take_inbox(loop);
+            loop->woken = 0;
+            while ((c = inbox)) {
+                inbox = c->loop_next;
+                log_connection(c);
+                close_connection(c);
+            }
+        }
+#endif
+
+        /* idle connections get no events: check the request timeouts
+         * every second */
+        if (cur_time - last_sweep >= 1000) {
+            for (c = loop->first_ctx; c; c = c->loop_next) {
+                if ((c->state == HTTPSTATE_WAIT_REQUEST ||
+                     c->state == RTSPSTATE_WAIT_REQUEST) &&
+                    c->timeout - cur_time < 0)
+                    conn_queue(c);
+            }
+            metrics_update();
+            last_sweep = cur_time;
+        }
+
+        loop_run(loop);
+
+        for (i = 0; i < 2; i++) {
+            if (!loop->listen_ready[i])
+                continue;
+            loop->listen_ready[i] = 0;
+            /* new HTTP or RTSP connection requests */
+            for (n = 0; n < 64; n++)
+                if (new_connection(loop->listen_fd[i], i) < 0)
+                    break;
+        }
+        loop_account(loop);
+    }
+}
+#else
+static int poll_loop(int server_fd, int rtsp_server_fd)
+{
+    int ret, delay, events;
+    struct pollfd *poll_table, *poll_entry;
+    HTTPContext *c, *c_next;
+    int64_t last_update = 0;
+
+    poll_table = av_mallocz_array(config.nb_max_http_connections + 2,
+                                  sizeof(*poll_table));
+    if(!poll_table) {
+        http_log("Impossible to allocate a poll table handling %d "
+                 "connections.\n", config.nb_max_http_connections);
+        return -1;
+    }
 
     for(;;) {
         poll_entry = poll_table;
@@ -606,49 +1798,16 @@ static int http_server(void)
         c = first_http_ctx;
         delay = 1000;
         while (c) {
-            int fd;
-            fd = c->fd;
-            switch(c->state) {
-            case HTTPSTATE_SEND_HEADER:
-            case RTSPSTATE_SEND_REPLY:
-            case RTSPSTATE_SEND_PACKET:
-                c->poll_entry = poll_entry;
-                poll_entry->fd = fd;
-                poll_entry->events = POLLOUT;
-                poll_entry++;
-                break;
-            case HTTPSTATE_SEND_DATA_HEADER:
-            case HTTPSTATE_SEND_DATA:
-            case HTTPSTATE_SEND_DATA_TRAILER:
-                if (!c->is_packetized) {
-                    /* for TCP, we output as much as we can
-                     * (may need to put a limit) */
-                    c->poll_entry = poll_entry;
-                    poll_entry->fd = fd;
-                    poll_entry->events = POLLOUT;
-                    poll_entry++;
-                } else {
-                    /* when ffserver is doing the timing, we work by
-                     * looking at which packet needs to be sent every
-                     * 10 ms (one tick wait XXX: 10 ms assumed) */
-                    if (delay > 10)
-                        delay = 10;
-                }
-                break;
-            case HTTPSTATE_WAIT_REQUEST:
-            case HTTPSTATE_RECEIVE_DATA:
-            case HTTPSTATE_WAIT_FEED:
-            case RTSPSTATE_WAIT_REQUEST:
-                /* need to catch errors */
+            events = conn_events(c);
+            if (conn_ticks(c) && delay > 10)
+                delay = 10;
+            if (events) {
                 c->poll_entry = poll_entry;
-                poll_entry->fd = fd;
-                poll_entry->events = POLLIN;/* Maybe this will work */
+                poll_entry->fd = c->fd;
+                poll_entry->events = events;
                 poll_entry++;
-                break;
-            default:
+            } else
                 c->poll_entry = NULL;
-                break;
-            }
             c = c->next;
         }
 
@@ -662,7 +1821,14 @@ static int http_server(void)
             }
         } while (ret < 0);
 
-        cur_time = av_gettime() / 1000;
+        main_loop.wake_time = av_gettime();
+        cur_time = main_loop.wake_time / 1000;
+        main_loop.cur_time = cur_time;
+
+        if (cur_time - last_update >= 1000) {
+            metrics_update();
+            last_update = cur_time;
+        }
 
         if (need_to_start_children) {
             need_to_start_children = 0;
@@ -672,6 +1838,7 @@ static int http_server(void)
         /* now handle the events */
         for(c = first_http_ctx; c; c = c_next) {
             c_next = c->next;
+            c->revents = c->poll_entry ? c->poll_entry->revents : 0;
             if (handle_connection(c) < 0) {
                 log_connection(c);
                 /* close and free the connection */
@@ -691,11 +1858,72 @@ static int http_server(void)
             if (poll_entry->revents & POLLIN)
                 new_connection(rtsp_server_fd, 1);
         }
+        loop_account(&main_loop);
     }
 
-quit:
-    av_free(poll_table);
-    return -1;
+quit:
+    av_free(poll_table);
+    return -1;
+}
+#endif
+
+/* main loop of the HTTP server */
+static int http_server(void)
+{
+    int server_fd = 0, rtsp_server_fd = 0;
+
+    if (config.http_addr.sin_port) {
+        server_fd = socket_open_listen(&config.http_addr);
+        if (server_fd < 0)
+            return -1;
+    }
+
+    if (config.rtsp_addr.sin_port) {
+        rtsp_server_fd = socket_open_listen(&config.rtsp_addr);
+        if (rtsp_server_fd < 0) {
+            closesocket(server_fd);
+            return -1;
+        }
+    }
+
+    if (!rtsp_server_fd && !server_fd) {
+        http_log("HTTP and RTSP disabled.\n");
+        return -1;
+    }
+
+#if USE_EPOLL
+    if (loop_init(&main_loop) < 0 ||
+        (server_fd && loop_listen(&main_loop, 0, server_fd) < 0) ||
+        (rtsp_server_fd && loop_listen(&main_loop, 1, rtsp_server_fd) < 0)) {
+        http_log("Could not create event loop: %s\n", strerror(errno));
+        return -1;
+    }
+    main_loop.cur_time = cur_time = av_gettime() / 1000;
+#endif
+
+#if USE_WORKERS
+    if (config.nb_workers > 0)
+        start_workers();
+#else
+    if (config.nb_workers > 0) {
+        http_log("Worker threads are not supported on this platform\n");
+        config.nb_workers = 0;
+    }
+#endif
+
+    metrics_init();
+
+    http_log("FFserver started.\n");
+
+    start_children(config.first_feed);
+
+    start_multicast();
+
+#if USE_EPOLL
+    return epoll_loop();
+#else
+    return poll_loop(server_fd, rtsp_server_fd);
+#endif
 }
 
 /* start waiting for a new HTTP/RTSP request */
@@ -728,7 +1956,7 @@ static void http_send_too_busy_reply(int fd)
 }
 
 
-static void new_connection(int server_fd, int is_rtsp)
+static int new_connection(int server_fd, int is_rtsp)
 {
     struct sockaddr_in from_addr;
     socklen_t len;
@@ -739,13 +1967,15 @@ static void new_connection(int server_fd, int is_rtsp)
     fd = accept(server_fd, (struct sockaddr *)&from_addr,
                 &len);
     if (fd < 0) {
-        http_log("error during accept %s\n", strerror(errno));
-        return;
+        if (ff_neterrno() != AVERROR(EAGAIN))
+            http_log("error during accept %s\n", strerror(errno));
+        return -1;
     }
     if (ff_socket_nonblock(fd, 1) < 0)
         av_log(NULL, AV_LOG_WARNING, "ff_socket_nonblock failed\n");
 
     if (nb_connections >= config.nb_max_connections) {
+        metrics_inc(&metrics.conns_refused);
         http_send_too_busy_reply(fd);
         goto fail;
     }
@@ -763,13 +1993,17 @@ static void new_connection(int server_fd, int is_rtsp)
     if (!c->buffer)
         goto fail;
 
+    if (loop_add(&main_loop, c) < 0)
+        goto fail;
+
     c->next = first_http_ctx;
     first_http_ctx = c;
     nb_connections++;
+    metrics_inc(&metrics.conns_accepted);
 
     start_wait_request(c, is_rtsp);
 
-    return;
+    return 0;
 
  fail:
     if (c) {
@@ -777,6 +2011,28 @@ static void new_connection(int server_fd, int is_rtsp)
         av_free(c);
     }
     closesocket(fd);
+    return 0;
+}
+
+static void close_input_stream(HTTPContext *c)
+{
+    AVIOContext *pb = NULL;
+    AVStream *st;
+    int i;
+
+    if (c->fmt_in) {
+        if (c->fmt_in->flags & AVFMT_FLAG_CUSTOM_IO)
+            pb = c->fmt_in->pb;
+        /* close each frame parser */
+        for(i=0;i<c->fmt_in->nb_streams;i++) {
+            st = c->fmt_in->streams[i];
+            if (st->codec->codec)
+                avcodec_close(st->codec);
+        }
+        avformat_close_input(&c->fmt_in);
+        feed_map_free_input(&pb);
+    }
+    feed_map_unref(&c->feed_map);
 }
 
 static void close_connection(HTTPContext *c)
@@ -784,7 +2040,8 @@ static void close_connection(HTTPContext *c)
     HTTPContext **cp, *c1;
     int i, nb_streams;
     AVFormatContext *ctx;
-    AVStream *st;
+
+    loop_remove(c->loop, c);
 
     /* remove connection from list */
     cp = &first_http_ctx;
@@ -805,15 +2062,8 @@ static void close_connection(HTTPContext *c)
     /* remove connection associated resources */
     if (c->fd >= 0)
         closesocket(c->fd);
-    if (c->fmt_in) {
-        /* close each frame parser */
-        for(i=0;i<c->fmt_in->nb_streams;i++) {
-            st = c->fmt_in->streams[i];
-            if (st->codec->codec)
-                avcodec_close(st->codec);
-        }
-        avformat_close_input(&c->fmt_in);
-    }
+    close_input_stream(c);
+    shared_detach(c);
 
     /* free RTP output streams if any */
     nb_streams = 0;
@@ -850,6 +2100,15 @@ static void close_connection(HTTPContext *c)
     if (c->stream && !c->post && c->stream->stream_type == STREAM_TYPE_LIVE)
         current_bandwidth -= c->stream->bandwidth;
 
+    if (c->metrics) {
+        c->metrics->clients--;
+        if (!c->post && !c->http_error &&
+            (c->state == HTTPSTATE_SEND_DATA_HEADER ||
+             c->state == HTTPSTATE_SEND_DATA ||
+             c->state == HTTPSTATE_WAIT_FEED))
+            metrics_inc(&metrics.conns_dropped);
+    }
+
     /* signal that there is no feed if we are the feeder socket */
     if (c->state == HTTPSTATE_RECEIVE_DATA && c->stream) {
         c->stream->feed_opened = 0;
@@ -872,13 +2131,15 @@ static int handle_connection(HTTPContext *c)
     case HTTPSTATE_WAIT_REQUEST:
     case RTSPSTATE_WAIT_REQUEST:
         /* timeout ? */
-        if ((c->timeout - cur_time) < 0)
+        if ((c->timeout - cur_time) < 0) {
+            metrics_inc(&metrics.conns_timed_out);
             return -1;
-        if (c->poll_entry->revents & (POLLERR | POLLHUP))
+        }
+        if (c->revents & (POLLERR | POLLHUP))
             return -1;
 
         /* no need to read if no events */
-        if (!(c->poll_entry->revents & POLLIN))
+        if (!(c->revents & POLLIN))
             return 0;
         /* read the data */
     read_loop:
@@ -889,6 +2150,8 @@ static int handle_connection(HTTPContext *c)
             if (ff_neterrno() != AVERROR(EAGAIN) &&
                 ff_neterrno() != AVERROR(EINTR))
                 return -1;
+            if (ff_neterrno() == AVERROR(EAGAIN))
+                c->revents &= ~POLLIN;
             break;
         }
         /* search for end of request. */
@@ -912,11 +2175,11 @@ static int handle_connection(HTTPContext *c)
         break;
 
     case HTTPSTATE_SEND_HEADER:
-        if (c->poll_entry->revents & (POLLERR | POLLHUP))
+        if (c->revents & (POLLERR | POLLHUP))
             return -1;
 
         /* no need to write if no events */
-        if (!(c->poll_entry->revents & POLLOUT))
+        if (!(c->revents & POLLOUT))
             return 0;
         len = send(c->fd, c->buffer_ptr, c->buffer_end - c->buffer_ptr, 0);
         if (len < 0) {
@@ -924,11 +2187,13 @@ static int handle_connection(HTTPContext *c)
                 ff_neterrno() != AVERROR(EINTR)) {
                 goto close_connection;
             }
+            if (ff_neterrno() == AVERROR(EAGAIN))
+                conn_stalled(c);
             break;
         }
         c->buffer_ptr += len;
         if (c->stream)
-            c->stream->bytes_served += len;
+            add_bytes_served(c->stream, len);
         c->data_count += len;
         if (c->buffer_ptr >= c->buffer_end) {
             av_freep(&c->pb_buffer);
@@ -939,6 +2204,7 @@ static int handle_connection(HTTPContext *c)
              * stream */
             c->state = HTTPSTATE_SEND_DATA_HEADER;
             c->buffer_ptr = c->buffer_end = c->buffer;
+            shared_attach(c);
         }
         break;
 
@@ -949,11 +2215,11 @@ static int handle_connection(HTTPContext *c)
          * input streams set the speed). It may be better to verify
          * that we do not rely too much on the kernel queues */
         if (!c->is_packetized) {
-            if (c->poll_entry->revents & (POLLERR | POLLHUP))
+            if (c->revents & (POLLERR | POLLHUP))
                 return -1;
 
             /* no need to read if no events */
-            if (!(c->poll_entry->revents & POLLOUT))
+            if (!(c->revents & POLLOUT))
                 return 0;
         }
         if (http_send_data(c) < 0)
@@ -962,32 +2228,41 @@ static int handle_connection(HTTPContext *c)
         if (c->state == HTTPSTATE_SEND_DATA_TRAILER)
             return -1;
         /* Check if it is a single jpeg frame 123 */
-        if (c->stream->single_frame && c->data_count > c->cur_frame_bytes && c->cur_frame_bytes > 0) {
-            close_connection(c);
-        }
+        if (c->stream->single_frame && c->data_count > c->cur_frame_bytes && c->cur_frame_bytes > 0)
+            return -1;
         break;
     case HTTPSTATE_RECEIVE_DATA:
         /* no need to read if no events */
-        if (c->poll_entry->revents & (POLLERR | POLLHUP))
+        if (c->revents & (POLLERR | POLLHUP))
             return -1;
-        if (!(c->poll_entry->revents & POLLIN))
+        if (!(c->revents & POLLIN))
             return 0;
         if (http_receive_data(c) < 0)
             return -1;
         break;
     case HTTPSTATE_WAIT_FEED:
         /* no need to read if no events */
-        if (c->poll_entry->revents & (POLLIN | POLLERR | POLLHUP))
+        if (c->revents & (POLLERR | POLLHUP))
             return -1;
+        if (c->revents & POLLIN) {
+            /* the client has nothing to send: data or EOF means it is
+             * going away. With edge triggered events POLLIN may be left
+             * over from the request, so check before closing */
+            char b;
+            if (recv(c->fd, &b, 1, MSG_PEEK) >= 0 ||
+                ff_neterrno() != AVERROR(EAGAIN))
+                return -1;
+            c->revents &= ~POLLIN;
+        }
 
         /* nothing to do, we'll be waken up by incoming feed packets */
         break;
 
     case RTSPSTATE_SEND_REPLY:
-        if (c->poll_entry->revents & (POLLERR | POLLHUP))
+        if (c->revents & (POLLERR | POLLHUP))
             goto close_connection;
         /* no need to write if no events */
-        if (!(c->poll_entry->revents & POLLOUT))
+        if (!(c->revents & POLLOUT))
             return 0;
         len = send(c->fd, c->buffer_ptr, c->buffer_end - c->buffer_ptr, 0);
         if (len < 0) {
@@ -995,6 +2270,8 @@ static int handle_connection(HTTPContext *c)
                 ff_neterrno() != AVERROR(EINTR)) {
                 goto close_connection;
             }
+            if (ff_neterrno() == AVERROR(EAGAIN))
+                conn_stalled(c);
             break;
         }
         c->buffer_ptr += len;
@@ -1006,12 +2283,12 @@ static int handle_connection(HTTPContext *c)
         }
         break;
     case RTSPSTATE_SEND_PACKET:
-        if (c->poll_entry->revents & (POLLERR | POLLHUP)) {
+        if (c->revents & (POLLERR | POLLHUP)) {
             av_freep(&c->packet_buffer);
             return -1;
         }
         /* no need to write if no events */
-        if (!(c->poll_entry->revents & POLLOUT))
+        if (!(c->revents & POLLOUT))
             return 0;
         len = send(c->fd, c->packet_buffer_ptr,
                     c->packet_buffer_end - c->packet_buffer_ptr, 0);
@@ -1022,6 +2299,8 @@ static int handle_connection(HTTPContext *c)
                 av_freep(&c->packet_buffer);
                 return -1;
             }
+            if (ff_neterrno() == AVERROR(EAGAIN))
+                conn_stalled(c);
             break;
         }
         c->packet_buffer_ptr += len;
@@ -1455,6 +2734,7 @@ static int http_parse_request(HTTPContext *c)
     }
 
     if (c->post == 0 && config.max_bandwidth < current_bandwidth) {
+        metrics_inc(&metrics.conns_refused);
         c->http_error = 503;
         q = c->buffer;
         snprintf(q, c->buffer_size,
@@ -1605,6 +2885,9 @@ static int http_parse_request(HTTPContext *c)
     }
 
     stream->conns_served++;
+    c->metrics = stream_metrics(stream);
+    if (c->metrics)
+        c->metrics->clients++;
 
     /* XXX: add there authenticate and IP match */
 
@@ -1732,7 +3015,8 @@ static int http_parse_request(HTTPContext *c)
     c->state = HTTPSTATE_SEND_HEADER;
     return 0;
  send_status:
-    compute_status(c);
+    if (!compute_metrics(c, info))
+        compute_status(c);
     /* horrible: we use this value to avoid
      * going to the send data state */
     c->http_error = 200;
@@ -2026,13 +3310,282 @@ static void compute_status(HTTPContext *c)
     c->buffer_end = c->pb_buffer + len;
 }
 
+enum StreamMetricId {
+    METRIC_CLIENTS,
+    METRIC_CONNS,
+    METRIC_SENT,
+    METRIC_SENT_RATE,
+    METRIC_STALLS,
+    METRIC_FEEDER,
+    METRIC_RECEIVED,
+    METRIC_RECEIVED_RATE,
+};
+
+static const struct StreamMetricDef {
+    enum StreamMetricId id;
+    const char *name;
+    const char *type;
+    int feed;
+} stream_metric_defs[] = {
+    { METRIC_CLIENTS,       "clients",                  "gauge",   0 },
+    { METRIC_CONNS,         "connections_total",        "counter", 0 },
+    { METRIC_SENT,          "sent_bytes_total",         "counter", 0 },
+    { METRIC_SENT_RATE,     "sent_bytes_per_second",    "gauge",   0 },
+    { METRIC_STALLS,        "send_stalls_total",        "counter", 0 },
+    { METRIC_FEEDER,        "connected",                "gauge",   1 },
+    { METRIC_RECEIVED,      "received_bytes_total",     "counter", 1 },
+    { METRIC_RECEIVED_RATE, "received_bytes_per_second", "gauge",  1 },
+};
+
+static int64_t stream_metric_value(StreamMetrics *m, enum StreamMetricId id)
+{
+    FFServerStream *stream = m->stream;
+    int64_t bytes;
+
+    switch (id) {
+    case METRIC_CLIENTS:
+        return m->clients;
+    case METRIC_CONNS:
+        return stream->conns_served;
+    case METRIC_SENT:
+    case METRIC_SENT_RATE:
+        lock_shared();
+        bytes = stream->bytes_served;
+        unlock_shared();
+        return id == METRIC_SENT ? bytes :
+                                   compute_datarate(&m->sent_rate, bytes);
+    case METRIC_STALLS:
+        return metrics_get(&m->send_stalls);
+    case METRIC_FEEDER:
+        return stream->feed_opened;
+    case METRIC_RECEIVED:
+        return m->bytes_received;
+    case METRIC_RECEIVED_RATE:
+        return compute_datarate(&m->received_rate, m->bytes_received);
+    }
+    return 0;
+}
+
+/* print s as a quoted Prometheus label value or JSON string */
+static void print_quoted(AVIOContext *pb, const char *s)
+{
+    avio_w8(pb, '"');
+    for (; *s; s++) {
+        if (*s == '\n') {
+            avio_printf(pb, "\\n");
+            continue;
+        }
+        if (*s == '"' || *s == '\\')
+            avio_w8(pb, '\\');
+        avio_w8(pb, *s);
+    }
+    avio_w8(pb, '"');
+}
+
+static void print_metric(AVIOContext *pb, int json, const char *name,
+                         const char *type, int64_t value)
+{
+    if (json)
+        avio_printf(pb, "\"%s\":%"PRId64",", name, value);
+    else
+        avio_printf(pb, "# TYPE ffserver_%s %s\nffserver_%s %"PRId64"\n",
+                    name, type, name, value);
+}
+
+static const struct LoopMetricDef {
+    const char *name;
+    const char *type;
+} loop_metric_defs[] = {
+    { "iterations_total",   "counter" },
+    { "busy_seconds_total", "counter" },
+    { "busy_max_seconds",   "gauge"   },  /* since the previous read */
+};
+
+static double loop_metric_value(EventLoop *loop, int id)
+{
+    switch (id) {
+    case 0:
+        return __atomic_load_n(&loop->iterations, __ATOMIC_RELAXED);
+    case 1:
+        return __atomic_load_n(&loop->busy_time, __ATOMIC_RELAXED) / 1e6;
+    default:
+        return __atomic_exchange_n(&loop->busy_max, 0, __ATOMIC_RELAXED) / 1e6;
+    }
+}
+
+static void loop_metric_name(char *buf, int size, int i)
+{
+    if (i)
+        snprintf(buf, size, "worker%d", i - 1);
+    else
+        snprintf(buf, size, "main");
+}
+
+static void print_loop_metrics(AVIOContext *pb, int json)
+{
+    EventLoop *loop;
+    char name[16];
+    int i, j;
+
+    if (json) {
+        avio_printf(pb, "\"loops\":[");
+        for (i = 0; i <= config.nb_workers; i++) {
+            loop = i ? &workers[i - 1] : &main_loop;
+            loop_metric_name(name, sizeof(name), i);
+            avio_printf(pb, "%s{\"name\":\"%s\"", i ? "," : "", name);
+            for (j = 0; j < FF_ARRAY_ELEMS(loop_metric_defs); j++)
+                avio_printf(pb, ",\"%s\":%.15g", loop_metric_defs[j].name,
+                            loop_metric_value(loop, j));
+            avio_printf(pb, "}");
+        }
+        avio_printf(pb, "]");
+        return;
+    }
+
+    for (j = 0; j < FF_ARRAY_ELEMS(loop_metric_defs); j++) {
+        avio_printf(pb, "# TYPE ffserver_loop_%s %s\n",
+                    loop_metric_defs[j].name, loop_metric_defs[j].type);
+        for (i = 0; i <= config.nb_workers; i++) {
+            loop = i ? &workers[i - 1] : &main_loop;
+            loop_metric_name(name, sizeof(name), i);
+            avio_printf(pb, "ffserver_loop_%s{loop=\"%s\"} %.15g\n",
+                        loop_metric_defs[j].name, name,
+                        loop_metric_value(loop, j));
+        }
+    }
+}
+
+/* Serve the counters of a status stream in the Prometheus text format, or
+ * as JSON. Unlike the status page, nothing here depends on the number of
+ * connections, unless the JSON clients list is asked for. Return 0 if the
+ * status page was requested. */
+static int compute_metrics(HTTPContext *c, const char *info)
+{
+    char buf[32];
+    const char *name = c->stream->filename;
+    size_t name_len = strlen(name);
+    AVIOContext *pb;
+    StreamMetrics *m;
+    HTTPContext *c1;
+    int json, i, feed, first;
+    int len;
+
+    if (av_find_info_tag(buf, sizeof(buf), "format", info)) {
+        if (!strcmp(buf, "json"))
+            json = 1;
+        else if (!strcmp(buf, "prometheus"))
+            json = 0;
+        else
+            return 0;
+    } else if (name_len >= 5 && !strcmp(name + name_len - 5, ".json")) {
+        json = 1;
+    } else if (!strcmp(name, "metrics")) {
+        json = 0;
+    } else
+        return 0;
+
+    if (avio_open_dyn_buf(&pb) < 0) {
+        c->buffer_ptr = c->buffer;
+        c->buffer_end = c->buffer;
+        return 1;
+    }
+
+    avio_printf(pb, "HTTP/1.0 200 OK\r\n");
+    avio_printf(pb, "Content-type: %s\r\n", json ? "application/json" :
+                "text/plain; version=0.0.4");
+    avio_printf(pb, "Pragma: no-cache\r\n");
+    avio_printf(pb, "\r\n");
+
+    if (json)
+        avio_printf(pb, "{");
+    print_metric(pb, json, "connections", "gauge", nb_connections);
+    print_metric(pb, json, "connections_accepted_total", "counter",
+                 metrics_get(&metrics.conns_accepted));
+    print_metric(pb, json, "connections_refused_total", "counter",
+                 metrics_get(&metrics.conns_refused));
+    print_metric(pb, json, "connections_timed_out_total", "counter",
+                 metrics_get(&metrics.conns_timed_out));
+    print_metric(pb, json, "connections_dropped_total", "counter",
+                 metrics_get(&metrics.conns_dropped));
+    print_metric(pb, json, "send_stalls_total", "counter",
+                 metrics_get(&metrics.send_stalls));
+    print_metric(pb, json, "bandwidth_kbits", "gauge", current_bandwidth);
+    print_metric(pb, json, "max_bandwidth_kbits", "gauge",
+                 config.max_bandwidth);
+
+    if (json) {
+        /* one object per stream, then per feed */
+        for (feed = 0; feed < 2; feed++) {
+            avio_printf(pb, "\"%s\":[", feed ? "feeds" : "streams");
+            first = 1;
+            for (m = first_stream_metrics; m; m = m->next) {
+                if ((m->stream->feed == m->stream) != feed)
+                    continue;
+                avio_printf(pb, "%s{\"name\":", first ? "" : ",");
+                print_quoted(pb, m->stream->filename);
+                for (i = 0; i < FF_ARRAY_ELEMS(stream_metric_defs); i++)
+                    if (stream_metric_defs[i].feed == feed)
+                        avio_printf(pb, ",\"%s\":%"PRId64,
+                                    stream_metric_defs[i].name,
+                                    stream_metric_value(m,
+                                        stream_metric_defs[i].id));
+                avio_printf(pb, "}");
+                first = 0;
+            }
+            avio_printf(pb, "],");
+        }
+        print_loop_metrics(pb, json);
+
+        if (av_find_info_tag(buf, sizeof(buf), "clients", info) &&
+            strtol(buf, 0, 10)) {
+            avio_printf(pb, ",\"clients\":[");
+            for (c1 = first_http_ctx; c1; c1 = c1->next) {
+                avio_printf(pb, "%s{\"stream\":", c1 == first_http_ctx ? "" : ",");
+                print_quoted(pb, c1->stream ? c1->stream->filename : "");
+                avio_printf(pb, ",\"address\":\"%s\",\"state\":\"%s\","
+                                "\"bytes\":%"PRId64",\"bytes_per_second\":%d}",
+                            inet_ntoa(c1->from_addr.sin_addr),
+                            http_state[c1->state], c1->data_count,
+                            compute_datarate(&c1->datarate, c1->data_count));
+            }
+            avio_printf(pb, "]");
+        }
+        avio_printf(pb, "}\n");
+    } else {
+        for (i = 0; i < FF_ARRAY_ELEMS(stream_metric_defs); i++) {
+            const struct StreamMetricDef *def = &stream_metric_defs[i];
+
+            avio_printf(pb, "# TYPE ffserver_%s_%s %s\n",
+                        def->feed ? "feed" : "stream", def->name, def->type);
+            for (m = first_stream_metrics; m; m = m->next) {
+                if ((m->stream->feed == m->stream) != def->feed)
+                    continue;
+                avio_printf(pb, "ffserver_%s_%s{%s=",
+                            def->feed ? "feed" : "stream", def->name,
+                            def->feed ? "feed" : "stream");
+                print_quoted(pb, m->stream->filename);
+                avio_printf(pb, "} %"PRId64"\n",
+                            stream_metric_value(m, def->id));
+            }
+        }
+        print_loop_metrics(pb, json);
+    }
+
+    len = avio_close_dyn_buf(pb, &c->pb_buffer);
+    c->buffer_ptr = c->pb_buffer;
+    c->buffer_end = c->pb_buffer + len;
+    return 1;
+}
+
 static int open_input_stream(HTTPContext *c, const char *info)
 {
     char buf[128];
     char input_filename[1024];
     AVFormatContext *s = NULL;
+    AVIOContext *pb = NULL;
     int buf_size, i, ret;
-    int64_t stream_pos;
+    int64_t stream_pos, seek_pos = -1;
+    TimeShiftEntry *key;
 
     /* find file name */
     if (c->stream->feed) {
@@ -2046,9 +3599,14 @@ static int open_input_stream(HTTPContext *c, const char *info)
             }
         } else if (av_find_info_tag(buf, sizeof(buf), "buffer", info)) {
             int prebuffer = strtol(buf, 0, 10);
-            stream_pos = av_gettime() - prebuffer * (int64_t)1000000;
+            stream_pos = time_shift_live(c->stream->feed) -
+                         prebuffer * (int64_t)1000000;
         } else
-            stream_pos = av_gettime() - c->stream->prebuffer * (int64_t)1000;
+            stream_pos = time_shift_live(c->stream->feed) -
+                         c->stream->prebuffer * (int64_t)1000;
+        /* start on a key frame of the time-shift window */
+        if ((key = time_shift_find(c->stream->feed, stream_pos)))
+            seek_pos = key->pos;
     } else {
         strcpy(input_filename, c->stream->feed_filename);
         buf_size = 0;
@@ -2066,10 +3624,19 @@ static int open_input_stream(HTTPContext *c, const char *info)
         return AVERROR(EINVAL);
     }
 
-    /* open stream */
+    /* open stream, feeds are read from their map when possible */
+    if (c->stream->feed && (c->feed_map = feed_map_open(c->stream->feed))) {
+        s = avformat_alloc_context();
+        if (!s || !(pb = feed_map_alloc_input(c->feed_map))) {
+            avformat_free_context(s);
+            return AVERROR(ENOMEM);
+        }
+        s->pb = pb;
+    }
     ret = avformat_open_input(&s, input_filename, c->stream->ifmt,
                               &c->stream->in_opts);
     if (ret < 0) {
+        feed_map_free_input(&pb);
         http_log("Could not open input '%s': %s\n",
                  input_filename, av_err2str(ret));
         return ret;
@@ -2103,10 +3670,12 @@ static int open_input_stream(HTTPContext *c, const char *info)
         }
     }
 
-    if (c->fmt_in->iformat->read_seek)
+    if (seek_pos >= 0)
+        ffm_seek_packet(c->fmt_in, seek_pos);
+    else if (c->fmt_in->iformat->read_seek)
         av_seek_frame(c->fmt_in, -1, stream_pos, 0);
     /* set the start time (needed for maxtime and RTP packet timing) */
-    c->start_time = cur_time;
+    c->start_time = c->loop->cur_time;
     c->first_pts = AV_NOPTS_VALUE;
     return 0;
 }
@@ -2206,13 +3775,22 @@ static int http_prepare_data(HTTPContext *c)
     case HTTPSTATE_SEND_DATA:
         /* find a new packet */
         /* read a packet from the input stream */
-        if (c->stream->feed)
-            ffm_set_write_index(c->fmt_in,
-                                c->stream->feed->feed_write_index,
-                                c->stream->feed->feed_size);
+        if (c->stream->feed) {
+            int64_t write_index, feed_size;
+
+            if (c->feed_map) {
+                write_index = feed_map_write_index(c->feed_map, &feed_size);
+            } else {
+                lock_shared();
+                write_index = c->stream->feed->feed_write_index;
+                feed_size   = c->stream->feed->feed_size;
+                unlock_shared();
+            }
+            ffm_set_write_index(c->fmt_in, write_index, feed_size);
+        }
 
         if (c->stream->max_time &&
-            c->stream->max_time + c->start_time - cur_time < 0)
+            c->stream->max_time + c->start_time - c->loop->cur_time < 0)
             /* We have timed out */
             c->state = HTTPSTATE_SEND_DATA_TRAILER;
         else {
@@ -2242,10 +3820,11 @@ static int http_prepare_data(HTTPContext *c)
                 }
             } else {
                 int source_index = pkt.stream_index;
+                c->key_packet = 0;
                 /* update first pts if needed */
                 if (c->first_pts == AV_NOPTS_VALUE) {
                     c->first_pts = av_rescale_q(pkt.dts, c->fmt_in->streams[pkt.stream_index]->time_base, AV_TIME_BASE_Q);
-                    c->start_time = cur_time;
+                    c->start_time = c->loop->cur_time;
                 }
                 /* send it to the appropriate stream */
                 if (c->stream->feed) {
@@ -2267,7 +3846,7 @@ static int http_prepare_data(HTTPContext *c)
                             if (pkt.flags & AV_PKT_FLAG_KEY &&
                                 (st->codec->codec_type == AVMEDIA_TYPE_VIDEO ||
                                  c->stream->nb_streams == 1))
-                                c->got_key_frame = 1;
+                                c->got_key_frame = c->key_packet = 1;
                             if (!c->stream->send_on_key || c->got_key_frame)
                                 goto send_it;
                         }
@@ -2372,6 +3951,343 @@ static int http_prepare_data(HTTPContext *c)
     return 0;
 }
 
+/* formats a client can start receiving at any packet boundary, after the
+ * header */
+static const char * const shared_formats[] = {
+    "mpegts", "mpeg", "mpjpeg", "asf_stream", "flv", "mp3", "adts", NULL
+};
+
+static inline void lock_output(SharedOutput *so)
+{
+#if USE_WORKERS
+    pthread_mutex_lock(&so->lock);
+#endif
+}
+
+static inline void unlock_output(SharedOutput *so)
+{
+#if USE_WORKERS
+    pthread_mutex_unlock(&so->lock);
+#endif
+}
+
+/* a client can use the shared output of its stream if it wants the live
+ * position with the stream defaults, and nothing is specific to it */
+static int shared_eligible(HTTPContext *c)
+{
+    FFServerStream *stream = c->stream;
+    int i;
+
+    if (!stream || !stream->feed || !stream->fmt || c->post ||
+        c->is_packetized || c->wmp_client_id || strchr(c->url, '?') ||
+        stream->max_time || stream->single_frame)
+        return 0;
+    for (i = 0; shared_formats[i]; i++)
+        if (!strcmp(stream->fmt->name, shared_formats[i]))
+            return 1;
+    return 0;
+}
+
+static void shared_free(SharedOutput *so)
+{
+    SharedOutput **sp;
+    HTTPContext *mux = so->mux;
+    int i;
+
+    for (sp = &first_shared; *sp; sp = &(*sp)->next) {
+        if (*sp == so) {
+            *sp = so->next;
+            break;
+        }
+    }
+
+    for (i = 0; i < SHARED_MAX_CHUNKS; i++)
+        av_buffer_unref(&so->chunks[i].buf);
+    av_buffer_unref(&so->header);
+
+    close_input_stream(mux);
+    for(i=0; i<mux->fmt_ctx.nb_streams; i++)
+        av_freep(&mux->fmt_ctx.streams[i]);
+    av_freep(&mux->fmt_ctx.streams);
+    av_freep(&mux->fmt_ctx.priv_data);
+    av_dict_free(&mux->fmt_ctx.metadata);
+    av_freep(&mux->pb_buffer);
+    av_free(mux);
+#if USE_WORKERS
+    pthread_mutex_destroy(&so->lock);
+#endif
+    av_free(so);
+}
+
+static SharedOutput *shared_open(FFServerStream *stream)
+{
+    SharedOutput *so;
+    HTTPContext *mux;
+
+    so = av_mallocz(sizeof(*so));
+    mux = av_mallocz(sizeof(*mux));
+    if (!so || !mux) {
+        av_free(so);
+        av_free(mux);
+        return NULL;
+    }
+    mux->fd = -1;
+    mux->loop = &main_loop;
+    mux->stream = stream;
+    mux->state = HTTPSTATE_SEND_DATA_HEADER;
+    so->mux = mux;
+    so->last_key_seq = -1;
+#if USE_WORKERS
+    pthread_mutex_init(&so->lock, NULL);
+#endif
+    so->next = first_shared;
+    first_shared = so;
+
+    if (open_input_stream(mux, "") < 0) {
+        http_log("Could not open input stream for shared output '%s'\n",
+                 stream->filename);
+        shared_free(so);
+        return NULL;
+    }
+    return so;
+}
+
+/* must be called with the output locked */
+static void shared_drop_oldest(SharedOutput *so)
+{
+    SharedChunk *ch = &so->chunks[so->first_seq % SHARED_MAX_CHUNKS];
+
+    so->size -= ch->buf->size;
+    av_buffer_unref(&ch->buf);
+    if (so->last_key_seq == so->first_seq)
+        so->last_key_seq = -1;
+    so->first_seq++;
+}
+
+static void shared_append(SharedOutput *so, AVBufferRef *buf, int key)
+{
+    SharedChunk *ch;
+
+    lock_output(so);
+    if (so->next_seq - so->first_seq == SHARED_MAX_CHUNKS)
+        shared_drop_oldest(so);
+    ch = &so->chunks[so->next_seq % SHARED_MAX_CHUNKS];
+    ch->buf = buf;
+    ch->key = key;
+    so->size += buf->size;
+    if (key)
+        so->last_key_seq = so->next_seq;
+    so->next_seq++;
+    while (so->size > SHARED_MAX_BYTES && so->first_seq < so->last_key_seq)
+        shared_drop_oldest(so);
+    unlock_output(so);
+}
+
+/* mux what the feed received since the last call, one chunk per packet */
+static void shared_pump(SharedOutput *so)
+{
+    HTTPContext *mux = so->mux;
+    AVBufferRef *buf;
+    int ret, len, header;
+
+    if (so->ended)
+        return;
+    if (mux->state == HTTPSTATE_WAIT_FEED)
+        mux->state = HTTPSTATE_SEND_DATA;
+
+    for(;;) {
+        header = mux->state == HTTPSTATE_SEND_DATA_HEADER;
+        ret = http_prepare_data(mux);
+        if (ret < 0 || mux->state == HTTPSTATE_SEND_DATA_TRAILER)
+            break;
+
+        buf = NULL;
+        len = mux->buffer_end - mux->buffer_ptr;
+        if (len > 0 && mux->pb_buffer) {
+            /* the chunk takes over the muxer output buffer */
+            buf = av_buffer_create(mux->pb_buffer, len, NULL, NULL, 0);
+            if (!buf)
+                break;
+            mux->pb_buffer = NULL;
+        }
+        mux->buffer_ptr = mux->buffer_end = NULL;
+
+        if (header) {
+            lock_output(so);
+            so->header = buf;
+            so->started = 1;
+            unlock_output(so);
+        } else if (buf)
+            shared_append(so, buf, mux->key_packet);
+
+        if (ret)
+            /* no more data in the feed */
+            return;
+    }
+
+    lock_output(so);
+    so->ended = 1;
+    unlock_output(so);
+}
+
+static void shared_pump_feed(FFServerStream *feed)
+{
+    SharedOutput *so;
+
+    for (so = first_shared; so; so = so->next)
+        if (so->mux->stream->feed == feed)
+            shared_pump(so);
+}
+
+/* called once the reply header has been sent: switch the client to the
+ * shared output of its stream, clients which cannot use one keep their
+ * own muxer */
+static void shared_attach(HTTPContext *c)
+{
+    SharedOutput *so;
+
+    if (!shared_eligible(c))
+        return;
+
+    for (so = first_shared; so; so = so->next)
+        if (so->mux->stream == c->stream && !so->ended)
+            break;
+    if (!so) {
+        so = shared_open(c->stream);
+        if (!so)
+            return;
+    }
+    shared_pump(so);
+    if (!so->started || so->ended) {
+        if (!so->nb_clients)
+            shared_free(so);
+        return;
+    }
+
+    lock_output(so);
+    if (so->header) {
+        c->shared_refs[0] = av_buffer_ref(so->header);
+        if (!c->shared_refs[0]) {
+            unlock_output(so);
+            return;
+        }
+        c->nb_shared_refs = 1;
+    }
+    /* start at the last key frame for an immediate picture */
+    if (so->last_key_seq >= 0) {
+        c->shared_seq = so->last_key_seq;
+    } else {
+        c->shared_seq = so->next_seq;
+        c->shared_wait_key = c->stream->send_on_key;
+    }
+    unlock_output(so);
+
+    so->nb_clients++;
+    c->shared = so;
+    c->shared_offset = 0;
+    /* the shared output reads the feed for us */
+    close_input_stream(c);
+}
+
+static void shared_detach(HTTPContext *c)
+{
+    SharedOutput *so = c->shared;
+
+    if (!so)
+        return;
+    while (c->nb_shared_refs > 0)
+        av_buffer_unref(&c->shared_refs[--c->nb_shared_refs]);
+    c->shared = NULL;
+    if (!--so->nb_clients)
+        shared_free(so);
+}
+
+/* send the shared chunks from the client position, without copying them */
+static int shared_send_data(HTTPContext *c)
+{
+    SharedOutput *so = c->shared;
+    struct iovec iov[SHARED_IOV];
+    SharedChunk *ch;
+    AVBufferRef *ref;
+    int i, n, ended;
+    ssize_t len;
+
+    if (c->state == HTTPSTATE_SEND_DATA_TRAILER)
+        return -1;
+    c->state = HTTPSTATE_SEND_DATA;
+
+    for(;;) {
+        lock_output(so);
+        if (c->shared_seq < so->first_seq) {
+            /* too slow: skip what was dropped */
+            c->shared_seq = so->last_key_seq >= 0 ? so->last_key_seq :
+                                                    so->next_seq;
+            c->shared_wait_key = so->last_key_seq < 0;
+        }
+        while (c->nb_shared_refs < SHARED_IOV &&
+               c->shared_seq < so->next_seq) {
+            ch = &so->chunks[c->shared_seq % SHARED_MAX_CHUNKS];
+            if (c->shared_wait_key && !ch->key) {
+                c->shared_seq++;
+                continue;
+            }
+            if (!(ref = av_buffer_ref(ch->buf)))
+                break;
+            c->shared_wait_key = 0;
+            c->shared_refs[c->nb_shared_refs++] = ref;
+            c->shared_seq++;
+        }
+        ended = so->ended;
+        unlock_output(so);
+
+        if (!c->nb_shared_refs) {
+            if (ended)
+                return -1;
+            /* we will be woken up by the feed */
+            c->state = HTTPSTATE_WAIT_FEED;
+            return 0;
+        }
+
+        for (i = 0; i < c->nb_shared_refs; i++) {
+            iov[i].iov_base = c->shared_refs[i]->data;
+            iov[i].iov_len  = c->shared_refs[i]->size;
+        }
+        iov[0].iov_base  = c->shared_refs[0]->data + c->shared_offset;
+        iov[0].iov_len  -= c->shared_offset;
+
+        len = writev(c->fd, iov, c->nb_shared_refs);
+        if (len < 0) {
+            if (ff_neterrno() != AVERROR(EAGAIN) &&
+                ff_neterrno() != AVERROR(EINTR))
+                /* error : close connection */
+                return -1;
+            if (ff_neterrno() == AVERROR(EAGAIN))
+                conn_stalled(c);
+            return 0;
+        }
+        c->data_count += len;
+        update_datarate(&c->datarate, c->data_count, c->loop->cur_time);
+        add_bytes_served(c->stream, len);
+
+        /* release the chunks entirely sent */
+        for (n = 0; n < c->nb_shared_refs && (size_t)len >= iov[n].iov_len; n++) {
+            len -= iov[n].iov_len;
+            av_buffer_unref(&c->shared_refs[n]);
+            c->shared_offset = 0;
+        }
+        if (n) {
+            memmove(c->shared_refs, c->shared_refs + n,
+                    (c->nb_shared_refs - n) * sizeof(*c->shared_refs));
+            c->nb_shared_refs -= n;
+        }
+        if (c->nb_shared_refs) {
+            /* the socket buffer is full */
+            c->shared_offset += len;
+            return 0;
+        }
+    }
+}
+
 /* should convert the format at the same time */
 /* send data starting at c->buffer_ptr to the output connection
  * (either UDP or TCP)
@@ -2380,6 +4296,9 @@ static int http_send_data(HTTPContext *c)
 {
     int len, ret;
 
+    if (c->shared)
+        return shared_send_data(c);
+
     for(;;) {
         if (c->buffer_ptr >= c->buffer_end) {
             ret = http_prepare_data(c);
@@ -2410,9 +4329,9 @@ static int http_send_data(HTTPContext *c)
                 }
 
                 c->data_count += len;
-                update_datarate(&c->datarate, c->data_count);
+                update_datarate(&c->datarate, c->data_count, c->loop->cur_time);
                 if (c->stream)
-                    c->stream->bytes_served += len;
+                    add_bytes_served(c->stream, len);
 
                 if (c->rtp_protocol == RTSP_LOWER_TRANSPORT_TCP) {
                     /* RTP packets are sent inside the RTSP TCP connection */
@@ -2459,6 +4378,7 @@ static int http_send_data(HTTPContext *c)
                          * send it later, so a new state is needed to
                          * "lock" the RTSP TCP connection */
                         rtsp_c->state = RTSPSTATE_SEND_PACKET;
+                        conn_queue(rtsp_c);
                         break;
                     } else
                         /* all data has been sent */
@@ -2481,15 +4401,16 @@ static int http_send_data(HTTPContext *c)
                         ff_neterrno() != AVERROR(EINTR))
                         /* error : close connection */
                         return -1;
-                    else
-                        return 0;
+                    if (ff_neterrno() == AVERROR(EAGAIN))
+                        conn_stalled(c);
+                    return 0;
                 }
                 c->buffer_ptr += len;
 
                 c->data_count += len;
-                update_datarate(&c->datarate, c->data_count);
+                update_datarate(&c->datarate, c->data_count, c->loop->cur_time);
                 if (c->stream)
-                    c->stream->bytes_served += len;
+                    add_bytes_served(c->stream, len);
                 break;
             }
         }
@@ -2501,6 +4422,7 @@ static int http_start_receive_data(HTTPContext *c)
 {
     int fd;
     int ret;
+    int64_t write_index, feed_size;
 
     if (c->stream->feed_opened) {
         http_log("Stream feed '%s' was not opened\n",
@@ -2524,15 +4446,22 @@ static int http_start_receive_data(HTTPContext *c)
         return ret;
     }
     c->feed_fd = fd;
+    c->feed_map = feed_map_open(c->stream);
 
     if (c->stream->truncate) {
-        /* truncate feed file */
+        /* truncate feed file, the readers must not touch the pages removed */
+        feed_map_wrlock(c->feed_map);
         ffm_write_write_index(c->feed_fd, FFM_PACKET_SIZE);
         http_log("Truncating feed file '%s'\n", c->stream->feed_filename);
-        if (ftruncate(c->feed_fd, FFM_PACKET_SIZE) < 0) {
-            ret = AVERROR(errno);
+        ret = ftruncate(c->feed_fd, FFM_PACKET_SIZE) < 0 ? AVERROR(errno) : 0;
+        if (!ret && c->feed_map) {
+            c->feed_map->alloc_size = FFM_PACKET_SIZE;
+            feed_map_publish(c->feed_map, FFM_PACKET_SIZE, FFM_PACKET_SIZE);
+        }
+        feed_map_unlock(c->feed_map);
+        if (ret < 0) {
             http_log("Error truncating feed file '%s': %s\n",
-                     c->stream->feed_filename, strerror(errno));
+                     c->stream->feed_filename, av_err2str(ret));
             return ret;
         }
     } else {
@@ -2542,13 +4471,16 @@ static int http_start_receive_data(HTTPContext *c)
                      c->stream->feed_filename, strerror(errno));
             return ret;
         }
-        c->stream->feed_write_index = ret;
     }
 
-    c->stream->feed_write_index = FFMAX(ffm_read_write_index(fd),
-                                        FFM_PACKET_SIZE);
-    c->stream->feed_size = lseek(fd, 0, SEEK_END);
+    write_index = FFMAX(ffm_read_write_index(fd), FFM_PACKET_SIZE);
+    feed_size = lseek(fd, 0, SEEK_END);
     lseek(fd, 0, SEEK_SET);
+    lock_shared();
+    c->stream->feed_write_index = write_index;
+    c->stream->feed_size = feed_size;
+    unlock_shared();
+    time_shift_start_feed(c->stream);
 
     /* init buffer input */
     c->buffer_ptr = c->buffer;
@@ -2560,8 +4492,8 @@ static int http_start_receive_data(HTTPContext *c)
 
 static int http_receive_data(HTTPContext *c)
 {
-    HTTPContext *c1;
-    int len, loop_run = 0;
+    TimeShiftIndex *ts;
+    int len, ret, loop_run = 0;
 
     while (c->chunked_encoding && !c->chunk_size &&
            c->buffer_end > c->buffer_ptr) {
@@ -2573,6 +4505,8 @@ static int http_receive_data(HTTPContext *c)
                 ff_neterrno() != AVERROR(EINTR))
                 /* error : close connection */
                 goto fail;
+            if (ff_neterrno() == AVERROR(EAGAIN))
+                c->revents &= ~POLLIN;
             return 0;
         } else if (len == 0) {
             /* end of connection : close it */
@@ -2599,6 +4533,8 @@ static int http_receive_data(HTTPContext *c)
                 ff_neterrno() != AVERROR(EINTR))
                 /* error : close connection */
                 goto fail;
+            if (ff_neterrno() == AVERROR(EAGAIN))
+                c->revents &= ~POLLIN;
         } else if (len == 0)
             /* end of connection : close it */
             goto fail;
@@ -2606,7 +4542,9 @@ static int http_receive_data(HTTPContext *c)
             c->chunk_size -= len;
             c->buffer_ptr += len;
             c->data_count += len;
-            update_datarate(&c->datarate, c->data_count);
+            update_datarate(&c->datarate, c->data_count, cur_time);
+            if (c->metrics)
+                c->metrics->bytes_received += len;
         }
     }
 
@@ -2623,16 +4561,30 @@ static int http_receive_data(HTTPContext *c)
         /* a packet has been received : write it in the store, except
          * if header */
         if (c->data_count > FFM_PACKET_SIZE) {
-            /* XXX: use llseek or url_seek
-             * XXX: Should probably fail? */
-            if (lseek(c->feed_fd, feed->feed_write_index, SEEK_SET) == -1)
-                http_log("Seek to %"PRId64" failed\n", feed->feed_write_index);
+            if (c->feed_map) {
+                ret = feed_map_write(c->feed_map, feed->feed_write_index,
+                                     c->buffer);
+                if (ret < 0) {
+                    http_log("Error writing to feed file: %s\n",
+                             av_err2str(ret));
+                    goto fail;
+                }
+            } else {
+                /* XXX: use llseek or url_seek
+                 * XXX: Should probably fail? */
+                if (lseek(c->feed_fd, feed->feed_write_index, SEEK_SET) == -1)
+                    http_log("Seek to %"PRId64" failed\n", feed->feed_write_index);
 
-            if (write(c->feed_fd, c->buffer, FFM_PACKET_SIZE) < 0) {
-                http_log("Error writing to feed file: %s\n", strerror(errno));
-                goto fail;
+                if (write(c->feed_fd, c->buffer, FFM_PACKET_SIZE) < 0) {
+                    http_log("Error writing to feed file: %s\n", strerror(errno));
+                    goto fail;
+                }
             }
+            if ((ts = time_shift_get(feed)))
+                time_shift_parse_packet(ts, feed->feed_write_index, c->buffer);
 
+            /* the workers read the index and size concurrently */
+            lock_shared();
             feed->feed_write_index += FFM_PACKET_SIZE;
             /* update file size */
             if (feed->feed_write_index > c->stream->feed_size)
@@ -2642,20 +4594,22 @@ static int http_receive_data(HTTPContext *c)
             if (c->stream->feed_max_size &&
                 feed->feed_write_index >= c->stream->feed_max_size)
                 feed->feed_write_index = FFM_PACKET_SIZE;
+            unlock_shared();
 
             /* write index */
-            if (ffm_write_write_index(c->feed_fd, feed->feed_write_index) < 0) {
+            if (c->feed_map)
+                feed_map_publish(c->feed_map, feed->feed_write_index,
+                                 feed->feed_size);
+            else if (ffm_write_write_index(c->feed_fd, feed->feed_write_index) < 0) {
                 http_log("Error writing index to feed file: %s\n",
                          strerror(errno));
                 goto fail;
             }
 
-            /* wake up any waiting connections */
-            for(c1 = first_http_ctx; c1; c1 = c1->next) {
-                if (c1->state == HTTPSTATE_WAIT_FEED &&
-                    c1->stream->feed == c->stream->feed)
-                    c1->state = HTTPSTATE_SEND_DATA;
-            }
+            /* mux the new data once for the shared outputs, then wake up
+             * any waiting connections */
+            shared_pump_feed(c->stream->feed);
+            wake_feed_waiters(c->stream->feed, 0);
         } else {
             /* We have a header in our hands that contains useful data */
             AVFormatContext *s = avformat_alloc_context();
@@ -2710,11 +4664,7 @@ static int http_receive_data(HTTPContext *c)
     c->stream->feed_opened = 0;
     close(c->feed_fd);
     /* wake up any waiting connections to stop waiting for feed */
-    for(c1 = first_http_ctx; c1; c1 = c1->next) {
-        if (c1->state == HTTPSTATE_WAIT_FEED &&
-            c1->stream->feed == c->stream->feed)
-            c1->state = HTTPSTATE_SEND_DATA_TRAILER;
-    }
+    wake_feed_waiters(c->stream->feed, 1);
     return -1;
 }
 
@@ -3175,6 +5125,7 @@ static void rtsp_cmd_play(HTTPContext *c, const char *url, RTSPMessageHeader *h)
     }
 
     rtp_c->state = HTTPSTATE_SEND_DATA;
+    conn_queue(rtp_c);
 
     /* now everything is OK, so we can send the connection parameters */
     rtsp_reply_header(c, RTSP_STATUS_OK);
@@ -3269,6 +5220,7 @@ static HTTPContext *rtp_new_connection(struct sockaddr_in *from_addr,
 
     current_bandwidth += stream->bandwidth;
 
+    loop_add(&main_loop, c);
     c->next = first_http_ctx;
     first_http_ctx = c;
     return c;
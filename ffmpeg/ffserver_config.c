@@ -657,6 +657,11 @@ static int ffserver_parse_config_global(FFServerConfig *config, const char *cmd,
                   "MaxHTTPConnections(%d)\n", config->nb_max_connections,
                   config->nb_max_http_connections);
         }
+    } else if (!av_strcasecmp(cmd, "Workers")) {
+        ffserver_get_arg(arg, sizeof(arg), p);
+        ffserver_set_int_param(&val, arg, 0, 0, 256, config,
+                "Invalid Workers: '%s'\n", arg);
+        config->nb_workers = val;
     } else if (!av_strcasecmp(cmd, "MaxBandwidth")) {
         int64_t llval;
         char *tailp;
@@ -783,6 +788,11 @@ static int ffserver_parse_config_feed(FFServerConfig *config, const char *cmd, c
             ERROR("Feed max file size is too small. Must be at least %d.\n",
                   FFM_PACKET_SIZE*4);
         }
+    } else if (!av_strcasecmp(cmd, "TimeShift")) {
+        ffserver_get_arg(arg, sizeof(arg), p);
+        if (av_parse_time(&feed->time_shift, arg, 1) < 0 ||
+            feed->time_shift <= 0)
+            ERROR("Invalid time-shift window: '%s'\n", arg);
     } else if (!av_strcasecmp(cmd, "</Feed>")) {
         *pfeed = NULL;
     } else {
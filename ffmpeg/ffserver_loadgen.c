@@ -0,0 +1,348 @@
+/*
+ * Load generator for ffserver
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Opens many HTTP client connections to an ffserver stream and reports
+ * throughput and latency. Linux only, it does not depend on the FFmpeg
+ * libraries:
+ *
+ *   cc -O2 -o ffserver_loadgen ffserver_loadgen.c
+ *   ffserver_loadgen -c 5000 -d 60 http://127.0.0.1:8090/test.mpg
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+enum ClientState {
+    CLIENT_CONNECTING,
+    CLIENT_SENDING,
+    CLIENT_RECEIVING,
+    CLIENT_DONE,
+};
+
+typedef struct Client {
+    int fd;
+    enum ClientState state;
+    int request_sent;             /* bytes of the request already sent */
+    int64_t start_time;           /* connect() called, in us */
+    int64_t connect_time;         /* connection established, in us */
+    int64_t first_byte_time;      /* first response byte, in us */
+    int64_t bytes;
+} Client;
+
+typedef struct Stats {
+    int64_t bytes;
+    int connected, failed, closed;
+    int streaming;                /* clients receiving data right now */
+    int64_t *ttfb;                /* time to first byte of each client, in us */
+    int nb_ttfb;
+} Stats;
+
+static char request[1024];
+static int request_len;
+
+static int64_t gettime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int parse_url(const char *url, char *host, int host_size,
+                     char *port, int port_size, const char **path)
+{
+    const char *p = url, *end;
+
+    if (!strncmp(p, "http://", 7))
+        p += 7;
+    end = p + strcspn(p, ":/");
+    if (end == p || end - p >= host_size)
+        return -1;
+    memcpy(host, p, end - p);
+    host[end - p] = 0;
+    p = end;
+    snprintf(port, port_size, "80");
+    if (*p == ':') {
+        p++;
+        end = p + strcspn(p, "/");
+        if (end == p || end - p >= port_size)
+            return -1;
+        memcpy(port, p, end - p);
+        port[end - p] = 0;
+        p = end;
+    }
+    *path = *p ? p : "/";
+    return 0;
+}
+
+static int client_open(Client *cl, int epoll_fd, const struct addrinfo *ai)
+{
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET };
+    int tmp = 1;
+
+    cl->fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (cl->fd < 0)
+        return -1;
+    setsockopt(cl->fd, IPPROTO_TCP, TCP_NODELAY, &tmp, sizeof(tmp));
+    cl->start_time = gettime();
+    if (connect(cl->fd, ai->ai_addr, ai->ai_addrlen) < 0 &&
+        errno != EINPROGRESS) {
+        close(cl->fd);
+        cl->fd = -1;
+        return -1;
+    }
+    cl->state = CLIENT_CONNECTING;
+    ev.data.ptr = cl;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, cl->fd, &ev) < 0) {
+        close(cl->fd);
+        cl->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void client_close(Client *cl, Stats *st, int failed)
+{
+    if (cl->fd >= 0)
+        close(cl->fd);
+    cl->fd = -1;
+    cl->state = CLIENT_DONE;
+    if (cl->bytes)
+        st->streaming--;
+    if (failed)
+        st->failed++;
+    else
+        st->closed++;
+}
+
+static void client_handle(Client *cl, Stats *st, uint32_t events)
+{
+    char buf[65536];
+    ssize_t len;
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+
+    if (cl->state == CLIENT_DONE)
+        return;
+
+    if (cl->state == CLIENT_CONNECTING) {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            return;
+        getsockopt(cl->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+        if (err) {
+            client_close(cl, st, 1);
+            return;
+        }
+        cl->connect_time = gettime();
+        cl->state = CLIENT_SENDING;
+        st->connected++;
+    }
+
+    if (cl->state == CLIENT_SENDING) {
+        while (cl->request_sent < request_len) {
+            len = send(cl->fd, request + cl->request_sent,
+                       request_len - cl->request_sent, MSG_NOSIGNAL);
+            if (len < 0) {
+                if (errno == EAGAIN)
+                    return;
+                client_close(cl, st, 1);
+                return;
+            }
+            cl->request_sent += len;
+        }
+        cl->state = CLIENT_RECEIVING;
+    }
+
+    /* edge triggered: read until the socket is drained */
+    for (;;) {
+        len = recv(cl->fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EINTR)
+                client_close(cl, st, 1);
+            return;
+        }
+        if (!len) {
+            client_close(cl, st, !cl->bytes);
+            return;
+        }
+        if (!cl->bytes) {
+            cl->first_byte_time = gettime();
+            st->ttfb[st->nb_ttfb++] = cl->first_byte_time - cl->start_time;
+            st->streaming++;
+        }
+        cl->bytes += len;
+        st->bytes += len;
+    }
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(int64_t *v, int n, double p)
+{
+    if (!n)
+        return 0;
+    return v[(int)((n - 1) * p)] / 1000.0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: ffserver_loadgen [options] url\n"
+            "  -c n   number of client connections (default 1000)\n"
+            "  -r n   new connections per second, 0 for all at once (default 500)\n"
+            "  -d n   test duration in seconds (default 30)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    char host[256], port[16];
+    const char *path, *url;
+    struct addrinfo hints = { 0 }, *ai;
+    struct epoll_event events[1024];
+    struct rlimit rl;
+    Client *clients;
+    Stats st = { 0 };
+    int nb_clients = 1000, rate = 500, duration = 30;
+    int i, n, opened = 0, ret;
+    int64_t start, now, last_report, last_bytes = 0;
+    int epoll_fd;
+
+    while ((ret = getopt(argc, argv, "c:r:d:")) != -1) {
+        switch (ret) {
+        case 'c': nb_clients = atoi(optarg); break;
+        case 'r': rate       = atoi(optarg); break;
+        case 'd': duration   = atoi(optarg); break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1 || nb_clients <= 0 || duration <= 0)
+        usage();
+    url = argv[optind];
+
+    if (parse_url(url, host, sizeof(host), port, sizeof(port), &path) < 0) {
+        fprintf(stderr, "Invalid URL '%s'\n", url);
+        return 1;
+    }
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((ret = getaddrinfo(host, port, &hints, &ai))) {
+        fprintf(stderr, "Could not resolve '%s': %s\n", host, gai_strerror(ret));
+        return 1;
+    }
+    request_len = snprintf(request, sizeof(request),
+                           "GET %s HTTP/1.0\r\n"
+                           "Host: %s\r\n"
+                           "User-Agent: ffserver_loadgen\r\n"
+                           "\r\n", path, host);
+
+    /* one descriptor per client, plus some slack */
+    if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < nb_clients + 64) {
+        rl.rlim_cur = rl.rlim_max < nb_clients + 64 ? rl.rlim_max :
+                      nb_clients + 64;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if (rl.rlim_cur < nb_clients + 64)
+            fprintf(stderr, "Warning: only %d descriptors available\n",
+                    (int)rl.rlim_cur);
+    }
+
+    clients = calloc(nb_clients, sizeof(*clients));
+    st.ttfb = calloc(nb_clients, sizeof(*st.ttfb));
+    epoll_fd = epoll_create1(0);
+    if (!clients || !st.ttfb || epoll_fd < 0) {
+        fprintf(stderr, "Initialization failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    start = last_report = gettime();
+    for (;;) {
+        now = gettime();
+        if (now - start >= (int64_t)duration * 1000000)
+            break;
+
+        /* ramp up */
+        n = rate ? (now - start) * rate / 1000000 + 1 : nb_clients;
+        while (opened < nb_clients && opened < n) {
+            Client *cl = &clients[opened++];
+            if (client_open(cl, epoll_fd, ai) < 0)
+                client_close(cl, &st, 1);
+        }
+
+        n = epoll_wait(epoll_fd, events, 1024, 10);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        for (i = 0; i < n; i++)
+            client_handle(events[i].data.ptr, &st, events[i].events);
+
+        now = gettime();
+        if (now - last_report >= 1000000) {
+            printf("%6.1fs: %d opened, %d connected, %d streaming, "
+                   "%d failed, %.2f MB/s\n",
+                   (now - start) / 1000000.0, opened, st.connected,
+                   st.streaming, st.failed,
+                   (st.bytes - last_bytes) / ((now - last_report) / 1e6) / 1e6);
+            fflush(stdout);
+            last_bytes  = st.bytes;
+            last_report = now;
+        }
+    }
+
+    now = gettime();
+    qsort(st.ttfb, st.nb_ttfb, sizeof(*st.ttfb), cmp_int64);
+    printf("\n%d clients, %d connected, %d received data, %d failed\n",
+           opened, st.connected, st.nb_ttfb, st.failed);
+    printf("received %"PRId64" bytes in %.1fs: %.2f MB/s, %.1f kB/s per client\n",
+           st.bytes, (now - start) / 1e6,
+           st.bytes / ((now - start) / 1e6) / 1e6,
+           st.nb_ttfb ? st.bytes / ((now - start) / 1e6) / 1e3 / st.nb_ttfb : 0);
+    printf("time to first byte (ms): p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+           percentile(st.ttfb, st.nb_ttfb, 0.5),
+           percentile(st.ttfb, st.nb_ttfb, 0.9),
+           percentile(st.ttfb, st.nb_ttfb, 0.99),
+           percentile(st.ttfb, st.nb_ttfb, 1));
+
+    for (i = 0; i < opened; i++)
+        if (clients[i].fd >= 0)
+            close(clients[i].fd);
+    close(epoll_fd);
+    freeaddrinfo(ai);
+    free(st.ttfb);
+    free(clients);
+    return st.nb_ttfb ? 0 : 1;
+}
@@ -89,6 +89,7 @@ typedef struct FFServerStream {
     int conns_served;
     int64_t bytes_served;
     int64_t feed_max_size;        /* maximum storage size, zero means unlimited */
+    int64_t time_shift;           /* time-shift window in us, zero means none */
     int64_t feed_write_index;     /* current write position in feed (it wraps around) */
     int64_t feed_size;            /* current size of feed */
     struct FFServerStream *next_feed;
@@ -108,6 +109,8 @@ typedef struct FFServerConfig {
     int errors;
     int warnings;
     int use_defaults;
+    int nb_workers;               /* threads streaming HTTP connections, 0 to
+                                   * serve everything from the main loop */
     // Following variables MUST NOT be used outside configuration parsing code.
     enum AVCodecID guessed_audio_codec_id;
     enum AVCodecID guessed_video_codec_id;
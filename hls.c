@@ -26,19 +26,24 @@
  * http://tools.ietf.org/html/draft-pantos-http-live-streaming
  */
 
+#include "libavutil/aes.h"
 #include "libavutil/avstring.h"
 #include "libavutil/avassert.h"
+#include "libavutil/atomic.h"
 #include "libavutil/intreadwrite.h"
 #include "libavutil/mathematics.h"
+#include "libavutil/md5.h"
 #include "libavutil/opt.h"
 #include "libavutil/dict.h"
 #include "libavutil/time.h"
+#include "libavutil/thread.h"
 #include "avformat.h"
 #include "internal.h"
 #include "avio_internal.h"
 #include "id3v2.h"
 
 #define INITIAL_BUFFER_SIZE 32768
+#define CRYPT_BUF_SIZE 4096
 
 #define MAX_FIELD_LEN 64
 #define MAX_CHARACTERISTICS_LEN 512
@@ -46,6 +51,18 @@
 #define MPEG_TIME_BASE 90000
 #define MPEG_TIME_BASE_Q (AVRational){1, MPEG_TIME_BASE}
 
+#define MAX_PREFETCH_DEPTH 8
+#define PREFETCH_POLL_INTERVAL 100000 /* us between interrupt checks of prefetch_take */
+
+/* largest segment a cache fill holds in memory */
+#define CACHE_MAX_ENTRY (64 * 1024 * 1024)
+/* cache fills waiting for the writer beyond this are dropped */
+#define CACHE_MAX_PENDING (64 * 1024 * 1024)
+#define CACHE_INDEX "index"
+
+/* share of the measured throughput a variant may use */
+#define ABR_SAFETY_PERCENT 80
+
 /*
  * An apple http stream consists of a playlist with media segment files,
  * played sequentially. There may be several playlists with the same
@@ -76,6 +93,80 @@ struct segment {
     struct segment *init_section;
 };
 
+enum PrefetchState {
+    PREFETCH_FREE,
+    PREFETCH_PENDING,
+    PREFETCH_LOADING,
+    PREFETCH_DONE
+};
+
+/*
+ * A media segment downloaded ahead of the demuxer by a prefetch worker.
+ * The segment is a private copy (url and key duplicated), since a live
+ * playlist reload may replace the segment list while it is downloading.
+ * All fields except buf/data_len are protected by the playlist lock;
+ * buf/data_len belong to the worker while LOADING and to the demuxer
+ * once the slot has been taken.
+ */
+struct prefetch {
+    enum PrefetchState state;
+    int seq_no;
+    volatile int cancel;
+    struct segment seg;
+    AVDictionary *opts;
+    char key_url[MAX_URL_SIZE];
+    uint8_t key[16];
+    uint8_t *buf;
+    unsigned int buf_size;
+    int64_t data_len;
+    int64_t fetch_time;
+    int cached;
+    int ret;
+};
+
+/*
+ * Persistent LRU cache of segments and init sections in cache_dir.
+ * Entries are named by the md5 of url and byte range. AES-128 segments
+ * are stored as the ciphertext that came off the network and decrypted
+ * on every read. Their keys are never stored: a key next to its
+ * ciphertext would leave the segment in the clear on disk.
+ * Entries are local files, opened with a "file" only whitelist
+ * whatever the playlist's protocols are. The index file
+ * keeps size and recency of every entry across sessions. Fills are written
+ * by a writer thread to a temporary file and moved into place.
+ */
+struct cache_entry {
+    char name[33];
+    int64_t size;
+    int64_t last_used;
+};
+
+struct cache_job {
+    char name[33];
+    uint8_t *data;
+    int64_t size;
+    struct cache_job *next;
+};
+
+struct segment_cache {
+    char *dir;
+    int64_t max_size;
+    int64_t total_size;
+    int64_t clock;
+    struct cache_entry *entries;
+    int n_entries;
+    unsigned int entries_size;
+    struct cache_job *jobs, *last_job;
+    int64_t pending;
+    int abort;
+#if HAVE_THREADS
+    pthread_t thread;
+    int thread_started;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
 struct rendition;
 
 enum PlaylistType {
@@ -84,6 +175,12 @@ enum PlaylistType {
     PLS_TYPE_VOD
 };
 
+enum ABRPolicy {
+    ABR_NONE,
+    ABR_THROUGHPUT,
+    ABR_BUFFER
+};
+
 /*
  * Each playlist has its own demuxer. If it currently is active,
  * it has an open AVIOContext too, and potentially an AVPacket
@@ -111,6 +208,23 @@ struct playlist {
     int64_t cur_seg_offset;
     int64_t last_load_time;
 
+    /* Playlist whose output streams this playlist's packets are returned
+     * as, itself unless ABR made it stand in for another variant. */
+    struct playlist *out;
+    int abr_switch;         /* segment boundary reached, hand over to c->abr_next */
+    unsigned new_extradata; /* streams whose next packet carries new extradata */
+    int64_t seg_bytes;      /* download accounting of the current segment */
+    int64_t seg_time;
+    int seg_cached;         /* current segment is read from the disk cache */
+
+    /* copy of the segment being read from the network, stored in the
+     * disk cache once complete */
+    char fill_name[33];
+    int filling;
+    uint8_t *fill_buf;
+    unsigned int fill_buf_size;
+    int64_t fill_len;
+
     /* Currently active Media Initialization Section */
     struct segment *cur_init_section;
     uint8_t *init_sec_buf;
@@ -121,6 +235,17 @@ struct playlist {
     char key_url[MAX_URL_SIZE];
     uint8_t key[16];
 
+    /* An AES-128 segment is read as ciphertext from input, the disk cache
+     * copy included, and decrypted by crypt_pb. */
+    int decrypt;
+    AVIOContext crypt_pb;
+    struct AVAES *aes;
+    uint8_t aes_iv[16];
+    uint8_t crypt_buf[CRYPT_BUF_SIZE];
+    int crypt_len;
+    int crypt_eof;
+    int64_t crypt_left;     /* ciphertext left in the byte range, or -1 */
+
     /* ID3 timestamp handling (elementary audio streams have ID3 timestamps
      * (and possibly other ID3 tags) in the beginning of each segment) */
     int is_id3_timestamped; /* -1: not yet known */
@@ -136,6 +261,17 @@ struct playlist {
     int64_t seek_timestamp;
     int seek_flags;
     int seek_stream_index; /* into subdemuxer stream array */
+    int64_t seek_offset;   /* start the next segment at this byte offset */
+
+    /* Start of every segment relative to the first one, n_seg_starts is
+     * n_segments + 1 once built and 0 after the segment list changed. */
+    int64_t *seg_starts;
+    int n_seg_starts;
+
+    /* I-frame playlist over the same media files, if the master playlist
+     * has one, giving the keyframe positions within segments. */
+    struct playlist *iframes;
+    int iframes_checked;
 
     /* Renditions associated with this playlist, if any.
      * Alternative rendition playlists have a single rendition associated
@@ -148,6 +284,42 @@ struct playlist {
      * playlist, if any. */
     int n_init_sections;
     struct segment **init_sections;
+
+    /* Segments cur_seq_no .. cur_seq_no + prefetch_depth, downloaded by
+     * prefetch_depth worker threads. cur_prefetch is the slot read_data
+     * is currently reading from instead of input. */
+    struct prefetch prefetch[MAX_PREFETCH_DEPTH + 1];
+    struct prefetch *cur_prefetch;
+    volatile int prefetch_abort;
+    int n_prefetch_threads;
+
+    /* EXT-X-SERVER-CONTROL and EXT-X-SKIP of the last parse */
+    int can_block_reload;
+    int64_t can_skip_until;
+    int skipped_segments;
+
+    /* Live playlists are reloaded by a refresher thread into refreshed,
+     * read_data swaps the new segment list in between segments. The
+     * refresh_ fields below refreshed are owned by that thread. */
+    struct playlist *refreshed;
+    int refresh_ret;
+    int refresh_started;
+    volatile int refresh_abort;
+    int refresh_full;           /* a delta update could not be applied */
+    AVDictionary *refresh_opts;
+    int refresh_msn;            /* first media sequence number not listed yet */
+    int refresh_block;
+    int64_t refresh_skip_until;
+    int64_t refresh_target;
+    int64_t refresh_due;
+    int64_t refresh_fetch_time;
+    int64_t refresh_last_ok;
+#if HAVE_THREADS
+    pthread_t prefetch_threads[MAX_PREFETCH_DEPTH];
+    pthread_t refresh_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
 };
 
 /*
@@ -167,6 +339,7 @@ struct rendition {
 
 struct variant {
     int bandwidth;
+    int abr_ok; /* main playlist can stand in for the ABR base */
 
     /* every variant contains at least the main Media Playlist in index 0 */
     int n_playlists;
@@ -186,6 +359,8 @@ typedef struct HLSContext {
     struct playlist **playlists;
     int n_renditions;
     struct rendition **renditions;
+    int n_iframe_urls;
+    char **iframe_urls;                  ///< EXT-X-I-FRAME-STREAM-INF playlists
 
     int cur_seq_no;
     int live_start_index;
@@ -199,6 +374,25 @@ typedef struct HLSContext {
     char *http_proxy;                    ///< holds the address of the HTTP proxy server
     AVDictionary *avio_opts;
     int strict_std_compliance;
+    int prefetch_depth;
+    int prefetch_buffer_size;
+    int64_t prefetch_hits;               ///< segments that were fully downloaded when the demuxer reached them
+    int64_t prefetch_misses;             ///< segments the demuxer had to wait for or open itself
+    int abr;                             ///< ABRPolicy
+    int64_t abr_buffer_low;
+    int64_t abr_buffer_high;
+    int64_t abr_buffer_level;            ///< set by the caller while playing: media buffered after the demuxer
+    int64_t abr_throughput;              ///< bits per second, moving average over segment downloads
+    int64_t abr_switches;
+    struct playlist *abr_base;           ///< main playlist whose streams the caller reads
+    int abr_variant;                     ///< variant currently feeding abr_base
+    int abr_next;
+    char *cache_dir;
+    int64_t cache_size;
+    int64_t cache_hits;
+    int64_t cache_misses;
+    int64_t cache_bytes_saved;
+    struct segment_cache *cache;
 } HLSContext;
 
 static int read_chomp_line(AVIOContext *s, char *buf, int maxlen)
@@ -219,6 +413,8 @@ static void free_segment_list(struct playlist *pls)
     }
     av_freep(&pls->segments);
     pls->n_segments = 0;
+    pls->skipped_segments = 0;
+    pls->n_seg_starts = 0;
 }
 
 static void free_init_section_list(struct playlist *pls)
@@ -232,22 +428,113 @@ static void free_init_section_list(struct playlist *pls)
     pls->n_init_sections = 0;
 }
 
+/* Free a playlist that was only parsed, not added to c->playlists. */
+static void free_parsed_playlist(struct playlist *pls)
+{
+    if (!pls)
+        return;
+    free_segment_list(pls);
+    free_init_section_list(pls);
+    av_freep(&pls->seg_starts);
+    av_free(pls);
+}
+
+static void prefetch_reset(struct prefetch *p)
+{
+    av_freep(&p->seg.url);
+    av_freep(&p->seg.key);
+    av_dict_free(&p->opts);
+    p->data_len = 0;
+    p->cancel   = 0;
+    p->cached   = 0;
+    p->ret      = 0;
+    p->state    = PREFETCH_FREE;
+}
+
+/* Close the connection read_data reads from. A segment from the disk
+ * cache was not opened through io_open. */
+static void close_input(struct playlist *pls)
+{
+    if (pls->seg_cached)
+        avio_closep(&pls->input);
+    else if (pls->input)
+        ff_format_io_close(pls->parent, &pls->input);
+    pls->seg_cached = 0;
+    pls->decrypt    = 0;
+}
+
+/* Stop the prefetch workers of a playlist and free their buffers. */
+static void prefetch_stop(struct playlist *pls)
+{
+    int i;
+
+#if HAVE_THREADS
+    pthread_mutex_lock(&pls->lock);
+    pls->prefetch_abort = 1;
+    for (i = 0; i < FF_ARRAY_ELEMS(pls->prefetch); i++)
+        pls->prefetch[i].cancel = 1;
+    pthread_cond_broadcast(&pls->cond);
+    pthread_mutex_unlock(&pls->lock);
+
+    for (i = 0; i < pls->n_prefetch_threads; i++)
+        pthread_join(pls->prefetch_threads[i], NULL);
+    pls->n_prefetch_threads = 0;
+#endif
+
+    for (i = 0; i < FF_ARRAY_ELEMS(pls->prefetch); i++) {
+        prefetch_reset(&pls->prefetch[i]);
+        av_freep(&pls->prefetch[i].buf);
+        pls->prefetch[i].buf_size = 0;
+    }
+    pls->cur_prefetch = NULL;
+}
+
+/* Stop the refresher of a live playlist and drop a reload not applied yet. */
+static void refresh_stop(struct playlist *pls)
+{
+#if HAVE_THREADS
+    if (pls->refresh_started) {
+        pthread_mutex_lock(&pls->lock);
+        pls->refresh_abort = 1;
+        pthread_cond_broadcast(&pls->cond);
+        pthread_mutex_unlock(&pls->lock);
+        pthread_join(pls->refresh_thread, NULL);
+        pls->refresh_started = 0;
+    }
+#endif
+    free_parsed_playlist(pls->refreshed);
+    pls->refreshed = NULL;
+    av_dict_free(&pls->refresh_opts);
+    pls->refresh_abort = 0;
+    pls->refresh_ret   = 0;
+}
+
 static void free_playlist_list(HLSContext *c)
 {
     int i;
     for (i = 0; i < c->n_playlists; i++) {
         struct playlist *pls = c->playlists[i];
+        refresh_stop(pls);
+        prefetch_stop(pls);
+#if HAVE_THREADS
+        pthread_mutex_destroy(&pls->lock);
+        pthread_cond_destroy(&pls->cond);
+#endif
         free_segment_list(pls);
         free_init_section_list(pls);
+        av_freep(&pls->seg_starts);
+        free_parsed_playlist(pls->iframes);
         av_freep(&pls->renditions);
         av_freep(&pls->id3_buf);
         av_dict_free(&pls->id3_initial);
         ff_id3v2_free_extra_meta(&pls->id3_deferred_extra);
         av_freep(&pls->init_sec_buf);
+        av_freep(&pls->fill_buf);
+        av_freep(&pls->aes);
+        av_freep(&pls->crypt_pb.buffer);
         av_packet_unref(&pls->pkt);
         av_freep(&pls->pb.buffer);
-        if (pls->input)
-            ff_format_io_close(c->ctx, &pls->input);
+        close_input(pls);
         if (pls->ctx) {
             pls->ctx->pb = NULL;
             avformat_close_input(&pls->ctx);
@@ -281,6 +568,10 @@ static void free_rendition_list(HLSContext *c)
         av_freep(&c->renditions[i]);
     av_freep(&c->renditions);
     c->n_renditions = 0;
+    for (i = 0; i < c->n_iframe_urls; i++)
+        av_freep(&c->iframe_urls[i]);
+    av_freep(&c->iframe_urls);
+    c->n_iframe_urls = 0;
 }
 
 /*
@@ -305,6 +596,12 @@ static struct playlist *new_playlist(HLSContext *c, const char *url,
 
     pls->is_id3_timestamped = -1;
     pls->id3_mpegts_timestamp = AV_NOPTS_VALUE;
+    pls->out = pls;
+
+#if HAVE_THREADS
+    pthread_mutex_init(&pls->lock, NULL);
+    pthread_cond_init(&pls->cond, NULL);
+#endif
 
     dynarray_add(&c->playlists, &c->n_playlists, pls);
     return pls;
@@ -383,6 +680,51 @@ static void handle_key_args(struct key_info *info, const char *key,
     }
 }
 
+struct iframe_stream_info {
+    char uri[MAX_URL_SIZE];
+};
+
+static void handle_iframe_stream_args(struct iframe_stream_info *info, const char *key,
+                                      int key_len, char **dest, int *dest_len)
+{
+    if (!strncmp(key, "URI=", key_len)) {
+        *dest     =        info->uri;
+        *dest_len = sizeof(info->uri);
+    }
+}
+
+static int new_iframe_stream(HLSContext *c, struct iframe_stream_info *info,
+                             const char *url_base)
+{
+    char tmp_str[MAX_URL_SIZE];
+    char *url;
+
+    if (!info->uri[0])
+        return 0;
+    ff_make_absolute_url(tmp_str, sizeof(tmp_str), url_base, info->uri);
+    if (!(url = av_strdup(tmp_str)))
+        return AVERROR(ENOMEM);
+    dynarray_add(&c->iframe_urls, &c->n_iframe_urls, url);
+    return 0;
+}
+
+struct server_control_info {
+    char can_block_reload[4];
+    char can_skip_until[16];
+};
+
+static void handle_server_control_args(struct server_control_info *info, const char *key,
+                                       int key_len, char **dest, int *dest_len)
+{
+    if (!strncmp(key, "CAN-BLOCK-RELOAD=", key_len)) {
+        *dest     =        info->can_block_reload;
+        *dest_len = sizeof(info->can_block_reload);
+    } else if (!strncmp(key, "CAN-SKIP-UNTIL=", key_len)) {
+        *dest     =        info->can_skip_until;
+        *dest_len = sizeof(info->can_skip_until);
+    }
+}
+
 struct init_section_info {
     char uri[MAX_URL_SIZE];
     char byterange[32];
@@ -589,8 +931,15 @@ static void update_options(char **dest, const char *name, void *src)
         av_freep(dest);
 }
 
+/*
+ * worker_cb is NULL on the demuxer thread, which opens through s->io_open
+ * and keeps the cookies up to date. A prefetch worker passes its own
+ * interrupt callback: it opens the protocol directly, since neither the
+ * io_open of the caller nor the cookies string have to be thread safe.
+ */
 static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
-                    AVDictionary *opts, AVDictionary *opts2)
+                    AVDictionary *opts, AVDictionary *opts2,
+                    const AVIOInterruptCB *worker_cb)
 {
     HLSContext *c = s->priv_data;
     AVDictionary *tmp = NULL;
@@ -621,8 +970,12 @@ static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
     else if (strcmp(proto_name, "file") || !strncmp(url, "file,", 5))
         return AVERROR_INVALIDDATA;
 
-    ret = s->io_open(s, pb, url, AVIO_FLAG_READ, &tmp);
-    if (ret >= 0) {
+    if (worker_cb)
+        ret = ffio_open_whitelist(pb, url, AVIO_FLAG_READ, worker_cb, &tmp,
+                                  s->protocol_whitelist, s->protocol_blacklist);
+    else
+        ret = s->io_open(s, pb, url, AVIO_FLAG_READ, &tmp);
+    if (ret >= 0 && !worker_cb) {
         // update cookies on http response with setcookies.
         void *u = (s->flags & AVFMT_FLAG_CUSTOM_IO) ? NULL : s->pb;
         update_options(&c->cookies, "cookies", u);
@@ -634,6 +987,15 @@ static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
     return ret;
 }
 
+static void close_url(AVFormatContext *s, AVIOContext **pb,
+                      const AVIOInterruptCB *worker_cb)
+{
+    if (worker_cb)
+        avio_closep(pb);
+    else
+        ff_format_io_close(s, pb);
+}
+
 static int parse_playlist(HLSContext *c, const char *url,
                           struct playlist *pls, AVIOContext *in)
 {
@@ -652,6 +1014,10 @@ static int parse_playlist(HLSContext *c, const char *url,
     struct variant_info variant_info;
     char tmp_str[MAX_URL_SIZE];
     struct segment *cur_init_section = NULL;
+    /* the master playlist, parsed once from hls_read_header. Only it may
+     * add to c->iframe_urls: reloads run on the refresher threads while
+     * the demuxer thread reads the list. */
+    const int is_master = !pls;
 
     if (!in) {
 #if 1
@@ -691,6 +1057,8 @@ static int parse_playlist(HLSContext *c, const char *url,
         free_segment_list(pls);
         pls->finished = 0;
         pls->type = PLS_TYPE_UNSPECIFIED;
+        pls->can_block_reload = 0;
+        pls->can_skip_until   = 0;
     }
     while (!avio_feof(in)) {
         read_chomp_line(in, line, sizeof(line));
@@ -699,6 +1067,12 @@ static int parse_playlist(HLSContext *c, const char *url,
             memset(&variant_info, 0, sizeof(variant_info));
             ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_variant_args,
                                &variant_info);
+        } else if (av_strstart(line, "#EXT-X-I-FRAME-STREAM-INF:", &ptr)) {
+            struct iframe_stream_info info = {{0}};
+            ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_iframe_stream_args,
+                               &info);
+            if (is_master && (ret = new_iframe_stream(c, &info, url)) < 0)
+                goto fail;
         } else if (av_strstart(line, "#EXT-X-KEY:", &ptr)) {
             struct key_info info = {{0}};
             ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_key_args,
@@ -745,6 +1119,21 @@ static int parse_playlist(HLSContext *c, const char *url,
             ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_init_section_args,
                                &info);
             cur_init_section = new_init_section(pls, &info, url);
+        } else if (av_strstart(line, "#EXT-X-SERVER-CONTROL:", &ptr)) {
+            struct server_control_info info = {{0}};
+            ret = ensure_playlist(c, &pls, url);
+            if (ret < 0)
+                goto fail;
+            ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_server_control_args,
+                               &info);
+            pls->can_block_reload = !strcmp(info.can_block_reload, "YES");
+            pls->can_skip_until   = atof(info.can_skip_until) * AV_TIME_BASE;
+        } else if (av_strstart(line, "#EXT-X-SKIP:SKIPPED-SEGMENTS=", &ptr)) {
+            /* delta update, the first segments are the ones we already have */
+            ret = ensure_playlist(c, &pls, url);
+            if (ret < 0)
+                goto fail;
+            pls->skipped_segments = FFMAX(atoi(ptr), 0);
         } else if (av_strstart(line, "#EXT-X-ENDLIST", &ptr)) {
             if (pls)
                 pls->finished = 1;
@@ -785,7 +1174,7 @@ static int parse_playlist(HLSContext *c, const char *url,
                 if (has_iv) {
                     memcpy(seg->iv, iv, sizeof(iv));
                 } else {
-                    int seq = pls->start_seq_no + pls->n_segments;
+                    int seq = pls->start_seq_no + pls->skipped_segments + pls->n_segments;
                     memset(seg->iv, 0, sizeof(seg->iv));
                     AV_WB32(seg->iv + 12, seq);
                 }
@@ -838,6 +1227,384 @@ fail:
     return ret;
 }
 
+static void cache_name(char *name, const char *url, int64_t offset, int64_t size)
+{
+    char key[MAX_URL_SIZE + 48];
+    uint8_t md5[16];
+
+    snprintf(key, sizeof(key), "%s@%"PRId64"+%"PRId64, url, offset, size);
+    av_md5_sum(md5, key, strlen(key));
+    ff_data_to_hex(name, md5, sizeof(md5), 1);
+    name[32] = '\0';
+}
+
+static void cache_path(struct segment_cache *cache, char *path, int size,
+                       const char *name)
+{
+    snprintf(path, size, "%s/%s", cache->dir, name);
+}
+
+static void cache_lock(struct segment_cache *cache)
+{
+#if HAVE_THREADS
+    pthread_mutex_lock(&cache->lock);
+#endif
+}
+
+static void cache_unlock(struct segment_cache *cache)
+{
+#if HAVE_THREADS
+    pthread_mutex_unlock(&cache->lock);
+#endif
+}
+
+static struct cache_entry *cache_find(struct segment_cache *cache, const char *name)
+{
+    int i;
+    for (i = 0; i < cache->n_entries; i++)
+        if (!strcmp(cache->entries[i].name, name))
+            return &cache->entries[i];
+    return NULL;
+}
+
+static void cache_drop(struct segment_cache *cache, struct cache_entry *e)
+{
+    char path[MAX_URL_SIZE];
+
+    cache_path(cache, path, sizeof(path), e->name);
+    avpriv_io_delete(path);
+    cache->total_size -= e->size;
+    *e = cache->entries[--cache->n_entries];
+}
+
+/* Evict least recently used entries until size more bytes fit. */
+static void cache_evict(struct segment_cache *cache, int64_t size)
+{
+    while (cache->n_entries && cache->total_size + size > cache->max_size) {
+        struct cache_entry *lru = &cache->entries[0];
+        int i;
+        for (i = 1; i < cache->n_entries; i++)
+            if (cache->entries[i].last_used < lru->last_used)
+                lru = &cache->entries[i];
+        cache_drop(cache, lru);
+    }
+}
+
+/* rename() does not replace an existing file on every platform */
+static int cache_move(const char *src, const char *dst)
+{
+    if (avpriv_io_move(src, dst) >= 0)
+        return 0;
+    avpriv_io_delete(dst);
+    return avpriv_io_move(src, dst);
+}
+
+static int cache_write_file(struct segment_cache *cache, const char *name,
+                            const uint8_t *data, int64_t size)
+{
+    char path[MAX_URL_SIZE], tmp[MAX_URL_SIZE];
+    AVIOContext *pb;
+    int ret;
+
+    cache_path(cache, path, sizeof(path), name);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((ret = avio_open(&pb, tmp, AVIO_FLAG_WRITE)) < 0)
+        return ret;
+    avio_write(pb, data, size);
+    avio_flush(pb);
+    ret = pb->error;
+    avio_closep(&pb);
+    if (ret >= 0)
+        ret = cache_move(tmp, path);
+    if (ret < 0)
+        avpriv_io_delete(tmp);
+    return ret;
+}
+
+static void cache_save_index(struct segment_cache *cache)
+{
+    char path[MAX_URL_SIZE], tmp[MAX_URL_SIZE];
+    AVIOContext *pb;
+    int i;
+
+    cache_path(cache, path, sizeof(path), CACHE_INDEX);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (avio_open(&pb, tmp, AVIO_FLAG_WRITE) < 0)
+        return;
+    cache_lock(cache);
+    for (i = 0; i < cache->n_entries; i++)
+        avio_printf(pb, "%s %"PRId64" %"PRId64"\n", cache->entries[i].name,
+                    cache->entries[i].size, cache->entries[i].last_used);
+    cache_unlock(cache);
+    avio_closep(&pb);
+    cache_move(tmp, path);
+}
+
+static void cache_load_index(struct segment_cache *cache)
+{
+    char path[MAX_URL_SIZE], line[128];
+    AVIOContext *pb;
+
+    cache_path(cache, path, sizeof(path), CACHE_INDEX);
+    if (avio_open(&pb, path, AVIO_FLAG_READ) < 0)
+        return;
+    while (!avio_feof(pb)) {
+        struct cache_entry e, *entries;
+        if (read_chomp_line(pb, line, sizeof(line)) <= 0 ||
+            sscanf(line, "%32s %"SCNd64" %"SCNd64, e.name, &e.size, &e.last_used) != 3 ||
+            strlen(e.name) != 32 || e.size <= 0)
+            continue;
+        entries = av_fast_realloc(cache->entries, &cache->entries_size,
+                                  (cache->n_entries + 1) * sizeof(*entries));
+        if (!entries)
+            break;
+        cache->entries = entries;
+        cache->entries[cache->n_entries++] = e;
+        cache->total_size += e.size;
+        cache->clock = FFMAX(cache->clock, e.last_used);
+    }
+    avio_closep(&pb);
+    /* the cap may have shrunk since the last session */
+    cache_evict(cache, 0);
+}
+
+static void cache_insert(struct segment_cache *cache, struct cache_job *job)
+{
+    struct cache_entry *e, *entries;
+
+    if (cache_write_file(cache, job->name, job->data, job->size) < 0)
+        return;
+
+    cache_lock(cache);
+    if ((e = cache_find(cache, job->name)))
+        cache_drop(cache, e);
+    cache_evict(cache, job->size);
+    entries = av_fast_realloc(cache->entries, &cache->entries_size,
+                              (cache->n_entries + 1) * sizeof(*entries));
+    if (entries) {
+        cache->entries = entries;
+        e = &cache->entries[cache->n_entries++];
+        memcpy(e->name, job->name, sizeof(e->name));
+        e->size      = job->size;
+        e->last_used = ++cache->clock;
+        cache->total_size += job->size;
+    }
+    cache_unlock(cache);
+}
+
+#if HAVE_THREADS
+static void *cache_thread(void *arg)
+{
+    struct segment_cache *cache = arg;
+
+    pthread_mutex_lock(&cache->lock);
+    for (;;) {
+        struct cache_job *job = cache->jobs;
+        if (!job) {
+            if (cache->abort)
+                break;
+            pthread_cond_wait(&cache->cond, &cache->lock);
+            continue;
+        }
+        cache->jobs = job->next;
+        pthread_mutex_unlock(&cache->lock);
+
+        cache_insert(cache, job);
+
+        pthread_mutex_lock(&cache->lock);
+        cache->pending -= job->size;
+        av_free(job->data);
+        av_free(job);
+        if (!cache->jobs) {
+            pthread_mutex_unlock(&cache->lock);
+            cache_save_index(cache);
+            pthread_mutex_lock(&cache->lock);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return NULL;
+}
+#endif
+
+/*
+ * Hand a complete segment (or key) to the cache. Takes ownership of data.
+ * Without threads the file is written right away.
+ */
+static void cache_store(HLSContext *c, const char *name, uint8_t *data, int64_t size)
+{
+    struct segment_cache *cache = c->cache;
+    struct cache_job *job;
+
+    if (!data)
+        return;
+    if (!cache || size <= 0 || size > cache->max_size ||
+        !(job = av_mallocz(sizeof(*job)))) {
+        av_free(data);
+        return;
+    }
+    memcpy(job->name, name, sizeof(job->name));
+    job->data = data;
+    job->size = size;
+
+#if HAVE_THREADS
+    pthread_mutex_lock(&cache->lock);
+    if (cache->thread_started && !cache->abort &&
+        cache->pending + size <= CACHE_MAX_PENDING) {
+        if (cache->jobs)
+            cache->last_job->next = job;
+        else
+            cache->jobs = job;
+        cache->last_job = job;
+        cache->pending += size;
+        pthread_cond_signal(&cache->cond);
+        job = NULL;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (!job)
+        return;
+    if (cache->thread_started) {
+        /* writer is behind, drop this fill */
+        av_free(data);
+        av_free(job);
+        return;
+    }
+#endif
+    cache_insert(cache, job);
+    cache_save_index(cache);
+    av_free(data);
+    av_free(job);
+}
+
+/*
+ * Look name up, marking it as recently used. On a hit returns the entry
+ * size and the file path.
+ */
+static int64_t cache_lookup(HLSContext *c, const char *name, char *path, int path_size)
+{
+    struct segment_cache *cache = c->cache;
+    struct cache_entry *e;
+    int64_t size = 0;
+
+    if (!cache)
+        return 0;
+    cache_lock(cache);
+    if ((e = cache_find(cache, name))) {
+        e->last_used = ++cache->clock;
+        size = e->size;
+        c->cache_hits++;
+        c->cache_bytes_saved += size;
+        cache_path(cache, path, path_size, name);
+    } else {
+        c->cache_misses++;
+    }
+    cache_unlock(cache);
+    return size;
+}
+
+/* The file of a hit could not be opened (removed behind our back). */
+static void cache_forget(HLSContext *c, const char *name)
+{
+    struct segment_cache *cache = c->cache;
+    struct cache_entry *e;
+
+    cache_lock(cache);
+    if ((e = cache_find(cache, name))) {
+        c->cache_hits--;
+        c->cache_misses++;
+        c->cache_bytes_saved -= e->size;
+        cache->total_size -= e->size;
+        *e = cache->entries[--cache->n_entries];
+    }
+    cache_unlock(cache);
+}
+
+static int cache_open(AVFormatContext *s)
+{
+    HLSContext *c = s->priv_data;
+    struct segment_cache *cache;
+
+    if (!c->cache_dir || !c->cache_dir[0])
+        return 0;
+    if (!(cache = av_mallocz(sizeof(*cache))))
+        return AVERROR(ENOMEM);
+    if (!(cache->dir = av_strdup(c->cache_dir))) {
+        av_free(cache);
+        return AVERROR(ENOMEM);
+    }
+    cache->max_size = c->cache_size;
+    cache_load_index(cache);
+
+#if HAVE_THREADS
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->cond, NULL);
+    if (!pthread_create(&cache->thread, NULL, cache_thread, cache))
+        cache->thread_started = 1;
+#endif
+    c->cache = cache;
+    av_log(s, AV_LOG_VERBOSE, "Segment cache '%s': %d entries, %"PRId64" bytes\n",
+           cache->dir, cache->n_entries, cache->total_size);
+    return 0;
+}
+
+static void cache_close(HLSContext *c)
+{
+    struct segment_cache *cache = c->cache;
+
+    if (!cache)
+        return;
+#if HAVE_THREADS
+    /* the writer drains the queued fills before it exits */
+    pthread_mutex_lock(&cache->lock);
+    cache->abort = 1;
+    pthread_cond_signal(&cache->cond);
+    pthread_mutex_unlock(&cache->lock);
+    if (cache->thread_started)
+        pthread_join(cache->thread, NULL);
+    pthread_mutex_destroy(&cache->lock);
+    pthread_cond_destroy(&cache->cond);
+#endif
+    cache_save_index(cache);
+    av_freep(&cache->entries);
+    av_freep(&cache->dir);
+    av_freep(&c->cache);
+}
+
+/* Start keeping a copy of the segment read_data is about to read. */
+static void cache_fill_start(HLSContext *c, struct playlist *pls, struct segment *seg)
+{
+    pls->fill_len = 0;
+    pls->filling  = c->cache && !pls->seg_cached;
+    if (pls->filling)
+        cache_name(pls->fill_name, seg->url, seg->url_offset, seg->size);
+}
+
+static void cache_fill(struct playlist *pls, const uint8_t *buf, int size)
+{
+    uint8_t *fill;
+
+    if (!pls->filling)
+        return;
+    if (pls->fill_len + size > CACHE_MAX_ENTRY ||
+        !(fill = av_fast_realloc(pls->fill_buf, &pls->fill_buf_size,
+                                 pls->fill_len + size))) {
+        pls->filling = 0;
+        return;
+    }
+    pls->fill_buf = fill;
+    memcpy(pls->fill_buf + pls->fill_len, buf, size);
+    pls->fill_len += size;
+}
+
+/* The segment was read to its end, store the copy. */
+static void cache_fill_commit(HLSContext *c, struct playlist *pls)
+{
+    if (pls->filling && pls->fill_len > 0)
+        cache_store(c, pls->fill_name, av_memdup(pls->fill_buf, pls->fill_len),
+                    pls->fill_len);
+    pls->filling  = 0;
+    pls->fill_len = 0;
+}
+
 static struct segment *current_segment(struct playlist *pls)
 {
     return pls->segments[pls->cur_seq_no - pls->start_seq_no];
@@ -858,12 +1625,26 @@ static int read_from_url(struct playlist *pls, struct segment *seg,
     if (seg->size >= 0)
         buf_size = FFMIN(buf_size, seg->size - pls->cur_seg_offset);
 
-    if (mode == READ_COMPLETE) {
-        ret = avio_read(pls->input, buf, buf_size);
-        if (ret != buf_size)
+    if (pls->cur_prefetch) {
+        struct prefetch *p = pls->cur_prefetch;
+        ret = FFMIN(buf_size, p->data_len - pls->cur_seg_offset);
+        if (ret > 0)
+            memcpy(buf, p->buf + pls->cur_seg_offset, ret);
+        else
+            ret = AVERROR_EOF;
+    } else {
+        int64_t start = av_gettime_relative();
+        ret = avio_read(pls->decrypt ? &pls->crypt_pb : pls->input, buf, buf_size);
+        if (mode == READ_COMPLETE && ret != buf_size)
             av_log(NULL, AV_LOG_ERROR, "Could not read complete segment.\n");
-    } else
-        ret = avio_read(pls->input, buf, buf_size);
+        if (ret > 0 && !pls->seg_cached) {
+            pls->seg_bytes += ret;
+            pls->seg_time  += av_gettime_relative() - start;
+            /* decrypt_read keeps the ciphertext */
+            if (!pls->decrypt)
+                cache_fill(pls, buf, ret);
+        }
+    }
 
     if (ret > 0)
         pls->cur_seg_offset += ret;
@@ -1068,100 +1849,564 @@ static void intercept_id3(struct playlist *pls, uint8_t *buf,
         pls->is_id3_timestamped = (pls->id3_mpegts_timestamp != AV_NOPTS_VALUE);
 }
 
-static int open_input(HLSContext *c, struct playlist *pls, struct segment *seg)
+static void segment_options(HLSContext *c, struct segment *seg, AVDictionary **opts)
 {
-    AVDictionary *opts = NULL;
-    int ret;
-
     // broker prior HTTP options that should be consistent across requests
-    av_dict_set(&opts, "user-agent", c->user_agent, 0);
-    av_dict_set(&opts, "cookies", c->cookies, 0);
-    av_dict_set(&opts, "headers", c->headers, 0);
-    av_dict_set(&opts, "http_proxy", c->http_proxy, 0);
-    av_dict_set(&opts, "seekable", "0", 0);
+    av_dict_set(opts, "user-agent", c->user_agent, 0);
+    av_dict_set(opts, "cookies", c->cookies, 0);
+    av_dict_set(opts, "headers", c->headers, 0);
+    av_dict_set(opts, "http_proxy", c->http_proxy, 0);
+    av_dict_set(opts, "seekable", "0", 0);
 
     if (seg->size >= 0) {
         /* try to restrict the HTTP request to the part we want
          * (if this is in fact a HTTP request) */
-        av_dict_set_int(&opts, "offset", seg->url_offset, 0);
-        av_dict_set_int(&opts, "end_offset", seg->url_offset + seg->size, 0);
+        av_dict_set_int(opts, "offset", seg->url_offset, 0);
+        av_dict_set_int(opts, "end_offset", seg->url_offset + seg->size, 0);
+    } else if (seg->url_offset) {
+        av_dict_set_int(opts, "offset", seg->url_offset, 0);
     }
+}
 
-    av_log(pls->parent, AV_LOG_VERBOSE, "HLS request for url '%s', offset %"PRId64", playlist %d\n",
-           seg->url, seg->url_offset, pls->index);
-
-    if (seg->key_type == KEY_NONE) {
-        ret = open_url(pls->parent, &pls->input, seg->url, c->avio_opts, opts);
-    } else if (seg->key_type == KEY_AES_128) {
-        AVDictionary *opts2 = NULL;
-        char iv[33], key[33], url[MAX_URL_SIZE];
-        if (strcmp(seg->key, pls->key_url)) {
-            AVIOContext *pb;
-            if (open_url(pls->parent, &pb, seg->key, c->avio_opts, opts) == 0) {
-                ret = avio_read(pb, pls->key, sizeof(pls->key));
-                if (ret != sizeof(pls->key)) {
-                    av_log(NULL, AV_LOG_ERROR, "Unable to read key file %s\n",
-                           seg->key);
-                }
-                ff_format_io_close(pls->parent, &pb);
-            } else {
-                av_log(NULL, AV_LOG_ERROR, "Unable to open key file %s\n",
-                       seg->key);
-            }
-            av_strlcpy(pls->key_url, seg->key, sizeof(pls->key_url));
-        }
-        ff_data_to_hex(iv, seg->iv, sizeof(seg->iv), 0);
-        ff_data_to_hex(key, pls->key, sizeof(pls->key), 0);
-        iv[32] = key[32] = '\0';
-        if (strstr(seg->url, "://"))
-            snprintf(url, sizeof(url), "crypto+%s", seg->url);
-        else
-            snprintf(url, sizeof(url), "crypto:%s", seg->url);
-
-        av_dict_copy(&opts2, c->avio_opts, 0);
-        av_dict_set(&opts2, "key", key, 0);
-        av_dict_set(&opts2, "iv", iv, 0);
-
-        ret = open_url(pls->parent, &pls->input, url, opts2, opts);
+/* read_packet of crypt_pb. The last block is held back until input ends
+ * to strip its PKCS#7 padding. */
+static int decrypt_read(void *opaque, uint8_t *buf, int buf_size)
+{
+    struct playlist *pls = opaque;
+    int blocks, len;
 
-        av_dict_free(&opts2);
+    while (!pls->crypt_eof && pls->crypt_len < 2 * 16) {
+        int want = sizeof(pls->crypt_buf) - pls->crypt_len;
+        int ret;
 
-        if (ret < 0) {
-            goto cleanup;
+        if (pls->crypt_left >= 0)
+            want = FFMIN(want, pls->crypt_left);
+        ret = want > 0 ? avio_read(pls->input, pls->crypt_buf + pls->crypt_len, want) : 0;
+        if (ret < 0 && ret != AVERROR_EOF)
+            return ret;
+        if (ret <= 0) {
+            pls->crypt_eof = 1;
+            break;
         }
-        ret = 0;
-    } else if (seg->key_type == KEY_SAMPLE_AES) {
-        av_log(pls->parent, AV_LOG_ERROR,
-               "SAMPLE-AES encryption is not supported yet\n");
-        ret = AVERROR_PATCHWELCOME;
+        if (!pls->seg_cached)
+            cache_fill(pls, pls->crypt_buf + pls->crypt_len, ret);
+        if (pls->crypt_left >= 0)
+            pls->crypt_left -= ret;
+        pls->crypt_len += ret;
     }
-    else
-      ret = AVERROR(ENOSYS);
 
-    /* Seek to the requested position. If this was a HTTP request, the offset
-     * should already be where want it to, but this allows e.g. local testing
-     * without a HTTP server. */
-    if (ret == 0 && seg->key_type == KEY_NONE && seg->url_offset) {
-        int64_t seekret = avio_seek(pls->input, seg->url_offset, SEEK_SET);
-        if (seekret < 0) {
-            av_log(pls->parent, AV_LOG_ERROR, "Unable to seek to offset %"PRId64" of HLS segment '%s'\n", seg->url_offset, seg->url);
-            ret = seekret;
-            ff_format_io_close(pls->parent, &pls->input);
-        }
+    blocks = pls->crypt_len / 16 - !pls->crypt_eof;
+    blocks = FFMIN(blocks, buf_size / 16);
+    if (blocks <= 0)
+        return AVERROR_EOF;
+    len = blocks * 16;
+    av_aes_crypt(pls->aes, buf, pls->crypt_buf, blocks, pls->aes_iv, 1);
+    pls->crypt_len -= len;
+    memmove(pls->crypt_buf, pls->crypt_buf + len, pls->crypt_len);
+
+    if (pls->crypt_eof && pls->crypt_len < 16) {
+        if (buf[len - 1] >= 1 && buf[len - 1] <= 16)
+            len -= buf[len - 1];
+        if (!len)
+            return AVERROR_EOF;
     }
-
-cleanup:
-    av_dict_free(&opts);
-    pls->cur_seg_offset = 0;
-    return ret;
+    return len;
 }
 
-static int update_init_section(struct playlist *pls, struct segment *seg)
+/* Have read_from_url decrypt the AES-128 segment just opened on input. */
+static int decrypt_start(struct playlist *pls, struct segment *seg)
+{
+    uint8_t *buf  = pls->crypt_pb.buffer;
+    int buf_size  = pls->crypt_pb.buffer_size;
+
+    if (!pls->aes && !(pls->aes = av_aes_alloc()))
+        return AVERROR(ENOMEM);
+    if (!buf) {
+        if (!(buf = av_malloc(CRYPT_BUF_SIZE)))
+            return AVERROR(ENOMEM);
+        buf_size = CRYPT_BUF_SIZE;
+    }
+    ffio_init_context(&pls->crypt_pb, buf, buf_size, 0, pls,
+                      decrypt_read, NULL, NULL);
+    pls->crypt_pb.seekable = 0;
+    av_aes_init(pls->aes, pls->key, 128, 1);
+    memcpy(pls->aes_iv, seg->iv, sizeof(pls->aes_iv));
+    pls->crypt_len  = 0;
+    pls->crypt_eof  = 0;
+    pls->crypt_left = seg->size;
+    pls->decrypt    = 1;
+    return 0;
+}
+
+/* Decrypt an AES-128 segment held whole in buf in place, returns the size
+ * of the plaintext. */
+static int64_t decrypt_segment(const uint8_t *key, const uint8_t *seg_iv,
+                               uint8_t *buf, int64_t size)
+{
+    struct AVAES *aes = av_aes_alloc();
+    uint8_t iv[16];
+
+    if (!aes)
+        return AVERROR(ENOMEM);
+    size &= ~(int64_t)15;
+    memcpy(iv, seg_iv, sizeof(iv));
+    av_aes_init(aes, key, 128, 1);
+    av_aes_crypt(aes, buf, buf, size / 16, iv, 1);
+    av_free(aes);
+
+    if (size > 0 && buf[size - 1] >= 1 && buf[size - 1] <= 16)
+        size -= buf[size - 1];
+    return size;
+}
+
+/*
+ * Open seg into *in. key_url/key cache the last AES-128 key: the demuxer
+ * thread passes the playlist's own, prefetch workers their slot's copy.
+ * An AES-128 segment is opened as ciphertext, from the network and from
+ * the disk cache alike, the caller decrypts it with key and seg->iv.
+ * *cached is set when the data comes from the disk cache. worker_cb as
+ * for open_url. *in must be closed with close_url, or with avio_closep
+ * when cached: a cache file is not opened through io_open.
+ */
+static int open_segment(HLSContext *c, struct playlist *pls, struct segment *seg,
+                        AVIOContext **in, AVDictionary *opts,
+                        char *key_url, uint8_t *key,
+                        const AVIOInterruptCB *worker_cb, int *cached)
+{
+    char name[33], path[MAX_URL_SIZE];
+    int ret;
+
+    *cached = 0;
+    if (seg->key_type == KEY_SAMPLE_AES) {
+        av_log(pls->parent, AV_LOG_ERROR,
+               "SAMPLE-AES encryption is not supported yet\n");
+        return AVERROR_PATCHWELCOME;
+    } else if (seg->key_type != KEY_NONE && seg->key_type != KEY_AES_128) {
+        return AVERROR(ENOSYS);
+    }
+
+    /* the key itself is never cached, see the disk cache */
+    if (seg->key_type == KEY_AES_128 && strcmp(seg->key, key_url)) {
+        AVIOContext *pb;
+        if (open_url(pls->parent, &pb, seg->key, c->avio_opts, opts, worker_cb) == 0) {
+            ret = avio_read(pb, key, 16);
+            if (ret != 16) {
+                av_log(NULL, AV_LOG_ERROR, "Unable to read key file %s\n",
+                       seg->key);
+            }
+            close_url(pls->parent, &pb, worker_cb);
+        } else {
+            av_log(NULL, AV_LOG_ERROR, "Unable to open key file %s\n",
+                   seg->key);
+        }
+        av_strlcpy(key_url, seg->key, MAX_URL_SIZE);
+    }
+
+    if (c->cache) {
+        cache_name(name, seg->url, seg->url_offset, seg->size);
+        if (cache_lookup(c, name, path, sizeof(path)) > 0) {
+            av_log(pls->parent, AV_LOG_VERBOSE, "HLS cache hit for url '%s', offset %"PRId64", playlist %d\n",
+                   seg->url, seg->url_offset, pls->index);
+            if (ffio_open_whitelist(in, path, AVIO_FLAG_READ,
+                                    worker_cb ? worker_cb : c->interrupt_callback,
+                                    NULL, "file", NULL) == 0) {
+                *cached = 1;
+                return 0;
+            }
+            cache_forget(c, name);
+        }
+    }
+
+    av_log(pls->parent, AV_LOG_VERBOSE, "HLS request for url '%s', offset %"PRId64", playlist %d\n",
+           seg->url, seg->url_offset, pls->index);
+
+    ret = open_url(pls->parent, in, seg->url, c->avio_opts, opts, worker_cb);
+
+    /* Seek to the requested position. If this was a HTTP request, the offset
+     * should already be where want it to, but this allows e.g. local testing
+     * without a HTTP server. */
+    if (ret == 0 && seg->url_offset) {
+        int64_t seekret = avio_seek(*in, seg->url_offset, SEEK_SET);
+        if (seekret < 0) {
+            av_log(pls->parent, AV_LOG_ERROR, "Unable to seek to offset %"PRId64" of HLS segment '%s'\n", seg->url_offset, seg->url);
+            ret = seekret;
+            close_url(pls->parent, in, worker_cb);
+        }
+    }
+
+    return ret;
+}
+
+/* Open seg for read_data, from byte offset on (only for unencrypted
+ * segments, to start at a keyframe after a seek). */
+static int open_input(HLSContext *c, struct playlist *pls, struct segment *seg,
+                      int64_t offset)
+{
+    AVDictionary *opts = NULL;
+    int64_t start = av_gettime_relative();
+    struct segment part;
+    int ret;
+
+    if (offset > 0) {
+        part = *seg;
+        part.url_offset += offset;
+        if (part.size >= 0)
+            part.size -= offset;
+        seg = &part;
+    }
+
+    segment_options(c, seg, &opts);
+    ret = open_segment(c, pls, seg, &pls->input, opts,
+                       pls->key_url, pls->key, NULL, &pls->seg_cached);
+    av_dict_free(&opts);
+    if (ret == 0 && seg->key_type == KEY_AES_128 &&
+        (ret = decrypt_start(pls, seg)) < 0)
+        close_input(pls);
+    /* read_from_url limits reads against the whole segment */
+    pls->cur_seg_offset = offset;
+    pls->seg_bytes = 0;
+    pls->seg_time  = av_gettime_relative() - start;
+    /* only whole segments go to the disk cache */
+    if (ret == 0 && !offset)
+        cache_fill_start(c, pls, seg);
+    return ret;
+}
+
+/* Release the segment read_data is reading from, be it a connection or a
+ * prefetched buffer. */
+static void close_segment(struct playlist *pls)
+{
+    /* an incomplete copy is not worth keeping */
+    pls->filling    = 0;
+    close_input(pls);
+    if (pls->cur_prefetch) {
+#if HAVE_THREADS
+        pthread_mutex_lock(&pls->lock);
+        prefetch_reset(pls->cur_prefetch);
+        pthread_cond_broadcast(&pls->cond);
+        pthread_mutex_unlock(&pls->lock);
+#endif
+        pls->cur_prefetch = NULL;
+    }
+}
+
+#if HAVE_THREADS
+/* Wait on pls->cond for at most timeout microseconds. */
+static void playlist_timedwait(struct playlist *pls, int64_t timeout)
+{
+    int64_t t = av_gettime() + timeout;
+    struct timespec ts = { t / 1000000, (t % 1000000) * 1000 };
+
+    pthread_cond_timedwait(&pls->cond, &pls->lock, &ts);
+}
+
+static int prefetch_interrupt(void *opaque)
+{
+    struct playlist *pls = opaque;
+    HLSContext *c = pls->parent->priv_data;
+
+    return pls->prefetch_abort || ff_check_interrupt(c->interrupt_callback);
+}
+
+static struct prefetch *prefetch_find(struct playlist *pls, int seq_no)
+{
+    int i;
+    for (i = 0; i < FF_ARRAY_ELEMS(pls->prefetch); i++) {
+        struct prefetch *p = &pls->prefetch[i];
+        if (p->state != PREFETCH_FREE && !p->cancel && p->seq_no == seq_no)
+            return p;
+    }
+    return NULL;
+}
+
+/* Download a whole segment into p->buf, bounded by the per slot share of
+ * prefetch_buffer_size. A segment that does not fit is left to read_data. */
+static int fetch_segment(HLSContext *c, struct playlist *pls, struct prefetch *p)
+{
+    AVIOInterruptCB cb = { prefetch_interrupt, pls };
+    int64_t limit = c->prefetch_buffer_size / c->prefetch_depth;
+    int64_t start = av_gettime_relative();
+    int64_t size;
+    AVIOContext *in = NULL;
+    int ret;
+
+    ret = open_segment(c, pls, &p->seg, &in, p->opts, p->key_url, p->key, &cb,
+                       &p->cached);
+    if (ret < 0)
+        return ret;
+
+    size = p->seg.size >= 0 ? p->seg.size : avio_size(in);
+    for (;;) {
+        int64_t want = size > p->data_len ? size :
+                       p->data_len + FFMAX(INITIAL_BUFFER_SIZE, p->data_len / 2);
+
+        if (avpriv_atomic_int_get(&p->cancel) ||
+            avpriv_atomic_int_get(&pls->prefetch_abort)) {
+            ret = AVERROR_EXIT;
+            break;
+        }
+        /* unknown size: grow up to the cap */
+        if (size <= 0)
+            want = FFMIN(want, limit);
+        if (want > limit || want <= p->data_len) {
+            ret = AVERROR(ENOSPC);
+            break;
+        }
+        if (want > p->buf_size) {
+            uint8_t *buf = av_fast_realloc(p->buf, &p->buf_size, want);
+            if (!buf) {
+                ret = AVERROR(ENOMEM);
+                break;
+            }
+            p->buf = buf;
+        }
+        ret = avio_read(in, p->buf + p->data_len,
+                        FFMIN(INITIAL_BUFFER_SIZE, p->buf_size - p->data_len));
+        if (ret <= 0) {
+            if (ret == AVERROR_EOF || ret == 0)
+                ret = 0;
+            break;
+        }
+        p->data_len += ret;
+        if (size > 0 && p->data_len >= size) {
+            ret = 0;
+            break;
+        }
+    }
+    p->fetch_time = av_gettime_relative() - start;
+
+    close_url(pls->parent, &in, &cb);
+    if (ret == 0 && p->data_len > 0 && !p->cached) {
+        char name[33];
+        cache_name(name, p->seg.url, p->seg.url_offset, p->seg.size);
+        cache_store(c, name, av_memdup(p->buf, p->data_len), p->data_len);
+    }
+    if (ret == 0 && p->seg.key_type == KEY_AES_128) {
+        int64_t len = decrypt_segment(p->key, p->seg.iv, p->buf, p->data_len);
+        if (len < 0)
+            ret = len;
+        else
+            p->data_len = len;
+    }
+    return ret;
+}
+
+static void *prefetch_thread(void *arg)
+{
+    struct playlist *pls = arg;
+    HLSContext *c = pls->parent->priv_data;
+
+    pthread_mutex_lock(&pls->lock);
+    while (!pls->prefetch_abort) {
+        struct prefetch *p = NULL;
+        int i, ret;
+
+        /* oldest pending segment first, it is needed soonest */
+        for (i = 0; i < FF_ARRAY_ELEMS(pls->prefetch); i++) {
+            struct prefetch *q = &pls->prefetch[i];
+            if (q->state == PREFETCH_PENDING && (!p || q->seq_no < p->seq_no))
+                p = q;
+        }
+        if (!p) {
+            pthread_cond_wait(&pls->cond, &pls->lock);
+            continue;
+        }
+        p->state = PREFETCH_LOADING;
+        pthread_mutex_unlock(&pls->lock);
+
+        ret = fetch_segment(c, pls, p);
+
+        pthread_mutex_lock(&pls->lock);
+        if (p->cancel) {
+            prefetch_reset(p);
+        } else {
+            if (ret < 0 && ret != AVERROR(ENOSPC))
+                av_log(pls->parent, AV_LOG_WARNING,
+                       "Failed to prefetch segment %d of playlist %d\n",
+                       p->seq_no, pls->index);
+            p->ret   = ret;
+            p->state = PREFETCH_DONE;
+        }
+        pthread_cond_broadcast(&pls->cond);
+    }
+    pthread_mutex_unlock(&pls->lock);
+    return NULL;
+}
+
+/*
+ * Queue first up to cur_seq_no + prefetch_depth for download, and drop
+ * slots that fell out of that window (after a seek, or when a live
+ * playlist moved past them).
+ */
+static void prefetch_schedule(HLSContext *c, struct playlist *pls, int first)
+{
+    int i, seq_no;
+    int last = FFMIN(pls->cur_seq_no + c->prefetch_depth,
+                     pls->start_seq_no + pls->n_segments - 1);
+
+    if (c->prefetch_depth <= 0)
+        return;
+
+    pthread_mutex_lock(&pls->lock);
+    for (i = 0; i < FF_ARRAY_ELEMS(pls->prefetch); i++) {
+        struct prefetch *p = &pls->prefetch[i];
+        if (p->state == PREFETCH_FREE || p == pls->cur_prefetch)
+            continue;
+        if (p->seq_no < first || p->seq_no > last) {
+            if (p->state == PREFETCH_LOADING)
+                p->cancel = 1;
+            else
+                prefetch_reset(p);
+        }
+    }
+
+    for (seq_no = FFMAX(first, pls->start_seq_no); seq_no <= last; seq_no++) {
+        struct segment *seg = pls->segments[seq_no - pls->start_seq_no];
+        struct prefetch *p = NULL;
+
+        if (prefetch_find(pls, seq_no))
+            continue;
+        for (i = 0; i < FF_ARRAY_ELEMS(pls->prefetch) && !p; i++)
+            if (pls->prefetch[i].state == PREFETCH_FREE)
+                p = &pls->prefetch[i];
+        if (!p)
+            break;
+
+        p->seg              = *seg;
+        p->seg.init_section = NULL;
+        p->seg.url          = av_strdup(seg->url);
+        p->seg.key          = seg->key ? av_strdup(seg->key) : NULL;
+        if (!p->seg.url || (seg->key && !p->seg.key)) {
+            prefetch_reset(p);
+            break;
+        }
+        segment_options(c, seg, &p->opts);
+        /* hand over the current key so the worker does not refetch it */
+        av_strlcpy(p->key_url, pls->key_url, sizeof(p->key_url));
+        memcpy(p->key, pls->key, sizeof(p->key));
+        p->seq_no = seq_no;
+        p->state  = PREFETCH_PENDING;
+    }
+
+    while (pls->n_prefetch_threads < FFMIN(c->prefetch_depth, MAX_PREFETCH_DEPTH)) {
+        if (pthread_create(&pls->prefetch_threads[pls->n_prefetch_threads], NULL,
+                           prefetch_thread, pls)) {
+            av_log(pls->parent, AV_LOG_WARNING, "Failed to start prefetch thread\n");
+            break;
+        }
+        pls->n_prefetch_threads++;
+    }
+    pthread_cond_broadcast(&pls->cond);
+    pthread_mutex_unlock(&pls->lock);
+}
+
+/* Drop every prefetched segment except the one being read. */
+static void prefetch_flush(struct playlist *pls)
+{
+    int i;
+
+    pthread_mutex_lock(&pls->lock);
+    for (i = 0; i < FF_ARRAY_ELEMS(pls->prefetch); i++) {
+        struct prefetch *p = &pls->prefetch[i];
+        if (p == pls->cur_prefetch)
+            continue;
+        if (p->state == PREFETCH_LOADING)
+            p->cancel = 1;
+        else
+            prefetch_reset(p);
+    }
+    pthread_mutex_unlock(&pls->lock);
+}
+
+/*
+ * Make the prefetched copy of cur_seq_no the current segment, waiting for
+ * a download that is already running. Returns 1 if read_data can read from
+ * memory, 0 if it has to open the segment itself.
+ */
+static int prefetch_take(HLSContext *c, struct playlist *pls)
+{
+    struct prefetch *p;
+    int ret = 0, ready;
+
+    if (c->prefetch_depth <= 0 || !pls->n_prefetch_threads)
+        return 0;
+
+    pthread_mutex_lock(&pls->lock);
+    p = prefetch_find(pls, pls->cur_seq_no);
+    ready = p && p->state == PREFETCH_DONE;
+    while (p && p->state != PREFETCH_DONE) {
+        if (ff_check_interrupt(c->interrupt_callback)) {
+            ret = AVERROR_EXIT;
+            break;
+        }
+        /* a stalled download signals nothing, keep polling the interrupt */
+        playlist_timedwait(pls, PREFETCH_POLL_INTERVAL);
+        p = prefetch_find(pls, pls->cur_seq_no);
+    }
+    if (p && ret == 0) {
+        if (p->ret >= 0 && p->data_len > 0) {
+            pls->cur_prefetch = p;
+            /* a segment from the disk cache says nothing about the network */
+            pls->seg_bytes = p->cached ? 0 : p->data_len;
+            pls->seg_time  = p->fetch_time;
+            ret = 1;
+        } else {
+            prefetch_reset(p);
+            ready = 0;
+        }
+    }
+    pthread_mutex_unlock(&pls->lock);
+
+    if (ret >= 0) {
+        if (ready)
+            c->prefetch_hits++;
+        else
+            c->prefetch_misses++;
+    }
+    pls->cur_seg_offset = 0;
+    return ret;
+}
+/* Duration of the segments after the current one that are already in memory. */
+static int64_t prefetch_ahead(struct playlist *pls)
+{
+    int64_t duration = 0;
+    int i;
+
+    pthread_mutex_lock(&pls->lock);
+    for (i = 0; i < FF_ARRAY_ELEMS(pls->prefetch); i++) {
+        struct prefetch *p = &pls->prefetch[i];
+        if (p->state == PREFETCH_DONE && p != pls->cur_prefetch && p->ret >= 0)
+            duration += p->seg.duration;
+    }
+    pthread_mutex_unlock(&pls->lock);
+    return duration;
+}
+#else
+static void prefetch_schedule(HLSContext *c, struct playlist *pls, int first)
+{
+}
+
+static int64_t prefetch_ahead(struct playlist *pls)
+{
+    return 0;
+}
+
+static void prefetch_flush(struct playlist *pls)
+{
+}
+
+static int prefetch_take(HLSContext *c, struct playlist *pls)
+{
+    return 0;
+}
+#endif
+
+static int update_init_section(struct playlist *pls, struct segment *seg)
 {
     static const int max_init_section_size = 1024*1024;
     HLSContext *c = pls->parent->priv_data;
     int64_t sec_size;
-    int64_t urlsize;
+    int64_t urlsize = -1;
     int ret;
 
     if (seg->init_section == pls->cur_init_section)
@@ -1172,7 +2417,7 @@ static int update_init_section(struct playlist *pls, struct segment *seg)
     if (!seg->init_section)
         return 0;
 
-    ret = open_input(c, pls, seg->init_section);
+    ret = open_input(c, pls, seg->init_section, 0);
     if (ret < 0) {
         av_log(pls->parent, AV_LOG_WARNING,
                "Failed to open an initialization section in playlist %d\n",
@@ -1197,7 +2442,10 @@ static int update_init_section(struct playlist *pls, struct segment *seg)
 
     ret = read_from_url(pls, seg->init_section, pls->init_sec_buf,
                         pls->init_sec_buf_size, READ_COMPLETE);
-    ff_format_io_close(pls->parent, &pls->input);
+    /* only a section read up to its known size goes to the cache */
+    if (ret == seg->init_section->size || ret == urlsize)
+        cache_fill_commit(c, pls);
+    close_segment(pls);
 
     if (ret < 0)
         return ret;
@@ -1220,6 +2468,412 @@ static int64_t default_reload_interval(struct playlist *pls)
                           pls->target_duration;
 }
 
+/* Options of the playlist requests, rebuilt by the demuxer thread as
+ * cookies may change between requests. Called with pls->lock held. */
+static void refresh_update_options(HLSContext *c, struct playlist *pls)
+{
+    av_dict_free(&pls->refresh_opts);
+    av_dict_set(&pls->refresh_opts, "seekable", "0", 0);
+    av_dict_set(&pls->refresh_opts, "user-agent", c->user_agent, 0);
+    av_dict_set(&pls->refresh_opts, "cookies", c->cookies, 0);
+    av_dict_set(&pls->refresh_opts, "headers", c->headers, 0);
+    av_dict_set(&pls->refresh_opts, "http_proxy", c->http_proxy, 0);
+}
+
+/* Move the segments of a reload into pls. Runs on the demuxer thread. */
+static int refresh_merge(struct playlist *pls, struct playlist *next)
+{
+    struct segment **segments;
+    int i, j, k, first, n;
+
+    /* a delta update lists only the segments after the skipped ones,
+     * take those from the list we have */
+    first = next->start_seq_no - pls->start_seq_no;
+    if (next->skipped_segments &&
+        (first < 0 || first + next->skipped_segments > pls->n_segments))
+        return AVERROR(EAGAIN);
+
+    n = next->skipped_segments + next->n_segments;
+    segments = av_malloc_array(FFMAX(n, 1), sizeof(*segments));
+    if (!segments)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < next->skipped_segments; i++) {
+        segments[i] = pls->segments[first + i];
+        pls->segments[first + i] = NULL;
+    }
+    memcpy(segments + i, next->segments, next->n_segments * sizeof(*segments));
+
+    for (i = 0; i < pls->n_segments; i++) {
+        if (!pls->segments[i])
+            continue;
+        av_freep(&pls->segments[i]->key);
+        av_freep(&pls->segments[i]->url);
+        av_freep(&pls->segments[i]);
+    }
+    av_freep(&pls->segments);
+    pls->segments     = segments;
+    pls->n_segments   = n;
+    pls->n_seg_starts = 0;
+    av_freep(&next->segments);
+    next->n_segments = 0;
+
+    /* keep the init sections we know so an unchanged EXT-X-MAP is not
+     * downloaded again after every reload */
+    for (i = 0; i < next->n_init_sections; i++) {
+        struct segment *sec = next->init_sections[i], *same = NULL;
+        for (j = 0; j < pls->n_init_sections && !same; j++) {
+            struct segment *old = pls->init_sections[j];
+            if (!strcmp(old->url, sec->url) && old->url_offset == sec->url_offset &&
+                old->size == sec->size)
+                same = old;
+        }
+        if (same) {
+            for (j = 0; j < pls->n_segments; j++)
+                if (pls->segments[j]->init_section == sec)
+                    pls->segments[j]->init_section = same;
+            av_freep(&sec->url);
+            av_freep(&sec);
+        } else {
+            dynarray_add(&pls->init_sections, &pls->n_init_sections, sec);
+        }
+    }
+    av_freep(&next->init_sections);
+    next->n_init_sections = 0;
+
+    /* free the sections of segments that left the playlist. The current
+     * one stays, update_init_section tells sections apart by address. */
+    for (i = j = 0; i < pls->n_init_sections; i++) {
+        struct segment *sec = pls->init_sections[i];
+        int used = sec == pls->cur_init_section;
+        for (k = 0; k < pls->n_segments && !used; k++)
+            used = pls->segments[k]->init_section == sec;
+        if (used) {
+            pls->init_sections[j++] = sec;
+        } else {
+            av_freep(&sec->url);
+            av_freep(&sec);
+        }
+    }
+    pls->n_init_sections = j;
+
+    pls->start_seq_no     = next->start_seq_no;
+    pls->target_duration  = next->target_duration;
+    pls->finished         = next->finished;
+    pls->type             = next->type;
+    pls->last_load_time   = next->last_load_time;
+    pls->can_block_reload = next->can_block_reload;
+    pls->can_skip_until   = next->can_skip_until;
+    return 0;
+}
+
+#if HAVE_THREADS
+static int refresh_interrupt(void *opaque)
+{
+    struct playlist *pls = opaque;
+    HLSContext *c = pls->parent->priv_data;
+
+    return pls->refresh_abort || ff_check_interrupt(c->interrupt_callback);
+}
+
+/* Load url into a new playlist next. The request has its own interrupt
+ * callback so that a blocking reload does not hold up hls_close. */
+static int refresh_fetch(HLSContext *c, struct playlist *pls, const char *url,
+                         AVDictionary **opts, struct playlist **next)
+{
+    AVIOInterruptCB cb = { refresh_interrupt, pls };
+    AVIOContext *in = NULL;
+    int ret;
+
+    if (!(*next = av_mallocz(sizeof(**next))))
+        return AVERROR(ENOMEM);
+    ret = ffio_open_whitelist(&in, url, AVIO_FLAG_READ, &cb, opts,
+                              c->ctx->protocol_whitelist, c->ctx->protocol_blacklist);
+    if (ret >= 0) {
+        ret = parse_playlist(c, pls->url, *next, in);
+        avio_closep(&in);
+    }
+    if (ret < 0) {
+        free_parsed_playlist(*next);
+        *next = NULL;
+    }
+    return ret;
+}
+
+/*
+ * Reload a live playlist ahead of the time its next segment is expected,
+ * by the measured request time. A server that can block playlist reloads
+ * is asked for the next media sequence number right away and answers as
+ * soon as it exists; one that offers delta updates only sends the
+ * segments after the ones we have.
+ */
+static void *refresh_thread(void *arg)
+{
+    struct playlist *pls = arg;
+    HLSContext *c = pls->parent->priv_data;
+    char url[MAX_URL_SIZE];
+    /* a blocking request is only made after one that brought new segments,
+     * a failing or non-blocking server is polled at the reload interval */
+    int advanced = 1;
+
+    pthread_mutex_lock(&pls->lock);
+    while (!pls->refresh_abort) {
+        struct playlist *next = NULL;
+        AVDictionary *opts = NULL;
+        int64_t now = av_gettime_relative(), start, interval;
+        int block, skip, ret, msn;
+
+        block = pls->refresh_block && advanced;
+        if (!block && now < pls->refresh_due) {
+            playlist_timedwait(pls, pls->refresh_due - now);
+            continue;
+        }
+        /* the skipped segments are taken from the list read_data has,
+         * so no delta update while a reload is waiting to be applied */
+        skip = pls->refresh_skip_until > 0 && !pls->refreshed && !pls->refresh_full &&
+               now - pls->refresh_last_ok < pls->refresh_skip_until / 2;
+        av_dict_copy(&opts, pls->refresh_opts, 0);
+        pthread_mutex_unlock(&pls->lock);
+
+        av_strlcpy(url, pls->url, sizeof(url));
+        if (block)
+            av_strlcatf(url, sizeof(url), "%s_HLS_msn=%d",
+                        strchr(url, '?') ? "&" : "?", pls->refresh_msn);
+        if (skip)
+            av_strlcatf(url, sizeof(url), "%s_HLS_skip=YES",
+                        strchr(url, '?') ? "&" : "?");
+
+        start = av_gettime_relative();
+        ret = refresh_fetch(c, pls, url, &opts, &next);
+        av_dict_free(&opts);
+        now = av_gettime_relative();
+
+        pthread_mutex_lock(&pls->lock);
+        if (pls->refresh_abort) {
+            free_parsed_playlist(next);
+            break;
+        }
+        if (ret < 0) {
+            if (ret != AVERROR_EXIT)
+                av_log(pls->parent, AV_LOG_WARNING, "Failed to reload playlist %d\n",
+                       pls->index);
+            pls->refresh_ret = ret;
+            pls->refresh_due = now + pls->refresh_target / 2;
+            advanced = 0;
+            pthread_cond_broadcast(&pls->cond);
+            continue;
+        }
+
+        pls->refresh_fetch_time = pls->refresh_fetch_time ?
+            (pls->refresh_fetch_time * 3 + (now - start)) / 4 : now - start;
+        pls->refresh_last_ok = now;
+        if (skip)
+            pls->refresh_full = 0;
+
+        msn = next->start_seq_no + next->skipped_segments + next->n_segments;
+        /* nothing new: poll again at half the target duration */
+        advanced = msn > pls->refresh_msn;
+        interval = advanced && next->n_segments ?
+                   next->segments[next->n_segments - 1]->duration :
+                   next->target_duration / 2;
+        pls->refresh_msn        = msn;
+        pls->refresh_due        = now + interval - FFMIN(pls->refresh_fetch_time, interval / 2);
+        pls->refresh_block      = next->can_block_reload;
+        pls->refresh_skip_until = next->can_skip_until;
+        pls->refresh_target     = next->target_duration;
+        pls->refresh_ret        = 0;
+
+        free_parsed_playlist(pls->refreshed);
+        pls->refreshed = next;
+        pthread_cond_broadcast(&pls->cond);
+        if (next->finished)
+            break;
+    }
+    pthread_mutex_unlock(&pls->lock);
+    return NULL;
+}
+
+static int refresh_start(HLSContext *c, struct playlist *pls)
+{
+    int ret;
+
+    if (pls->refresh_started)
+        return 0;
+
+    /* the fields the refresher owns start from the playlist as loaded */
+    pthread_mutex_lock(&pls->lock);
+    refresh_update_options(c, pls);
+    pls->refresh_msn        = pls->start_seq_no + pls->n_segments;
+    pls->refresh_block      = pls->can_block_reload;
+    pls->refresh_skip_until = pls->can_skip_until;
+    pls->refresh_target     = pls->target_duration;
+    pls->refresh_due        = pls->last_load_time + default_reload_interval(pls);
+    pls->refresh_last_ok    = pls->last_load_time;
+    pls->refresh_fetch_time = 0;
+    pls->refresh_full       = 0;
+    pthread_mutex_unlock(&pls->lock);
+
+    ret = pthread_create(&pls->refresh_thread, NULL, refresh_thread, pls);
+    if (ret) {
+        av_log(pls->parent, AV_LOG_WARNING, "Failed to start playlist refresher\n");
+        return AVERROR(ret);
+    }
+    pls->refresh_started = 1;
+    return 0;
+}
+
+/* Apply a reload the refresher made, or return the error of the last one. */
+static int refresh_apply(HLSContext *c, struct playlist *pls)
+{
+    struct playlist *next;
+    int ret;
+
+    pthread_mutex_lock(&pls->lock);
+    next = pls->refreshed;
+    pls->refreshed = NULL;
+    ret = next ? 0 : pls->refresh_ret;
+    pls->refresh_ret = 0;
+    if (next)
+        refresh_update_options(c, pls);
+    pthread_mutex_unlock(&pls->lock);
+
+    if (!next)
+        return ret;
+
+    /* select_cur_seq_no may have reloaded synchronously in the meantime */
+    if (next->last_load_time > pls->last_load_time) {
+        ret = refresh_merge(pls, next);
+        if (ret == AVERROR(EAGAIN)) {
+            av_log(pls->parent, AV_LOG_VERBOSE,
+                   "Delta update of playlist %d does not match, requesting a full reload\n",
+                   pls->index);
+            pthread_mutex_lock(&pls->lock);
+            pls->refresh_full = 1;
+            pls->refresh_due  = 0;
+            pthread_cond_broadcast(&pls->cond);
+            pthread_mutex_unlock(&pls->lock);
+            ret = 0;
+        }
+    }
+    free_parsed_playlist(next);
+    return ret;
+}
+
+/* Sleep until the refresher has something for read_data. */
+static int refresh_wait(HLSContext *c, struct playlist *pls)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&pls->lock);
+    while (!pls->refreshed && !pls->refresh_ret) {
+        if (ff_check_interrupt(c->interrupt_callback)) {
+            ret = AVERROR_EXIT;
+            break;
+        }
+        /* woken by the refresher, the timeout only serves the interrupt
+         * callback */
+        playlist_timedwait(pls, 100000);
+    }
+    pthread_mutex_unlock(&pls->lock);
+    return ret;
+}
+#else
+static int refresh_start(HLSContext *c, struct playlist *pls)
+{
+    return AVERROR(ENOSYS);
+}
+
+static int refresh_apply(HLSContext *c, struct playlist *pls)
+{
+    return 0;
+}
+
+static int refresh_wait(HLSContext *c, struct playlist *pls)
+{
+    return AVERROR(ENOSYS);
+}
+#endif
+
+static struct playlist *abr_active(HLSContext *c)
+{
+    return c->variants[c->abr_variant]->playlists[0];
+}
+
+static void abr_update_throughput(HLSContext *c, struct playlist *pls)
+{
+    int64_t sample;
+
+    if (pls->seg_bytes <= 0 || pls->seg_time <= 0)
+        return;
+    sample = av_rescale(pls->seg_bytes * 8, AV_TIME_BASE, pls->seg_time);
+    c->abr_throughput = c->abr_throughput ?
+                        (c->abr_throughput * 7 + sample * 3) / 10 : sample;
+    pls->seg_bytes = pls->seg_time = 0;
+}
+
+/*
+ * Pick the variant for the next segment. The throughput policy takes the
+ * best variant fitting in ABR_SAFETY_PERCENT of the measured throughput.
+ * The buffer policy maps the buffer level linearly between abr_buffer_low
+ * (lowest variant) and abr_buffer_high (highest variant) onto a bit rate.
+ */
+static int abr_select_variant(HLSContext *c, struct playlist *pls)
+{
+    int i, best = -1, lowest = -1;
+    int64_t min_bw = INT64_MAX, max_bw = 0, rate;
+
+    for (i = 0; i < c->n_variants; i++) {
+        struct variant *var = c->variants[i];
+        if (!var->abr_ok)
+            continue;
+        min_bw = FFMIN(min_bw, var->bandwidth);
+        max_bw = FFMAX(max_bw, var->bandwidth);
+    }
+
+    if (c->abr == ABR_BUFFER) {
+        int64_t level = c->abr_buffer_level + prefetch_ahead(pls);
+        if (level <= c->abr_buffer_low)
+            rate = min_bw;
+        else if (level >= c->abr_buffer_high || c->abr_buffer_high <= c->abr_buffer_low)
+            rate = max_bw;
+        else
+            rate = min_bw + av_rescale(max_bw - min_bw, level - c->abr_buffer_low,
+                                       c->abr_buffer_high - c->abr_buffer_low);
+    } else {
+        if (!c->abr_throughput)
+            return c->abr_variant;
+        rate = c->abr_throughput * ABR_SAFETY_PERCENT / 100;
+    }
+
+    for (i = 0; i < c->n_variants; i++) {
+        struct variant *var = c->variants[i];
+        if (!var->abr_ok)
+            continue;
+        if (lowest < 0 || var->bandwidth < c->variants[lowest]->bandwidth)
+            lowest = i;
+        if (var->bandwidth <= rate &&
+            (best < 0 || var->bandwidth > c->variants[best]->bandwidth))
+            best = i;
+    }
+    return best >= 0 ? best : lowest;
+}
+
+/* Called at a segment boundary of the playlist feeding abr_base. */
+static int abr_check_switch(HLSContext *c, struct playlist *pls)
+{
+    if (!c->abr || !c->abr_base || pls != abr_active(c))
+        return 0;
+
+    abr_update_throughput(c, pls);
+    if (pls->finished && pls->cur_seq_no >= pls->start_seq_no + pls->n_segments)
+        return 0;
+
+    c->abr_next = abr_select_variant(c, pls);
+    if (c->abr_next < 0 || c->abr_next == c->abr_variant)
+        return 0;
+    pls->abr_switch = 1;
+    return 1;
+}
+
 static int read_data(void *opaque, uint8_t *buf, int buf_size)
 {
     struct playlist *v = opaque;
@@ -1228,19 +2882,19 @@ static int read_data(void *opaque, uint8_t *buf, int buf_size)
     int just_opened = 0;
 
 restart:
-    if (!v->needed)
+    if (!v->needed || v->abr_switch)
         return AVERROR_EOF;
 
-    if (!v->input) {
+    if (!v->input && !v->cur_prefetch) {
         int64_t reload_interval;
         struct segment *seg;
 
         /* Check that the playlist is still needed before opening a new
          * segment. */
         if (v->ctx && v->ctx->nb_streams &&
-            v->parent->nb_streams >= v->stream_offset + v->ctx->nb_streams) {
+            v->parent->nb_streams >= v->out->stream_offset + v->ctx->nb_streams) {
             v->needed = 0;
-            for (i = v->stream_offset; i < v->stream_offset + v->ctx->nb_streams;
+            for (i = v->out->stream_offset; i < v->out->stream_offset + v->ctx->nb_streams;
                 i++) {
                 if (v->parent->streams[i]->discard < AVDISCARD_ALL)
                     v->needed = 1;
@@ -1249,16 +2903,29 @@ restart:
         if (!v->needed) {
             av_log(v->parent, AV_LOG_INFO, "No longer receiving playlist %d\n",
                 v->index);
+            prefetch_flush(v);
+            refresh_stop(v);
             return AVERROR_EOF;
         }
 
+        /* Live playlists are reloaded in the background, the synchronous
+         * reload below is the fallback when no refresher could be started. */
+        if (!v->finished && !v->refresh_started)
+            refresh_start(c, v);
+
         /* If this is a live stream and the reload interval has elapsed since
          * the last playlist reload, reload the playlists now. */
         reload_interval = default_reload_interval(v);
 
 reload:
-        if (!v->finished &&
-            av_gettime_relative() - v->last_load_time >= reload_interval) {
+        if (v->refresh_started) {
+            if ((ret = refresh_apply(c, v)) < 0) {
+                av_log(v->parent, AV_LOG_WARNING, "Failed to reload playlist %d\n",
+                       v->index);
+                return ret;
+            }
+        } else if (!v->finished &&
+                   av_gettime_relative() - v->last_load_time >= reload_interval) {
             if ((ret = parse_playlist(c, v->url, v, NULL)) < 0) {
                 av_log(v->parent, AV_LOG_WARNING, "Failed to reload playlist %d\n",
                        v->index);
@@ -1278,6 +2945,11 @@ reload:
         if (v->cur_seq_no >= v->start_seq_no + v->n_segments) {
             if (v->finished)
                 return AVERROR_EOF;
+            if (v->refresh_started) {
+                if ((ret = refresh_wait(c, v)) < 0)
+                    return ret;
+                goto reload;
+            }
             while (av_gettime_relative() - v->last_load_time < reload_interval) {
                 if (ff_check_interrupt(c->interrupt_callback))
                     return AVERROR_EXIT;
@@ -1294,7 +2966,19 @@ reload:
         if (ret)
             return ret;
 
-        ret = open_input(c, v, seg);
+        if (v->seek_offset > 0) {
+            /* start at the keyframe hls_read_seek found, the segments
+             * after it are fetched meanwhile */
+            int64_t offset = v->seek_offset;
+            v->seek_offset = 0;
+            prefetch_schedule(c, v, v->cur_seq_no + 1);
+            ret = open_input(c, v, seg, offset);
+        } else {
+            prefetch_schedule(c, v, v->cur_seq_no);
+            ret = prefetch_take(c, v);
+            if (ret == 0)
+                ret = open_input(c, v, seg, 0);
+        }
         if (ret < 0) {
             if (ff_check_interrupt(c->interrupt_callback))
                 return AVERROR_EXIT;
@@ -1324,11 +3008,18 @@ reload:
 
         return ret;
     }
-    ff_format_io_close(v->parent, &v->input);
+    if (ret == 0 || ret == AVERROR_EOF)
+        cache_fill_commit(c, v);
+    close_segment(v);
     v->cur_seq_no++;
 
     c->cur_seq_no = v->cur_seq_no;
 
+    /* let the subdemuxer drain, hls_read_packet continues with the new
+     * variant from the next segment */
+    if (abr_check_switch(c, v))
+        return AVERROR_EOF;
+
     goto restart;
 }
 
@@ -1405,12 +3096,32 @@ static void add_metadata_from_renditions(AVFormatContext *s, struct playlist *pl
     }
 }
 
+/* Fill seg_starts, the start of every segment relative to the first. */
+static int update_segment_index(struct playlist *pls)
+{
+    int i, ret;
+
+    if (pls->n_seg_starts == pls->n_segments + 1)
+        return 0;
+    ret = av_reallocp_array(&pls->seg_starts, pls->n_segments + 1,
+                            sizeof(*pls->seg_starts));
+    if (ret < 0) {
+        pls->n_seg_starts = 0;
+        return ret;
+    }
+    pls->seg_starts[0] = 0;
+    for (i = 0; i < pls->n_segments; i++)
+        pls->seg_starts[i + 1] = pls->seg_starts[i] + pls->segments[i]->duration;
+    pls->n_seg_starts = pls->n_segments + 1;
+    return 0;
+}
+
 /* if timestamp was in valid range: returns 1 and sets seq_no
  * if not: returns 0 and sets seq_no to closest segment */
 static int find_timestamp_in_playlist(HLSContext *c, struct playlist *pls,
                                       int64_t timestamp, int *seq_no)
 {
-    int i;
+    int lo, hi;
     int64_t pos = c->first_timestamp == AV_NOPTS_VALUE ?
                   0 : c->first_timestamp;
 
@@ -1419,18 +3130,79 @@ static int find_timestamp_in_playlist(HLSContext *c, struct playlist *pls,
         return 0;
     }
 
-    for (i = 0; i < pls->n_segments; i++) {
-        int64_t diff = pos + pls->segments[i]->duration - timestamp;
-        if (diff > 0) {
-            *seq_no = pls->start_seq_no + i;
-            return 1;
+    timestamp -= pos;
+    if (!pls->n_segments || update_segment_index(pls) < 0 ||
+        timestamp >= pls->seg_starts[pls->n_segments]) {
+        *seq_no = pls->start_seq_no + pls->n_segments - 1;
+        return 0;
+    }
+
+    /* last segment starting at or before timestamp */
+    lo = 0;
+    hi = pls->n_segments - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) >> 1;
+        if (pls->seg_starts[mid] <= timestamp)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    *seq_no = pls->start_seq_no + lo;
+
+    return 1;
+}
+
+/* Load the I-frame playlists of the master playlist until one lists the
+ * media files of pls. Only tried once per playlist. */
+static struct playlist *find_iframe_playlist(HLSContext *c, struct playlist *pls)
+{
+    int i, j;
+
+    if (pls->iframes_checked)
+        return pls->iframes;
+    pls->iframes_checked = 1;
+
+    for (i = 0; i < c->n_iframe_urls && pls->n_segments && !pls->iframes; i++) {
+        struct playlist *iframes = av_mallocz(sizeof(*iframes));
+        if (!iframes)
+            break;
+        av_strlcpy(iframes->url, c->iframe_urls[i], sizeof(iframes->url));
+        if (parse_playlist(c, iframes->url, iframes, NULL) >= 0 && iframes->n_segments) {
+            for (j = 0; j < pls->n_segments && !pls->iframes; j++)
+                if (!strcmp(pls->segments[j]->url, iframes->segments[0]->url))
+                    pls->iframes = iframes;
         }
-        pos += pls->segments[i]->duration;
+        if (pls->iframes != iframes)
+            free_parsed_playlist(iframes);
     }
+    return pls->iframes;
+}
 
-    *seq_no = pls->start_seq_no + pls->n_segments - 1;
+/*
+ * Byte offset within segment seq_no of the last keyframe at or before
+ * timestamp, and the time of that keyframe. Returns 0 if unknown.
+ */
+static int find_keyframe(HLSContext *c, struct playlist *pls, int seq_no,
+                         int64_t timestamp, int64_t *offset, int64_t *time)
+{
+    struct playlist *iframes = find_iframe_playlist(c, pls);
+    struct segment *seg = pls->segments[seq_no - pls->start_seq_no];
+    struct segment *kf;
+    int k;
+
+    /* an encrypted segment can only be decrypted from its start */
+    if (!iframes || seg->key_type != KEY_NONE ||
+        !find_timestamp_in_playlist(c, iframes, timestamp, &k))
+        return 0;
+    kf = iframes->segments[k - iframes->start_seq_no];
+    if (strcmp(kf->url, seg->url) || kf->url_offset < seg->url_offset ||
+        (seg->size >= 0 && kf->url_offset >= seg->url_offset + seg->size))
+        return 0;
 
-    return 0;
+    *offset = kf->url_offset - seg->url_offset;
+    *time   = (c->first_timestamp == AV_NOPTS_VALUE ? 0 : c->first_timestamp) +
+              iframes->seg_starts[k - iframes->start_seq_no];
+    return 1;
 }
 
 static int select_cur_seq_no(HLSContext *c, struct playlist *pls)
@@ -1532,6 +3304,9 @@ static int hls_read_header(AVFormatContext *s)
         update_options(&c->http_proxy, "http_proxy", u);
     }
 
+    if ((ret = cache_open(s)) < 0)
+        goto fail;
+
     if ((ret = parse_playlist(c, s->filename, NULL, s->pb)) < 0)
         goto fail;
 
@@ -1706,9 +3481,130 @@ fail:
     free_playlist_list(c);
     free_variant_list(c);
     free_rendition_list(c);
+    cache_close(c);
     return ret;
 }
 
+static int abr_compatible(HLSContext *c, struct playlist *base, struct variant *var)
+{
+    struct playlist *pls = var->playlists[0];
+    int i;
+
+    if (!var->bandwidth || !pls->ctx || !pls->n_segments)
+        return 0;
+    if (pls == base)
+        return 1;
+    if (pls->ctx->nb_streams != base->ctx->nb_streams ||
+        playlist_in_multiple_variants(c, pls))
+        return 0;
+    for (i = 0; i < pls->ctx->nb_streams; i++) {
+        AVCodecParameters *par  = pls->ctx->streams[i]->codecpar;
+        AVCodecParameters *bpar = base->ctx->streams[i]->codecpar;
+        if (par->codec_type != bpar->codec_type || par->codec_id != bpar->codec_id)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Once the caller has picked its streams: ABR applies when they come from
+ * the main playlist of exactly one variant and at least one other variant
+ * carries the same stream layout.
+ */
+static void abr_init(AVFormatContext *s)
+{
+    HLSContext *c = s->priv_data;
+    int i, base = -1, n = 0;
+
+    for (i = 0; i < c->n_variants; i++) {
+        if (!c->variants[i]->playlists[0]->cur_needed)
+            continue;
+        if (base >= 0) {
+            base = -1;
+            break;
+        }
+        base = i;
+    }
+    if (base >= 0) {
+        for (i = 0; i < c->n_variants; i++) {
+            struct variant *var = c->variants[i];
+            var->abr_ok = abr_compatible(c, c->variants[base]->playlists[0], var);
+            n += var->abr_ok;
+        }
+    }
+    if (base < 0 || !c->variants[base]->abr_ok || n < 2) {
+        av_log(s, AV_LOG_VERBOSE, "No variants to adapt between, ABR disabled\n");
+        c->abr = ABR_NONE;
+        return;
+    }
+
+    c->abr_base    = c->variants[base]->playlists[0];
+    c->abr_variant = base;
+    av_dict_set_int(&s->metadata, "variant_bitrate", c->variants[base]->bandwidth, 0);
+}
+
+/*
+ * The playlist feeding abr_base has drained its last segment: continue
+ * from the next segment of variant abr_next. Timestamps stay continuous
+ * since variants are cut at the same points; packets are rescaled to the
+ * time base of the output streams and the first one of each stream carries
+ * the extradata of the new variant.
+ */
+static void abr_switch(AVFormatContext *s, struct playlist *old)
+{
+    HLSContext *c = s->priv_data;
+    struct variant *var = c->variants[c->abr_next];
+    struct playlist *pls = var->playlists[0];
+
+    old->abr_switch = 0;
+    close_segment(old);
+    prefetch_flush(old);
+    old->needed = 0;
+    old->out    = old;
+
+    /* VOD variants are aligned by index, live ones by sequence number */
+    pls->cur_seq_no = pls->finished ?
+                      pls->start_seq_no + old->cur_seq_no - old->start_seq_no :
+                      old->cur_seq_no;
+    pls->needed = 1;
+    pls->out    = c->abr_base;
+    pls->new_extradata = ~0U;
+    close_segment(pls);
+    av_packet_unref(&pls->pkt);
+    reset_packet(&pls->pkt);
+    pls->pb.eof_reached = 0;
+    pls->pb.buf_end = pls->pb.buf_ptr = pls->pb.buffer;
+    pls->pb.pos = 0;
+    ff_read_frame_flush(pls->ctx);
+    pls->seek_timestamp = AV_NOPTS_VALUE;
+
+    av_log(s, AV_LOG_INFO, "Switching from variant %d to %d (%d bps), throughput %"PRId64" bps\n",
+           c->abr_variant, c->abr_next, var->bandwidth, c->abr_throughput);
+    c->abr_variant = c->abr_next;
+    c->abr_switches++;
+    av_dict_set_int(&s->metadata, "variant_bitrate", var->bandwidth, 0);
+    s->event_flags |= AVFMT_EVENT_FLAG_METADATA_UPDATED;
+}
+
+static void abr_output_packet(AVFormatContext *s, struct playlist *pls,
+                              AVPacket *pkt, AVRational tb)
+{
+    int idx = pkt->stream_index - pls->out->stream_offset;
+    AVStream *ist = pls->ctx->streams[idx];
+
+    av_packet_rescale_ts(pkt, tb, s->streams[pkt->stream_index]->time_base);
+
+    if (idx < 32 && (pls->new_extradata & (1U << idx))) {
+        pls->new_extradata &= ~(1U << idx);
+        if (ist->codecpar->extradata_size > 0) {
+            uint8_t *side = av_packet_new_side_data(pkt, AV_PKT_DATA_NEW_EXTRADATA,
+                                                    ist->codecpar->extradata_size);
+            if (side)
+                memcpy(side, ist->codecpar->extradata, ist->codecpar->extradata_size);
+        }
+    }
+}
+
 static int recheck_discard_flags(AVFormatContext *s, int first)
 {
     HLSContext *c = s->priv_data;
@@ -1724,6 +3620,13 @@ static int recheck_discard_flags(AVFormatContext *s, int first)
         if (st->discard < AVDISCARD_ALL)
             pls->cur_needed = 1;
     }
+    if (c->abr && !c->abr_base)
+        abr_init(s);
+    if (c->abr_base && c->abr_base->cur_needed && abr_active(c) != c->abr_base) {
+        /* the streams of abr_base are fed by the current variant */
+        c->abr_base->cur_needed = 0;
+        abr_active(c)->cur_needed = 1;
+    }
     for (i = 0; i < c->n_playlists; i++) {
         struct playlist *pls = c->playlists[i];
         if (pls->cur_needed && !pls->needed) {
@@ -1739,8 +3642,8 @@ static int recheck_discard_flags(AVFormatContext *s, int first)
             }
             av_log(s, AV_LOG_INFO, "Now receiving playlist %d, segment %d\n", i, pls->cur_seq_no);
         } else if (first && !pls->cur_needed && pls->needed) {
-            if (pls->input)
-                ff_format_io_close(pls->parent, &pls->input);
+            close_segment(pls);
+            prefetch_flush(pls);
             pls->needed = 0;
             changed = 1;
             av_log(s, AV_LOG_INFO, "No longer receiving playlist %d\n", i);
@@ -1799,6 +3702,7 @@ static int hls_read_packet(AVFormatContext *s, AVPacket *pkt)
     recheck_discard_flags(s, c->first_packet);
     c->first_packet = 0;
 
+restart:
     for (i = 0; i < c->n_playlists; i++) {
         struct playlist *pls = c->playlists[i];
         /* Make sure we've got one buffered packet from each open playlist
@@ -1812,6 +3716,11 @@ static int hls_read_packet(AVFormatContext *s, AVPacket *pkt)
                     if (!avio_feof(&pls->pb) && ret != AVERROR_EOF)
                         return ret;
                     reset_packet(&pls->pkt);
+                    if (pls->abr_switch) {
+                        abr_switch(s, pls);
+                        minplaylist = -1;
+                        goto restart;
+                    }
                     break;
                 } else {
                     /* stream_index check prevents matching picture attachments etc. */
@@ -1871,15 +3780,19 @@ static int hls_read_packet(AVFormatContext *s, AVPacket *pkt)
     /* If we got a packet, return it */
     if (minplaylist >= 0) {
         struct playlist *pls = c->playlists[minplaylist];
-        *pkt = pls->pkt;
-        pkt->stream_index += pls->stream_offset;
-        reset_packet(&c->playlists[minplaylist]->pkt);
+        AVRational tb = get_timebase(pls);
 
-        if (pkt->dts != AV_NOPTS_VALUE)
-            c->cur_timestamp = av_rescale_q(pkt->dts,
+        if (pls->pkt.dts != AV_NOPTS_VALUE)
+            c->cur_timestamp = av_rescale_q(pls->pkt.dts,
                                             pls->ctx->streams[pls->pkt.stream_index]->time_base,
                                             AV_TIME_BASE_Q);
 
+        *pkt = pls->pkt;
+        pkt->stream_index += pls->out->stream_offset;
+        if (pls->out != pls || pls->new_extradata)
+            abr_output_packet(s, pls, pkt, tb);
+        reset_packet(&c->playlists[minplaylist]->pkt);
+
         return 0;
     }
     return AVERROR_EOF;
@@ -1889,9 +3802,18 @@ static int hls_close(AVFormatContext *s)
 {
     HLSContext *c = s->priv_data;
 
+    if (c->prefetch_hits + c->prefetch_misses)
+        av_log(s, AV_LOG_VERBOSE, "Prefetch hits %"PRId64", misses %"PRId64"\n",
+               c->prefetch_hits, c->prefetch_misses);
+    if (c->cache)
+        av_log(s, AV_LOG_VERBOSE, "Cache hits %"PRId64", misses %"PRId64", %"PRId64" bytes saved\n",
+               c->cache_hits, c->cache_misses, c->cache_bytes_saved);
+
     free_playlist_list(c);
     free_variant_list(c);
     free_rendition_list(c);
+    /* after the prefetch workers are gone, they feed the cache too */
+    cache_close(c);
 
     av_dict_free(&c->avio_opts);
 
@@ -1905,6 +3827,7 @@ static int hls_read_seek(AVFormatContext *s, int stream_index,
     struct playlist *seek_pls = NULL;
     int i, seq_no;
     int64_t first_timestamp, seek_timestamp, duration;
+    int64_t start_timestamp, seek_offset = 0;
 
     if ((flags & AVSEEK_FLAG_BYTE) ||
         !(c->variants[0]->playlists[0]->finished || c->variants[0]->playlists[0]->type == PLS_TYPE_EVENT))
@@ -1933,20 +3856,29 @@ static int hls_read_seek(AVFormatContext *s, int stream_index,
             break;
         }
     }
+    /* the streams of abr_base are fed by the current variant */
+    if (seek_pls && seek_pls == c->abr_base)
+        seek_pls = abr_active(c);
     /* check if the timestamp is valid for the playlist with the
      * specified stream index */
     if (!seek_pls || !find_timestamp_in_playlist(c, seek_pls, seek_timestamp, &seq_no))
         return AVERROR(EIO);
 
+    /* where reading starts: the keyframe an I-frame playlist points to
+     * within the segment, else the segment itself */
+    if (!find_keyframe(c, seek_pls, seq_no, seek_timestamp, &seek_offset, &start_timestamp))
+        start_timestamp = first_timestamp +
+                          seek_pls->seg_starts[seq_no - seek_pls->start_seq_no];
+
     /* set segment now so we do not need to search again below */
     seek_pls->cur_seq_no = seq_no;
-    seek_pls->seek_stream_index = stream_index - seek_pls->stream_offset;
+    seek_pls->seek_stream_index = stream_index - seek_pls->out->stream_offset;
 
     for (i = 0; i < c->n_playlists; i++) {
         /* Reset reading */
         struct playlist *pls = c->playlists[i];
-        if (pls->input)
-            ff_format_io_close(pls->parent, &pls->input);
+        close_segment(pls);
+        pls->abr_switch = 0;
         av_packet_unref(&pls->pkt);
         reset_packet(&pls->pkt);
         pls->pb.eof_reached = 0;
@@ -1959,8 +3891,18 @@ static int hls_read_seek(AVFormatContext *s, int stream_index,
 
         pls->seek_timestamp = seek_timestamp;
         pls->seek_flags = flags;
-
-        if (pls != seek_pls) {
+        pls->seek_offset = 0;
+
+        if (pls == seek_pls) {
+            pls->seek_offset = seek_offset;
+            /* Nothing before start_timestamp is read, so a backward seek
+             * takes the first keyframe instead of discarding up to the
+             * one after the target. The margin covers dts before pts and
+             * rounded EXTINF durations. */
+            if (flags & AVSEEK_FLAG_BACKWARD)
+                pls->seek_timestamp = start_timestamp -
+                    pls->segments[seq_no - pls->start_seq_no]->duration;
+        } else {
             /* set closest segment seq_no for playlists not handled above */
             find_timestamp_in_playlist(c, pls, seek_timestamp, &pls->cur_seq_no);
             /* seek the playlist to the given position without taking
@@ -1995,6 +3937,37 @@ static int hls_probe(AVProbeData *p)
 static const AVOption hls_options[] = {
     {"live_start_index", "segment index to start live streams at (negative values are from the end)",
         OFFSET(live_start_index), AV_OPT_TYPE_INT, {.i64 = -3}, INT_MIN, INT_MAX, FLAGS},
+    {"prefetch_depth", "number of segments to download ahead of the demuxer, 0 disables prefetching",
+        OFFSET(prefetch_depth), AV_OPT_TYPE_INT, {.i64 = 2}, 0, MAX_PREFETCH_DEPTH, FLAGS},
+    {"prefetch_buffer_size", "memory a playlist may use for prefetched segments",
+        OFFSET(prefetch_buffer_size), AV_OPT_TYPE_INT, {.i64 = 32*1024*1024}, 1024*1024, INT_MAX, FLAGS},
+    {"abr", "adapt the variant to the network, switching at segment boundaries",
+        OFFSET(abr), AV_OPT_TYPE_INT, {.i64 = ABR_NONE}, ABR_NONE, ABR_BUFFER, FLAGS, "abr"},
+        {"none", "keep the variant the caller selected", 0, AV_OPT_TYPE_CONST, {.i64 = ABR_NONE}, 0, 0, FLAGS, "abr"},
+        {"throughput", "best variant fitting the measured segment throughput", 0, AV_OPT_TYPE_CONST, {.i64 = ABR_THROUGHPUT}, 0, 0, FLAGS, "abr"},
+        {"buffer", "variant chosen from the buffer level", 0, AV_OPT_TYPE_CONST, {.i64 = ABR_BUFFER}, 0, 0, FLAGS, "abr"},
+    {"abr_buffer_low", "buffer level at or below which the buffer policy uses the lowest variant",
+        OFFSET(abr_buffer_low), AV_OPT_TYPE_DURATION, {.i64 = 5000000}, 0, INT64_MAX, FLAGS},
+    {"abr_buffer_high", "buffer level at or above which the buffer policy uses the highest variant",
+        OFFSET(abr_buffer_high), AV_OPT_TYPE_DURATION, {.i64 = 20000000}, 0, INT64_MAX, FLAGS},
+    {"abr_buffer_level", "media buffered by the caller after the demuxer, updated while playing",
+        OFFSET(abr_buffer_level), AV_OPT_TYPE_DURATION, {.i64 = 0}, 0, INT64_MAX, FLAGS},
+    {"abr_switches", "number of variant switches",
+        OFFSET(abr_switches), AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, FLAGS | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY},
+    {"prefetch_hits", "segments that were already downloaded when needed",
+        OFFSET(prefetch_hits), AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, FLAGS | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY},
+    {"prefetch_misses", "segments the demuxer had to wait for or open itself",
+        OFFSET(prefetch_misses), AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, FLAGS | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY},
+    {"cache_dir", "directory keeping segments, init sections and keys across sessions, empty disables the cache",
+        OFFSET(cache_dir), AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, FLAGS},
+    {"cache_size", "maximum size of the segment cache, least recently used entries are evicted",
+        OFFSET(cache_size), AV_OPT_TYPE_INT64, {.i64 = 512*1024*1024}, 1024*1024, INT64_MAX, FLAGS},
+    {"cache_hits", "segments and keys read from the cache",
+        OFFSET(cache_hits), AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, FLAGS | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY},
+    {"cache_misses", "segments and keys fetched from the network with the cache enabled",
+        OFFSET(cache_misses), AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, FLAGS | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY},
+    {"cache_bytes_saved", "bytes read from the cache instead of the network",
+        OFFSET(cache_bytes_saved), AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, FLAGS | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY},
     {NULL}
 };
 
@@ -12,6 +12,7 @@ LOCAL_SRC_FILES := main.cpp \
 				   ../../Classes/ff.cpp \
 				   ../../Classes/FFVideo.cpp \
 				   ../../Classes/CCFFmpegNode.cpp \
+				   ../../Classes/YUVSprite.cpp \
 				   ../../Classes/SDLAudio.cpp \
 				   ../../Classes/SDLEvent.cpp \
 				   ../../Classes/SDLOverlay.cpp \
@@ -4,6 +4,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <thread>
+#include <atomic>
 
 #define inline __inline
 #include "ffconfig.h"
@@ -35,6 +36,7 @@ extern "C"
 #include "libavutil/bprint.h"
 #include "libavutil/time.h"
 #include "libavutil/threadmessage.h"
+#include "libavutil/atomic.h"
 #include "libavcodec/mathops.h"
 #include "libavformat/os_support.h"
 
@@ -66,6 +68,17 @@ namespace ff
 #define ALIGN16(x) FFALIGN(x,16)
 
 	struct AVRaw;
+
+	/*
+	 * Queue cell of an encode context. The same raw can wait in the queues
+	 * of several contexts (liveOnRtmpMulti), AVRaw::next can't link them all.
+	 */
+	struct AVRawNode
+	{
+		AVRaw * raw;
+		AVRawNode * next;
+	};
+
 	typedef std::mutex mutex_t;
 	typedef std::condition_variable condition_t;
 	typedef std::unique_lock<std::mutex> mutex_lock_t;
@@ -81,14 +94,14 @@ namespace ff
 		SwrContext *swr_ctx;
 		SwsContext *sws_ctx;
 
-		AVRaw * head;
-		AVRaw * tail;
+		AVRawNode * head;
+		AVRawNode * tail;
 		std::thread * encode_thread;
-		int stop_thread;
+		std::atomic<int> stop_thread;
 		mutex_t * mutex;
 		condition_t * cond;
 		int isflush;
-		int encode_waiting;
+		std::atomic<int> encode_waiting;
 	};
 
 	/*
@@ -249,9 +249,11 @@ namespace ff
 		AVPacket pkt;
 		AVCodecContext *ctx;
 		AVFrame * frame;
+		int64_t ctime;
 		while (true)
 		{
 			ret = av_read_frame(pdc->_ctx, &pkt);
+			ctime = av_gettime_relative();
 
 			if (ret < 0)
 			{
@@ -270,6 +272,7 @@ namespace ff
 				{
 					AVRaw * praw = make_image_raw(ctx->pix_fmt, ctx->width, ctx->height);
 					praw->pts = frame->pkt_pts;
+					praw->ctime = ctime;
 					praw->time_base = ctx->pkt_timebase;
 					av_image_copy(praw->data, praw->linesize, (const uint8_t **)frame->data, frame->linesize, ctx->pix_fmt, ctx->width, ctx->height);
 					av_packet_unref(&pkt);
@@ -286,6 +289,7 @@ namespace ff
 				{
 					AVRaw * praw = make_audio_raw(ctx->sample_fmt, frame->channels, frame->nb_samples);
 					praw->pts = frame->pkt_pts;
+					praw->ctime = ctime;
 					praw->time_base = ctx->pkt_timebase;
 					av_samples_copy(praw->data, frame->data, 0, 0, frame->nb_samples, frame->channels, ctx->sample_fmt);
 					av_packet_unref(&pkt);
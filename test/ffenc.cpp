@@ -1,4 +1,6 @@
 #include "ffenc.h"
+#include <algorithm>
+#include <new>
 
 #ifdef __ANDROID__
 	#include <jni.h>
@@ -20,6 +22,11 @@
 
 namespace ff
 {
+	/*
+	 * Packets a live stream may queue while the other one has none
+	 */
+#define MAX_MUX_QUEUE 64
+
 	/*
 	 * 锟斤拷AVFormatContext锟斤拷锟斤拷锟铰碉拷锟斤拷
 	 */
@@ -81,6 +88,7 @@ namespace ff
 
 			c->codec_id = codec_id;
 			c->bit_rate = stream_bit_rate;
+			pec->_vbitrate = stream_bit_rate;
 			/* 锟街憋拷锟绞憋拷锟斤拷锟斤拷2锟侥憋拷锟斤拷锟斤拷锟斤拷锟斤拷锟斤拷要锟斤拷锟斤拷锟� */
 			c->width = w;
 			c->height = h;
@@ -366,6 +374,36 @@ namespace ff
 		return praw;
 	}
 
+	/*
+	 * The queue of an encode context holds its own reference on the raw
+	 */
+	static void ctx_push_raw(AVCtx * pctx, AVRaw *praw)
+	{
+		AVRawNode * node = new AVRawNode();
+		retain_raw(praw);
+		node->raw = praw;
+		node->next = NULL;
+		if (!pctx->head)
+			pctx->head = node;
+		else
+			pctx->tail->next = node;
+		pctx->tail = node;
+	}
+
+	static AVRaw * ctx_pop_raw(AVCtx * pctx)
+	{
+		AVRawNode * node = pctx->head;
+		AVRaw * praw;
+		if (!node)
+			return NULL;
+		pctx->head = node->next;
+		if (!pctx->head)
+			pctx->tail = NULL;
+		praw = node->raw;
+		delete node;
+		return praw;
+	}
+
 	void ffFlush(AVEncodeContext *pec)
 	{
 		AVCtx * pctx;
@@ -521,15 +559,265 @@ namespace ff
 		return 0;
 	}
 
+	static AVPacketQueue * packet_queue_alloc()
+	{
+		AVPacketQueue * q = new AVPacketQueue();
+		AVPacketNode * dummy = new AVPacketNode();
+		av_init_packet(&dummy->pkt);
+		dummy->next = NULL;
+		q->head = dummy;
+		q->tail = dummy;
+		q->count = 0;
+		return q;
+	}
+
+	/*
+	 * Called from the encode thread only, takes over the packet reference
+	 */
+	static int packet_queue_push(AVPacketQueue * q, AVPacket *pkt, int64_t ctime)
+	{
+		AVPacketNode * node = new AVPacketNode();
+		int ret = av_packet_ref(&node->pkt, pkt);
+		av_packet_unref(pkt);
+		if (ret < 0){
+			delete node;
+			return ret;
+		}
+		node->ctime = ctime;
+		node->next.store(NULL, std::memory_order_relaxed);
+		q->tail->next.store(node, std::memory_order_release);
+		q->tail = node;
+		q->count++;
+		return 0;
+	}
+
+	/*
+	 * Called from the mux thread only
+	 */
+	static AVPacket * packet_queue_peek(AVPacketQueue * q)
+	{
+		AVPacketNode * next = q->head->next.load(std::memory_order_acquire);
+		return next ? &next->pkt : NULL;
+	}
+
+	static int packet_queue_pop(AVPacketQueue * q, AVPacket * pkt, int64_t * ctime)
+	{
+		AVPacketNode * next = q->head->next.load(std::memory_order_acquire);
+		if (!next)
+			return 0;
+		av_packet_move_ref(pkt, &next->pkt);
+		if (ctime)
+			*ctime = next->ctime;
+		delete q->head;
+		q->head = next;
+		q->count--;
+		return 1;
+	}
+
+	static void packet_queue_free(AVPacketQueue ** pq)
+	{
+		AVPacket pkt;
+		AVPacketQueue * q = *pq;
+		if (!q)
+			return;
+		av_init_packet(&pkt);
+		while (packet_queue_pop(q, &pkt, NULL))
+			av_packet_unref(&pkt);
+		delete q->head;
+		delete q;
+		*pq = NULL;
+	}
+
+	/*
+	 * Everything the mux thread waits for is signalled under mux_mutex,
+	 * it looks at the queues again under the lock before sleeping
+	 */
+	static void wake_mux(AVEncodeContext * pec)
+	{
+		mutex_lock_t lock(*pec->mux_mutex);
+		pec->mux_cond->notify_one();
+	}
+
 	static int write_frame(AVEncodeContext *pec,AVFormatContext *fmt_ctx, const AVRational *time_base, AVStream *st, AVPacket *pkt)
 	{
-		mutex_lock_t lock(*pec->write_mutex);
+		AVPacketQueue * q;
+		int64_t ctime = 0;
+		int ret;
+
+		if (pec->mux_error)
+			return AVERROR(EIO);
+
+		if (st == pec->_video_st && pkt->pts != AV_NOPTS_VALUE && pkt->pts >= 0)
+			ctime = pec->_vctimes[pkt->pts % MAX_CTIME_RING];
+
 		/* rescale output packet timestamp values from codec to stream timebase */
 		av_packet_rescale_ts(pkt, *time_base, st->time_base);
 		pkt->stream_index = st->index;
 
-		/* Write the compressed frame to the media file. */
-		return av_interleaved_write_frame(fmt_ctx, pkt);
+		if (fmt_ctx->oformat->flags & AVFMT_RAWPICTURE){
+			/*
+			 * The raw picture hack points pkt.data at the reusable frame,
+			 * it can't outlive this call so it is written in place.
+			 */
+			mutex_lock_t lock(*pec->write_mutex);
+			return av_interleaved_write_frame(fmt_ctx, pkt);
+		}
+
+		q = st == pec->_video_st ? pec->_vpq : pec->_apq;
+		ret = packet_queue_push(q, pkt, ctime);
+		if (ret < 0)
+			return ret;
+		wake_mux(pec);
+		return 0;
+	}
+
+	/*
+	 * A stream whose encode thread has stopped will not produce more packets.
+	 * The encode threads are all started before the mux thread.
+	 */
+	static int is_stream_done(AVEncodeContext * pec, AVCtx * pctx)
+	{
+		return pctx->stop_thread;
+	}
+
+	static int is_mux_done(AVEncodeContext * pec)
+	{
+		return pec->stop_mux &&
+			(!pec->has_video || is_stream_done(pec, &pec->_vctx)) &&
+			(!pec->has_audio || is_stream_done(pec, &pec->_actx)) &&
+			!packet_queue_peek(pec->_vpq) && !packet_queue_peek(pec->_apq);
+	}
+
+	/*
+	 * Pick the queue holding the packet with the smallest dts.
+	 * Waits for every live stream to have a packet, unless one of them
+	 * falls more than MAX_MUX_QUEUE packets behind.
+	 * Returns NULL when nothing can be written yet.
+	 */
+	static AVPacketQueue * select_mux_queue(AVEncodeContext * pec)
+	{
+		AVPacketQueue * qs[2];
+		AVCtx * ctxs[2];
+		AVStream * sts[2];
+		AVPacketQueue * best = NULL;
+		AVPacket * best_pkt = NULL;
+		AVRational best_tb;
+		int n = 0;
+		int starved = 0;
+
+		if (pec->has_video){
+			qs[n] = pec->_vpq; ctxs[n] = &pec->_vctx; sts[n] = pec->_video_st; n++;
+		}
+		if (pec->has_audio){
+			qs[n] = pec->_apq; ctxs[n] = &pec->_actx; sts[n] = pec->_audio_st; n++;
+		}
+		for (int i = 0; i < n; i++){
+			AVPacket * pkt = packet_queue_peek(qs[i]);
+			if (!pkt){
+				if (!is_stream_done(pec, ctxs[i]))
+					starved = 1;
+				continue;
+			}
+			int64_t dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+			if (!best_pkt || av_compare_ts(dts, sts[i]->time_base,
+				best_pkt->dts != AV_NOPTS_VALUE ? best_pkt->dts : best_pkt->pts, best_tb) < 0){
+				best = qs[i];
+				best_pkt = pkt;
+				best_tb = sts[i]->time_base;
+			}
+		}
+		if (starved && best && best->count < MAX_MUX_QUEUE)
+			return NULL;
+		return best;
+	}
+
+	static void add_latency_sample(AVEncodeContext * pec, int64_t ctime)
+	{
+		int64_t dt = av_gettime_relative() - ctime;
+		mutex_lock_t lock(*pec->mux_mutex);
+		pec->_latency[pec->_nb_latency % MAX_LATENCY_SAMPLES] = dt;
+		pec->_nb_latency++;
+	}
+
+	int ffGetLatency(AVEncodeContext *pec, int64_t *p50, int64_t *p95, int64_t *p99)
+	{
+		int64_t samples[MAX_LATENCY_SAMPLES];
+		int n;
+		{
+			mutex_lock_t lock(*pec->mux_mutex);
+			n = FFMIN(pec->_nb_latency, MAX_LATENCY_SAMPLES);
+			memcpy(samples, pec->_latency, n*sizeof(int64_t));
+		}
+		if (n <= 0)
+			return 0;
+		std::sort(samples, samples + n);
+		if (p50)*p50 = samples[(n - 1) * 50 / 100];
+		if (p95)*p95 = samples[(n - 1) * 95 / 100];
+		if (p99)*p99 = samples[(n - 1) * 99 / 100];
+		return n;
+	}
+
+	int ffGetMuxPending(AVEncodeContext *pec, int64_t *write_time)
+	{
+		if (write_time)
+			*write_time = pec->_write_time;
+		return pec->_vpq->count + pec->_apq->count;
+	}
+
+	void ffSetVideoBitRate(AVEncodeContext *pec, int bitRate)
+	{
+		pec->_vbitrate_req = bitRate;
+	}
+
+	int ffGetVideoBitRate(AVEncodeContext *pec)
+	{
+		int bitRate = pec->_vbitrate_req;
+		if (bitRate)
+			return bitRate;
+		return pec->_vbitrate;
+	}
+
+	static int mux_thread_proc(AVEncodeContext * pec)
+	{
+		AVPacket pkt;
+		AVPacketQueue * q;
+		int64_t ctime, t;
+		int ret;
+
+		av_init_packet(&pkt);
+		while (1)
+		{
+			q = select_mux_queue(pec);
+			if (!q){
+				mutex_lock_t lock(*pec->mux_mutex);
+				if (select_mux_queue(pec))
+					continue;
+				if (is_mux_done(pec))
+					break;
+				pec->mux_cond->wait(lock);
+				continue;
+			}
+			packet_queue_pop(q, &pkt, &ctime);
+			if (pec->mux_error){
+				av_packet_unref(&pkt);
+				continue;
+			}
+			mutex_lock_t lock(*pec->write_mutex);
+			t = av_gettime_relative();
+			ret = av_interleaved_write_frame(pec->_ctx, &pkt);
+			t = av_gettime_relative() - t;
+			pec->_write_time = pec->_write_time ? (pec->_write_time * 7 + t) / 8 : t;
+			if (ret < 0){
+				char errmsg[ERROR_BUFFER_SIZE];
+				av_strerror(ret, errmsg, ERROR_BUFFER_SIZE);
+				av_log(NULL, AV_LOG_FATAL, "mux_thread_proc av_interleaved_write_frame : %s\n", errmsg);
+				pec->mux_error = 1;
+			}
+			else if (ctime > 0){
+				add_latency_sample(pec, ctime);
+			}
+		}
+		return 0;
 	}
 
 	/*
@@ -547,6 +835,26 @@ namespace ff
 
 		c = pec->_video_st->codec;
 		st = pec->_video_st;
+
+		/*
+		 * Frames dropped by the low latency mode keep their time slots
+		 */
+		pec->_vctx.next_pts += praw->skip;
+
+		/*
+		 * A bit rate change takes effect between frames, libx264 reconfigures
+		 * its rate control when it sees the new values
+		 */
+		int bitRate = pec->_vbitrate_req.exchange(0);
+		if (bitRate){
+			c->bit_rate = bitRate;
+			pec->_vbitrate = bitRate;
+			if (c->rc_max_rate){
+				c->rc_max_rate = bitRate;
+				c->rc_buffer_size = bitRate;
+			}
+		}
+
 		for (int i = 0; i < praw->recount; i++){
 
 			if (!frame)
@@ -557,6 +865,8 @@ namespace ff
 			if (!frame)
 				return -1;
 
+			pec->_vctimes[frame->pts % MAX_CTIME_RING] = praw->ctime;
+
 			//		printf("video pts = %I64d, %I64d\n", praw->pts, frame->pts);
 
 			if (pec->_ctx->oformat->flags & AVFMT_RAWPICTURE) {
@@ -811,7 +1121,7 @@ namespace ff
 		
 		if (pctx->isflush)return NULL;
 
-		praw = list_pop_raw(&pctx->head, &pctx->tail);
+		praw = ctx_pop_raw(pctx);
 		
 		return praw;
 	}
@@ -846,6 +1156,7 @@ namespace ff
 			}
 		}
 		pctx->stop_thread = 1;
+		wake_mux(pec);
 		return 0;
 	}
 
@@ -879,6 +1190,7 @@ namespace ff
 			}
 		}
 		pctx->stop_thread = 1;
+		wake_mux(pec);
 		return 0;
 	}
 	/*
@@ -965,13 +1277,13 @@ namespace ff
 
 		ffInit();
 		
-		pec = (AVEncodeContext *)malloc(sizeof(AVEncodeContext));
+		/* value-initialized: zeroed, with its std::atomic members constructed */
+		pec = new (std::nothrow) AVEncodeContext();
 		if (!pec)
 		{
-			av_log(NULL, AV_LOG_ERROR, "ffCreateEncodeContext malloc return nullptr\n");
+			av_log(NULL, AV_LOG_ERROR, "ffCreateEncodeContext new return nullptr\n");
 			return pec;
 		}
-		memset(pec, 0, sizeof(AVEncodeContext));
 		pec->_width = w;
 		pec->_height = h;
 		pec->_fileName = strdup(filename);
@@ -1018,7 +1330,7 @@ namespace ff
 		{
 			if (open_video(pec, video_codec_id, 
 				in_w,in_h,in_fmt,
-				NULL) < 0)
+				opt_arg) < 0)
 			{
 				ffCloseEncodeContext(pec);
 				return NULL;
@@ -1041,7 +1353,10 @@ namespace ff
 		 */
 		ofmt = ofmt_ctx->oformat;
 		if (!(ofmt->flags & AVFMT_NOFILE)) {
-			ret = avio_open(&ofmt_ctx->pb, filename, AVIO_FLAG_WRITE);
+			AVDictionary *io_opt = NULL;
+			av_dict_copy(&io_opt, opt_arg, 0);
+			ret = avio_open2(&ofmt_ctx->pb, filename, AVIO_FLAG_WRITE, NULL, &io_opt);
+			av_dict_free(&io_opt);
 			if (ret < 0) {
 				av_log(NULL, AV_LOG_ERROR, "Could not open output file '%s'\n", filename);
 				ffCloseEncodeContext(pec);
@@ -1051,7 +1366,14 @@ namespace ff
 		/*
 		 * 写锟斤拷媒锟斤拷头锟侥硷拷
 		 */
-		ret = avformat_write_header(ofmt_ctx, NULL);
+		/*
+		 * Muxer options (flush_packets, max_interleave_delta...) come from opt_arg too,
+		 * keys meant for the codecs are left untouched
+		 */
+		AVDictionary *fmt_opt = NULL;
+		av_dict_copy(&fmt_opt, opt_arg, 0);
+		ret = avformat_write_header(ofmt_ctx, &fmt_opt);
+		av_dict_free(&fmt_opt);
 		if (ret < 0) {
 			av_log(NULL, AV_LOG_ERROR, "Error occurred when opening output file \n");
 			ffCloseEncodeContext(pec);
@@ -1065,6 +1387,10 @@ namespace ff
 		 * 锟斤拷锟斤拷压锟斤拷压锟斤拷锟竭筹拷
 		 */
 		pec->write_mutex = new mutex_t();
+		pec->mux_mutex = new mutex_t();
+		pec->mux_cond = new condition_t();
+		pec->_vpq = packet_queue_alloc();
+		pec->_apq = packet_queue_alloc();
 
 		if (pec->has_audio)
 			initAVCtx(pec, &pec->_actx, audio_encode_thread_proc);
@@ -1072,6 +1398,7 @@ namespace ff
 		if (pec->has_video)
 			initAVCtx(pec, &pec->_vctx, video_encode_thread_proc);
 
+		pec->mux_thread = new std::thread(mux_thread_proc, pec);
 		return pec;
 	}
 
@@ -1087,12 +1414,21 @@ namespace ff
 
 	static void ffStopThreadAVCtx(AVCtx *ctx)
 	{
+		AVRaw * praw;
 		if (ctx->encode_thread){
 			ctx->cond->notify_one();
 			ctx->encode_thread->join();
+			/*
+			 * Raws left behind by a flush or an encode error
+			 */
+			while ((praw = ctx_pop_raw(ctx)) != NULL)
+				release_raw(praw);
 			delete ctx->mutex;
 			delete ctx->cond;
 			delete ctx->encode_thread;
+			ctx->mutex = NULL;
+			ctx->cond = NULL;
+			ctx->encode_thread = NULL;
 		}
 	}
 
@@ -1109,6 +1445,19 @@ namespace ff
 			ffStopThreadAVCtx(&pec->_actx);
 			ffStopThreadAVCtx(&pec->_vctx);
 
+			/*
+			 * The mux thread drains what the encoders left before the trailer
+			 */
+			if (pec->mux_thread){
+				pec->stop_mux = 1;
+				wake_mux(pec);
+				pec->mux_thread->join();
+				delete pec->mux_thread;
+				pec->mux_thread = NULL;
+			}
+			packet_queue_free(&pec->_vpq);
+			packet_queue_free(&pec->_apq);
+
 			if (pec->_ctx)
 			{
 				if (pec->isopen)
@@ -1142,9 +1491,11 @@ namespace ff
 			ffFreeAVCtx(&pec->_actx);
 			
 			delete pec->write_mutex;
+			delete pec->mux_mutex;
+			delete pec->mux_cond;
 
 			free((void*)pec->_fileName);
-			free(pec);
+			delete pec;
 		}
 	}
 
@@ -1183,13 +1534,110 @@ namespace ff
 		}
 
 		mutex_lock_t lk(*pctx->mutex);
-		list_push_raw(&pctx->head, &pctx->tail, praw);
+		ctx_push_raw(pctx, praw);
 		pec->_nb_raws++;
 		pec->_buffer_size += getAVRawSizeKB(praw);
 		pctx->cond->notify_one();
 		return 0;
 	}
 
+	/*
+	 * Create every missing directory of path, up to the last separator
+	 */
+	static void make_dirs(const char *path)
+	{
+		char dir[1024];
+		av_strlcpy(dir, path, sizeof(dir));
+		for (char *p = dir + 1; *p; p++){
+			if (*p == '/' || *p == '\\'){
+				char c = *p;
+				*p = 0;
+				mkdir(dir, 0777);
+				*p = c;
+			}
+		}
+	}
+
+	/*
+	 * fmp4 segments and the temp_file flag came with libavformat 57.83 (FFmpeg 3.4),
+	 * the muxers this tree is built against reject them
+	 */
+#define HAVE_HLS_FMP4 (LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57, 83, 100))
+
+	const char * ffSegmentOptions(const char *filename, const AVSegmentOption *pso,
+		AVRational frameRate, AVDictionary **opt)
+	{
+		AVSegmentOption so = { 0, DEFAULT_SEGMENT_DURATION, 0 };
+		char pattern[1024];
+		const char *sep, *fmt;
+		int dir_len, gop;
+
+		if (av_match_ext(filename, "m3u8"))
+			fmt = "hls";
+		else if (av_match_ext(filename, "mpd"))
+			fmt = "dash";
+		else
+			return NULL;
+
+		if (pso)
+			so = *pso;
+		if (so.duration <= 0)
+			so.duration = DEFAULT_SEGMENT_DURATION;
+#if !HAVE_HLS_FMP4
+		if (so.fmp4 && !strcmp(fmt, "hls")){
+			av_log(NULL, AV_LOG_WARNING, "ffSegmentOptions fmp4 segments need libavformat 57.83, using mpeg-ts\n");
+			so.fmp4 = 0;
+		}
+#endif
+
+		make_dirs(filename);
+		sep = FFMAX(strrchr(filename, '/'), strrchr(filename, '\\'));
+		dir_len = sep ? (int)(sep - filename + 1) : 0;
+
+		/*
+		 * The muxers cut on the first keyframe after the target duration,
+		 * a fixed GOP of exactly one segment keeps the segments even
+		 */
+		gop = frameRate.den > 0 ? (int)(so.duration * av_q2d(frameRate) + 0.5) : so.duration * STREAM_FRAME_RATE;
+		av_dict_set_int(opt, "g", gop, 0);
+		av_dict_set_int(opt, "keyint_min", gop, 0);
+		av_dict_set_int(opt, "sc_threshold", 0, 0);
+
+		if (!strcmp(fmt, "hls")){
+			snprintf(pattern, sizeof(pattern), "%.*sseg%%05d.%s", dir_len, filename, so.fmp4 ? "m4s" : "ts");
+			av_dict_set_int(opt, "hls_time", so.duration, 0);
+			av_dict_set_int(opt, "hls_list_size", so.list_size, 0);
+			av_dict_set(opt, "hls_segment_filename", pattern, 0);
+#if HAVE_HLS_FMP4
+			if (so.fmp4)
+				av_dict_set(opt, "hls_segment_type", "fmp4", 0);
+			/*
+			 * Segments are written under a temporary name and renamed when complete
+			 */
+			av_dict_set(opt, "hls_flags", so.list_size > 0 ? "delete_segments+temp_file" : "temp_file", 0);
+#else
+			/*
+			 * A segment is only listed once it is closed, a player following
+			 * the playlist never sees it half written
+			 */
+			if (so.list_size > 0)
+				av_dict_set(opt, "hls_flags", "delete_segments", 0);
+#endif
+		}
+		else{
+			av_dict_set_int(opt, "min_seg_duration", (int64_t)so.duration * AV_TIME_BASE, 0);
+			av_dict_set_int(opt, "window_size", so.list_size, 0);
+			av_dict_set_int(opt, "extra_window_size", so.list_size > 0 ? 2 : 0, 0);
+			/*
+			 * A SegmentTemplate lets players compute the name of the segment
+			 * being written. An explicit SegmentList only names closed segments,
+			 * and the manifest is replaced by rename.
+			 */
+			av_dict_set(opt, "use_template", "0", 0);
+		}
+		return fmt;
+	}
+
 	void ffInit()
 	{
 #ifdef __ANDROID__
@@ -9,6 +9,27 @@ namespace ff
 	int read_media_file(const char *filename, const char *outfile);
 	int read_trancode(const char *filename, const char *outfile);
 
+#define MAX_LATENCY_SAMPLES 256
+#define MAX_CTIME_RING 64
+
+	struct AVPacketNode
+	{
+		AVPacket pkt;
+		int64_t ctime; //capture time of the source raw, 0 if unknown
+		std::atomic<AVPacketNode *> next;
+	};
+
+	/*
+	 * Unbounded single-producer/single-consumer packet queue.
+	 * The encode thread pushes, the mux thread peeks and pops, neither locks.
+	 */
+	struct AVPacketQueue
+	{
+		AVPacketNode * head; //consumer side, always a dummy node
+		AVPacketNode * tail; //producer side
+		std::atomic<int> count;
+	};
+
 	struct AVEncodeContext
 	{
 		const char *_fileName;
@@ -26,6 +47,37 @@ namespace ff
 		int _nb_raws; //ԭ֡
 
 		mutex_t * write_mutex;
+
+		/*
+		 * Encoded packets go through a per-stream queue to the mux thread,
+		 * which interleaves them by dts and does the only blocking I/O.
+		 */
+		AVPacketQueue * _vpq;
+		AVPacketQueue * _apq;
+		std::thread * mux_thread;
+		mutex_t * mux_mutex;
+		condition_t * mux_cond;
+		std::atomic<int> stop_mux;
+		std::atomic<int> mux_error;
+
+		/*
+		 * AVRaw::ctime of the last MAX_CTIME_RING video frames by frame pts.
+		 * Only the video encode thread uses it, write_frame hands the
+		 * capture time of each packet over to the mux thread.
+		 */
+		int64_t _vctimes[MAX_CTIME_RING];
+
+		/*
+		 * Glass-to-publish latency of the last MAX_LATENCY_SAMPLES video
+		 * packets in microseconds, from AVRaw::ctime to the return of
+		 * av_interleaved_write_frame. Written by the mux thread under mux_mutex.
+		 */
+		int64_t _latency[MAX_LATENCY_SAMPLES];
+		int _nb_latency;
+
+		int64_t _write_time; //moving average of av_interleaved_write_frame time in us
+		std::atomic<int> _vbitrate_req; //bit rate requested by ffSetVideoBitRate, 0 if none pending
+		std::atomic<int> _vbitrate; //bit rate the video encoder runs at, ffGetVideoBitRate reads it from any thread
 	};
 
 	/**
@@ -48,6 +100,26 @@ namespace ff
 		int in_ch, int in_sampleRate, AVSampleFormat in_sampleFmt,
 		AVDictionary * opt_arg);
 
+	/*
+	 * Segmented output (HLS ts/fmp4 or DASH) written next to its playlist
+	 */
+#define DEFAULT_SEGMENT_DURATION 4
+	struct AVSegmentOption
+	{
+		int fmp4; //HLS only, fragmented mp4 segments instead of mpeg-ts, needs libavformat 57.83
+		int duration; //target segment duration in seconds, the GOP is aligned to it
+		int list_size; //segments kept in the playlist and on disk, 0 keeps them all
+	};
+
+	/*
+	 * If filename is a playlist (.m3u8 or .mpd) create its directory, fill opt
+	 * with the muxer and encoder settings and return the muxer name to give
+	 * ffCreateEncodeContext. Returns NULL for any other filename.
+	 * pso may be NULL for the defaults.
+	 */
+	const char * ffSegmentOptions(const char *filename, const AVSegmentOption *pso,
+		AVRational frameRate, AVDictionary **opt);
+
 	/*
 	 * Ƶÿ֡Ĳ,ͨ
 	 */
@@ -82,5 +154,25 @@ namespace ff
 	int ffGetBufferSize(AVEncodeContext *pec);
 
 	int ffIsWaitingOrStop(AVEncodeContext *pec);
+
+	/*
+	 * Latency percentiles (us) over the last MAX_LATENCY_SAMPLES video frames
+	 * Returns the number of samples used, 0 if none has been published yet
+	 */
+	int ffGetLatency(AVEncodeContext *pec, int64_t *p50, int64_t *p95, int64_t *p99);
+
+	/*
+	 * Number of encoded packets waiting for the muxer,
+	 * write_time receives the average av_interleaved_write_frame time in us
+	 */
+	int ffGetMuxPending(AVEncodeContext *pec, int64_t *write_time);
+
+	/*
+	 * Change the video bit rate without reopening the stream.
+	 * The encode thread applies it before the next frame, the encoder must
+	 * have been opened with maxrate/bufsize for VBV to follow the new rate.
+	 */
+	void ffSetVideoBitRate(AVEncodeContext *pec, int bitRate);
+	int ffGetVideoBitRate(AVEncodeContext *pec);
 }
 #endif
\ No newline at end of file
@@ -109,21 +109,24 @@ namespace ff
 	*/
 	int retain_raw(AVRaw * praw)
 	{
-		praw->ref++;
-		return praw->ref;
+		return avpriv_atomic_int_add_and_fetch(&praw->ref, 1);
 	}
 
 	int release_raw(AVRaw * praw)
 	{
 		if (praw)
 		{
-			praw->ref--;
-			if (praw->ref <= 0)
+			/*
+			 * A raw may be queued to several encode contexts (liveOnRtmpMulti),
+			 * the last encode thread to let go frees it
+			 */
+			int ref = avpriv_atomic_int_add_and_fetch(&praw->ref, -1);
+			if (ref <= 0)
 			{
 				ffFreeRaw(praw);
 				return -1;
 			}
-			return praw->ref;
+			return ref;
 		}
 		else
 			return -1;
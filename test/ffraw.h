@@ -21,11 +21,13 @@ namespace ff
 		int channels;
 		int samples;
 		int format;
-		int ref;
+		volatile int ref; //shared between encode threads, only touched through retain_raw/release_raw
 		int size;
 		int seek_sample;
 		int recount;
+		int skip; //video frames dropped right before this one, the encoder leaves their pts out
 		int64_t pts;
+		int64_t ctime; //av_gettime_relative() when the device delivered the raw, 0 if unknown
 		AVRational time_base;
 		AVRawType type;
 		AVRaw *next;
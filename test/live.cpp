@@ -10,6 +10,11 @@ namespace ff
 #define AUDIO_CHANNELBIT 16
 #define MAX_NSYN 120
 #define MAX_ASYN 5
+#define LOWLATENCY_MAX_RAWS 4
+#define LOWLATENCY_MAX_INTERLEAVE_DELTA "100000"
+#define ADAPTIVE_INTERVAL 500000 //us between two checks
+#define ADAPTIVE_HOLD_DOWN 1000000 //us between two steps down
+#define ADAPTIVE_HOLD_UP 5000000 //us without congestion before a step up
 	static const char * preset[] = {
 		"placebo",
 		"veryslow",
@@ -35,8 +40,96 @@ namespace ff
 		AV_PIX_FMT_NV21
 	};
 
-	static void liveLoop(AVDecodeCtx * pdc, AVEncodeContext * pec, liveCB cb, liveState* pls)
+	void liveDefaultOptions(liveOptions * popt)
 	{
+		memset(popt, 0, sizeof(liveOptions));
+		popt->segmentDuration = 2;
+		popt->segmentListSize = 6;
+	}
+
+	struct liveAdaptive
+	{
+		int maxBitRate;
+		int minBitRate;
+		int bitRate;
+		int64_t frame_time; //us
+		int64_t last_check;
+		int64_t last_change;
+		int64_t last_congested;
+	};
+
+	static void adaptiveInit(liveAdaptive *pa, AVEncodeContext *pec, int minBitRate, int64_t t)
+	{
+		memset(pa, 0, sizeof(liveAdaptive));
+		pa->maxBitRate = ffGetVideoBitRate(pec);
+		pa->minBitRate = minBitRate > 0 ? FFMIN(minBitRate, pa->maxBitRate) : pa->maxBitRate / 8;
+		pa->bitRate = pa->maxBitRate;
+		pa->frame_time = av_rescale_q(1, pec->_video_st->codec->time_base, AVRational{ 1, AV_TIME_BASE });
+		pa->last_check = t;
+		pa->last_change = t;
+		pa->last_congested = t;
+	}
+
+	/*
+	 * Multiplicative step down on congestion, slow step up once it's gone
+	 */
+	static void adaptiveUpdate(liveAdaptive *pa, AVEncodeContext *pec, int64_t t)
+	{
+		int64_t write_time;
+		int pending, raws, congested, bitRate;
+		int fps;
+
+		if (t - pa->last_check < ADAPTIVE_INTERVAL)
+			return;
+		pa->last_check = t;
+
+		fps = pa->frame_time > 0 ? (int)(AV_TIME_BASE / pa->frame_time) : STREAM_FRAME_RATE;
+		pending = ffGetMuxPending(pec, &write_time);
+		raws = ffGetBufferSize(pec);
+		congested = pending > fps || raws > fps / 2 || write_time > pa->frame_time / 2;
+
+		bitRate = pa->bitRate;
+		if (congested){
+			pa->last_congested = t;
+			if (t - pa->last_change > ADAPTIVE_HOLD_DOWN)
+				bitRate = FFMAX(pa->bitRate * 7 / 10, pa->minBitRate);
+		}
+		else if (t - pa->last_congested > ADAPTIVE_HOLD_UP && t - pa->last_change > ADAPTIVE_HOLD_UP){
+			bitRate = FFMIN(pa->bitRate * 11 / 10, pa->maxBitRate);
+		}
+		if (bitRate != pa->bitRate){
+			av_log(NULL, AV_LOG_INFO, "adaptive bit rate %d -> %d (pending %d raws %d write %I64dus)\n",
+				pa->bitRate, bitRate, pending, raws, write_time);
+			pa->bitRate = bitRate;
+			pa->last_change = t;
+			ffSetVideoBitRate(pec, bitRate);
+		}
+	}
+
+	/*
+	 * Every rendition takes a reference on the same raw, the scaling to its
+	 * own size happens in its video encode thread so renditions scale in parallel
+	 */
+	static int addFrameAll(AVEncodeContext ** pecs, int npec, AVRaw * praw)
+	{
+		for (int i = 0; i < npec; i++){
+			if (ffAddFrame(pecs[i], praw) < 0)
+				return -1;
+		}
+		return 0;
+	}
+
+	static int maxBufferSize(AVEncodeContext ** pecs, int npec)
+	{
+		int n = 0;
+		for (int i = 0; i < npec; i++)
+			n = FFMAX(n, ffGetBufferSize(pecs[i]));
+		return n;
+	}
+
+	static void liveLoop(AVDecodeCtx * pdc, AVEncodeContext ** pecs, int npec, const liveOptions * popt, liveCB cb, liveState* pls)
+	{
+		AVEncodeContext * pec = pecs[0];
 		int ret, nsyn,ncsyn,nsynacc;
 		AVRational audio_time_base, video_time_base;
 		AVRaw * praw = NULL;
@@ -46,10 +139,16 @@ namespace ff
 		int64_t begin_pts = 0; //��һ֡���豸pts
 		int64_t nsyndt = 0;
 		int64_t nsynbt = 0;
+		int ndropped = 0; //video frames dropped since the last queued one
 		int64_t stimer = av_gettime_relative(); //��Ȼʱ����ʼ��
+		liveAdaptive adaptive[MAX_RENDITION_COUNT];
 		nsyn = 0;
 		ncsyn = 0;
 		nsynacc = 0;
+		for (int i = 0; popt->adaptive && i < npec; i++){
+			if (pecs[i]->has_video)
+				adaptiveInit(&adaptive[i], pecs[i], popt->minBitRate, stimer);
+		}
 		if (pdc->has_audio)
 			audio_time_base = pdc->_audio_st->codec->time_base;
 		if (pdc->has_video)
@@ -64,6 +163,10 @@ namespace ff
 			}
 
 			retain_raw(praw);
+			for (int i = 0; popt->adaptive && i < npec; i++){
+				if (pecs[i]->has_video)
+					adaptiveUpdate(&adaptive[i], pecs[i], ctimer);
+			}
 			if (!pdc->has_audio && begin_pts == 0){
 				begin_pts = praw->pts;
 				stimer = av_gettime_relative();
@@ -91,11 +194,23 @@ namespace ff
 				else
 					ncsyn = 0;
 
-				if (ncsyn >= 0 && ncsyn < MAX_NSYN ){
+				if (popt->lowLatency && maxBufferSize(pecs, npec) > LOWLATENCY_MAX_RAWS){
+					/*
+					 * The encoder is behind, a queued frame would only add latency.
+					 * The frame's time still counts so the synchronization doesn't
+					 * make it up with duplicates, the next queued frame skips it.
+					 */
+					int n = FFMAX(praw->recount + ncsyn, 0);
+					nframe += n;
+					ndropped += n;
+				}
+				else if (ncsyn >= 0 && ncsyn < MAX_NSYN ){
 				//	av_log(NULL, AV_LOG_INFO, "ncsyn = %d\n",ncsyn );
 					praw->recount += ncsyn;
+					praw->skip = ndropped;
+					ndropped = 0;
 					nframe += praw->recount;
-					if (ret = ffAddFrame(pec, praw) < 0){
+					if ((ret = addFrameAll(pecs, npec, praw)) < 0){
 						av_log(NULL, AV_LOG_ERROR, "liveLoop break : ret < 0 , ret = %d\n",ret);
 						break;
 					}
@@ -123,7 +238,7 @@ namespace ff
 					stimer = av_gettime_relative();
 				}
 				nsamples += praw->samples;
-				if( ret=ffAddFrame(pec, praw) < 0 )
+				if ((ret = addFrameAll(pecs, npec, praw)) < 0)
 					break;
 				/*
 				 * ������Ƶ֡����
@@ -170,6 +285,8 @@ namespace ff
 				if (cb && pls){
 					pls->nframes = nframe;
 					pls->ntimes = ctimer - stimer;
+					ffGetLatency(pec, &pls->latency_p50, &pls->latency_p95, &pls->latency_p99);
+					pls->vbitRate = ffGetVideoBitRate(pec);
 					if (cb(pls)){
 						av_log(NULL, AV_LOG_ERROR, "liveLoop break : nframe % 2 == 0 ,nframe = %d\n",nframe);
 						break;
@@ -205,14 +322,7 @@ namespace ff
 		int ow, int oh, int ofps,
 		liveCB cb)
 	{
-		AVDecodeCtx * pdc = NULL;
-		AVEncodeContext * pec = NULL;
-		AVDictionary *opt = NULL;
-		AVCodecID vid, aid;
-		AVPixelFormat pixFmt = pix_fmt_name ? av_get_pix_fmt(pix_fmt_name) : AV_PIX_FMT_NONE;
-		AVSampleFormat sampleFmt = sample_fmt_name ? av_get_sample_fmt(sample_fmt_name) : AV_SAMPLE_FMT_NONE;
-		
-		const char *outFmt;
+		liveRendition rendition;
 
 		cocos2d::CCLog("liveOnRtmp rtmp_publisher:%s\ncamera_name = %s,w=%d h=%d fps=%d,pix_fmt_name=%s,vbitRate=%d,\n\
 						phone_name = %s , rate=%d sample_fmt_name=%s abitRate=%d\n\
@@ -222,6 +332,55 @@ namespace ff
 						phone_name ? phone_name:"", rate, sample_fmt_name ? sample_fmt_name : "", 
 						abitRate,ow,oh,ofps);
 
+		rendition.url = rtmp_publisher;
+		rendition.w = ow;
+		rendition.h = oh;
+		rendition.vbitRate = vbitRate;
+		rendition.abitRate = abitRate;
+		liveOnRtmpMulti(&rendition, 1,
+			camera_name, w, h, fps, pix_fmt_name,
+			phone_name, rate, sample_fmt_name,
+			NULL,
+			cb);
+	}
+
+	static const char * liveOutputFormat(const char * url)
+	{
+		if (!av_strncasecmp(url, "rtmp", 4) ||
+			!av_strncasecmp(url, "tcp:", 4) ||
+			av_match_ext(url, "flv")){
+			return "flv";
+		}
+		return "mp4";
+	}
+
+	void liveOnRtmpMulti(
+		const liveRendition * renditions, int nrenditions,
+		const char * camera_name, int w, int h, int fps, const char * pix_fmt_name,
+		const char * phone_name, int rate, const char * sample_fmt_name,
+		const liveOptions * popt,
+		liveCB cb)
+	{
+		liveOptions defopt;
+		AVSegmentOption segment;
+		AVDecodeCtx * pdc = NULL;
+		AVEncodeContext * pecs[MAX_RENDITION_COUNT];
+		int npec = 0;
+		AVDictionary *opt = NULL;
+		AVCodecID vid, aid;
+		AVPixelFormat pixFmt = pix_fmt_name ? av_get_pix_fmt(pix_fmt_name) : AV_PIX_FMT_NONE;
+		AVSampleFormat sampleFmt = sample_fmt_name ? av_get_sample_fmt(sample_fmt_name) : AV_SAMPLE_FMT_NONE;
+
+		if (nrenditions > MAX_RENDITION_COUNT)
+			nrenditions = MAX_RENDITION_COUNT;
+		if (!popt){
+			liveDefaultOptions(&defopt);
+			popt = &defopt;
+		}
+		segment.fmp4 = popt->segmentFmp4;
+		segment.duration = popt->segmentDuration;
+		segment.list_size = popt->segmentListSize;
+
 		memset(&state, 0, sizeof(state));
 
 		if (cb){
@@ -240,7 +399,15 @@ namespace ff
 
 		av_dict_set(&opt, "preset", preset[9], 0);
 
-		//av_dict_set(&opt, "tune", "zerolatency", 0);
+		if (popt->lowLatency){
+			char gop[32];
+			snprintf(gop, sizeof(gop), "%d", fps > 0 ? fps : STREAM_FRAME_RATE);
+			av_dict_set(&opt, "tune", "zerolatency", 0);
+			av_dict_set(&opt, "bf", "0", 0);
+			av_dict_set(&opt, "g", gop, 0);
+			av_dict_set(&opt, "flush_packets", "1", 0);
+			av_dict_set(&opt, "max_interleave_delta", LOWLATENCY_MAX_INTERLEAVE_DELTA, 0);
+		}
 
 		//av_dict_set(&opt, "opencl", "true", 0);
 
@@ -263,21 +430,33 @@ namespace ff
 			 */
 			vid = camera_name ? AV_CODEC_ID_H264 : AV_CODEC_ID_NONE;
 			aid = phone_name ? AV_CODEC_ID_AAC : AV_CODEC_ID_NONE;
-			if ((rtmp_publisher[0] == 'R' || rtmp_publisher[0] == 'r') &&
-				(rtmp_publisher[1] == 'T' || rtmp_publisher[1] == 't') &&
-				(rtmp_publisher[2] == 'M' || rtmp_publisher[2] == 'm') &&
-				(rtmp_publisher[3] == 'P' || rtmp_publisher[3] == 'p')){
-				outFmt = "flv";
-			}
-			else{
-				outFmt = "mp4";
+			for (npec = 0; npec < nrenditions; npec++){
+				const liveRendition * pr = &renditions[npec];
+				AVDictionary *ropt = NULL;
+				const char *outFmt;
+
+				av_dict_copy(&ropt, opt, 0);
+				outFmt = ffSegmentOptions(pr->url, &segment, AVRational{ fps, 1 }, &ropt);
+				if (!outFmt)
+					outFmt = liveOutputFormat(pr->url);
+				if (popt->adaptive){
+					/*
+					 * libx264 can only retarget VBV at runtime if it was enabled when opened
+					 */
+					av_dict_set_int(&ropt, "maxrate", pr->vbitRate, 0);
+					av_dict_set_int(&ropt, "bufsize", pr->vbitRate, 0);
+				}
+				pecs[npec] = ffCreateEncodeContext(pr->url, outFmt,
+					pr->w, pr->h, AVRational{ fps, 1 }, pr->vbitRate, vid,
+					ctx->width, ctx->height, ctx->pix_fmt,
+					rate, pr->abitRate, aid,
+					AUDIO_CHANNEL, rate, sampleFmt,
+					ropt);
+				av_dict_free(&ropt);
+				if (!pecs[npec])
+					break;
 			}
-			pec = ffCreateEncodeContext(rtmp_publisher, outFmt, ow, oh, AVRational{ fps, 1 }, vbitRate, vid,
-				ctx->width, ctx->height, ctx->pix_fmt,
-				rate, abitRate, aid,
-				AUDIO_CHANNEL, rate, sampleFmt,
-				opt);
-			if (!pec){
+			if (npec < nrenditions){
 				if (cb){
 					state.state = LIVE_ERROR;
 					cb(&state);
@@ -286,7 +465,7 @@ namespace ff
 			}
 
 			state.state = LIVE_FRAME;
-			liveLoop(pdc,pec,cb,&state);
+			liveLoop(pdc, pecs, npec, popt, cb, &state);
 			break;
 		}
 
@@ -296,9 +475,9 @@ namespace ff
 			ffCloseDecodeContext(pdc);
 		}
 		//将为发送的数据发送出去然后关闭
-		if (pec){
-			ffFlush(pec);
-			ffCloseEncodeContext(pec);
+		for (int i = 0; i < npec; i++){
+			ffFlush(pecs[i]);
+			ffCloseEncodeContext(pecs[i]);
 		}
 		//通知回调，直播结束
 		if (cb){
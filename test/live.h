@@ -19,11 +19,48 @@ namespace ff
 		int64_t nframes; //͵֡
 		int64_t ntimes; //ֱʱ䵥λns
 		int nerror; //
+		int64_t latency_p50; //glass-to-publish latency percentiles of video frames, unit us
+		int64_t latency_p95;
+		int64_t latency_p99;
+		int vbitRate; //current video bit rate, follows the adaptive controller
 		char errorMsg[MAX_ERRORMSG_COUNT][MAX_ERRORMSG_LENGTH]; //Ϣ
 	};
 
 	typedef int(*liveCB)(liveState * pls);
 
+	/*
+	 * Publishing options of one liveOnRtmpMulti call,
+	 * liveDefaultOptions fills in the defaults
+	 */
+	struct liveOptions
+	{
+		/*
+		 * zerolatency tune, no B-frames, 1s GOP, small mux buffers,
+		 * and video frames are dropped instead of queued when the encoder falls behind
+		 */
+		int lowLatency;
+
+		/*
+		 * The video bit rate steps down towards minBitRate while the muxer backs up
+		 * (packets pending or slow av_interleaved_write_frame) and climbs back to
+		 * the rendition's vbitRate once the link has been clear for a while.
+		 * minBitRate 0 is an eighth of vbitRate.
+		 */
+		int adaptive;
+		int minBitRate;
+
+		/*
+		 * Segmenting for renditions whose url is a playlist (.m3u8 or .mpd):
+		 * fmp4 or ts HLS segments of segmentDuration seconds, segmentListSize
+		 * segments kept. The default is 2s ts segments with a window of 6.
+		 */
+		int segmentFmp4;
+		int segmentDuration;
+		int segmentListSize;
+	};
+
+	void liveDefaultOptions(liveOptions * popt);
+
 	/**
 	 * ѡƵƵ豸ֱ
 	 */
@@ -34,6 +71,32 @@ namespace ff
 		int ow, int oh, int ofps,
 		liveCB cb);
 
+#define MAX_RENDITION_COUNT 8
+
+	/*
+	 * One output of liveOnRtmpMulti, its own url (rtmp or file), size and bit rates
+	 */
+	struct liveRendition
+	{
+		const char * url;
+		int w, h;
+		int vbitRate;
+		int abitRate;
+	};
+
+	/**
+	 * Capture and decode once, publish up to MAX_RENDITION_COUNT renditions.
+	 * Every rendition has its own AVEncodeContext fed with the same decoded
+	 * AVRaw by reference, scaling runs in each rendition's encode thread.
+	 * popt may be NULL for the defaults.
+	 */
+	void liveOnRtmpMulti(
+		const liveRendition * renditions, int nrenditions,
+		const char * camera_name, int w, int h, int fps, const char * pix_fmt_name,
+		const char * phone_name, int rate, const char * sample_fmt_name,
+		const liveOptions * popt,
+		liveCB cb);
+
 #define MAX_DEVICE_NAME_LENGTH 256
 #define MAX_FORMAT_LENGTH 32
 #define MAX_CAPABILITY_COUNT 128
@@ -922,6 +922,7 @@ public class AppActivity extends Cocos2dxActivity  implements Cocos2dxCallback{
     }
     // Audio
     protected static AudioTrack mAudioTrack;
+    protected static long mAudioSamplesWritten;
     
     // Audio
     public static int audioInit(int sampleRate, boolean is16Bit, boolean isStereo, int desiredFrames) {
@@ -951,6 +952,7 @@ public class AppActivity extends Cocos2dxActivity  implements Cocos2dxCallback{
             }
             
             mAudioTrack.play();
+            mAudioSamplesWritten = 0;
         }
        
         Log.v("SDL", "SDL audio: got " + ((mAudioTrack.getChannelCount() >= 2) ? "stereo" : "mono") + " " + ((mAudioTrack.getAudioFormat() == AudioFormat.ENCODING_PCM_16BIT) ? "16-bit" : "8-bit") + " " + (mAudioTrack.getSampleRate() / 1000f) + "kHz, " + desiredFrames + " frames buffer");
@@ -966,6 +968,7 @@ public class AppActivity extends Cocos2dxActivity  implements Cocos2dxCallback{
             if (result > 0)
             {
                 i += result;
+                mAudioSamplesWritten += result;
             }
             else if (result == 0)
             {
@@ -994,6 +997,7 @@ public class AppActivity extends Cocos2dxActivity  implements Cocos2dxCallback{
             if (result > 0)
             {
                 i += result;
+                mAudioSamplesWritten += result;
             }
             else if (result == 0)
             {
@@ -1012,6 +1016,14 @@ public class AppActivity extends Cocos2dxActivity  implements Cocos2dxCallback{
         }
     }
 
+    // Frames written and not played yet, the playback head wraps like an int
+    public static int audioQueuedFrames()
+    {
+        if (mAudioTrack == null)
+            return -1;
+        return (int)(mAudioSamplesWritten / mAudioTrack.getChannelCount()) - mAudioTrack.getPlaybackHeadPosition();
+    }
+
     public static void audioQuit()
     {
         if (mAudioTrack != null)
@@ -523,6 +523,590 @@ static int liveCallback(liveState *pls)
 	return 0;
 }
 
+/*
+ * Local loopback sink for liveOnRtmp, a tcp listener reading the flv stream
+ * and throwing it away so the latency figures don't depend on a remote server.
+ */
+#define LOOPBACK_URL "tcp://127.0.0.1:19350"
+static int64_t s_loopback_bytes = 0;
+static int s_loopback_rate = 0; //bytes per second the sink reads at, 0 unlimited
+
+static void loopback_sink_proc(const char *url)
+{
+	AVIOContext * pb = NULL;
+	AVDictionary * opt = NULL;
+	static uint8_t buf[64 * 1024];
+	int64_t t0 = 0, n0 = 0;
+	int n;
+
+	av_dict_set(&opt, "listen", "1", 0);
+	if (avio_open2(&pb, url, AVIO_FLAG_READ, NULL, &opt) < 0){
+		av_dict_free(&opt);
+		printf("loopback sink can't listen on %s\n", url);
+		return;
+	}
+	av_dict_free(&opt);
+	/*
+	 * A throttled sink reads small chunks and sleeps to hold the rate,
+	 * tcp backpressure then reaches the publisher like a slow link would
+	 */
+	while ((n = avio_read(pb, buf, s_loopback_rate ? 4096 : sizeof(buf))) > 0){
+		s_loopback_bytes += n;
+		if (s_loopback_rate){
+			if (!t0){
+				t0 = av_gettime_relative();
+				n0 = s_loopback_bytes;
+			}
+			int64_t due = t0 + (s_loopback_bytes - n0) * AV_TIME_BASE / s_loopback_rate;
+			int64_t now = av_gettime_relative();
+			if (due > now)
+				av_usleep((unsigned)(due - now));
+		}
+		else
+			t0 = 0;
+	}
+	avio_closep(&pb);
+}
+
+static int latencyCallback(liveState *pls)
+{
+	static int64_t last_frames = 0;
+	if (pls->state == LIVE_FRAME && pls->nframes - last_frames >= 60){
+		last_frames = pls->nframes;
+		printf("frames %I64d sink %I64d kb bitrate %d kb latency p50 %.1fms p95 %.1fms p99 %.1fms\n",
+			pls->nframes, s_loopback_bytes / 1024, pls->vbitRate / 1024,
+			pls->latency_p50 / 1000.0, pls->latency_p95 / 1000.0, pls->latency_p99 / 1000.0);
+	}
+	return liveCallback(pls);
+}
+
+/*
+ * Congestion: the sink reads at 48kB/s for the first 20s of the stream
+ * then opens up, the adaptive controller should step down and back up
+ */
+static int congestionCallback(liveState *pls)
+{
+	if (pls->state == LIVE_FRAME && s_loopback_rate && pls->ntimes > 20 * (int64_t)AV_TIME_BASE){
+		printf("congestion over\n");
+		s_loopback_rate = 0;
+	}
+	return latencyCallback(pls);
+}
+
+static void test_live_congestion(const char *video_name, const char *audio_name,
+	const char *fmt_name, int w, int h, int fps)
+{
+	liveRendition rendition = { LOOPBACK_URL, w, h, 1024 * 1024, 32 * 1024 };
+	liveOptions opt;
+
+	s_loopback_rate = 48 * 1024;
+	std::thread sink(loopback_sink_proc, LOOPBACK_URL);
+	av_usleep(200 * 1000); //let the listener bind
+
+	liveDefaultOptions(&opt);
+	opt.adaptive = 1;
+	opt.minBitRate = 128 * 1024;
+	liveOnRtmpMulti(&rendition, 1,
+		video_name, w, h, fps, fmt_name,
+		audio_name, 22050, "s16",
+		&opt,
+		congestionCallback);
+	sink.join();
+	s_loopback_rate = 0;
+}
+
+/*
+ * HTTP stand-in serving the files of a directory one request at a time,
+ * enough for a player to follow the live HLS/DASH playlist.
+ */
+#define HTTP_STANDIN_URL "http://127.0.0.1:8080"
+#define HLS_DIR "hls_out"
+
+static void http_serve_client(AVIOContext *client, const char *dir)
+{
+	AVIOContext *file = NULL;
+	uint8_t *resource = NULL;
+	char path[1024];
+	static uint8_t buf[16 * 1024];
+	int ret, n;
+
+	while ((ret = avio_handshake(client)) > 0){
+		av_opt_get(client, "resource", AV_OPT_SEARCH_CHILDREN, &resource);
+		if (resource && strlen((char *)resource))
+			break;
+		av_freep(&resource);
+	}
+	if (ret >= 0 && resource && !strstr((char *)resource, "..")){
+		snprintf(path, sizeof(path), "%s%s", dir, (char *)resource);
+		if (avio_open(&file, path, AVIO_FLAG_READ) < 0)
+			file = NULL;
+	}
+	av_opt_set_int(client, "reply_code", file ? 200 : AVERROR_HTTP_NOT_FOUND, AV_OPT_SEARCH_CHILDREN);
+	while (ret >= 0 && (ret = avio_handshake(client)) > 0);
+
+	if (ret >= 0 && file){
+		while ((n = avio_read(file, buf, sizeof(buf))) > 0)
+			avio_write(client, buf, n);
+	}
+	if (file)
+		avio_closep(&file);
+	av_freep(&resource);
+	avio_flush(client);
+	avio_close(client);
+}
+
+static void http_standin_proc(const char *url, const char *dir)
+{
+	AVIOContext *server = NULL, *client = NULL;
+	AVDictionary *opt = NULL;
+
+	av_dict_set(&opt, "listen", "2", 0);
+	if (avio_open2(&server, url, AVIO_FLAG_WRITE, NULL, &opt) < 0){
+		av_dict_free(&opt);
+		printf("http stand-in can't listen on %s\n", url);
+		return;
+	}
+	av_dict_free(&opt);
+	while (avio_accept(server, &client) >= 0)
+		http_serve_client(client, dir);
+	avio_close(server);
+}
+
+static void test_live_hls(const char *video_name, const char *audio_name,
+	const char *fmt_name, int w, int h, int fps)
+{
+	std::thread http(http_standin_proc, HTTP_STANDIN_URL, HLS_DIR);
+	http.detach();
+
+	printf("playlist at " HTTP_STANDIN_URL "/index.m3u8\n");
+	liveOnRtmp(HLS_DIR "/index.m3u8",
+		video_name, w, h, fps, fmt_name, 1024 * 1024,
+		audio_name, 22050, "s16", 32 * 1024,
+		w, h, fps,
+		latencyCallback);
+}
+
+/*
+ * Plays back the output of a previous "hls" run through the stand-in and
+ * reports how many segments the demuxer found already prefetched. The
+ * stand-in serves one request at a time, so run it with 0 first for the
+ * baseline wall time.
+ */
+static void test_hls_prefetch(int depth)
+{
+	AVDictionary *opt = NULL;
+	AVDecodeCtx *pdc;
+	AVRaw *praw;
+	int64_t hits = 0, misses = 0, nframes = 0;
+	int64_t t0;
+
+	std::thread http(http_standin_proc, HTTP_STANDIN_URL, HLS_DIR);
+	http.detach();
+	av_usleep(200 * 1000); //let the listener bind
+
+	t0 = av_gettime_relative();
+	av_dict_set_int(&opt, "prefetch_depth", depth, 0);
+	pdc = ffCreateDecodeContext(HTTP_STANDIN_URL "/index.m3u8", opt);
+	av_dict_free(&opt);
+	if (!pdc){
+		printf("can't open " HTTP_STANDIN_URL "/index.m3u8\n");
+		return;
+	}
+	while ((praw = ffReadFrame(pdc)) != NULL){
+		nframes++;
+		release_raw(praw);
+	}
+	av_opt_get_int(pdc->_ctx->priv_data, "prefetch_hits", 0, &hits);
+	av_opt_get_int(pdc->_ctx->priv_data, "prefetch_misses", 0, &misses);
+	printf("prefetch depth %d frames %I64d time %.1fs hits %I64d misses %I64d\n",
+		depth, nframes, (av_gettime_relative() - t0) / 1000000.0, hits, misses);
+	ffCloseDecodeContext(pdc);
+}
+
+static void test_live_loopback(const char *video_name, const char *audio_name,
+	const char *fmt_name, int w, int h, int fps)
+{
+	liveRendition rendition = { LOOPBACK_URL, w, h, 1024 * 1024, 32 * 1024 };
+	liveOptions opt;
+
+	std::thread sink(loopback_sink_proc, LOOPBACK_URL);
+	av_usleep(200 * 1000); //let the listener bind
+
+	liveDefaultOptions(&opt);
+	opt.lowLatency = 1;
+	liveOnRtmpMulti(&rendition, 1,
+		video_name, w, h, fps, fmt_name,
+		audio_name, 22050, "s16",
+		&opt,
+		latencyCallback);
+	sink.join();
+}
+
+/*
+ * Times the vectorized sample format converters BuildAudioCVT picks against
+ * the generated scalar ones, on a callback sized buffer, and checks both
+ * give the same samples. The copy refilling the buffer is timed apart and
+ * taken out.
+ */
+static double cvt_sample(const Uint8 *p, AudioFormat fmt)
+{
+	Uint8 b[4];
+	int i, size = SDL_AUDIO_BITSIZE(fmt) / 8;
+
+	for (i = 0; i < size; i++)
+		b[i] = SDL_AUDIO_ISBIGENDIAN(fmt) ? p[size - 1 - i] : p[i];
+	if (SDL_AUDIO_ISFLOAT(fmt))
+		return *(float *)b;
+	switch (size){
+	case 1: return SDL_AUDIO_ISSIGNED(fmt) ? *(Sint8 *)b : *(Uint8 *)b;
+	case 2: return SDL_AUDIO_ISSIGNED(fmt) ? *(Sint16 *)b : *(Uint16 *)b;
+	default: return *(Sint32 *)b;
+	}
+}
+
+static void test_audio_cvt_bench()
+{
+	static const struct {
+		AudioFormat src, dst;
+		const char *name;
+	} pairs[] = {
+		{ AUDIO_S16LSB, AUDIO_F32LSB, "s16 -> f32" },
+		{ AUDIO_F32LSB, AUDIO_S16LSB, "f32 -> s16" },
+		{ AUDIO_S32LSB, AUDIO_F32LSB, "s32 -> f32" },
+		{ AUDIO_F32LSB, AUDIO_S32LSB, "f32 -> s32" },
+		{ AUDIO_U8, AUDIO_S16LSB, "u8 -> s16" },
+		{ AUDIO_S16LSB, AUDIO_U8, "s16 -> u8" },
+		{ AUDIO_S16LSB, AUDIO_S16MSB, "s16le -> s16be" },
+		{ AUDIO_S32LSB, AUDIO_S32MSB, "s32le -> s32be" },
+		{ AUDIO_F32LSB, AUDIO_F32MSB, "f32le -> f32be" },
+	};
+	const int samples = 4096 * 2; //a 4096 frames stereo callback
+	const int loops = 20000;
+	Uint8 *src = (Uint8 *)av_malloc(samples * 4);
+	Uint8 *vec = (Uint8 *)av_malloc(samples * 4 * 2);
+	Uint8 *ref = (Uint8 *)av_malloc(samples * 4 * 2);
+	int64_t t0, tcopy;
+	int i, j, n;
+
+	for (i = 0; i < (int)SDL_arraysize(pairs); i++){
+		AudioCVT cvt, scalar;
+		AudioFormat src_fmt = pairs[i].src, dst_fmt = pairs[i].dst;
+		int len = samples * SDL_AUDIO_BITSIZE(src_fmt) / 8;
+		double diff = 0, tvec, tref;
+
+		if (BuildAudioCVT(&cvt, src_fmt, 2, 44100, dst_fmt, 2, 44100, samples / 2) <= 0){
+			printf("%-16s can't convert\n", pairs[i].name);
+			continue;
+		}
+		scalar = cvt;
+		for (j = 0; sdl_audio_type_filters[j].filter; j++){
+			if (sdl_audio_type_filters[j].src_fmt == src_fmt &&
+				sdl_audio_type_filters[j].dst_fmt == dst_fmt)
+				scalar.filters[0] = sdl_audio_type_filters[j].filter;
+		}
+		if (cvt.filters[0] == scalar.filters[0]){
+			printf("%-16s no vector converter on this cpu\n", pairs[i].name);
+			continue;
+		}
+
+		for (j = 0; j < len; j++)
+			src[j] = (Uint8)rand();
+		if (SDL_AUDIO_ISFLOAT(src_fmt)){
+			for (j = 0; j < samples; j++)
+				((float *)src)[j] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+		}
+
+		t0 = av_gettime_relative();
+		for (n = 0; n < loops; n++)
+			memcpy(vec, src, len);
+		tcopy = av_gettime_relative() - t0;
+
+		cvt.buf = vec;
+		cvt.len = len;
+		t0 = av_gettime_relative();
+		for (n = 0; n < loops; n++){
+			memcpy(vec, src, len);
+			SDL_ConvertAudio(&cvt);
+		}
+		tvec = (double)(av_gettime_relative() - t0 - tcopy);
+
+		scalar.buf = ref;
+		scalar.len = len;
+		t0 = av_gettime_relative();
+		for (n = 0; n < loops; n++){
+			memcpy(ref, src, len);
+			SDL_ConvertAudio(&scalar);
+		}
+		tref = (double)(av_gettime_relative() - t0 - tcopy);
+
+		n = SDL_AUDIO_BITSIZE(dst_fmt) / 8;
+		for (j = 0; j < samples; j++)
+			diff = FFMAX(diff, fabs(cvt_sample(vec + j * n, dst_fmt) - cvt_sample(ref + j * n, dst_fmt)));
+		printf("%-16s scalar %.2f ns vector %.2f ns per sample, x%.1f, max diff %g\n",
+			pairs[i].name, tref * 1000.0 / loops / samples, tvec * 1000.0 / loops / samples,
+			tvec > 0 ? tref / tvec : 0.0, diff);
+	}
+	av_free(src);
+	av_free(vec);
+	av_free(ref);
+}
+
+/*
+ * Times the conversion chains BuildAudioCVT plans (shrinking stage first,
+ * fused kernels, chunking of large buffers) against converting the data type
+ * and then the channels over the whole buffer, on a callback sized buffer and
+ * on a large one, in input bytes per ns.
+ */
+static void test_audio_chain_bench()
+{
+	static const struct {
+		AudioFormat src;
+		int src_channels;
+		AudioFormat dst;
+		int dst_channels;
+		const char *name;
+	} chains[] = {
+		{ AUDIO_S16LSB, 6, AUDIO_F32LSB, 2, "s16 5.1 -> f32 stereo" },
+		{ AUDIO_F32LSB, 6, AUDIO_S16LSB, 2, "f32 5.1 -> s16 stereo" },
+		{ AUDIO_S16LSB, 2, AUDIO_F32LSB, 1, "s16 stereo -> f32 mono" },
+		{ AUDIO_F32LSB, 2, AUDIO_S16LSB, 1, "f32 stereo -> s16 mono" },
+		{ AUDIO_S16LSB, 1, AUDIO_F32LSB, 2, "s16 mono -> f32 stereo" },
+		{ AUDIO_F32LSB, 1, AUDIO_S16LSB, 2, "f32 mono -> s16 stereo" },
+		{ AUDIO_S32LSB, 4, AUDIO_S16MSB, 2, "s32 quad -> s16be stereo" },
+	};
+	static const int sizes[] = { 4096, 256 * 1024 }; //frames
+	Uint8 *src = (Uint8 *)av_malloc(256 * 1024 * 6 * 4);
+	Uint8 *vec = (Uint8 *)av_malloc(256 * 1024 * 6 * 4 * 2);
+	Uint8 *ref = (Uint8 *)av_malloc(256 * 1024 * 6 * 4 * 2);
+	int64_t t0, tcopy;
+	int i, j, k, n;
+
+	for (i = 0; i < (int)SDL_arraysize(chains); i++){
+		AudioCVT cvt, type, channel;
+		AudioFormat src_fmt = chains[i].src, dst_fmt = chains[i].dst;
+
+		if (BuildAudioCVT(&cvt, src_fmt, chains[i].src_channels, 44100,
+			dst_fmt, chains[i].dst_channels, 44100, 256 * 1024) <= 0 ||
+			BuildAudioCVT(&type, src_fmt, chains[i].src_channels, 44100,
+			dst_fmt, chains[i].src_channels, 44100, 256 * 1024) < 0 ||
+			BuildAudioCVT(&channel, dst_fmt, chains[i].src_channels, 44100,
+			dst_fmt, chains[i].dst_channels, 44100, 256 * 1024) < 0){
+			printf("%-26s can't convert\n", chains[i].name);
+			continue;
+		}
+
+		for (k = 0; k < (int)SDL_arraysize(sizes); k++){
+			int frames = sizes[k];
+			int len = frames * chains[i].src_channels * SDL_AUDIO_BITSIZE(src_fmt) / 8;
+			int loops = 80 * 1024 * 1024 / len;
+			double diff = 0, tnew, told;
+
+			for (j = 0; j < len; j++)
+				src[j] = (Uint8)rand();
+			if (SDL_AUDIO_ISFLOAT(src_fmt)){
+				for (j = 0; j < len / 4; j++)
+					((float *)src)[j] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+			}
+
+			t0 = av_gettime_relative();
+			for (n = 0; n < loops; n++)
+				memcpy(vec, src, len);
+			tcopy = av_gettime_relative() - t0;
+
+			cvt.buf = vec;
+			cvt.len = len;
+			t0 = av_gettime_relative();
+			for (n = 0; n < loops; n++){
+				memcpy(vec, src, len);
+				SDL_ConvertAudio(&cvt);
+			}
+			tnew = (double)(av_gettime_relative() - t0 - tcopy);
+
+			t0 = av_gettime_relative();
+			for (n = 0; n < loops; n++){
+				memcpy(ref, src, len);
+				type.buf = ref;
+				type.len = len;
+				SDL_ConvertAudio(&type);
+				channel.buf = ref;
+				channel.len = type.len_cvt;
+				SDL_ConvertAudio(&channel);
+			}
+			told = (double)(av_gettime_relative() - t0 - tcopy);
+
+			//mixing before or after the type conversion rounds differently
+			n = SDL_AUDIO_BITSIZE(dst_fmt) / 8;
+			for (j = 0; j < cvt.len_cvt / n; j++)
+				diff = FFMAX(diff, fabs(cvt_sample(vec + j * n, dst_fmt) - cvt_sample(ref + j * n, dst_fmt)));
+			//bytes/ns over the clock in GHz gives bytes/cycle
+			printf("%-26s %6d frames: type+channels %.2f planned %.2f bytes/ns, x%.1f, max diff %g\n",
+				chains[i].name, frames, told > 0 ? (double)len * loops / (told * 1000.0) : 0.0,
+				tnew > 0 ? (double)len * loops / (tnew * 1000.0) : 0.0,
+				tnew > 0 ? told / tnew : 0.0, diff);
+		}
+	}
+	av_free(src);
+	av_free(vec);
+	av_free(ref);
+}
+
+/*
+ * Times each vector YV12 blitter the cpu supports against the table driven
+ * one of the same depth, 1x and 2x, on a 640x360 frame, and counts the
+ * output bytes that differ.
+ */
+static void test_yuv_bench()
+{
+	static const struct {
+		int bpp;
+		Uint32 rmask, gmask, bmask;
+		const char *name;
+	} formats[] = {
+		{ 2, 0xF800, 0x07E0, 0x001F, "rgb565" },
+		{ 3, 0xFF0000, 0x00FF00, 0x0000FF, "rgb24" },
+		{ 4, 0x0000FF, 0x00FF00, 0xFF0000, "rgba" },
+	};
+	const int w = 640, h = 360;
+	const int loops = 200;
+	int64_t t0;
+	int i, j, k, n, scale;
+
+	for (i = 0; i < (int)SDL_arraysize(formats); i++){
+		Surface *vec = CreateRGBSurface(SWSURFACE, 2 * w, 2 * h, formats[i].bpp * 8,
+			formats[i].rmask, formats[i].gmask, formats[i].bmask, 0);
+		Surface *ref = CreateRGBSurface(SWSURFACE, 2 * w, 2 * h, formats[i].bpp * 8,
+			formats[i].rmask, formats[i].gmask, formats[i].bmask, 0);
+		Overlay *overlay = vec && ref ? CreateYUV_SW(w, h, YV12_OVERLAY, vec) : NULL;
+		const SDL_YUVBlitters *scalar = NULL;
+
+		if (!overlay){
+			printf("%-8s can't create the overlay\n", formats[i].name);
+			FreeSurface(vec);
+			FreeSurface(ref);
+			continue;
+		}
+		for (j = 0; j < w * h * 3 / 2; j++)
+			overlay->pixels[0][j] = (Uint8)rand();
+		for (j = 0; sdl_yv12_blitters[j].Display1X; j++){
+			if (sdl_yv12_blitters[j].bytes_per_pixel == formats[i].bpp && !sdl_yv12_blitters[j].features)
+				scalar = &sdl_yv12_blitters[j];
+		}
+
+		for (j = 0; sdl_yv12_blitters[j].Display1X; j++){
+			const SDL_YUVBlitters *b = &sdl_yv12_blitters[j];
+			const char *isa = b->features & CPU_HAS_AVX2 ? "avx2" :
+				b->features & CPU_HAS_SSE2 ? "sse2" : "neon";
+
+			if (b == scalar || b->bytes_per_pixel != formats[i].bpp ||
+				(b->features & SDL_GetCPUFeatures()) != b->features)
+				continue;
+			for (scale = 1; scale <= 2; scale++){
+				YUVBlitter fvec = scale == 1 ? b->Display1X : b->Display2X;
+				YUVBlitter fref = scale == 1 ? scalar->Display1X : scalar->Display2X;
+				int mod = vec->pitch / formats[i].bpp - w * scale;
+				double tvec, tref;
+				int diff = 0;
+
+				memset(vec->pixels, 0, vec->pitch * vec->h);
+				memset(ref->pixels, 0, ref->pitch * ref->h);
+				t0 = av_gettime_relative();
+				for (n = 0; n < loops; n++)
+					fvec(overlay->hwdata->colortab, overlay->hwdata->rgb_2_pix, overlay->hwdata->fit,
+						overlay->pixels[0], overlay->pixels[1], overlay->pixels[2], (Uint8 *)vec->pixels, h, w, mod);
+				tvec = (double)(av_gettime_relative() - t0);
+				t0 = av_gettime_relative();
+				for (n = 0; n < loops; n++)
+					fref(overlay->hwdata->colortab, overlay->hwdata->rgb_2_pix, overlay->hwdata->fit,
+						overlay->pixels[0], overlay->pixels[1], overlay->pixels[2], (Uint8 *)ref->pixels, h, w, mod);
+				tref = (double)(av_gettime_relative() - t0);
+
+				for (k = 0; k < vec->pitch * vec->h; k++)
+					diff += ((Uint8 *)vec->pixels)[k] != ((Uint8 *)ref->pixels)[k];
+				printf("%-8s %s %dx: tables %.2f ns vector %.2f ns per pixel, x%.1f, %d bytes differ\n",
+					formats[i].name, isa, scale,
+					tref * 1000.0 / loops / (w * h * scale * scale), tvec * 1000.0 / loops / (w * h * scale * scale),
+					tvec > 0 ? tref / tvec : 0.0, diff);
+			}
+		}
+		FreeYUVOverlay(overlay);
+		FreeSurface(vec);
+		FreeSurface(ref);
+	}
+}
+
+/*
+ * Bytes CCFFmpegNode sends to GL per frame. The RGB path converted the
+ * picture to RGB888 on the cpu and uploaded that, the YUV path uploads the
+ * three planes of the decoded frame as they are, line padding included.
+ * The upload is timed as a copy of the bytes, what the driver does first.
+ */
+static void test_yuv_upload_bench()
+{
+	static const struct {
+		int w, h;
+	} sizes[] = {
+		{ 640, 360 }, { 854, 480 }, { 1280, 720 }, { 1920, 1080 },
+	};
+	const int loops = 100;
+	int64_t t0;
+	int i, j, n;
+
+	for (i = 0; i < (int)SDL_arraysize(sizes); i++){
+		const int w = sizes[i].w, h = sizes[i].h;
+		AVFrame *frame = av_frame_alloc();
+		struct SwsContext *sws = sws_getContext(w, h, AV_PIX_FMT_YUV420P,
+			w, h, AV_PIX_FMT_RGB24, SWS_POINT, NULL, NULL, NULL);
+		uint8_t *rgb = (uint8_t *)av_malloc(w * h * 3);
+		uint8_t *staging = (uint8_t *)av_malloc(w * h * 3 + 64 * h);
+		int rgb_bytes = w * h * 3, yuv_bytes = 0;
+		int rgb_linesize = w * 3;
+		double trgb, tyuv;
+
+		if (!frame || !sws || !rgb || !staging){
+			printf("%dx%d out of memory\n", w, h);
+			goto end;
+		}
+		frame->format = AV_PIX_FMT_YUV420P;
+		frame->width = w;
+		frame->height = h;
+		if (av_frame_get_buffer(frame, 32) < 0){
+			printf("%dx%d can't allocate the frame\n", w, h);
+			goto end;
+		}
+		for (j = 0; j < 3; j++){
+			int rows = j ? (h + 1) / 2 : h;
+			memset(frame->data[j], 0x80, frame->linesize[j] * rows);
+			yuv_bytes += frame->linesize[j] * rows;
+		}
+
+		t0 = av_gettime_relative();
+		for (n = 0; n < loops; n++){
+			sws_scale(sws, frame->data, frame->linesize, 0, h, &rgb, &rgb_linesize);
+			memcpy(staging, rgb, rgb_bytes);
+		}
+		trgb = (double)(av_gettime_relative() - t0) / loops;
+
+		t0 = av_gettime_relative();
+		for (n = 0; n < loops; n++){
+			uint8_t *p = staging;
+			for (j = 0; j < 3; j++){
+				int size = frame->linesize[j] * (j ? (h + 1) / 2 : h);
+				memcpy(p, frame->data[j], size);
+				p += size;
+			}
+		}
+		tyuv = (double)(av_gettime_relative() - t0) / loops;
+
+		printf("%4dx%-4d rgb888 %8d bytes %7.1f us, yuv420p %8d bytes %7.1f us per frame, %.2f of the bytes\n",
+			w, h, rgb_bytes, trgb, yuv_bytes, tyuv, (double)yuv_bytes / rgb_bytes);
+	end:
+		av_free(staging);
+		av_free(rgb);
+		sws_freeContext(sws);
+		av_frame_free(&frame);
+	}
+}
+
 int _tmain(int argc, _TCHAR* argv[])
 {
 	AVDevice caps[8];
@@ -607,7 +1191,31 @@ int _tmain(int argc, _TCHAR* argv[])
 		h = _wtoi(argv[4]);
 		fps = _wtoi(argv[5]);
 	}
-	if (video_name){
+	if (video_name && argc > 6 && !_tcscmp(argv[6], _T("loopback"))){
+		test_live_loopback(video_name, audio_name, fmt_name, w, h, fps);
+	}
+	else if (video_name && argc > 6 && !_tcscmp(argv[6], _T("congestion"))){
+		test_live_congestion(video_name, audio_name, fmt_name, w, h, fps);
+	}
+	else if (video_name && argc > 6 && !_tcscmp(argv[6], _T("hls"))){
+		test_live_hls(video_name, audio_name, fmt_name, w, h, fps);
+	}
+	else if (argc > 6 && !_tcscmp(argv[6], _T("hlsplay"))){
+		test_hls_prefetch(argc > 7 ? _wtoi(argv[7]) : 2);
+	}
+	else if (argc > 6 && !_tcscmp(argv[6], _T("cvtbench"))){
+		test_audio_cvt_bench();
+	}
+	else if (argc > 6 && !_tcscmp(argv[6], _T("chainbench"))){
+		test_audio_chain_bench();
+	}
+	else if (argc > 6 && !_tcscmp(argv[6], _T("yuvbench"))){
+		test_yuv_bench();
+	}
+	else if (argc > 6 && !_tcscmp(argv[6], _T("uploadbench"))){
+		test_yuv_upload_bench();
+	}
+	else if (video_name){
 		printf("w = %d , h = %d , fps = %d\n",w,h,fps);
 	//	liveOnRtmp("rtmp://192.168.7.157/myapp/mystream",
 		liveOnRtmp("e:\\test.mp4",
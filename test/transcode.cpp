@@ -154,6 +154,13 @@ namespace ff
 				total = 0;
 			i = 1;
 
+			/*
+			 * A .m3u8/.mpd output is segmented into its directory
+			 */
+			const char * segfmt = ffSegmentOptions(output, NULL, ffGetFrameRate(pdc), &opt);
+			if (segfmt)
+				fmt = segfmt;
+
 			pec = ffCreateEncodeContext(output, fmt, w, h, ffGetFrameRate(pdc), bitRate, video_id,
 				w, h, AV_PIX_FMT_YUV420P,
 				sampleRate, audioBitRate, audio_id, 
@@ -17,6 +17,7 @@ namespace ff
 	* ת
 	* input ļ
 	* output ļ
+	*        a .m3u8 or .mpd output is written as HLS/DASH segments next to the playlist
 	* video_id ļƵ,AV_CODEC_COPYֺͬ,AV_CODEC_ID_NONE رƵ
 	* w,h ļԭƵı1ֲ,0.5 
 	* bitRate Ƶı 400*1024 =400kb,-1ȡĬֵ